@@ -8,6 +8,11 @@ extern "C" {
 } /* Duh. */
 #endif
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
 typedef enum cn_cbor_type {
   CN_CBOR_NULL,
   CN_CBOR_FALSE,   CN_CBOR_TRUE,
@@ -37,6 +42,7 @@ typedef struct cn_cbor {
     unsigned long count;        /* for use during filling */
   } v;                          /* TBD: optimize immediate */
   int length;
+  unsigned int generation;      /* the decode that made this node */
   struct cn_cbor* first_child;
   struct cn_cbor* last_child;
   struct cn_cbor* next;
@@ -52,7 +58,13 @@ typedef enum cn_cbor_error {
   CN_CBOR_ERR_MT_UNDEF_FOR_INDEF,
   CN_CBOR_ERR_RESERVED_AI,
   CN_CBOR_ERR_WRONG_NESTING_IN_INDEF_STRING,
-  CN_CBOR_ERR_OUT_OF_MEMORY
+  CN_CBOR_ERR_OUT_OF_MEMORY,
+  CN_CBOR_ERR_TOO_DEEP,
+  CN_CBOR_ERR_TOO_MANY_ITEMS,
+  CN_CBOR_ERR_COUNT_TOO_LARGE,
+  CN_CBOR_ERR_INVALID_ITEM,
+  CN_CBOR_ERR_INVALID_UTF8,
+  CN_CBOR_ERR_SCHEMA_MISMATCH
 } cn_cbor_error;
 
 extern const char *cn_cbor_error_str[];
@@ -64,7 +76,24 @@ typedef struct cn_cbor_errback {
 
 typedef void* (*cn_alloc_func)(size_t count, size_t size, void *context);
 
+/* Bounds on what one decode may build, for input from untrusted peers.
+   Each is checked before the work it guards is done; 0 leaves it off. */
+typedef struct cn_cbor_limits {
+  unsigned int max_depth;       /* open arrays, maps, tags and indefinite strings */
+  unsigned int max_items;       /* nodes in the whole tree */
+  unsigned int max_count;       /* members of an array, pairs of a map */
+  bool check_utf8;              /* fail on text that is not UTF-8 */
+} cn_cbor_limits;
+
 const cn_cbor* cn_cbor_decode(const char* buf, size_t len, cn_alloc_func calloc_func, void *context, cn_cbor_errback *errp);
+const cn_cbor* cn_cbor_decode_limited(const char* buf, size_t len, const cn_cbor_limits* limits, cn_alloc_func calloc_func, void *context, cn_cbor_errback *errp);
+/* Decode the item at the start of buf, which may have more after it, and
+   set *used to its length. */
+const cn_cbor* cn_cbor_decode_first(const char* buf, size_t len, size_t* used, const cn_cbor_limits* limits, cn_alloc_func calloc_func, void *context, cn_cbor_errback *errp);
+/* RFC 3629 UTF-8, checked with SSE2 or AVX2 where the CPU has them */
+bool cn_cbor_utf8_valid(const char* buf, size_t len);
+/* the same, a byte at a time, on any CPU */
+bool cn_cbor_utf8_valid_scalar(const char* buf, size_t len);
 const cn_cbor* cn_cbor_mapget_string(const cn_cbor* cb, const char* key);
 const cn_cbor* cn_cbor_mapget_int(const cn_cbor* cb, int key);
 const cn_cbor* cn_cbor_index(const cn_cbor* cb, int idx);
@@ -72,6 +101,279 @@ const cn_cbor* cn_cbor_index(const cn_cbor* cb, int idx);
 const cn_cbor* cn_cbor_alloc(cn_cbor_type t);
 void cn_cbor_free(const cn_cbor* js);
 
+/*
+ * Map keys prepared once, for lookups that are repeated per message.
+ * Integer keys match CN_CBOR_UINT and CN_CBOR_INT keys; string keys match
+ * CN_CBOR_TEXT and CN_CBOR_BYTES keys, as with cn_cbor_mapget_int() and
+ * cn_cbor_mapget_string().  A string key points at k, which must outlive
+ * it.
+ */
+typedef struct cn_cbor_key {
+  cn_cbor_type type;            /* CN_CBOR_INT or CN_CBOR_TEXT */
+  union {
+    const char* str;
+    long sint;
+  } v;
+  size_t length;
+  unsigned int hash;
+} cn_cbor_key;
+
+void cn_cbor_key_int(cn_cbor_key* key, long k);
+void cn_cbor_key_string(cn_cbor_key* key, const char* k);
+const cn_cbor* cn_cbor_mapget_key(const cn_cbor* cb, const cn_cbor_key* key);
+
+/*
+ * A hash index over the keys of one map, built on the first
+ * cn_cbor_mapget_indexed() call for that map; later lookups do not walk
+ * the map.  Small maps are walked anyway.  Start from
+ * CN_CBOR_MAP_INDEX_INIT, and call cn_cbor_map_index_free() when done.
+ * The index knows its map by address, length and decode generation, so a
+ * map decoded later at the same address, as happens with pools, gets a
+ * new index.
+ */
+typedef struct cn_cbor_map_index {
+  const cn_cbor* map;
+  const cn_cbor** slots;
+  unsigned int mask;
+  unsigned int generation;
+  int length;
+} cn_cbor_map_index;
+
+#define CN_CBOR_MAP_INDEX_INIT {NULL, NULL, 0, 0, 0}
+
+const cn_cbor* cn_cbor_mapget_indexed(cn_cbor_map_index* idx,
+                                      const cn_cbor* cb,
+                                      const cn_cbor_key* key);
+void cn_cbor_map_index_free(cn_cbor_map_index* idx);
+
+/*
+ * A compact tree: 24-byte nodes (on LP64) in one caller-supplied array,
+ * in encoded order, so the root is nodes[0] and a container's first
+ * child follows it.  Links are counts of nodes forward from the node
+ * that holds them, 0 for none; there are no parent links.  type, flags,
+ * length and v mean what they do in cn_cbor, and strings point into the
+ * decoded buffer.  One node per byte of input is always enough.
+ */
+#define CN_CBOR_COMPACT_MAX_DEPTH 64
+
+typedef struct cn_cbor_compact {
+  uint8_t type;                 /* cn_cbor_type */
+  uint8_t flags;                /* cn_cbor_flags */
+  uint16_t reserved;
+  uint32_t length;
+  union {
+    const char* str;
+    long sint;
+    unsigned long uint;
+    double dbl;
+  } v;
+  uint32_t child;
+  uint32_t next;
+} cn_cbor_compact;
+
+/* Fails with CN_CBOR_ERR_TOO_MANY_ITEMS if max_nodes is too few, and
+   CN_CBOR_ERR_TOO_DEEP past CN_CBOR_COMPACT_MAX_DEPTH.  *used, if given,
+   is set to the number of nodes filled. */
+const cn_cbor_compact* cn_cbor_compact_decode(const char* buf, size_t len,
+                                              cn_cbor_compact* nodes,
+                                              size_t max_nodes,
+                                              size_t* used,
+                                              cn_cbor_errback* errp);
+const cn_cbor_compact* cn_cbor_compact_first_child(const cn_cbor_compact* cb);
+const cn_cbor_compact* cn_cbor_compact_next(const cn_cbor_compact* cb);
+const cn_cbor_compact* cn_cbor_compact_mapget_int(const cn_cbor_compact* cb,
+                                                  int key);
+const cn_cbor_compact* cn_cbor_compact_mapget_string(const cn_cbor_compact* cb,
+                                                     const char* key);
+const cn_cbor_compact* cn_cbor_compact_index(const cn_cbor_compact* cb,
+                                             int idx);
+
+/*
+ * Pull-style reading without building a tree.  A cursor walks the encoded
+ * items in order; nothing is allocated, and strings are returned as
+ * slices of the input buffer, which must outlive them.
+ *
+ * cn_cbor_cursor_next() reads the head of the next item.  After an array
+ * or map head the cursor is on the first member; after a tag, on the
+ * tagged item; after an indefinite-length head, on the first member or
+ * chunk, and cn_cbor_cursor_break() consumes the closing break.
+ */
+typedef struct cn_cbor_cursor {
+  const unsigned char *pos;
+  const unsigned char *end;
+  cn_cbor_error err;
+} cn_cbor_cursor;
+
+typedef struct cn_cbor_item {
+  cn_cbor_type type;            /* never CN_CBOR_*_CHUNKED */
+  int flags;                    /* CN_CBOR_FL_INDEF for indefinite length */
+  union {
+    const char* str;
+    long sint;
+    unsigned long uint;
+    double dbl;
+  } v;
+  size_t length;                /* bytes, array items or map pairs */
+} cn_cbor_item;
+
+void cn_cbor_cursor_init(cn_cbor_cursor *cur, const char *buf, size_t len);
+bool cn_cbor_cursor_done(const cn_cbor_cursor *cur);
+bool cn_cbor_cursor_next(cn_cbor_cursor *cur, cn_cbor_item *item);
+bool cn_cbor_cursor_break(cn_cbor_cursor *cur);
+/* skip the next item, with everything in it */
+bool cn_cbor_cursor_skip(cn_cbor_cursor *cur);
+/* skip what is left of an item whose head was just read */
+bool cn_cbor_cursor_skip_contents(cn_cbor_cursor *cur,
+                                  const cn_cbor_item *item);
+/* With the cursor just after the head of map, find the value for an
+   integer key and read its head into value.  Returns false with err
+   CN_CBOR_NO_ERROR if the key is not there, leaving the cursor after the
+   map. */
+bool cn_cbor_cursor_mapget_int(cn_cbor_cursor *cur,
+                               const cn_cbor_item *map,
+                               long key,
+                               cn_cbor_item *value);
+
+/*
+ * CBOR sequences (RFC 8742): items back to back with nothing between
+ * them, such as a log file or a stream read in pieces.  Items are taken
+ * off the front of the current buffer one at a time, and offset counts
+ * the bytes consumed since the start of the stream.
+ *
+ * When the buffer ends partway through an item, err is
+ * CN_CBOR_ERR_OUT_OF_DATA and nothing is consumed.  Move the
+ * cn_cbor_seq_pending() bytes at buf + pos to the front of the next
+ * buffer, read more after them, and hand that to cn_cbor_seq_input().
+ * Any other error sticks.  Items point into the buffer they came from.
+ */
+typedef struct cn_cbor_seq {
+  const char* buf;
+  size_t len;
+  size_t pos;                   /* bytes of buf consumed */
+  uint64_t offset;              /* bytes of the stream consumed */
+  cn_cbor_error err;
+  const cn_cbor_limits* limits;
+  cn_alloc_func calloc_func;
+  void* context;
+} cn_cbor_seq;
+
+/* limits apply to each item; they, and context, must outlive seq */
+void cn_cbor_seq_init(cn_cbor_seq* seq, const cn_cbor_limits* limits,
+                      cn_alloc_func calloc_func, void* context);
+/* the next part of the stream, starting with the pending bytes */
+void cn_cbor_seq_input(cn_cbor_seq* seq, const char* buf, size_t len);
+/* NULL with err CN_CBOR_NO_ERROR once the buffer is used up */
+const cn_cbor* cn_cbor_seq_next(cn_cbor_seq* seq);
+/* the next item's encoding, checked but not decoded */
+bool cn_cbor_seq_next_raw(cn_cbor_seq* seq, const char** item, size_t* len);
+size_t cn_cbor_seq_pending(const cn_cbor_seq* seq);
+/* true if the stream may end here: no error and nothing pending */
+bool cn_cbor_seq_done(const cn_cbor_seq* seq);
+
+/*
+ * Writing without a tree.  Items go straight into the writer's output;
+ * arrays and maps of known size close themselves after their last
+ * member, and indefinite ones are closed with cn_cbor_write_end().
+ * Errors stick: after the first, every call fails, and err says why.
+ * Running out of room is CN_CBOR_ERR_OUT_OF_MEMORY.
+ */
+#define CN_CBOR_WRITER_MAX_DEPTH 16
+
+typedef struct cn_cbor_writer_level {
+  uint64_t count;               /* still to come, or so far if indef */
+  bool indef;
+  bool map;
+} cn_cbor_writer_level;
+
+typedef struct cn_cbor_writer {
+  uint8_t *buf;
+  size_t size;
+  size_t pos;                   /* bytes in buf */
+  size_t length;                /* bytes of output, in buf or not */
+  bool growable;
+  struct iovec *iov;
+  int iovcnt;
+  int used;                     /* iov entries filled */
+  bool in_scratch;              /* iov[used - 1] ends at buf + pos */
+  size_t copy_max;
+  cn_cbor_error err;
+  int depth;
+  cn_cbor_writer_level open[CN_CBOR_WRITER_MAX_DEPTH];
+} cn_cbor_writer;
+
+/* into buf; with a NULL buf, only count the length */
+void cn_cbor_writer_init(cn_cbor_writer *w, uint8_t *buf, size_t size);
+/* into a buffer that is grown as needed; cn_cbor_writer_free()
+   releases it */
+void cn_cbor_writer_init_growable(cn_cbor_writer *w);
+/* heads and strings shorter than copy_max into scratch, longer strings
+   as iov entries pointing at the caller's data */
+void cn_cbor_writer_init_iov(cn_cbor_writer *w,
+                             uint8_t *scratch, size_t size,
+                             struct iovec *iov, int iovcnt,
+                             size_t copy_max);
+void cn_cbor_writer_free(cn_cbor_writer *w);
+/* true if nothing failed and nothing is left open */
+bool cn_cbor_writer_finish(cn_cbor_writer *w);
+
+bool cn_cbor_write_array(cn_cbor_writer *w, uint64_t count);
+bool cn_cbor_write_map(cn_cbor_writer *w, uint64_t pairs);
+bool cn_cbor_write_array_indef(cn_cbor_writer *w);
+bool cn_cbor_write_map_indef(cn_cbor_writer *w);
+bool cn_cbor_write_end(cn_cbor_writer *w);
+/* the tagged item comes next */
+bool cn_cbor_write_tag(cn_cbor_writer *w, uint64_t tag);
+bool cn_cbor_write_uint(cn_cbor_writer *w, uint64_t val);
+bool cn_cbor_write_int(cn_cbor_writer *w, int64_t val);
+bool cn_cbor_write_bytes(cn_cbor_writer *w, const void *data, size_t len);
+bool cn_cbor_write_text(cn_cbor_writer *w, const char *str, size_t len);
+bool cn_cbor_write_bool(cn_cbor_writer *w, bool val);
+bool cn_cbor_write_null(cn_cbor_writer *w);
+bool cn_cbor_write_double(cn_cbor_writer *w, double val);
+/* one whole item, already encoded; it is not checked */
+bool cn_cbor_write_encoded(cn_cbor_writer *w, const void *item, size_t len);
+/* a whole tree */
+bool cn_cbor_write_item(cn_cbor_writer *w, const cn_cbor *cb);
+
+/*
+ * Typed arrays (RFC 8746, tags 64 to 87): a tag giving the element type
+ * and byte order, on a byte string holding the packed elements.  A view
+ * points into the decoded buffer.  cn_cbor_typed_array_native() gives
+ * the elements in place when they are already in host order and
+ * aligned; cn_cbor_typed_array_copy() gives them in host order always,
+ * byte-swapping with SSSE3 or AVX2 where the CPU has them.  16-bit and
+ * 128-bit floats are copied as raw bits.
+ */
+typedef enum cn_cbor_ta_kind {
+  CN_CBOR_TA_UINT,
+  CN_CBOR_TA_SINT,
+  CN_CBOR_TA_FLOAT
+} cn_cbor_ta_kind;
+
+typedef struct cn_cbor_typed_array {
+  cn_cbor_ta_kind kind;
+  unsigned int size;            /* bytes per element */
+  bool little_endian;
+  const uint8_t* data;
+  size_t count;                 /* elements */
+} cn_cbor_typed_array;
+
+/* false unless tag is a typed array tag and len a whole number of its
+   elements */
+bool cn_cbor_typed_array_init(cn_cbor_typed_array* ta, uint64_t tag,
+                              const void* data, size_t len);
+/* the same, from a tag node as cn_cbor_decode() builds it */
+bool cn_cbor_typed_array_view(const cn_cbor* cb, cn_cbor_typed_array* ta);
+/* the elements, or NULL if they would need swapping or aligning */
+const void* cn_cbor_typed_array_native(const cn_cbor_typed_array* ta);
+/* count elements into out, in host order */
+void cn_cbor_typed_array_copy(const cn_cbor_typed_array* ta, void* out);
+/* count host-order elements of size bytes, as one tag and byte string;
+   in an iov writer, the elements are not copied */
+bool cn_cbor_write_typed_array(cn_cbor_writer* w, cn_cbor_ta_kind kind,
+                               unsigned int size,
+                               const void* data, size_t count);
+
 #ifdef  __cplusplus
 }
 #endif
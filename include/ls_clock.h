@@ -0,0 +1,51 @@
+/**
+ * \file
+ * \brief
+ * Cached clock readings, for code that needs the time often but not
+ * precisely: log timestamps, timers and statistics.
+ *
+ * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "ls_basics.h"
+
+/**
+ * Size of the buffer holding a timestamp from ls_clock_timestamp(),
+ * "YYYY-MM-DDTHH:MM:SS" plus the terminating NULL.
+ */
+#define LS_CLOCK_TIMESTAMP_LEN 20
+
+/**
+ * Read the monotonic clock and cache the result for ls_clock_now().  The
+ * tube manager calls this once per loop iteration.
+ *
+ * Thread-safe.
+ *
+ * \retval uint64_t The new value of ls_clock_now().
+ */
+LS_API uint64_t ls_clock_update(void);
+
+/**
+ * Get the cached monotonic time, in milliseconds from an arbitrary starting
+ * point, as of the last call to ls_clock_update().
+ *
+ * Thread-safe.
+ *
+ * \retval uint64_t The cached time in milliseconds.
+ */
+LS_API uint64_t ls_clock_now(void);
+
+/**
+ * Get the current local time as "YYYY-MM-DDTHH:MM:SS".  The string is only
+ * reformatted when the second changes, so repeated calls cost a time() call.
+ *
+ * Thread-safe; each thread has its own buffer.
+ *
+ * \retval const char * The timestamp, valid until the next call on the same
+ *      thread, or NULL if the time could not be read.
+ */
+LS_API const char *ls_clock_timestamp(void);
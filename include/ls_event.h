@@ -16,6 +16,16 @@
  */
 typedef struct _ls_event_t ls_event;
 
+/**
+ * Identifier for an event, unique within its dispatcher. Identifiers are
+ * assigned in creation order starting at 0, so an event source that creates
+ * a fixed set of events can publish them as constants.
+ */
+typedef unsigned int ls_event_id;
+
+/** Value returned for events that have no identifier. */
+#define LS_EVENT_ID_INVALID ((ls_event_id)-1)
+
 /** Event data passed to bound callbacks. */
 typedef struct _ls_event_data_t
 {
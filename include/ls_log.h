@@ -14,16 +14,61 @@
 
 #include "ls_mem.h"
 
+/**
+ * The most verbose level compiled into the library.  Messages logged through
+ * LS_LOG() (and the macros built on it) above this level are removed by the
+ * compiler, along with the evaluation of their arguments.  Define this to,
+ * e.g., LS_LOG_INFO for release builds.
+ */
+#ifndef LS_LOG_COMPILED_LEVEL
+#define LS_LOG_COMPILED_LEVEL LS_LOG_MEMTRACE
+#endif
+
+/**
+ * The module that LS_LOG() in the current file logs as.  Define this before
+ * including any headers to tag a source file with its module.
+ */
+#ifndef LS_LOG_FILE_MODULE
+#define LS_LOG_FILE_MODULE LS_LOG_MODULE_DEFAULT
+#endif
+
+/**
+ * True if a message for {module} at {level} would be output.  Cheap enough to
+ * guard hot paths with; folds to false for levels above LS_LOG_COMPILED_LEVEL.
+ */
+#define LS_LOG_ENABLED(module, level) \
+        ((level) <= LS_LOG_COMPILED_LEVEL && \
+         (level) <= _ls_log_levels[(module)])
+
+/**
+ * Log as the current file's module (see LS_LOG_FILE_MODULE).  The arguments
+ * are only evaluated if the message would be output.  Each use is a call
+ * site that can be written to the binary log (see ls_log_binary_open()).
+ */
+#define LS_LOG(level, ...) \
+        do { \
+            if (LS_LOG_ENABLED(LS_LOG_FILE_MODULE, (level))) \
+            { \
+                static ls_log_site _ls_log_site = \
+                        { __FILE__, __LINE__, 0, 0, "" }; \
+                ls_log_site_log(&_ls_log_site, LS_LOG_FILE_MODULE, (level), \
+                                __VA_ARGS__); \
+            } \
+        } while (0)
+
+/** The most arguments a binary log call site can take */
+#define LS_LOG_SITE_MAX_ARGS 15
+
 /** Convenience macro for tracing a function entry where no arguments need to be
  *  logged */
 #define LS_LOG_TRACE_FUNCTION_NO_ARGS \
-        ls_log(LS_LOG_TRACE, "entering: %s", __func__)
+        LS_LOG(LS_LOG_TRACE, "entering: %s", __func__)
 /** Convenience macro for tracing a function entry with logged arguments.
  * The space after __func__ but before the comma is intentional as recommended
  * at http://gcc.gnu.org/onlinedocs/cpp/Variadic-Macros.html for compatibility
  */
 #define LS_LOG_TRACE_FUNCTION(fmt, ...) \
-        ls_log(LS_LOG_TRACE, "entering: %s; args=("fmt")", \
+        LS_LOG(LS_LOG_TRACE, "entering: %s; args=("fmt")", \
         __func__ , __VA_ARGS__)
 
 /**
@@ -49,6 +94,60 @@ typedef enum
     LS_LOG_MEMTRACE
 } ls_loglevel;
 
+/**
+ * Enumeration of the library modules with their own log level
+ */
+typedef enum
+{
+    /** Everything not listed below, including application code */
+    LS_LOG_MODULE_DEFAULT = 0,
+    /** Memory allocation (ls_mem) */
+    LS_LOG_MODULE_MEM,
+    /** Event dispatching (ls_eventing) */
+    LS_LOG_MODULE_EVENTING,
+    /** Tubes and the tube manager */
+    LS_LOG_MODULE_TUBE,
+    /** The number of modules; not a valid module */
+    LS_LOG_MODULE_MAX
+} ls_log_module_id;
+
+/**
+ * The current level of each module, indexed by ls_log_module_id.  Read by
+ * LS_LOG_ENABLED(); use ls_log_set_module_level() to change.
+ */
+LS_API extern ls_loglevel _ls_log_levels[LS_LOG_MODULE_MAX];
+
+/**
+ * A logging call site, one per use of LS_LOG().  Only touched through
+ * ls_log_site_log().
+ */
+typedef struct _ls_log_site
+{
+    /** Source file of the call */
+    const char *file;
+    /** Source line of the call */
+    int         line;
+    /** Identifier in binary logs; 0 until first written to one */
+    uint32_t    id;
+    /** The binary log this site was last described in */
+    uint32_t    epoch;
+    /** Storage type of each argument, filled in with {id} */
+    char        sig[LS_LOG_SITE_MAX_ARGS + 1];
+} ls_log_site;
+
+/**
+ * What the async logger does with messages that arrive while its queue is
+ * full.  Either way, the logging thread never waits for the writer.
+ */
+typedef enum
+{
+    /** Discard the message; ls_log_async_dropped() counts the losses */
+    LS_LOG_OVERFLOW_DROP = 0,
+    /** Discard the message, and have the writer log how many were lost once
+     *  it catches up */
+    LS_LOG_OVERFLOW_COUNT
+} ls_log_overflow_policy;
+
 /**
  * Signature of the log text generator function passed to ls_log_chunked().  No
  * log message functions should be called from this function to avoid garbled
@@ -84,7 +183,8 @@ LS_API const char *ls_log_level_name(ls_loglevel level);
  *
  * Note: Supplied function will be called three times for each log
  * message; once for date/time/level preamble, once for the message and
- * once for a trailing newline.
+ * once for a trailing newline.  In async mode (see ls_log_async_start())
+ * it is called once per line instead, from the background writer thread.
  *
  * \param stream Output stream, always stderr.
  * \param format Format string like vfprintf.
@@ -110,6 +210,8 @@ LS_API void ls_log_set_function(ls_log_vararg_function fn);
  * Set the current log level, defaults to LS_LOG_INFO.
  *
  * Everything at this level or less verbose than this level will be printed.
+ * This sets the level of every module; use ls_log_set_module_level()
+ * afterwards to make individual modules more or less verbose.
  *
  * Note: Not thread-safe.
  *
@@ -124,6 +226,27 @@ LS_API void ls_log_set_level(ls_loglevel level);
  */
 LS_API ls_loglevel ls_log_get_level(void);
 
+/**
+ * Set the log level of one module, leaving the others alone.
+ *
+ * Note: Not thread-safe.
+ *
+ * \invariant module < LS_LOG_MODULE_MAX
+ * \param module The module to change.
+ * \param level The new log level for {module}.
+ */
+LS_API void ls_log_set_module_level(ls_log_module_id module,
+                                    ls_loglevel level);
+
+/**
+ * Get the log level of one module.
+ *
+ * \invariant module < LS_LOG_MODULE_MAX
+ * \param module The module to look up.
+ * \retval The current log level of {module}.
+ */
+LS_API ls_loglevel ls_log_get_module_level(ls_log_module_id module);
+
 /**
  * Enables or disables printing the NDC prefix for log messages.  By default,
  * the NDC prefix is enabled.
@@ -137,14 +260,17 @@ LS_API void ls_log_set_ndc_enabled(bool enabled);
  * will be prefixed to all subsequent messages until a corresponding call to
  * ls_log_pop_ndc() is made.
  *
+ * Each thread has its own NDC stack, in a fixed thread-local buffer: pushing
+ * and popping never allocate.  Messages are truncated to 127 bytes, and only
+ * the bottom 16 contexts are printed; deeper ones are shown as a count.
+ *
  * \invariant fmt != NULL
  * \param[in] fmt The printf-style format string
  * \param[in] ... Extra parameters to interpolate into {fmt}.
  * @return The depth of the NDC stack after the given push.  This must later
  * be passed to ls_log_pop_ndc() to verify the consistency of the NDC stack.  If
- * this function fails to push (due, for example, to a low memory condition or
- * a malformed format string), an appropriate warning will be printed and 0
- * will be returned.
+ * this function fails to push (due to a malformed format string), an
+ * appropriate warning will be printed and 0 will be returned.
  */
 LS_API int ls_log_push_ndc(const char *fmt, ...)
         __attribute__ ((__format__ (__printf__, 1, 2)));
@@ -180,6 +306,122 @@ LS_API void ls_log_pop_ndc(int ndc_depth);
 LS_API void ls_log(ls_loglevel level, const char *fmt, ...)
         __attribute__ ((__format__ (__printf__, 2, 3)));
 
+/**
+ * Log at the given level as the given module.  Like ls_log(), but the message
+ * is filtered by the level of {module}.  Usually called through LS_LOG().
+ *
+ * \invariant fmt != NULL
+ * \param[in] module The module logging this message.
+ * \param[in] level The log level for this message.
+ * \param[in] fmt The printf-style format to log
+ * \param[in] ... Extra parameters to interpolate into {fmt}.
+ */
+LS_API void ls_log_module(ls_log_module_id module, ls_loglevel level,
+                          const char *fmt, ...)
+        __attribute__ ((__format__ (__printf__, 3, 4)));
+
+/**
+ * Switch to asynchronous logging.  Each message is formatted by the thread
+ * logging it into a slot of a lock-free queue, and a background thread
+ * passes the finished lines to the log function, so slow log output never
+ * holds up the caller.  The log function is called once per line, from the
+ * background thread.  Lines longer than 511 bytes are truncated.
+ *
+ * Queued messages are written out by ls_log_async_stop(), which is also
+ * registered to run at exit.
+ *
+ * Note: Not thread-safe.
+ *
+ * \param[in] capacity The number of lines that can be queued, rounded up to
+ *      a power of two.  0 selects a default of 1024.
+ * \param[in] policy What to do with messages when the queue is full.
+ * \param[out] err The error information (provide NULL to ignore)
+ * \retval bool true if async logging was started, false otherwise.
+ */
+LS_API bool ls_log_async_start(size_t capacity,
+                               ls_log_overflow_policy policy,
+                               ls_err *err);
+
+/**
+ * Wait until every message queued before this call has been written.  Does
+ * nothing if async logging is not running.
+ */
+LS_API void ls_log_async_flush(void);
+
+/**
+ * Write out the queued messages, stop the background thread and return to
+ * synchronous logging.  Does nothing if async logging is not running.
+ *
+ * Note: No other thread may be logging while this is called.
+ */
+LS_API void ls_log_async_stop(void);
+
+/**
+ * Get the number of messages discarded because the async queue was full.
+ *
+ * \retval uint64_t The count since ls_log_async_start(), or 0 if async
+ *      logging is not running.
+ */
+LS_API uint64_t ls_log_async_dropped(void);
+
+/**
+ * Log from a call site; called by LS_LOG().  While a binary log is open the
+ * message is written there, otherwise this behaves like ls_log_module().
+ *
+ * \invariant site != NULL
+ * \invariant fmt != NULL
+ * \param[in] site The call site, which caches the format's argument types.
+ * \param[in] module The module logging this message.
+ * \param[in] level The log level for this message.
+ * \param[in] fmt The printf-style format to log.  Must be the same string
+ *      every time {site} is used.
+ * \param[in] ... Extra parameters to interpolate into {fmt}.
+ */
+LS_API void ls_log_site_log(ls_log_site *site,
+                            ls_log_module_id module,
+                            ls_loglevel level,
+                            const char *fmt, ...)
+        __attribute__ ((__format__ (__printf__, 4, 5)));
+
+/**
+ * Start writing LS_LOG() messages to a binary log file instead of
+ * formatting them.  Each call site's format string is written once; after
+ * that, a message costs a call site ID, a timestamp and a copy of its
+ * arguments, appended to a memory-mapped file without locking or system
+ * calls.  Strings are copied up to 255 bytes.  samplecode/spudlogdump turns
+ * the file back into text.
+ *
+ * The NDC is not recorded.  Messages from ls_log() and friends, and from
+ * call sites whose format uses a conversion the binary log cannot store
+ * (such as %n or %ls), are still logged as text.
+ *
+ * Note: Not thread-safe.
+ *
+ * \invariant path != NULL
+ * \param[in] path The file to write; created or truncated.
+ * \param[in] size The size of the file.  Messages that do not fit are
+ *      dropped and counted by ls_log_binary_dropped().
+ * \param[out] err The error information (provide NULL to ignore)
+ * \retval bool true if the binary log was opened, false otherwise.
+ */
+LS_API bool ls_log_binary_open(const char *path, size_t size, ls_err *err);
+
+/**
+ * Stop binary logging: unmap the file and trim it to the space used.  Does
+ * nothing if no binary log is open.
+ *
+ * Note: No other thread may be logging while this is called.
+ */
+LS_API void ls_log_binary_close(void);
+
+/**
+ * Get the number of messages that did not fit in the binary log.
+ *
+ * \retval uint64_t The count since ls_log_binary_open(), or 0 if no binary
+ *      log is open.
+ */
+LS_API uint64_t ls_log_binary_dropped(void);
+
 /**
  * Log an error, with extra information.  If the error is NULL,
  * just use the extra information.
@@ -215,5 +457,5 @@ LS_API void ls_log_chunked(ls_loglevel level,
         ls_log_generator_fn generator_fn, void *arg,
         const char *fmt, ...) __attribute__ ((__format__ (__printf__, 4, 5)));
 
-#define LS_LOG_ERR(err, what) ls_log(LS_LOG_ERROR, "%s:%d (%s) %d, %s", __FILE__, __LINE__, (what), (err).code, (err).message)
-#define LS_LOG_PERROR(what) ls_log(LS_LOG_ERROR, "%s:%d (%s) %d, %s", __FILE__, __LINE__, (what), errno, strerror(errno))
+#define LS_LOG_ERR(err, what) LS_LOG(LS_LOG_ERROR, "%s:%d (%s) %d, %s", __FILE__, __LINE__, (what), (err).code, (err).message)
+#define LS_LOG_PERROR(what) LS_LOG(LS_LOG_ERROR, "%s:%d (%s) %d, %s", __FILE__, __LINE__, (what), errno, strerror(errno))
@@ -0,0 +1,108 @@
+/**
+ * \file
+ * \brief
+ * Layout of the files written by ls_log_binary_open(), for tools that read
+ * them.
+ *
+ * A file is an ls_log_binary_header followed by records, each starting on an
+ * 8-byte boundary with an ls_log_record_header.  A record's size is written
+ * when its space is reserved, and its kind once the rest of it is written;
+ * a record whose kind is still LS_LOG_RECORD_UNFINISHED was never completed
+ * and should be skipped.  A record with a size of 0 marks the end of the
+ * data.  All values are in the byte order of the machine that wrote the
+ * file, and fields after the record header are not aligned.
+ *
+ * A LS_LOG_RECORD_SITE record describes a call site, and comes before the
+ * first message from it.  After the header: the source line as a uint32_t,
+ * then the format string, the source file name and the argument signature,
+ * each NULL-terminated.
+ *
+ * A LS_LOG_RECORD_MESSAGE record is one message.  After the header: the
+ * wall-clock time in microseconds since the epoch as a uint64_t, then one
+ * value per character of the site's signature.  Strings ('s') are a
+ * uint32_t length (LS_LOG_BINARY_NULL_STRING for NULL) followed by that many
+ * bytes; everything else is 8 bytes: an int64_t for the integer types, a
+ * double for 'd' and 'D', and a uint64_t for pointers.
+ *
+ * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/** The first bytes of every binary log */
+#define LS_LOG_BINARY_MAGIC "SPUDBLOG"
+/** The version of the layout described here */
+#define LS_LOG_BINARY_VERSION 2
+/** Written as a uint32_t, to detect a reader with the wrong byte order */
+#define LS_LOG_BINARY_BYTE_ORDER 0x01020304
+/** String length recorded for a NULL string argument */
+#define LS_LOG_BINARY_NULL_STRING 0xFFFFFFFF
+
+/* Argument signature characters: the type passed for each conversion */
+/** int (including %c and promoted char and short) */
+#define LS_LOG_ARG_INT 'i'
+/** long */
+#define LS_LOG_ARG_LONG 'l'
+/** long long */
+#define LS_LOG_ARG_LLONG 'L'
+/** size_t */
+#define LS_LOG_ARG_SIZE 'z'
+/** intmax_t */
+#define LS_LOG_ARG_INTMAX 'j'
+/** ptrdiff_t */
+#define LS_LOG_ARG_PTRDIFF 't'
+/** double */
+#define LS_LOG_ARG_DOUBLE 'd'
+/** long double, stored as a double */
+#define LS_LOG_ARG_LDOUBLE 'D'
+/** const char *, NULL-terminated */
+#define LS_LOG_ARG_STRING 's'
+/** void * */
+#define LS_LOG_ARG_POINTER 'p'
+
+/**
+ * The start of a binary log
+ */
+typedef struct _ls_log_binary_header
+{
+    /** LS_LOG_BINARY_MAGIC, without the NULL */
+    char     magic[8];
+    /** LS_LOG_BINARY_VERSION */
+    uint32_t version;
+    /** LS_LOG_BINARY_BYTE_ORDER */
+    uint32_t byte_order;
+} ls_log_binary_header;
+
+/**
+ * Kinds of binary log records
+ */
+typedef enum
+{
+    /** Space reserved for a record that has not been committed */
+    LS_LOG_RECORD_UNFINISHED = 0,
+    /** A call site description */
+    LS_LOG_RECORD_SITE = 1,
+    /** A message from a call site */
+    LS_LOG_RECORD_MESSAGE
+} ls_log_record_kind;
+
+/**
+ * The start of every binary log record
+ */
+typedef struct _ls_log_record_header
+{
+    /** Size of the whole record including padding, a multiple of 8 */
+    uint32_t size;
+    /** An ls_log_record_kind */
+    uint8_t  kind;
+    /** The ls_loglevel of the site */
+    uint8_t  level;
+    /** The ls_log_module_id of the site */
+    uint8_t  module;
+    /** The number of arguments */
+    uint8_t  nargs;
+    /** The call site ID */
+    uint32_t site;
+} ls_log_record_header;
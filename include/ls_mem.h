@@ -33,6 +33,9 @@
  *
  * Because pools free everything on their destruction they also
  * work well for tasks were the lifetime of the pool is short.
+ * A pool can also be reused as scratch space: ls_pool_reset() and
+ * ls_pool_rewind() release its allocations but keep its blocks,
+ * so a long-lived pool eventually stops allocating at all.
  *
  * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
  */
@@ -58,6 +61,78 @@ typedef struct _ls_pool_int ls_pool;
  */
 typedef void (*ls_pool_cleaner)(void *arg);
 
+/**
+ * An allocation point in an ls_pool, set by ls_pool_mark().  The fields
+ * are private.
+ */
+typedef struct _ls_pool_marker
+{
+    /** The current page */
+    void  *page;
+    /** The bytes used in the current page */
+    size_t used;
+    /** The newest cleaner */
+    void  *cleaners;
+} ls_pool_marker;
+
+/**
+ * Subsystems that library allocations are accounted to.
+ */
+typedef enum
+{
+    /** Anything not allocated with a more specific tag */
+    LS_MEM_TAG_OTHER = 0,
+    /** Tubes, tube managers and their workers */
+    LS_MEM_TAG_TUBE,
+    /** Hashtables and their nodes */
+    LS_MEM_TAG_HTABLE,
+    /** Event dispatchers, events and bindings */
+    LS_MEM_TAG_EVENTING,
+    /** Decoded and encoded CBOR */
+    LS_MEM_TAG_CBOR,
+    /** Logging buffers */
+    LS_MEM_TAG_LOG,
+    /** Number of tags */
+    LS_MEM_TAG_MAX
+} ls_mem_tag;
+
+/** Number of buckets in ls_mem_stats::histogram */
+#define LS_MEM_HISTOGRAM_BUCKETS 12
+
+/**
+ * Allocation counters for one tag.  The counts are cumulative since the
+ * process started; sample them twice to get rates.
+ */
+typedef struct _ls_mem_tag_stats
+{
+    /** Blocks allocated, including resizes */
+    uint64_t allocs;
+    /** Blocks freed, including resizes */
+    uint64_t frees;
+    /** Bytes allocated, including resizes */
+    uint64_t bytes_allocated;
+    /** Bytes currently allocated */
+    size_t   live_bytes;
+    /** Blocks currently allocated */
+    size_t   live_objects;
+    /** Highest live_bytes seen since start or ls_mem_reset_peaks() */
+    size_t   peak_bytes;
+} ls_mem_tag_stats;
+
+/**
+ * A snapshot of the library's allocation accounting.
+ */
+typedef struct _ls_mem_stats
+{
+    /** Counters for each ls_mem_tag */
+    ls_mem_tag_stats tags[LS_MEM_TAG_MAX];
+    /** Counters for all tags together */
+    ls_mem_tag_stats total;
+    /** Allocations by requested size: bucket i counts sizes up to 16 << i
+        bytes, and the last bucket everything larger */
+    uint64_t         histogram[LS_MEM_HISTOGRAM_BUCKETS];
+} ls_mem_stats;
+
 /**
  * Callback signature used by ls_data_malloc.
  *
@@ -103,6 +178,31 @@ LS_API void ls_data_set_memory_funcs(ls_data_malloc_func  malloc_func,
                                      ls_data_realloc_func realloc_func,
                                      ls_data_free_func    free_func);
 
+/**
+ * Turn the per-thread small block caches on or off.
+ *
+ * When enabled, blocks of up to 256 bytes released with ls_data_free are
+ * kept in a cache owned by the releasing thread and reused by later
+ * allocations of the same size class.  When a thread's cache grows past
+ * its limit, or the thread exits, blocks move to a shared central pool in
+ * batches, where any thread can pick them up.  All memory still comes from
+ * the functions given to ls_data_set_memory_funcs().
+ *
+ * Blocks allocated while the caches were on may be freed after they are
+ * turned off, and the other way around.  Disabled by default.
+ *
+ * \param[in] enabled true to use the caches
+ */
+LS_API void ls_data_set_thread_caches(bool enabled);
+
+/**
+ * Return cached blocks to the underlying free function.
+ *
+ * Empties the calling thread's cache and the central pool.  Blocks cached
+ * by other running threads are not touched.
+ */
+LS_API void ls_data_release_caches(void);
+
 /**
  * Release memory allocated by the JabberWerxC library.
  *
@@ -129,6 +229,15 @@ LS_API void ls_data_free(void *ptr);
  */
 LS_API void * ls_data_malloc(size_t size);
 
+/**
+ * Allocate 'size' bytes of memory, accounted to the given subsystem.
+ *
+ * \param[in] tag The subsystem the memory is for.
+ * \param[in] size The number of bytes to allocate.
+ * \retval void* Pointer to the allocated memory, released with ls_data_free
+ */
+LS_API void * ls_data_malloc_tagged(ls_mem_tag tag, size_t size);
+
 /**
  * Changes the size of the memory block pointed to by 'ptr' to size 'size'.
  *
@@ -141,6 +250,18 @@ LS_API void * ls_data_malloc(size_t size);
  */
 LS_API void * ls_data_realloc(void *ptr, size_t size);
 
+/**
+ * Changes the size of the memory block pointed to by 'ptr' to size 'size',
+ * accounting the result to the given subsystem.  ls_data_realloc keeps the
+ * tag the block already had.
+ *
+ * \param[in] tag The subsystem the memory is for.
+ * \param[in] ptr The original block of memory, or NULL.
+ * \param[in] size The number of bytes to reallocate.
+ * \retval void* Pointer to the resized memory block.
+ */
+LS_API void * ls_data_realloc_tagged(ls_mem_tag tag, void *ptr, size_t size);
+
 /**
  * Contiguously allocates enough space for nmemb objects that are size bytes of
  * memory each and returns a pointer to the allocated memory.  The allocated
@@ -154,6 +275,38 @@ LS_API void * ls_data_realloc(void *ptr, size_t size);
  */
 LS_API void * ls_data_calloc(size_t nmemb, size_t size);
 
+/**
+ * Like ls_data_calloc, accounted to the given subsystem.
+ *
+ * \param[in] tag The subsystem the memory is for.
+ * \param[in] nmemb The number of contiguous chunks to allocate.
+ * \param[in] size The number of bytes to allocate per chunk.
+ * \retval void* Pointer to the allocated memory
+ */
+LS_API void * ls_data_calloc_tagged(ls_mem_tag tag, size_t nmemb, size_t size);
+
+/**
+ * Copy the current allocation counters.  The counters are always kept, at
+ * the cost of a few relaxed atomic adds per allocation; the snapshot is
+ * not taken atomically across counters.
+ *
+ * \param[out] stats Receives the counters.
+ */
+LS_API void ls_mem_get_stats(ls_mem_stats *stats);
+
+/**
+ * Restart high-water tracking: set each peak to the current live bytes.
+ */
+LS_API void ls_mem_reset_peaks(void);
+
+/**
+ * Get a short name for an accounting tag, e.g. for reports.
+ *
+ * \param[in] tag The tag.
+ * \retval const char* The name, or NULL if tag is out of range.
+ */
+LS_API const char * ls_mem_tag_name(ls_mem_tag tag);
+
 /**
  * Duplicate a string by allocating memory
  *
@@ -201,6 +354,42 @@ LS_API char * ls_data_strndup(const char *src,
 LS_API bool ls_pool_create(size_t    size,
                            ls_pool **pool,
                            ls_err   *err);
+/**
+ * Free everything allocated from the given pool, but keep its pages for
+ * reuse, so a pool used as scratch space for a packet or a batch stops
+ * calling malloc once its pages have grown to fit.
+ *
+ * Bound ls_pool_cleaner callbacks are invoked, and removed, first.
+ *
+ * \invariant pool != NULL
+ * \param pool The memory pool to reset
+ */
+LS_API void ls_pool_reset(ls_pool *pool);
+
+/**
+ * Remember the current allocation point of a pool, so that everything
+ * allocated after it can be released with ls_pool_rewind().
+ *
+ * \invariant pool != NULL
+ * \invariant marker != NULL
+ * \param[in] pool The memory pool
+ * \param[out] marker The allocation point
+ */
+LS_API void ls_pool_mark(ls_pool *pool, ls_pool_marker *marker);
+
+/**
+ * Release everything allocated from a pool since {marker} was set,
+ * keeping the pages for reuse.  Cleaners added since then are invoked and
+ * removed.  Markers must be rewound in the reverse of the order they were
+ * set, and a marker is invalid once the pool is reset or rewound past it.
+ *
+ * \invariant pool != NULL
+ * \invariant marker != NULL
+ * \param[in] pool The memory pool
+ * \param[in] marker An allocation point set by ls_pool_mark()
+ */
+LS_API void ls_pool_rewind(ls_pool *pool, const ls_pool_marker *marker);
+
 /**
  * Free any memory allocated by the given pool, including the pool itself.
  *
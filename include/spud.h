@@ -8,6 +8,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "ls_error.h"
+#include "ls_mem.h"
 #include "cn-cbor/cn-cbor.h"
 
 #define SPUD_TUBE_ID_SIZE               8
@@ -29,6 +30,12 @@ typedef enum {
 #define SPUD_PDEC    0x10
 #define SPUD_COMMAND 0xC0
 
+/* Limits on the CBOR of a received message, so that no datagram can make
+   the decoder build more than SPUD_MAX_CBOR_ITEMS nodes */
+#define SPUD_MAX_CBOR_DEPTH 8
+#define SPUD_MAX_CBOR_ITEMS 256
+#define SPUD_MAX_CBOR_COUNT 128
+
 /*
  *  0                   1                   2                   3
  *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2
@@ -67,14 +74,35 @@ typedef struct _spud_header
 typedef struct _spud_message
 {
     spud_header *header;
-    /* CBOR MAP */
+    /* CBOR MAP, once decoded by spud_message_cbor() */
     const cn_cbor *cbor;
+    /* pool the CBOR is decoded into, if any */
+    ls_pool *pool;
+    /* length of the whole datagram */
+    size_t length;
+    /* where pool stood before this message, for spud_unparse() */
+    ls_pool_marker mark;
 } spud_message;
 
 
 bool spud_is_spud(const uint8_t *payload, size_t length);
 
+/* Checks the header only; the CBOR is left for spud_message_cbor() or
+   spud_message_data().  payload must outlive msg. */
 bool spud_parse(const uint8_t *payload, size_t length, spud_message *msg, ls_err *err);
+/* Like spud_parse, but the CBOR nodes will be carved out of one block of
+   pool, sized for the worst case of one node per byte of the datagram up
+   to SPUD_MAX_CBOR_ITEMS, so no per-node allocations are made.
+   spud_unparse() releases what this message took from pool, and
+   nothing else. */
+bool spud_parse_pool(const uint8_t *payload, size_t length, ls_pool *pool,
+                     spud_message *msg, ls_err *err);
+/* Decode the CBOR map on first use.  *cbor is NULL if there is none. */
+bool spud_message_cbor(spud_message *msg, const cn_cbor **cbor, ls_err *err);
+/* Find key 0 of the map as a byte or text string, reading in place
+   without building a tree.  *data is NULL if there is no such value. */
+bool spud_message_data(spud_message *msg, const uint8_t **data, size_t *len,
+                       ls_err *err);
 void spud_unparse(spud_message *msg);
 
 bool spud_init(spud_header *hdr, spud_tube_id *id, ls_err *err);
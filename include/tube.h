@@ -33,10 +33,24 @@ typedef enum {
 #define EV_ADD_NAME     "add"
 #define EV_REMOVE_NAME  "remove"
 
+/* Events fired by a tube_manager.  Each value is also the ls_event_id of the
+   event in the manager's dispatcher, so binding by type needs no name lookup. */
+typedef enum {
+  EV_RUNNING,
+  EV_DATA,
+  EV_CLOSE,
+  EV_ADD,
+  EV_REMOVE,
+  EV_MAX
+} tube_event_type;
+
 typedef struct _tube_manager tube_manager;
 
 typedef struct _tube tube;
 
+/* A set of subscriptions shared by several tubes */
+typedef struct _tube_group tube_group;
+
 typedef ssize_t (*tube_sendmsg_func)(int socket,
                                      const struct msghdr *message,
                                      int flags);
@@ -46,10 +60,24 @@ typedef ssize_t (*tube_recvmsg_func)(int socket,
 
 typedef struct _tube_event_data {
     tube *t;
-    const cn_cbor *cbor;
     const struct sockaddr* peer;
+    /* the packet, only header-checked; see tube_event_cbor() */
+    spud_message *msg;
 } tube_event_data;
 
+/* A packet body written in place for tube_send_map().  Heads and short
+   values are copied into scratch; strings of TUBE_MAP_COPY_MAX bytes or
+   more are sent from where they are, so must outlive the send. */
+#define TUBE_MAP_SCRATCH 256
+#define TUBE_MAP_IOVECS 16
+#define TUBE_MAP_COPY_MAX 64
+
+typedef struct _tube_map {
+    cn_cbor_writer w;
+    uint8_t scratch[TUBE_MAP_SCRATCH];
+    struct iovec iov[TUBE_MAP_IOVECS];
+} tube_map;
+
 LS_API bool tube_manager_create(int buckets,
                                 tube_manager **m,
                                 ls_err *err);
@@ -64,6 +92,11 @@ LS_API bool tube_manager_bind_event(tube_manager *mgr,
                                     ls_event_notify_callback cb,
                                     ls_err *err);
 
+LS_API bool tube_manager_bind_event_type(tube_manager *mgr,
+                                         tube_event_type type,
+                                         ls_event_notify_callback cb,
+                                         ls_err *err);
+
 LS_API bool tube_manager_add(tube_manager *mgr,
                              tube *t,
                              ls_err *err);
@@ -71,6 +104,24 @@ LS_API bool tube_manager_add(tube_manager *mgr,
 LS_API void tube_manager_remove(tube_manager *mgr,
                                 tube *t);
 
+/* Hand data events to {num_workers} worker threads instead of running them
+   on the thread in tube_manager_loop.  Each tube is pinned to one worker, so
+   its data events stay in order while different tubes run in parallel.  Each
+   worker queues at most {queue_depth} packets (0 for a default); when a
+   queue is full the receive loop waits for it.  Close events and tube
+   removal wait for the tube's queued data first.  Data callbacks bound in
+   this mode run concurrently: they must not change bindings, or add or
+   remove tubes, and their event has no pool.  Pass 0 workers to go back to
+   inline callbacks.  Call only while tube_manager_loop is not running. */
+LS_API bool tube_manager_set_workers(tube_manager *mgr,
+                                     unsigned int num_workers,
+                                     size_t queue_depth,
+                                     ls_err *err);
+LS_API unsigned int tube_manager_get_workers(tube_manager *mgr);
+
+/* Receive and dispatch packets until tube_manager_stop.  ls_clock_now is
+   updated as each packet arrives, so callbacks can use it as the receive
+   time. */
 LS_API bool tube_manager_loop(tube_manager *mgr, ls_err *err);
 LS_API bool tube_manager_running(tube_manager *mgr);
 LS_API void tube_manager_stop(tube_manager *mgr);
@@ -82,6 +133,29 @@ LS_API bool tube_manager_is_responder(tube_manager *mgr);
 LS_API bool tube_create(tube_manager *mgr, tube **t, ls_err *err);
 LS_API void tube_destroy(tube *t);
 
+/* Subscriptions for a single tube, or for the tubes in a group.  When an
+   event fires for a tube, callbacks bound to the tube run first, then those
+   bound to its group, then those bound to the manager.  Events with no
+   callbacks bound at a level cost nothing at that level.  Unlike
+   tube_manager_bind_event, {arg} is passed through to the callback, and
+   the event source is the tube or group. */
+LS_API bool tube_bind_event(tube *t,
+                            tube_event_type type,
+                            ls_event_notify_callback cb,
+                            void *arg,
+                            ls_err *err);
+LS_API void tube_set_group(tube *t, tube_group *group);
+LS_API tube_group *tube_get_group(tube *t);
+
+/* A group must outlive the tubes that are set to use it. */
+LS_API bool tube_group_create(tube_group **g, ls_err *err);
+LS_API void tube_group_destroy(tube_group *g);
+LS_API bool tube_group_bind_event(tube_group *g,
+                                  tube_event_type type,
+                                  ls_event_notify_callback cb,
+                                  void *arg,
+                                  ls_err *err);
+
 /* print [local address]:port to stdout */
 LS_API bool tube_print(const tube *t, ls_err *err);
 LS_API bool tube_open(tube *t, const struct sockaddr *dest, ls_err *err);
@@ -90,6 +164,20 @@ LS_API bool tube_ack(tube *t,
                      const struct sockaddr *peer,
                      ls_err *err);
 LS_API bool tube_data(tube *t, uint8_t *data, size_t len, ls_err *err);
+/* Send any CBOR item as the body of a cmd packet.  Large strings are
+   sent from where they are, not copied. */
+LS_API bool tube_send_cbor(tube *t,
+                           spud_command cmd,
+                           const cn_cbor *cbor,
+                           ls_err *err);
+/* Start a map with the given number of pairs; write them with the
+   cn_cbor_write_*() functions on &m->w, then send it with
+   tube_send_map(). */
+LS_API void tube_map_init(tube_map *m, size_t pairs);
+LS_API bool tube_send_map(tube *t,
+                          spud_command cmd,
+                          tube_map *m,
+                          ls_err *err);
 LS_API bool tube_close(tube *t, ls_err *err);
 
 LS_API bool tube_send(tube *t,
@@ -102,6 +190,15 @@ LS_API void tube_set_data(tube *t, void *data);
 LS_API void *tube_get_data(tube *t);
 LS_API char *tube_id_to_string(tube *t, char* buf, size_t len);
 LS_API tube_states_t tube_get_state(tube *t);
+
+/* The packet's CBOR, decoded on first use.  NULL if there is none or it
+   does not decode.  Valid until the callback returns. */
+LS_API const cn_cbor *tube_event_cbor(tube_event_data *d);
+/* Key 0 of the packet's map as bytes, read in place without decoding the
+   rest.  False if there is no such value. */
+LS_API bool tube_event_data_bytes(tube_event_data *d,
+                                  const uint8_t **data,
+                                  size_t *len);
 LS_API void tube_get_id(tube *t, spud_tube_id *id);
 
 LS_API void tube_set_socket_functions(tube_sendmsg_func send,
@@ -0,0 +1,518 @@
+/*
+ * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
+ *
+ * Measure CBOR decode throughput, building a tree with cn_cbor_decode(),
+ * with and without UTF-8 checks, a compact tree with
+ * cn_cbor_compact_decode(), and walking the same bytes with a cursor;
+ * UTF-8 validation on its own, vector against scalar; encode
+ * throughput for very deep and very wide trees; and 10k samples as a
+ * typed array against one item per sample.
+ *
+ * usage: cborbench [seconds-per-run]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cn-cbor/cn-cbor.h"
+
+#define CORPUS_SIZE (64 * 1024)
+#define TREE_DEPTH 4096
+#define TREE_WIDTH 4096
+#define SAMPLES 10000
+
+typedef struct _corpus_t {
+    const char *name;
+    uint8_t *buf;
+    size_t *offsets;            /* start of each message, plus the end */
+    size_t count;
+} corpus_t;
+
+static uint8_t *put_head(uint8_t *p, int mt, uint64_t val)
+{
+    mt <<= 5;
+    if (val < 24) {
+        *p++ = mt | (uint8_t)val;
+    } else if (val <= 0xff) {
+        *p++ = mt | 24;
+        *p++ = (uint8_t)val;
+    } else if (val <= 0xffff) {
+        *p++ = mt | 25;
+        *p++ = (uint8_t)(val >> 8);
+        *p++ = (uint8_t)val;
+    } else if (val <= 0xffffffffu) {
+        *p++ = mt | 26;
+        *p++ = (uint8_t)(val >> 24);
+        *p++ = (uint8_t)(val >> 16);
+        *p++ = (uint8_t)(val >> 8);
+        *p++ = (uint8_t)val;
+    } else {
+        int i;
+        *p++ = mt | 27;
+        for (i = 7; i >= 0; i--) {
+            *p++ = (uint8_t)(val >> (i * 8));
+        }
+    }
+    return p;
+}
+
+/* What a tube carries: {0: h'...'} with a payload of a few hundred bytes */
+static uint8_t *spud_message(uint8_t *p, unsigned seed)
+{
+    size_t len = 32 + (seed * 7919) % 480;
+    p = put_head(p, 5, 1);
+    p = put_head(p, 0, 0);
+    p = put_head(p, 2, len);
+    memset(p, (int)seed, len);
+    return p + len;
+}
+
+/* A mix of small ints, nested maps and arrays, text and floats */
+static uint8_t *general_message(uint8_t *p, unsigned seed)
+{
+    int i;
+    p = put_head(p, 5, 4);
+    p = put_head(p, 3, 2);
+    memcpy(p, "id", 2);
+    p += 2;
+    p = put_head(p, 0, (uint64_t)seed * 1000003u);
+    p = put_head(p, 0, 1);
+    p = put_head(p, 4, 8);
+    for (i = 0; i < 8; i++) {
+        p = put_head(p, i & 1, (uint64_t)(seed + i) << (i * 4));
+    }
+    p = put_head(p, 0, 2);
+    *p++ = 0xfb;                /* double */
+    memset(p, 0x3f, 8);
+    p += 8;
+    p = put_head(p, 3, 4);
+    memcpy(p, "tags", 4);
+    p += 4;
+    p = put_head(p, 5, 3);
+    for (i = 0; i < 3; i++) {
+        p = put_head(p, 0, i);
+        p = put_head(p, 3, 5);
+        memcpy(p, "value", 5);
+        p += 5;
+    }
+    return p;
+}
+
+/* Text-heavy: {"name": "...", "note": "..."} with some non-ASCII text */
+static uint8_t *text_message(uint8_t *p, unsigned seed)
+{
+    static const char *words[] = {
+        "spud ", "tube ", "path ", "declaration ", "caf\xc3\xa9 ",
+        "\xe2\x82\xac ", "\xe6\x97\xa5\xe6\x9c\xac ", "\xf0\x9f\x98\x80 "
+    };
+    uint8_t text[400];
+    size_t len = 0;
+    size_t want = 48 + (seed * 7919) % 320;
+    unsigned i = seed;
+
+    while (len < want) {
+        const char *w = words[(i++ * 2654435761u) >> 29];
+        memcpy(text + len, w, strlen(w));
+        len += strlen(w);
+    }
+    p = put_head(p, 5, 2);
+    p = put_head(p, 3, 4);
+    memcpy(p, "name", 4);
+    p += 4;
+    p = put_head(p, 3, 5);
+    memcpy(p, "caf\xc3\xa9", 5);
+    p += 5;
+    p = put_head(p, 3, 4);
+    memcpy(p, "note", 4);
+    p += 4;
+    p = put_head(p, 3, len);
+    memcpy(p, text, len);
+    return p + len;
+}
+
+static void build_corpus(corpus_t *c, const char *name,
+                         uint8_t *(*gen)(uint8_t *, unsigned))
+{
+    uint8_t tmp[1024];
+    uint8_t *p;
+    size_t used = 0;
+    size_t max = CORPUS_SIZE / 16;
+
+    c->name = name;
+    c->buf = malloc(CORPUS_SIZE);
+    c->offsets = malloc((max + 1) * sizeof(size_t));
+    c->count = 0;
+    if (!c->buf || !c->offsets) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (;;) {
+        size_t len = (size_t)(gen(tmp, (unsigned)c->count) - tmp);
+        if (used + len > CORPUS_SIZE || c->count == max) {
+            break;
+        }
+        p = c->buf + used;
+        memcpy(p, tmp, len);
+        c->offsets[c->count++] = used;
+        used += len;
+    }
+    c->offsets[c->count] = used;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool decode_tree(const corpus_t *c)
+{
+    size_t i;
+    cn_cbor_errback err;
+    for (i = 0; i < c->count; i++) {
+        const cn_cbor *cb = cn_cbor_decode(
+            (const char *)c->buf + c->offsets[i],
+            c->offsets[i + 1] - c->offsets[i], NULL, NULL, &err);
+        if (!cb) {
+            fprintf(stderr, "%s: message %zu: %s\n",
+                    c->name, i, cn_cbor_error_str[err.err]);
+            return false;
+        }
+        cn_cbor_free(cb);
+    }
+    return true;
+}
+
+static bool decode_utf8(const corpus_t *c)
+{
+    static const cn_cbor_limits limits = { 0, 0, 0, true };
+    size_t i;
+    cn_cbor_errback err;
+    for (i = 0; i < c->count; i++) {
+        const cn_cbor *cb = cn_cbor_decode_limited(
+            (const char *)c->buf + c->offsets[i],
+            c->offsets[i + 1] - c->offsets[i], &limits, NULL, NULL, &err);
+        if (!cb) {
+            fprintf(stderr, "%s: message %zu: %s\n",
+                    c->name, i, cn_cbor_error_str[err.err]);
+            return false;
+        }
+        cn_cbor_free(cb);
+    }
+    return true;
+}
+
+static bool decode_compact(const corpus_t *c)
+{
+    static cn_cbor_compact nodes[1024];
+    size_t i;
+    cn_cbor_errback err;
+    for (i = 0; i < c->count; i++) {
+        if (!cn_cbor_compact_decode((const char *)c->buf + c->offsets[i],
+                                    c->offsets[i + 1] - c->offsets[i],
+                                    nodes, sizeof(nodes) / sizeof(nodes[0]),
+                                    NULL, &err)) {
+            fprintf(stderr, "%s: message %zu: %s\n",
+                    c->name, i, cn_cbor_error_str[err.err]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool decode_cursor(const corpus_t *c)
+{
+    size_t i;
+    cn_cbor_cursor cur;
+    for (i = 0; i < c->count; i++) {
+        cn_cbor_cursor_init(&cur, (const char *)c->buf + c->offsets[i],
+                            c->offsets[i + 1] - c->offsets[i]);
+        if (!cn_cbor_cursor_skip(&cur) || !cn_cbor_cursor_done(&cur)) {
+            fprintf(stderr, "%s: message %zu: %s\n",
+                    c->name, i, cn_cbor_error_str[cur.err]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void run(const corpus_t *c, const char *how,
+                bool (*fn)(const corpus_t *), double seconds)
+{
+    double start = now();
+    double elapsed;
+    unsigned long passes = 0;
+
+    do {
+        if (!fn(c)) {
+            exit(1);
+        }
+        passes++;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    printf("%-8s %-7s %6zu msgs %8.1f MB/s %8.2f Mmsg/s\n",
+           c->name, how, c->count,
+           passes * c->offsets[c->count] / elapsed / 1e6,
+           passes * c->count / elapsed / 1e6);
+}
+
+/* The text of every message in the corpus, as one run of text */
+static void run_utf8(const corpus_t *c, const char *how,
+                     bool (*valid)(const char *, size_t), double seconds)
+{
+    char *text = malloc(CORPUS_SIZE);
+    size_t len = 0;
+    size_t i;
+    double start, elapsed;
+    unsigned long passes = 0;
+
+    if (!text) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    /* whole characters only: each message ends with its note */
+    for (i = 0; i < c->count; i++) {
+        cn_cbor_errback err;
+        const cn_cbor *cb = cn_cbor_decode(
+            (const char *)c->buf + c->offsets[i],
+            c->offsets[i + 1] - c->offsets[i], NULL, NULL, &err);
+        const cn_cbor *note = cb ? cn_cbor_mapget_string(cb, "note") : NULL;
+        if (note) {
+            memcpy(text + len, note->v.str, note->length);
+            len += note->length;
+        }
+        cn_cbor_free(cb);
+    }
+
+    start = now();
+    do {
+        if (!valid(text, len)) {
+            fprintf(stderr, "%s: not UTF-8\n", how);
+            exit(1);
+        }
+        passes++;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    printf("%-8s %-7s %6zu bytes %7.1f MB/s\n",
+           "utf8", how, len, passes * len / elapsed / 1e6);
+    free(text);
+}
+
+/* [[[...[0]...]]] */
+static size_t deep_tree(uint8_t *buf)
+{
+    size_t i;
+    for (i = 0; i < TREE_DEPTH; i++) {
+        buf[i] = 0x81;
+    }
+    buf[i++] = 0x00;
+    return i;
+}
+
+/* [{0: 0, 1: "wide"}, {0: 1, 1: "wide"}, ...] */
+static size_t wide_tree(uint8_t *buf)
+{
+    uint8_t *p = put_head(buf, 4, TREE_WIDTH);
+    int i;
+    for (i = 0; i < TREE_WIDTH; i++) {
+        p = put_head(p, 5, 2);
+        p = put_head(p, 0, 0);
+        p = put_head(p, 0, i);
+        p = put_head(p, 0, 1);
+        p = put_head(p, 3, 4);
+        memcpy(p, "wide", 4);
+        p += 4;
+    }
+    return (size_t)(p - buf);
+}
+
+static void run_encode(const char *name, size_t (*gen)(uint8_t *),
+                       size_t nodes, double seconds)
+{
+    uint8_t *in = malloc(CORPUS_SIZE);
+    uint8_t *out = malloc(CORPUS_SIZE);
+    const cn_cbor *cb;
+    cn_cbor_errback err;
+    cn_cbor_writer w;
+    size_t len;
+    double start, elapsed;
+    unsigned long passes = 0;
+
+    if (!in || !out) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    len = gen(in);
+    cb = cn_cbor_decode((const char *)in, len, NULL, NULL, &err);
+    if (!cb) {
+        fprintf(stderr, "%s: %s\n", name, cn_cbor_error_str[err.err]);
+        exit(1);
+    }
+
+    start = now();
+    do {
+        cn_cbor_writer_init(&w, out, CORPUS_SIZE);
+        if (!cn_cbor_write_item(&w, cb) || (w.length != len)) {
+            fprintf(stderr, "%s: encoding failed\n", name);
+            exit(1);
+        }
+        passes++;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    printf("%-8s %-7s %6zu bytes %7.1f MB/s %8.2f Mnode/s\n",
+           name, "encode", len,
+           passes * len / elapsed / 1e6,
+           passes * nodes / elapsed / 1e6);
+    cn_cbor_free(cb);
+    free(in);
+    free(out);
+}
+
+typedef struct _samples_t {
+    double in[SAMPLES];
+    double out[SAMPLES];
+    uint8_t enc[SAMPLES * 9 + 16];
+    size_t len;
+} samples_t;
+
+static bool typed_encode(samples_t *sm)
+{
+    cn_cbor_writer w;
+    cn_cbor_writer_init(&w, sm->enc, sizeof(sm->enc));
+    if (!cn_cbor_write_typed_array(&w, CN_CBOR_TA_FLOAT, sizeof(double),
+                                   sm->in, SAMPLES)) {
+        return false;
+    }
+    sm->len = w.length;
+    return true;
+}
+
+static bool items_encode(samples_t *sm)
+{
+    cn_cbor_writer w;
+    size_t i;
+    cn_cbor_writer_init(&w, sm->enc, sizeof(sm->enc));
+    cn_cbor_write_array(&w, SAMPLES);
+    for (i = 0; i < SAMPLES; i++) {
+        cn_cbor_write_double(&w, sm->in[i]);
+    }
+    sm->len = w.length;
+    return cn_cbor_writer_finish(&w);
+}
+
+static bool typed_decode(samples_t *sm)
+{
+    cn_cbor_errback err;
+    cn_cbor_typed_array ta;
+    const cn_cbor *cb = cn_cbor_decode((const char *)sm->enc, sm->len,
+                                       NULL, NULL, &err);
+    if (!cb || !cn_cbor_typed_array_view(cb, &ta) || ta.count != SAMPLES) {
+        return false;
+    }
+    cn_cbor_typed_array_copy(&ta, sm->out);
+    cn_cbor_free(cb);
+    return true;
+}
+
+/* the same bytes, as if from a peer of the other byte order */
+static bool typed_swap(samples_t *sm)
+{
+    cn_cbor_typed_array ta;
+    if (!cn_cbor_typed_array_init(&ta, 86 ^ 4, sm->in, sizeof(sm->in))) {
+        return false;
+    }
+    cn_cbor_typed_array_copy(&ta, sm->out);
+    return true;
+}
+
+static bool items_decode(samples_t *sm)
+{
+    cn_cbor_errback err;
+    const cn_cbor *cp;
+    size_t i = 0;
+    const cn_cbor *cb = cn_cbor_decode((const char *)sm->enc, sm->len,
+                                       NULL, NULL, &err);
+    if (!cb) {
+        return false;
+    }
+    for (cp = cb->first_child; cp; cp = cp->next) {
+        sm->out[i++] = cp->v.dbl;
+    }
+    cn_cbor_free(cb);
+    return i == SAMPLES;
+}
+
+static void run_samples(samples_t *sm, const char *how,
+                        bool (*fn)(samples_t *), double seconds)
+{
+    double start = now();
+    double elapsed;
+    unsigned long passes = 0;
+
+    do {
+        if (!fn(sm)) {
+            fprintf(stderr, "samples: %s failed\n", how);
+            exit(1);
+        }
+        passes++;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    printf("%-8s %-7s %6d samples %8.1f MB/s %8.2f Msample/s\n",
+           "samples", how, SAMPLES,
+           passes * sizeof(sm->in) / elapsed / 1e6,
+           passes * SAMPLES / elapsed / 1e6);
+}
+
+static void run_typed(double seconds)
+{
+    samples_t *sm = malloc(sizeof(*sm));
+    size_t i;
+
+    if (!sm) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < SAMPLES; i++) {
+        sm->in[i] = i * 0.25;
+    }
+    run_samples(sm, "typed", typed_encode, seconds);
+    run_samples(sm, "typed-d", typed_decode, seconds);
+    run_samples(sm, "swap-d", typed_swap, seconds);
+    run_samples(sm, "items", items_encode, seconds);
+    run_samples(sm, "items-d", items_decode, seconds);
+    free(sm);
+}
+
+int main(int argc, char *argv[])
+{
+    corpus_t corpora[3];
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    size_t i;
+
+    build_corpus(&corpora[0], "spud", spud_message);
+    build_corpus(&corpora[1], "general", general_message);
+    build_corpus(&corpora[2], "text", text_message);
+    run_utf8(&corpora[2], "vector", cn_cbor_utf8_valid, seconds);
+    run_utf8(&corpora[2], "scalar", cn_cbor_utf8_valid_scalar, seconds);
+
+    for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++) {
+        run(&corpora[i], "tree", decode_tree, seconds);
+        run(&corpora[i], "utf8", decode_utf8, seconds);
+        run(&corpora[i], "compact", decode_compact, seconds);
+        run(&corpora[i], "cursor", decode_cursor, seconds);
+        free(corpora[i].buf);
+        free(corpora[i].offsets);
+    }
+    run_encode("deep", deep_tree, TREE_DEPTH + 1, seconds);
+    run_encode("wide", wide_tree, 1 + 5 * TREE_WIDTH, seconds);
+    run_typed(seconds);
+    return 0;
+}
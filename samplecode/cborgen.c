@@ -0,0 +1,675 @@
+/*
+ * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
+ *
+ * Generate C decoders and encoders for fixed-shape CBOR maps.
+ *
+ * usage: cborgen schema-file output-base
+ *
+ * writes output-base.h and output-base.c.  A schema lists messages, each
+ * a map with integer or text keys:
+ *
+ *     # a comment
+ *     message path_decl
+ *         0       bytes   data
+ *         1       uint    seq     optional
+ *         -1      int     offset  optional
+ *         "ip"    text    addr    optional
+ *     end
+ *
+ * Types are uint, int, bool, double, bytes and text.  For each message
+ * there is a struct with one member per field (plus a length for bytes
+ * and text, which point into the decoded buffer, and a has_ flag for
+ * optional fields), a NAME_decode() that fills it in one pass over the
+ * bytes with a cursor, and a NAME_write() that encodes it with keys
+ * encoded ahead of time.  Keys not in the schema are skipped; missing
+ * required fields, duplicate keys and values of the wrong type fail with
+ * CN_CBOR_ERR_SCHEMA_MISMATCH.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_NAME 64
+#define MAX_FIELDS 32           /* bits in the generated seen mask */
+#define MAX_MESSAGES 64
+#define MAX_LINE 512
+#define MAX_TOKENS 8
+
+typedef enum _ftype_t {
+    T_UINT, T_INT, T_BOOL, T_DOUBLE, T_BYTES, T_TEXT
+} ftype_t;
+
+static const struct {
+    const char *name;
+    const char *ctype;
+} types[] = {
+    {"uint", "uint64_t"},
+    {"int", "int64_t"},
+    {"bool", "bool"},
+    {"double", "double"},
+    {"bytes", "const uint8_t *"},
+    {"text", "const char *"},
+};
+
+typedef struct _field_t {
+    bool text_key;
+    long int_key;
+    char text[MAX_NAME];
+    ftype_t type;
+    char name[MAX_NAME];
+    bool optional;
+    uint8_t key[MAX_NAME + 9];  /* the key, encoded */
+    size_t key_len;
+} field_t;
+
+typedef struct _message_t {
+    char name[MAX_NAME];
+    field_t fields[MAX_FIELDS];
+    int count;
+} message_t;
+
+static message_t messages[MAX_MESSAGES];
+static int num_messages = 0;
+static const char *schema_name;
+static int lineno;
+
+static void die(const char *fmt, ...)
+{
+    va_list ap;
+    fprintf(stderr, "%s:%d: ", schema_name, lineno);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+static bool is_ident(const char *s)
+{
+    if (!isalpha((unsigned char)*s) && *s != '_') {
+        return false;
+    }
+    while (*++s) {
+        if (!isalnum((unsigned char)*s) && *s != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Split a line into words; a quoted word may hold spaces, and # outside
+   quotes starts a comment.  The quotes are kept. */
+static int tokenize(char *line, char *tok[])
+{
+    int n = 0;
+    char *p = line;
+
+    for (;;) {
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (!*p || *p == '#') {
+            return n;
+        }
+        if (n == MAX_TOKENS) {
+            die("too many words");
+        }
+        tok[n++] = p;
+        if (*p == '"') {
+            p = strchr(p + 1, '"');
+            if (!p) {
+                die("unterminated string");
+            }
+            p++;
+        } else {
+            while (*p && !isspace((unsigned char)*p) && *p != '#') {
+                p++;
+            }
+        }
+        if (*p == '#') {
+            *p = '\0';
+            return n;
+        }
+        if (*p) {
+            *p++ = '\0';
+        }
+    }
+}
+
+static size_t put_head(uint8_t *p, int mt, uint64_t val)
+{
+    size_t len, i;
+    mt <<= 5;
+    if (val < 24) {
+        p[0] = mt | (uint8_t)val;
+        return 1;
+    }
+    if (val <= 0xff) {
+        p[0] = mt | 24;
+        len = 1;
+    } else if (val <= 0xffff) {
+        p[0] = mt | 25;
+        len = 2;
+    } else if (val <= 0xffffffffu) {
+        p[0] = mt | 26;
+        len = 4;
+    } else {
+        p[0] = mt | 27;
+        len = 8;
+    }
+    for (i = 0; i < len; i++) {
+        p[1 + i] = (uint8_t)(val >> ((len - 1 - i) * 8));
+    }
+    return 1 + len;
+}
+
+static void parse_field(message_t *m, char *tok[], int n)
+{
+    field_t *f;
+    char *end;
+    int i;
+
+    if (n < 3 || n > 4 || (n == 4 && strcmp(tok[3], "optional"))) {
+        die("expected: key type name [optional]");
+    }
+    if (m->count == MAX_FIELDS) {
+        die("more than %d fields in %s", MAX_FIELDS, m->name);
+    }
+    f = &m->fields[m->count];
+    memset(f, 0, sizeof(*f));
+
+    if (tok[0][0] == '"') {
+        size_t len = strlen(tok[0]) - 2;
+        if (len >= MAX_NAME) {
+            die("key too long");
+        }
+        f->text_key = true;
+        memcpy(f->text, tok[0] + 1, len);
+        f->text[len] = '\0';
+        if (strpbrk(f->text, "\\?")) {
+            die("keys may not hold \\ or ?");
+        }
+        f->key_len = put_head(f->key, 3, len);
+        memcpy(f->key + f->key_len, f->text, len);
+        f->key_len += len;
+    } else {
+        errno = 0;
+        f->int_key = strtol(tok[0], &end, 0);
+        if (*end || errno) {
+            die("bad key %s", tok[0]);
+        }
+        f->key_len = f->int_key < 0 ?
+            put_head(f->key, 1, (uint64_t)(-1 - f->int_key)) :
+            put_head(f->key, 0, (uint64_t)f->int_key);
+    }
+
+    for (i = 0; i < (int)(sizeof(types) / sizeof(types[0])); i++) {
+        if (!strcmp(tok[1], types[i].name)) {
+            break;
+        }
+    }
+    if (i == (int)(sizeof(types) / sizeof(types[0]))) {
+        die("unknown type %s", tok[1]);
+    }
+    f->type = (ftype_t)i;
+
+    if (!is_ident(tok[2]) || strlen(tok[2]) >= MAX_NAME - 8) {
+        die("bad field name %s", tok[2]);
+    }
+    strcpy(f->name, tok[2]);
+    f->optional = (n == 4);
+
+    for (i = 0; i < m->count; i++) {
+        if (!strcmp(m->fields[i].name, f->name)) {
+            die("field %s repeated", f->name);
+        }
+        if (m->fields[i].key_len == f->key_len &&
+            !memcmp(m->fields[i].key, f->key, f->key_len)) {
+            die("key %s repeated", tok[0]);
+        }
+    }
+    m->count++;
+}
+
+static void parse(FILE *in)
+{
+    char line[MAX_LINE];
+    char *tok[MAX_TOKENS];
+    message_t *m = NULL;
+    int n, i;
+
+    while (fgets(line, sizeof(line), in)) {
+        lineno++;
+        if (!strchr(line, '\n') && !feof(in)) {
+            die("line too long");
+        }
+        n = tokenize(line, tok);
+        if (n == 0) {
+            continue;
+        }
+        if (!strcmp(tok[0], "message")) {
+            if (m) {
+                die("message inside %s", m->name);
+            }
+            if (n != 2 || !is_ident(tok[1]) || strlen(tok[1]) >= MAX_NAME) {
+                die("expected: message name");
+            }
+            if (num_messages == MAX_MESSAGES) {
+                die("too many messages");
+            }
+            for (i = 0; i < num_messages; i++) {
+                if (!strcmp(messages[i].name, tok[1])) {
+                    die("message %s repeated", tok[1]);
+                }
+            }
+            m = &messages[num_messages++];
+            strcpy(m->name, tok[1]);
+            m->count = 0;
+        } else if (!strcmp(tok[0], "end")) {
+            if (!m || n != 1) {
+                die("unexpected end");
+            }
+            if (m->count == 0) {
+                die("message %s has no fields", m->name);
+            }
+            m = NULL;
+        } else if (m) {
+            parse_field(m, tok, n);
+        } else {
+            die("field outside a message");
+        }
+    }
+    if (m) {
+        die("message %s has no end", m->name);
+    }
+}
+
+static bool has_key_kind(const message_t *m, bool text)
+{
+    int i;
+    for (i = 0; i < m->count; i++) {
+        if (m->fields[i].text_key == text) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void write_header(FILE *out, const char *base)
+{
+    char guard[MAX_LINE];
+    const char *p;
+    size_t i;
+    int m, f;
+
+    p = strrchr(base, '/');
+    p = p ? p + 1 : base;
+    for (i = 0; p[i] && i < sizeof(guard) - 3; i++) {
+        guard[i] = isalnum((unsigned char)p[i]) ?
+            toupper((unsigned char)p[i]) : '_';
+    }
+    strcpy(guard + i, "_H");
+
+    fprintf(out, "/* Generated by cborgen from %s.  Do not edit. */\n\n",
+            schema_name);
+    fprintf(out, "#ifndef %s\n#define %s\n\n", guard, guard);
+    fprintf(out, "#include <stdbool.h>\n#include <stddef.h>\n"
+            "#include <stdint.h>\n\n#include \"cn-cbor/cn-cbor.h\"\n\n");
+    fprintf(out, "#ifdef  __cplusplus\nextern \"C\" {\n#endif\n");
+
+    for (m = 0; m < num_messages; m++) {
+        const message_t *msg = &messages[m];
+        fprintf(out, "\ntypedef struct %s {\n", msg->name);
+        for (f = 0; f < msg->count; f++) {
+            const field_t *fl = &msg->fields[f];
+            const char *ct = types[fl->type].ctype;
+            if (fl->optional) {
+                fprintf(out, "    bool has_%s;\n", fl->name);
+            }
+            fprintf(out, "    %s%s%s;\n", ct,
+                    ct[strlen(ct) - 1] == '*' ? "" : " ", fl->name);
+            if (fl->type == T_BYTES || fl->type == T_TEXT) {
+                fprintf(out, "    size_t %s_len;\n", fl->name);
+            }
+        }
+        fprintf(out, "} %s;\n\n", msg->name);
+        fprintf(out, "bool %s_decode(%s *m, const char *buf, size_t len,\n"
+                "    cn_cbor_errback *errp);\n", msg->name, msg->name);
+        fprintf(out, "bool %s_write(const %s *m, cn_cbor_writer *w);\n",
+                msg->name, msg->name);
+    }
+
+    fprintf(out, "\n#ifdef  __cplusplus\n}\n#endif\n\n#endif /* %s */\n",
+            guard);
+}
+
+/* The check and the store for one value */
+static void write_value(FILE *out, const field_t *f)
+{
+    switch (f->type) {
+    case T_UINT:
+        fprintf(out, "            if (val.type != CN_CBOR_UINT) {\n");
+        break;
+    case T_INT:
+        fprintf(out,
+                "            if (!(val.type == CN_CBOR_UINT && val.v.sint >= 0) &&\n"
+                "                !(val.type == CN_CBOR_INT && val.v.sint < 0)) {\n");
+        break;
+    case T_BOOL:
+        fprintf(out,
+                "            if (val.type != CN_CBOR_TRUE &&\n"
+                "                val.type != CN_CBOR_FALSE) {\n");
+        break;
+    case T_DOUBLE:
+        fprintf(out, "            if (val.type != CN_CBOR_DOUBLE) {\n");
+        break;
+    case T_BYTES: case T_TEXT:
+        fprintf(out,
+                "            if (val.type != %s ||\n"
+                "                (val.flags & CN_CBOR_FL_INDEF)) {\n",
+                f->type == T_BYTES ? "CN_CBOR_BYTES" : "CN_CBOR_TEXT");
+        break;
+    }
+    fprintf(out, "                return cborgen_fail(errp, "
+            "CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);\n"
+            "            }\n");
+    if (f->optional) {
+        fprintf(out, "            m->has_%s = true;\n", f->name);
+    }
+    switch (f->type) {
+    case T_UINT:
+        fprintf(out, "            m->%s = val.v.uint;\n", f->name);
+        break;
+    case T_INT:
+        fprintf(out, "            m->%s = val.v.sint;\n", f->name);
+        break;
+    case T_BOOL:
+        fprintf(out, "            m->%s = (val.type == CN_CBOR_TRUE);\n",
+                f->name);
+        break;
+    case T_DOUBLE:
+        fprintf(out, "            m->%s = val.v.dbl;\n", f->name);
+        break;
+    case T_BYTES:
+        fprintf(out, "            m->%s = (const uint8_t *)val.v.str;\n"
+                "            m->%s_len = val.length;\n", f->name, f->name);
+        break;
+    case T_TEXT:
+        fprintf(out, "            m->%s = val.v.str;\n"
+                "            m->%s_len = val.length;\n", f->name, f->name);
+        break;
+    }
+    fprintf(out, "            break;\n");
+}
+
+static void write_decode(FILE *out, const message_t *msg)
+{
+    uint32_t required = 0;
+    bool ints = has_key_kind(msg, false);
+    bool texts = has_key_kind(msg, true);
+    const char *els = "";
+    bool first;
+    int f;
+
+    for (f = 0; f < msg->count; f++) {
+        if (!msg->fields[f].optional) {
+            required |= (uint32_t)1 << f;
+        }
+    }
+
+    fprintf(out, "\nbool %s_decode(%s *m, const char *buf, size_t len,\n"
+            "    cn_cbor_errback *errp)\n{\n", msg->name, msg->name);
+    fprintf(out,
+            "    cn_cbor_cursor cur;\n"
+            "    cn_cbor_item map, key, val;\n"
+            "    uint32_t seen = 0;\n"
+            "    bool indef;\n"
+            "    size_t i;\n"
+            "    int field;\n\n"
+            "    memset(m, 0, sizeof(*m));\n"
+            "    cn_cbor_cursor_init(&cur, buf, len);\n"
+            "    if (!cn_cbor_cursor_next(&cur, &map)) {\n"
+            "        return cborgen_fail(errp, cur.err, buf, &cur);\n"
+            "    }\n"
+            "    if (map.type != CN_CBOR_MAP) {\n"
+            "        return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, "
+            "buf, &cur);\n"
+            "    }\n"
+            "    indef = (map.flags & CN_CBOR_FL_INDEF) != 0;\n"
+            "    for (i = 0; indef || i < map.length; i++) {\n"
+            "        if (indef && cn_cbor_cursor_break(&cur)) {\n"
+            "            break;\n"
+            "        }\n"
+            "        if (!cn_cbor_cursor_next(&cur, &key)) {\n"
+            "            return cborgen_fail(errp, cur.err, buf, &cur);\n"
+            "        }\n"
+            "        field = -1;\n");
+
+    if (ints) {
+        fprintf(out,
+                "        if ((key.type == CN_CBOR_UINT && key.v.sint >= 0) ||\n"
+                "            (key.type == CN_CBOR_INT && key.v.sint < 0)) {\n"
+                "            switch (key.v.sint) {\n");
+        for (f = 0; f < msg->count; f++) {
+            if (!msg->fields[f].text_key) {
+                fprintf(out, "            case %ld:\n"
+                        "                field = %d;\n"
+                        "                break;\n",
+                        msg->fields[f].int_key, f);
+            }
+        }
+        fprintf(out, "            }\n");
+        els = "} else ";
+    }
+    if (texts) {
+        fprintf(out, "        %sif (key.type == CN_CBOR_TEXT &&\n"
+                "            %s!(key.flags & CN_CBOR_FL_INDEF)) {\n",
+                els, *els ? "       " : "");
+        first = true;
+        for (f = 0; f < msg->count; f++) {
+            const field_t *fl = &msg->fields[f];
+            if (fl->text_key) {
+                fprintf(out, "            %sif (key.length == %zu &&\n"
+                        "                %smemcmp(key.v.str, \"%s\", %zu) == 0) {\n"
+                        "                field = %d;\n",
+                        first ? "" : "} else ", strlen(fl->text),
+                        first ? "" : "       ", fl->text, strlen(fl->text), f);
+                first = false;
+            }
+        }
+        fprintf(out, "            }\n");
+        els = "} else ";
+    }
+    fprintf(out,
+            "        %sif (!cn_cbor_cursor_skip_contents(&cur, &key)) {\n"
+            "            return cborgen_fail(errp, cur.err, buf, &cur);\n"
+            "        }\n", els);
+
+    fprintf(out,
+            "        if (field < 0) {\n"
+            "            /* not in the schema */\n"
+            "            if (!cn_cbor_cursor_skip(&cur)) {\n"
+            "                return cborgen_fail(errp, cur.err, buf, &cur);\n"
+            "            }\n"
+            "            continue;\n"
+            "        }\n"
+            "        if (seen & ((uint32_t)1 << field)) {\n"
+            "            return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, "
+            "buf, &cur);\n"
+            "        }\n"
+            "        seen |= (uint32_t)1 << field;\n"
+            "        if (!cn_cbor_cursor_next(&cur, &val)) {\n"
+            "            return cborgen_fail(errp, cur.err, buf, &cur);\n"
+            "        }\n"
+            "        switch (field) {\n");
+    for (f = 0; f < msg->count; f++) {
+        fprintf(out, "        case %d:\n", f);
+        write_value(out, &msg->fields[f]);
+    }
+    fprintf(out,
+            "        }\n"
+            "    }\n");
+    if (required) {
+        fprintf(out,
+                "    if ((seen & 0x%lxUL) != 0x%lxUL) {\n"
+                "        return cborgen_fail(errp, "
+                "CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);\n"
+                "    }\n",
+                (unsigned long)required, (unsigned long)required);
+    }
+    fprintf(out,
+            "    if (!cn_cbor_cursor_done(&cur)) {\n"
+            "        return cborgen_fail(errp, CN_CBOR_ERR_NOT_ALL_DATA_CONSUMED, "
+            "buf, &cur);\n"
+            "    }\n"
+            "    return true;\n"
+            "}\n");
+}
+
+static void write_encode(FILE *out, const message_t *msg)
+{
+    int required = 0;
+    int f;
+    size_t i;
+
+    fprintf(out, "\nbool %s_write(const %s *m, cn_cbor_writer *w)\n{\n",
+            msg->name, msg->name);
+    for (f = 0; f < msg->count; f++) {
+        const field_t *fl = &msg->fields[f];
+        fprintf(out, "    static const uint8_t key_%s[] = {", fl->name);
+        for (i = 0; i < fl->key_len; i++) {
+            fprintf(out, "%s0x%02x", i ? ", " : " ", fl->key[i]);
+        }
+        fprintf(out, " };\n");
+        if (!fl->optional) {
+            required++;
+        }
+    }
+
+    fprintf(out, "\n    cn_cbor_write_map(w, %d", required);
+    for (f = 0; f < msg->count; f++) {
+        if (msg->fields[f].optional) {
+            fprintf(out, " +\n        (m->has_%s ? 1 : 0)",
+                    msg->fields[f].name);
+        }
+    }
+    fprintf(out, ");\n");
+
+    for (f = 0; f < msg->count; f++) {
+        const field_t *fl = &msg->fields[f];
+        const char *ind = fl->optional ? "        " : "    ";
+        if (fl->optional) {
+            fprintf(out, "    if (m->has_%s) {\n", fl->name);
+        }
+        fprintf(out, "%scn_cbor_write_encoded(w, key_%s, sizeof(key_%s));\n",
+                ind, fl->name, fl->name);
+        switch (fl->type) {
+        case T_UINT:
+            fprintf(out, "%scn_cbor_write_uint(w, m->%s);\n", ind, fl->name);
+            break;
+        case T_INT:
+            fprintf(out, "%scn_cbor_write_int(w, m->%s);\n", ind, fl->name);
+            break;
+        case T_BOOL:
+            fprintf(out, "%scn_cbor_write_bool(w, m->%s);\n", ind, fl->name);
+            break;
+        case T_DOUBLE:
+            fprintf(out, "%scn_cbor_write_double(w, m->%s);\n",
+                    ind, fl->name);
+            break;
+        case T_BYTES:
+            fprintf(out, "%scn_cbor_write_bytes(w, m->%s, m->%s_len);\n",
+                    ind, fl->name, fl->name);
+            break;
+        case T_TEXT:
+            fprintf(out, "%scn_cbor_write_text(w, m->%s, m->%s_len);\n",
+                    ind, fl->name, fl->name);
+            break;
+        }
+        if (fl->optional) {
+            fprintf(out, "    }\n");
+        }
+    }
+    fprintf(out, "    return w->err == CN_CBOR_NO_ERROR;\n}\n");
+}
+
+static void write_source(FILE *out, const char *base)
+{
+    const char *p = strrchr(base, '/');
+    int m;
+
+    fprintf(out, "/* Generated by cborgen from %s.  Do not edit. */\n\n",
+            schema_name);
+    fprintf(out, "#include <string.h>\n\n#include \"%s.h\"\n\n",
+            p ? p + 1 : base);
+    fprintf(out,
+            "static bool cborgen_fail(cn_cbor_errback *errp, cn_cbor_error err,\n"
+            "                         const char *buf, const cn_cbor_cursor *cur)\n"
+            "{\n"
+            "    if (errp) {\n"
+            "        errp->err = err;\n"
+            "        errp->pos = (int)((const char *)cur->pos - buf);\n"
+            "    }\n"
+            "    return false;\n"
+            "}\n");
+    for (m = 0; m < num_messages; m++) {
+        write_decode(out, &messages[m]);
+        write_encode(out, &messages[m]);
+    }
+}
+
+static FILE *open_out(const char *base, const char *ext)
+{
+    char path[MAX_LINE];
+    FILE *out;
+
+    if (snprintf(path, sizeof(path), "%s%s", base, ext) >=
+        (int)sizeof(path)) {
+        fprintf(stderr, "%s: name too long\n", base);
+        exit(1);
+    }
+    out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    return out;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *in, *out;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s schema-file output-base\n", argv[0]);
+        return 2;
+    }
+    schema_name = argv[1];
+    in = fopen(schema_name, "r");
+    if (!in) {
+        fprintf(stderr, "%s: %s\n", schema_name, strerror(errno));
+        return 1;
+    }
+    parse(in);
+    fclose(in);
+
+    out = open_out(argv[2], ".h");
+    write_header(out, argv[2]);
+    if (fclose(out)) {
+        perror(argv[2]);
+        return 1;
+    }
+    out = open_out(argv[2], ".c");
+    write_source(out, argv[2]);
+    if (fclose(out)) {
+        perror(argv[2]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
+ *
+ * Check a file holding a CBOR sequence (RFC 8742), reading it a chunk at
+ * a time so that files of any size take the same memory, and report the
+ * number of items in it.
+ *
+ * usage: cborseq [file]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cn-cbor/cn-cbor.h"
+
+#define CHUNK_SIZE (64 * 1024)
+
+int main(int argc, char *argv[])
+{
+    cn_cbor_seq seq;
+    char *buf;
+    size_t size = CHUNK_SIZE;
+    size_t have = 0;
+    unsigned long items = 0;
+    const char *item;
+    size_t len;
+    ssize_t n;
+    int fd = 0;
+
+    if (argc > 1 && (fd = open(argv[1], O_RDONLY)) < 0) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    if (!(buf = malloc(size))) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    cn_cbor_seq_init(&seq, NULL, NULL, NULL);
+    for (;;) {
+        /* an item bigger than the buffer needs a bigger buffer */
+        if (have == size) {
+            char *bigger = realloc(buf, size * 2);
+            if (!bigger) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+            buf = bigger;
+            size *= 2;
+        }
+        n = read(fd, buf + have, size - have);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("read");
+            return 1;
+        }
+        if (n == 0) {
+            break;
+        }
+
+        cn_cbor_seq_input(&seq, buf, have + n);
+        while (cn_cbor_seq_next_raw(&seq, &item, &len)) {
+            items++;
+        }
+        if (seq.err != CN_CBOR_NO_ERROR &&
+            seq.err != CN_CBOR_ERR_OUT_OF_DATA) {
+            break;
+        }
+        have = cn_cbor_seq_pending(&seq);
+        memmove(buf, buf + seq.pos, have);
+    }
+
+    if (!cn_cbor_seq_done(&seq)) {
+        fprintf(stderr, "offset %llu: %s\n",
+                (unsigned long long)seq.offset,
+                cn_cbor_error_str[seq.err]);
+        return 1;
+    }
+    printf("%lu items, %llu bytes\n", items, (unsigned long long)seq.offset);
+    free(buf);
+    close(fd);
+    return 0;
+}
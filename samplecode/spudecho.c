@@ -53,16 +53,17 @@ static void read_cb(ls_event_data evt,
 
     UNUSED_PARAM(arg);
 
-    if (td->cbor) {
-        const cn_cbor *cp = cn_cbor_mapget_int(td->cbor, 0);
-        if (cp) {
+    if (td->msg->length > sizeof(spud_header)) {
+        const uint8_t *data;
+        size_t len;
+        if (tube_event_data_bytes(td, &data, &len)) {
             // echo
-            if (!tube_data(td->t, (uint8_t*)cp->v.str, cp->length, &err)) {
+            if (!tube_data(td->t, (uint8_t*)data, len, &err)) {
                 LS_LOG_ERR(err, "tube_data");
             }
             else 
             {
-                ls_log(LS_LOG_VERBOSE, "Received %s", (uint8_t*)cp->v.str);
+                ls_log(LS_LOG_VERBOSE, "Received %.*s", (int)len, data);
             }
         } else {
             if (!tube_data(td->t, NULL, 0, &err)) {
@@ -124,10 +125,10 @@ int main(int argc, char** argv)
       return 1;
     }
 
-    if (!tube_manager_bind_event(mgr, EV_DATA_NAME, read_cb, &err) ||
-        !tube_manager_bind_event(mgr, EV_CLOSE_NAME, close_cb, &err) ||
-        !tube_manager_bind_event(mgr, EV_ADD_NAME, add_cb, &err) ||
-        !tube_manager_bind_event(mgr, EV_REMOVE_NAME, remove_cb, &err)) {
+    if (!tube_manager_bind_event_type(mgr, EV_DATA, read_cb, &err) ||
+        !tube_manager_bind_event_type(mgr, EV_CLOSE, close_cb, &err) ||
+        !tube_manager_bind_event_type(mgr, EV_ADD, add_cb, &err) ||
+        !tube_manager_bind_event_type(mgr, EV_REMOVE, remove_cb, &err)) {
         LS_LOG_ERR(err, "tube_manager_bind_event");
         return 1;
     }
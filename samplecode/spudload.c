@@ -154,7 +154,7 @@ int spudtest(int argc, char **argv)
         return 1;
     }
 
-    if (!tube_manager_bind_event(mgr, EV_REMOVE_NAME, remove_cb, &err)) {
+    if (!tube_manager_bind_event_type(mgr, EV_REMOVE, remove_cb, &err)) {
         LS_LOG_ERR(err, "tube_manager_bind_event");
         return 1;
     }
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
+ *
+ * Print a binary log written by ls_log_binary_open() as text.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ls_log.h"
+#include "ls_log_binary.h"
+
+typedef struct _site_t {
+    const char *fmt;
+    const char *file;
+    const char *sig;
+    uint32_t line;
+} site_t;
+
+static site_t *sites = NULL;
+static size_t num_sites = 0;
+
+static bool add_site(uint32_t id, const uint8_t *body, const uint8_t *end)
+{
+    site_t *s;
+    const char *fmt, *file, *sig;
+    uint32_t line;
+
+    if (body + sizeof(line) > end) {
+        return false;
+    }
+    memcpy(&line, body, sizeof(line));
+    fmt = (const char *)body + sizeof(line);
+    file = memchr(fmt, '\0', end - (const uint8_t *)fmt);
+    if (!file++) {
+        return false;
+    }
+    sig = memchr(file, '\0', end - (const uint8_t *)file);
+    if (!sig++ || !memchr(sig, '\0', end - (const uint8_t *)sig)) {
+        return false;
+    }
+
+    if (id >= num_sites) {
+        size_t n = id + 16;
+        s = realloc(sites, n * sizeof(site_t));
+        if (!s) {
+            return false;
+        }
+        memset(s + num_sites, 0, (n - num_sites) * sizeof(site_t));
+        sites = s;
+        num_sites = n;
+    }
+    s = &sites[id];
+    s->fmt = fmt;
+    s->file = file;
+    s->sig = sig;
+    s->line = line;
+    return true;
+}
+
+static bool read_value(const uint8_t **args, const uint8_t *end,
+                       void *val, size_t len)
+{
+    if (*args + len > end) {
+        return false;
+    }
+    memcpy(val, *args, len);
+    *args += len;
+    return true;
+}
+
+/* Print one message by walking the format and formatting each conversion
+   with its stored value */
+static bool render(const site_t *s, const uint8_t *args, const uint8_t *end)
+{
+    const char *p = s->fmt;
+    const char *sig = s->sig;
+
+    while (*p) {
+        char spec[64];
+        size_t n = 0;
+        int h = 0;
+        char conv;
+        int64_t ival;
+        double dval;
+        uint64_t pval;
+        uint32_t slen;
+        char str[256];
+        int i;
+
+        if (*p != '%') {
+            putchar(*p++);
+            continue;
+        }
+        if (p[1] == '%') {
+            putchar('%');
+            p += 2;
+            continue;
+        }
+
+        spec[n++] = *p++;
+        while (*p && strchr("-+ #0'", *p) && n < 16) {
+            spec[n++] = *p++;
+        }
+        for (i = 0; i < 2; i++) {
+            if (i == 1) {
+                if (*p != '.') {
+                    break;
+                }
+                spec[n++] = *p++;
+            }
+            if (*p == '*') {
+                if (!*sig++ || !read_value(&args, end, &ival, sizeof(ival))) {
+                    return false;
+                }
+                n += snprintf(spec + n, sizeof(spec) - n, "%d", (int)ival);
+                p++;
+            }
+            while (*p >= '0' && *p <= '9' && n < 40) {
+                spec[n++] = *p++;
+            }
+        }
+        while (*p && strchr("hlqLzjt", *p)) {
+            if (*p == 'h') {
+                h++;
+            }
+            p++;
+        }
+        conv = *p++;
+
+        switch (*sig++) {
+        case LS_LOG_ARG_DOUBLE:
+        case LS_LOG_ARG_LDOUBLE:
+            if (!read_value(&args, end, &dval, sizeof(dval))) {
+                return false;
+            }
+            spec[n++] = conv;
+            spec[n] = '\0';
+            printf(spec, dval);
+            break;
+        case LS_LOG_ARG_POINTER:
+            if (!read_value(&args, end, &pval, sizeof(pval))) {
+                return false;
+            }
+            spec[n++] = conv;
+            spec[n] = '\0';
+            printf(spec, (void *)(uintptr_t)pval);
+            break;
+        case LS_LOG_ARG_STRING:
+            if (!read_value(&args, end, &slen, sizeof(slen))) {
+                return false;
+            }
+            if (slen == LS_LOG_BINARY_NULL_STRING) {
+                strcpy(str, "(null)");
+            } else {
+                if (slen >= sizeof(str) || args + slen > end) {
+                    return false;
+                }
+                memcpy(str, args, slen);
+                str[slen] = '\0';
+                args += slen;
+            }
+            spec[n++] = 's';
+            spec[n] = '\0';
+            printf(spec, str);
+            break;
+        case '\0':
+            return false;
+        default:
+            if (!read_value(&args, end, &ival, sizeof(ival))) {
+                return false;
+            }
+            if (conv == 'c') {
+                spec[n++] = 'c';
+                spec[n] = '\0';
+                printf(spec, (int)ival);
+                break;
+            }
+            if (conv == 'd' || conv == 'i') {
+                ival = (h == 1) ? (short)ival : (h == 2) ? (signed char)ival : ival;
+            } else {
+                ival = (h == 1) ? (unsigned short)ival :
+                       (h == 2) ? (unsigned char)ival : ival;
+            }
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = conv;
+            spec[n] = '\0';
+            printf(spec, (long long)ival);
+            break;
+        }
+    }
+    return true;
+}
+
+static void print_message(const ls_log_record_header *hdr,
+                          const uint8_t *body, const uint8_t *end)
+{
+    const site_t *s = (hdr->site < num_sites) ? &sites[hdr->site] : NULL;
+    uint64_t usec;
+    time_t t;
+    struct tm local;
+
+    if (!s || !s->fmt || body + sizeof(usec) > end) {
+        printf("<message from unknown site %u>\n", hdr->site);
+        return;
+    }
+    memcpy(&usec, body, sizeof(usec));
+    t = (time_t)(usec / 1000000);
+    localtime_r(&t, &local);
+    printf("%d-%2.2d-%2.2dT%2.2d:%2.2d:%2.2d.%6.6u [%-8s] %s:%u: ",
+           local.tm_year+1900, local.tm_mon+1, local.tm_mday,
+           local.tm_hour, local.tm_min, local.tm_sec,
+           (unsigned)(usec % 1000000),
+           (hdr->level <= LS_LOG_MEMTRACE) ?
+               ls_log_level_name((ls_loglevel)hdr->level) : "?",
+           s->file, s->line);
+    if (!render(s, body + sizeof(usec), end)) {
+        printf("<truncated>");
+    }
+    putchar('\n');
+}
+
+int main(int argc, char** argv)
+{
+    FILE *f;
+    uint8_t *buf;
+    long size;
+    size_t off;
+    ls_log_binary_header fh;
+    unsigned long unfinished = 0;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <binary log>\n", argv[0]);
+        return 2;
+    }
+    f = fopen(argv[1], "rb");
+    if (!f) {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(size > 0 ? size : 1);
+    if (!buf || fread(buf, 1, size, f) != (size_t)size) {
+        perror(argv[1]);
+        return 1;
+    }
+    fclose(f);
+
+    if ((size_t)size < sizeof(fh)) {
+        fprintf(stderr, "%s: not a binary log\n", argv[1]);
+        return 1;
+    }
+    memcpy(&fh, buf, sizeof(fh));
+    if (memcmp(fh.magic, LS_LOG_BINARY_MAGIC, sizeof(fh.magic)) ||
+        fh.version != LS_LOG_BINARY_VERSION ||
+        fh.byte_order != LS_LOG_BINARY_BYTE_ORDER) {
+        fprintf(stderr, "%s: not a binary log, or from another platform\n",
+                argv[1]);
+        return 1;
+    }
+
+    off = (sizeof(fh) + 7) & ~(size_t)7;
+    while (off + sizeof(ls_log_record_header) <= (size_t)size) {
+        ls_log_record_header hdr;
+        const uint8_t *body, *end;
+
+        memcpy(&hdr, buf + off, sizeof(hdr));
+        if (hdr.size == 0 || off + hdr.size > (size_t)size) {
+            break;
+        }
+        body = buf + off + sizeof(hdr);
+        end = buf + off + hdr.size;
+        if (hdr.kind == LS_LOG_RECORD_SITE) {
+            if (!add_site(hdr.site, body, end)) {
+                fprintf(stderr, "bad site record at offset %zu\n", off);
+            }
+        } else if (hdr.kind == LS_LOG_RECORD_MESSAGE) {
+            print_message(&hdr, body, end);
+        } else if (hdr.kind == LS_LOG_RECORD_UNFINISHED) {
+            unfinished++;
+        }
+        off += hdr.size;
+    }
+    if (unfinished) {
+        fprintf(stderr, "%lu unfinished records skipped\n", unfinished);
+    }
+
+    free(sites);
+    free(buf);
+    return 0;
+}
@@ -104,17 +104,15 @@ static void *socketListen(void *arg){
 static void data_cb(ls_event_data evt, void *arg)
 {
     tube_event_data *td = evt->data;
+    const uint8_t *data;
+    size_t len;
     UNUSED_PARAM(arg);
 
     config.numRcvdPkts++;
-    if (td->cbor) {
-        const cn_cbor *data = cn_cbor_mapget_int(td->cbor, 0);
-        ((char*)data->v.str)[data->length-1] = '\0';  // TODO: cheating
-        if (data && (data->type==CN_CBOR_TEXT || data->type==CN_CBOR_BYTES)) {
-            LOGI("\r " ESC_7C " RX: %i  %s",
-                 config.numRcvdPkts,
-                 data->v.str);
-        }
+    if (tube_event_data_bytes(td, &data, &len)) {
+        LOGI("\r " ESC_7C " RX: %i  %.*s",
+             config.numRcvdPkts,
+             (int)len, data);
     }
 }
 
@@ -169,8 +167,8 @@ int spudtest(int argc, char **argv)
         return 1;
     }
 
-    if (!tube_manager_bind_event(mgr, EV_RUNNING_NAME, running_cb, &err) ||
-        !tube_manager_bind_event(mgr, EV_DATA_NAME, data_cb, &err)) {
+    if (!tube_manager_bind_event_type(mgr, EV_RUNNING, running_cb, &err) ||
+        !tube_manager_bind_event_type(mgr, EV_DATA, data_cb, &err)) {
         LS_LOG_ERR(err, "tube_manager_bind_event");
         return 1;
     }
@@ -1,6 +1,10 @@
 #ifndef CBOR_PROTOCOL_H__
 #define CBOR_PROTOCOL_H__
 
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
 /* The 8 major types */
 #define MT_UNSIGNED 0
 #define MT_NEGATIVE 1
@@ -66,4 +70,22 @@
 #define IB_FLOAT4 (IB_PRIM + AI_4)
 #define IB_FLOAT8 (IB_PRIM + AI_8)
 
+/* Big-endian reads that are safe at any alignment; the memcpy compiles
+   to a plain load and the swap to a single instruction */
+static inline uint16_t cbor_read_be16(const unsigned char *p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return ntohs(v);
+}
+
+static inline uint32_t cbor_read_be32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return ntohl(v);
+}
+
+static inline uint64_t cbor_read_be64(const unsigned char *p) {
+  return ((uint64_t)cbor_read_be32(p) << 32) | cbor_read_be32(p + 4);
+}
+
 #endif
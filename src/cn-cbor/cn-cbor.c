@@ -13,16 +13,18 @@ extern "C" {
 #include <string.h>
 #include <assert.h>
 #include <math.h>
-
-#include <arpa/inet.h>
+#include <limits.h>
 
 #include "cn-cbor/cn-cbor.h"
 #include "cbor.h"
+#include "ls_mem.h"
 
-/* can be redefined, e.g. for pool allocation */
+/* can be redefined, e.g. for pool allocation; by default nodes are
+   counted against LS_MEM_TAG_CBOR */
 #ifndef CN_CBOR_CALLOC
-#define CN_CBOR_CALLOC() calloc(1, sizeof(cn_cbor))
-#define CN_CBOR_FREE(cb) free((void*)(cb))
+#define CN_CBOR_CALLOC(count, size) \
+  ls_data_calloc_tagged(LS_MEM_TAG_CBOR, (count), (size))
+#define CN_CBOR_FREE(cb) ls_data_free((void*)(cb))
 #endif
 
 #define CN_CBOR_FAIL(code) do { pb->err = code;  goto fail; } while(0)
@@ -53,17 +55,6 @@ static double decode_half(int half) {
   return half & 0x8000 ? -val : val;
 }
 
-/* Fix these if you can't do non-aligned reads */
-#define ntoh8p(p) (*(unsigned char*)(p))
-#define ntoh16p(p) (ntohs(*(unsigned short*)(p)))
-#define ntoh32p(p) (ntohl(*(unsigned long*)(p)))
-static uint64_t ntoh64p(unsigned char *p) {
-  uint64_t ret = ntoh32p(p);
-  ret <<= 32;
-  ret += ntoh32p(p+4);
-  return ret;
-}
-
 static cn_cbor_type mt_trans[] = {
   CN_CBOR_UINT,    CN_CBOR_INT,
   CN_CBOR_BYTES,   CN_CBOR_TEXT,
@@ -71,23 +62,56 @@ static cn_cbor_type mt_trans[] = {
   CN_CBOR_TAG,     CN_CBOR_SIMPLE,
 };
 
+/*
+ * What follows each initial byte: the number of argument bytes (0, 1, 2,
+ * 4 or 8), or one of the IBI_ special cases.
+ */
+#define IBI_RESERVED 0x10       /* ai 28..30 */
+#define IBI_INDEF    0x20       /* indefinite length string, array or map */
+#define IBI_NO_INDEF 0x30       /* ai 31 for a type with no indefinite form */
+#define IBI_BREAK    0x40
+#define IBI_SPECIAL  0xf0
+
+#define IBI_IMMEDIATE8 0, 0, 0, 0, 0, 0, 0, 0
+#define IBI_ROW(ai31)                                           \
+  IBI_IMMEDIATE8, IBI_IMMEDIATE8, IBI_IMMEDIATE8,               \
+  1, 2, 4, 8, IBI_RESERVED, IBI_RESERVED, IBI_RESERVED, ai31
+
+static const unsigned char ib_info[256] = {
+  IBI_ROW(IBI_NO_INDEF),        /* MT_UNSIGNED */
+  IBI_ROW(IBI_NO_INDEF),        /* MT_NEGATIVE */
+  IBI_ROW(IBI_INDEF),           /* MT_BYTES */
+  IBI_ROW(IBI_INDEF),           /* MT_TEXT */
+  IBI_ROW(IBI_INDEF),           /* MT_ARRAY */
+  IBI_ROW(IBI_INDEF),           /* MT_MAP */
+  IBI_ROW(IBI_NO_INDEF),        /* MT_TAG */
+  IBI_ROW(IBI_BREAK),           /* MT_PRIM */
+};
+
 struct parse_buf {
   unsigned char *buf;
   unsigned char *ebuf;
   cn_cbor_error err;
+  unsigned int max_depth;
+  unsigned int max_items;
+  uint64_t max_count;
+  bool check_utf8;
+  bool prefix;                  /* more may follow the item */
+  unsigned int generation;
 };
 
-#define TAKE(pos, ebuf, n, stmt)                \
-  if (n > (size_t)(ebuf - pos))                 \
-    CN_CBOR_FAIL(CN_CBOR_ERR_OUT_OF_DATA);      \
-  stmt;                                         \
-  pos += n;
+/* Numbers each decode, so that a tree can be told from one decoded later
+   into the same memory */
+static unsigned int _generation;
 
 static cn_cbor *decode_item (struct parse_buf *pb, cn_alloc_func calloc_func, void *context, cn_cbor* top_parent) {
   unsigned char *pos = pb->buf;
   unsigned char *ebuf = pb->ebuf;
   cn_cbor* parent = top_parent;
-  int ib;
+  unsigned int depth = 0;
+  unsigned int items = 0;
+  unsigned int ib;
+  unsigned int info;
   unsigned int mt;
   int ai;
   uint64_t val;
@@ -102,30 +126,64 @@ static cn_cbor *decode_item (struct parse_buf *pb, cn_alloc_func calloc_func, vo
   } u64;
 
 again:
-  TAKE(pos, ebuf, 1, ib = ntoh8p(pos) );
-  if (ib == IB_BREAK) {
-    if (!(parent->flags & CN_CBOR_FL_INDEF))
-      CN_CBOR_FAIL(CN_CBOR_ERR_BREAK_OUTSIDE_INDEF);
-    switch (parent->type) {
-    case CN_CBOR_BYTES: case CN_CBOR_TEXT:
-      parent->type += 2;            /* CN_CBOR_* -> CN_CBOR_*_CHUNKED */
-      break;
-    case CN_CBOR_MAP:
-      if (parent->length & 1)
-        CN_CBOR_FAIL(CN_CBOR_ERR_ODD_SIZE_INDEF_MAP);
-    default:;
-    }
-    goto complete;
-  }
+  /* one bounds check covers the initial byte and its argument */
+  if (pos >= ebuf)
+    CN_CBOR_FAIL(CN_CBOR_ERR_OUT_OF_DATA);
+  ib = *pos++;
+  info = ib_info[ib];
   mt = ib >> 5;
   ai = ib & 0x1f;
   val = ai;
 
+  if (info & IBI_SPECIAL) {
+    switch (info) {
+    case IBI_BREAK:
+      if (!(parent->flags & CN_CBOR_FL_INDEF))
+        CN_CBOR_FAIL(CN_CBOR_ERR_BREAK_OUTSIDE_INDEF);
+      switch (parent->type) {
+      case CN_CBOR_BYTES: case CN_CBOR_TEXT:
+        parent->type += 2;            /* CN_CBOR_* -> CN_CBOR_*_CHUNKED */
+        break;
+      case CN_CBOR_MAP:
+        if (parent->length & 1)
+          CN_CBOR_FAIL(CN_CBOR_ERR_ODD_SIZE_INDEF_MAP);
+      default:;
+      }
+      goto complete;
+    case IBI_RESERVED:
+      CN_CBOR_FAIL(CN_CBOR_ERR_RESERVED_AI);
+    case IBI_NO_INDEF:
+      CN_CBOR_FAIL(CN_CBOR_ERR_MT_UNDEF_FOR_INDEF);
+    }
+  } else if (info) {
+    if (info > (size_t)(ebuf - pos))
+      CN_CBOR_FAIL(CN_CBOR_ERR_OUT_OF_DATA);
+    switch (info) {
+    case 1: val = *pos; break;
+    case 2: val = cbor_read_be16(pos); break;
+    case 4: val = cbor_read_be32(pos); break;
+    default: val = cbor_read_be64(pos); break;
+    }
+    pos += info;
+  }
+
+  /* limits, before anything is allocated for this item */
+  if (++items > pb->max_items)
+    CN_CBOR_FAIL(CN_CBOR_ERR_TOO_MANY_ITEMS);
+  if ((info == IBI_INDEF || (mt >= MT_ARRAY && mt <= MT_TAG)) &&
+      depth >= pb->max_depth)
+    CN_CBOR_FAIL(CN_CBOR_ERR_TOO_DEEP);
+  if ((parent->flags & CN_CBOR_FL_INDEF) &&
+      (uint64_t)parent->length >=
+      (parent->type == CN_CBOR_MAP ? 2 * pb->max_count : pb->max_count))
+    CN_CBOR_FAIL(CN_CBOR_ERR_COUNT_TOO_LARGE);
+
   cb = calloc_func(1, sizeof(cn_cbor), context);
   if (!cb)
     CN_CBOR_FAIL(CN_CBOR_ERR_OUT_OF_MEMORY);
 
   cb->type = mt_trans[mt];
+  cb->generation = pb->generation;
 
   cb->parent = parent;
   if (parent->last_child) {
@@ -136,21 +194,12 @@ again:
   parent->last_child = cb;
   parent->length++;
 
-  switch (ai) {
-  case AI_1: TAKE(pos, ebuf, 1, val = ntoh8p(pos)) ; break;
-  case AI_2: TAKE(pos, ebuf, 2, val = ntoh16p(pos)) ; break;
-  case AI_4: TAKE(pos, ebuf, 4, val = ntoh32p(pos)) ; break;
-  case AI_8: TAKE(pos, ebuf, 8, val = ntoh64p(pos)) ; break;
-  case 28: case 29: case 30: CN_CBOR_FAIL(CN_CBOR_ERR_RESERVED_AI);
-  case AI_INDEF:
-    if ((mt - MT_BYTES) <= MT_MAP) {
-      cb->flags |= CN_CBOR_FL_INDEF;
-      cb->v.uint = val;
-      goto push;
-    } else {
-      CN_CBOR_FAIL(CN_CBOR_ERR_MT_UNDEF_FOR_INDEF);
-    }
+  if (info == IBI_INDEF) {
+    cb->flags |= CN_CBOR_FL_INDEF;
+    cb->v.uint = val;
+    goto push;
   }
+
   /* process content */
   switch (mt) {
   case MT_UNSIGNED:
@@ -160,14 +209,24 @@ again:
     cb->v.sint = ~val;          /* to do: Overflow check */
     break;
   case MT_BYTES: case MT_TEXT:
+    if (val > (size_t)(ebuf - pos))
+      CN_CBOR_FAIL(CN_CBOR_ERR_OUT_OF_DATA);
+    if (mt == MT_TEXT && pb->check_utf8 &&
+        !cn_cbor_utf8_valid((const char *)pos, val))
+      CN_CBOR_FAIL(CN_CBOR_ERR_INVALID_UTF8);
     cb->v.str = (char *) pos;
     cb->length = val;
-    TAKE(pos, ebuf, val, ;);
+    pos += val;
     break;
-  case MT_MAP:
-    val <<= 1;
-    /* fall through */
-  case MT_ARRAY:
+  case MT_ARRAY: case MT_MAP:
+    if (val > pb->max_count)
+      CN_CBOR_FAIL(CN_CBOR_ERR_COUNT_TOO_LARGE);
+    /* every member takes at least a byte, so fail now rather than at
+       the end of the data */
+    if (val > (size_t)(ebuf - pos) >> (mt == MT_MAP))
+      CN_CBOR_FAIL(CN_CBOR_ERR_OUT_OF_DATA);
+    if (mt == MT_MAP)
+      val <<= 1;
     if ((cb->v.count = val)) {
       cb->flags |= CN_CBOR_FL_COUNT;
       goto push;
@@ -209,16 +268,18 @@ fill:                           /* emulate loops */
   /* so we are done filling parent. */
 complete:                       /* emulate return from call */
   if (parent == top_parent) {
-    if (pos != ebuf)            /* XXX do this outside */
+    if (pos != ebuf && !pb->prefix)
       CN_CBOR_FAIL(CN_CBOR_ERR_NOT_ALL_DATA_CONSUMED);
     pb->buf = pos;
     return cb;
   }
   cb = parent;
   parent = parent->parent;
+  depth--;
   goto fill;
 push:                           /* emulate recursive call */
   parent = cb;
+  depth++;
   goto again;
 fail:
   pb->buf = pos;
@@ -226,11 +287,15 @@ fail:
 }
 
 static void *_cbor_calloc(size_t count, size_t size, void *context) {
-    return calloc(count, size);
+    return CN_CBOR_CALLOC(count, size);
 }
 
 const cn_cbor* cn_cbor_decode(const char* buf, size_t len, cn_alloc_func calloc_func, void *context, cn_cbor_errback *errp) {
-  cn_cbor catcher = {CN_CBOR_INVALID, 0, {0}, 0, NULL, NULL, NULL, NULL};
+  return cn_cbor_decode_limited(buf, len, NULL, calloc_func, context, errp);
+}
+
+static const cn_cbor* _decode(const char* buf, size_t len, bool prefix, size_t* used, const cn_cbor_limits* limits, cn_alloc_func calloc_func, void *context, cn_cbor_errback *errp) {
+  cn_cbor catcher = {CN_CBOR_INVALID, 0, {0}, 0, 0, NULL, NULL, NULL, NULL};
   struct parse_buf pb;
   cn_cbor* ret;
 
@@ -240,12 +305,19 @@ const cn_cbor* cn_cbor_decode(const char* buf, size_t len, cn_alloc_func calloc_
   pb.buf  = (unsigned char *)buf;
   pb.ebuf = (unsigned char *)buf+len;
   pb.err  = CN_CBOR_NO_ERROR;
+  pb.max_depth = (limits && limits->max_depth) ? limits->max_depth : UINT_MAX;
+  pb.max_items = (limits && limits->max_items) ? limits->max_items : UINT_MAX;
+  pb.max_count = (limits && limits->max_count) ? limits->max_count : UINT64_MAX;
+  pb.check_utf8 = limits && limits->check_utf8;
+  pb.prefix = prefix;
+  pb.generation = __atomic_add_fetch(&_generation, 1, __ATOMIC_RELAXED);
   ret = decode_item(&pb, calloc_func, context, &catcher);
   if (ret != NULL) {
     /* mark as top node */
     ret->parent = NULL;
   } else {
-    if (catcher.first_child) {
+    /* nodes from a caller's allocator are the caller's to release */
+    if (catcher.first_child && calloc_func == _cbor_calloc) {
       catcher.first_child->parent = 0;
       cn_cbor_free(catcher.first_child);
     }
@@ -255,9 +327,19 @@ const cn_cbor* cn_cbor_decode(const char* buf, size_t len, cn_alloc_func calloc_
     }
     return NULL;
   }
+  if (used)
+    *used = pb.buf - (unsigned char *)buf;
   return ret;
 }
 
+const cn_cbor* cn_cbor_decode_limited(const char* buf, size_t len, const cn_cbor_limits* limits, cn_alloc_func calloc_func, void *context, cn_cbor_errback *errp) {
+  return _decode(buf, len, false, NULL, limits, calloc_func, context, errp);
+}
+
+const cn_cbor* cn_cbor_decode_first(const char* buf, size_t len, size_t* used, const cn_cbor_limits* limits, cn_alloc_func calloc_func, void *context, cn_cbor_errback *errp) {
+  return _decode(buf, len, true, used, limits, calloc_func, context, errp);
+}
+
 const cn_cbor* cn_cbor_mapget_int(const cn_cbor* cb, int key) {
   cn_cbor* cp;
   assert(cb);
@@ -0,0 +1,210 @@
+#ifndef CN_COMPACT_C
+#define CN_COMPACT_C
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+#ifdef EMACS_INDENTATION_HELPER
+} /* Duh. */
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "cn-cbor/cn-cbor.h"
+
+#define COMPACT_FAIL(code) do { err = code; goto fail; } while(0)
+
+typedef struct compact_level {
+  uint32_t node;                /* the open container */
+  uint32_t last;                /* its last child so far, or itself */
+  uint64_t left;                /* children still to come, if definite */
+} compact_level;
+
+const cn_cbor_compact* cn_cbor_compact_decode(const char* buf, size_t len,
+                                              cn_cbor_compact* nodes,
+                                              size_t max_nodes,
+                                              size_t* used,
+                                              cn_cbor_errback* errp) {
+  compact_level open[CN_CBOR_COMPACT_MAX_DEPTH];
+  compact_level *top = NULL;
+  cn_cbor_cursor cur;
+  cn_cbor_item item;
+  cn_cbor_compact *cb;
+  cn_cbor_error err = CN_CBOR_NO_ERROR;
+  uint32_t n = 0;
+  int depth = 0;
+
+  assert(nodes);
+  if (max_nodes > UINT32_MAX)
+    max_nodes = UINT32_MAX;
+  cn_cbor_cursor_init(&cur, buf, len);
+
+  for (;;) {
+    if (top && (nodes[top->node].flags & CN_CBOR_FL_INDEF) &&
+        cn_cbor_cursor_break(&cur)) {
+      if (nodes[top->node].type == CN_CBOR_MAP &&
+          (nodes[top->node].length & 1))
+        COMPACT_FAIL(CN_CBOR_ERR_ODD_SIZE_INDEF_MAP);
+      top = --depth ? &open[depth - 1] : NULL;
+      goto complete;
+    }
+
+    if (n == max_nodes)
+      COMPACT_FAIL(CN_CBOR_ERR_TOO_MANY_ITEMS);
+    if (!cn_cbor_cursor_next(&cur, &item))
+      COMPACT_FAIL(cur.err);
+    if (item.length > UINT32_MAX)
+      COMPACT_FAIL(CN_CBOR_ERR_COUNT_TOO_LARGE);
+
+    cb = &nodes[n];
+    cb->type = item.type;
+    cb->flags = item.flags;
+    cb->reserved = 0;
+    cb->length = (uint32_t)item.length;
+    cb->v.uint = 0;
+    cb->child = 0;
+    cb->next = 0;
+
+    if (top) {
+      cn_cbor_compact *parent = &nodes[top->node];
+      if ((parent->type == CN_CBOR_BYTES_CHUNKED ||
+           parent->type == CN_CBOR_TEXT_CHUNKED) &&
+          (cb->type != parent->type - 2 || (cb->flags & CN_CBOR_FL_INDEF)))
+        COMPACT_FAIL(CN_CBOR_ERR_WRONG_NESTING_IN_INDEF_STRING);
+      if (top->last == top->node)
+        parent->child = n - top->node;
+      else
+        nodes[top->last].next = n - top->last;
+      top->last = n;
+      parent->length++;
+    }
+
+    switch (cb->type) {
+    case CN_CBOR_BYTES: case CN_CBOR_TEXT:
+      if (cb->flags & CN_CBOR_FL_INDEF) {
+        cb->type += 2;          /* CN_CBOR_* -> CN_CBOR_*_CHUNKED */
+        goto push;
+      }
+      cb->v.str = item.v.str;
+      break;
+    case CN_CBOR_ARRAY: case CN_CBOR_MAP:
+      cb->length = 0;           /* counts children as they come */
+      if (cb->flags & CN_CBOR_FL_INDEF)
+        goto push;
+      if (item.length) {
+        item.length *= (cb->type == CN_CBOR_MAP) ? 2 : 1;
+        goto push;
+      }
+      break;
+    case CN_CBOR_TAG:
+      cb->v.uint = item.v.uint;
+      item.length = 1;
+      goto push;
+    case CN_CBOR_DOUBLE:
+      cb->v.dbl = item.v.dbl;
+      break;
+    default:
+      cb->v.uint = item.v.uint;
+    }
+    n++;
+    goto complete;
+
+  push:
+    if (depth == CN_CBOR_COMPACT_MAX_DEPTH)
+      COMPACT_FAIL(CN_CBOR_ERR_TOO_DEEP);
+    top = &open[depth++];
+    top->node = n;
+    top->last = n;
+    top->left = item.length;
+    n++;
+    continue;
+
+  complete:
+    /* the item just finished counts against definite parents, which
+       close when full */
+    while (top && !(nodes[top->node].flags & CN_CBOR_FL_INDEF) &&
+           --top->left == 0)
+      top = --depth ? &open[depth - 1] : NULL;
+    if (!top)
+      break;
+  }
+
+  if (!cn_cbor_cursor_done(&cur))
+    COMPACT_FAIL(CN_CBOR_ERR_NOT_ALL_DATA_CONSUMED);
+  if (used)
+    *used = n;
+  return nodes;
+
+fail:
+  if (errp) {
+    errp->err = err;
+    errp->pos = cur.pos - (const unsigned char *)buf;
+  }
+  return NULL;
+}
+
+const cn_cbor_compact* cn_cbor_compact_first_child(const cn_cbor_compact* cb) {
+  assert(cb);
+  return cb->child ? cb + cb->child : NULL;
+}
+
+const cn_cbor_compact* cn_cbor_compact_next(const cn_cbor_compact* cb) {
+  assert(cb);
+  return cb->next ? cb + cb->next : NULL;
+}
+
+const cn_cbor_compact* cn_cbor_compact_mapget_int(const cn_cbor_compact* cb,
+                                                  int key) {
+  const cn_cbor_compact *cp, *val;
+  assert(cb);
+  for (cp = cn_cbor_compact_first_child(cb); cp;
+       cp = cn_cbor_compact_next(val)) {
+    if (!(val = cn_cbor_compact_next(cp)))
+      break;
+    if ((cp->type == CN_CBOR_UINT || cp->type == CN_CBOR_INT) &&
+        cp->v.sint == (long)key)
+      return val;
+  }
+  return NULL;
+}
+
+const cn_cbor_compact* cn_cbor_compact_mapget_string(const cn_cbor_compact* cb,
+                                                     const char* key) {
+  const cn_cbor_compact *cp, *val;
+  size_t keylen;
+  assert(cb);
+  assert(key);
+  keylen = strlen(key);
+  for (cp = cn_cbor_compact_first_child(cb); cp;
+       cp = cn_cbor_compact_next(val)) {
+    if (!(val = cn_cbor_compact_next(cp)))
+      break;
+    if ((cp->type == CN_CBOR_TEXT || cp->type == CN_CBOR_BYTES) &&
+        cp->length == keylen &&
+        memcmp(key, cp->v.str, keylen) == 0)
+      return val;
+  }
+  return NULL;
+}
+
+const cn_cbor_compact* cn_cbor_compact_index(const cn_cbor_compact* cb,
+                                             int idx) {
+  const cn_cbor_compact *cp;
+  int i = 0;
+  assert(cb);
+  for (cp = cn_cbor_compact_first_child(cb); cp;
+       cp = cn_cbor_compact_next(cp)) {
+    if (i == idx)
+      return cp;
+    i++;
+  }
+  return NULL;
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif  /* CN_COMPACT_C */
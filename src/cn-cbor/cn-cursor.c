@@ -0,0 +1,263 @@
+#ifndef CN_CURSOR_C
+#define CN_CURSOR_C
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+#ifdef EMACS_INDENTATION_HELPER
+} /* Duh. */
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "cn-cbor/cn-cbor.h"
+#include "cbor.h"
+
+/* Indefinite-length items that can be open at once while skipping */
+#define CN_CURSOR_MAX_INDEF 16
+
+#define CN_CURSOR_FAIL(code) do { cur->err = code; return false; } while(0)
+
+static cn_cbor_type mt_trans[] = {
+  CN_CBOR_UINT,    CN_CBOR_INT,
+  CN_CBOR_BYTES,   CN_CBOR_TEXT,
+  CN_CBOR_ARRAY,   CN_CBOR_MAP,
+  CN_CBOR_TAG,     CN_CBOR_SIMPLE,
+};
+
+static double decode_half(int half) {
+  int exp = (half >> 10) & 0x1f;
+  int mant = half & 0x3ff;
+  double val;
+  if (exp == 0) val = ldexp(mant, -24);
+  else if (exp != 31) val = ldexp(mant + 1024, exp - 25);
+  else val = mant == 0 ? INFINITY : NAN;
+  return half & 0x8000 ? -val : val;
+}
+
+static uint64_t read_be(const unsigned char *p, int n) {
+  switch (n) {
+  case 1: return *p;
+  case 2: return cbor_read_be16(p);
+  case 4: return cbor_read_be32(p);
+  default: return cbor_read_be64(p);
+  }
+}
+
+void cn_cbor_cursor_init(cn_cbor_cursor *cur, const char *buf, size_t len) {
+  assert(cur);
+  cur->pos = (const unsigned char *)buf;
+  cur->end = (const unsigned char *)buf + len;
+  cur->err = CN_CBOR_NO_ERROR;
+}
+
+bool cn_cbor_cursor_done(const cn_cbor_cursor *cur) {
+  return cur->pos == cur->end;
+}
+
+bool cn_cbor_cursor_break(cn_cbor_cursor *cur) {
+  if (cur->pos < cur->end && *cur->pos == IB_BREAK) {
+    cur->pos++;
+    return true;
+  }
+  return false;
+}
+
+bool cn_cbor_cursor_next(cn_cbor_cursor *cur, cn_cbor_item *item) {
+  static const int extra[4] = { 1, 2, 4, 8 };
+  size_t left = cur->end - cur->pos;
+  unsigned int ib, mt, ai;
+  uint64_t val;
+  union {
+    float f;
+    uint32_t u;
+  } u32;
+  union {
+    double d;
+    uint64_t u;
+  } u64;
+
+  if (left == 0)
+    CN_CURSOR_FAIL(CN_CBOR_ERR_OUT_OF_DATA);
+  ib = *cur->pos++;
+  left--;
+  if (ib == IB_BREAK)
+    CN_CURSOR_FAIL(CN_CBOR_ERR_BREAK_OUTSIDE_INDEF);
+
+  mt = ib >> 5;
+  ai = ib & 0x1f;
+  val = ai;
+  item->type = mt_trans[mt];
+  item->flags = 0;
+  item->length = 0;
+
+  if (ai >= AI_1 && ai <= AI_8) {
+    int n = extra[ai - AI_1];
+    if ((size_t)n > left)
+      CN_CURSOR_FAIL(CN_CBOR_ERR_OUT_OF_DATA);
+    val = read_be(cur->pos, n);
+    cur->pos += n;
+    left -= n;
+  } else if (ai == AI_INDEF) {
+    if (mt < MT_BYTES || mt > MT_MAP)
+      CN_CURSOR_FAIL(CN_CBOR_ERR_MT_UNDEF_FOR_INDEF);
+    item->flags = CN_CBOR_FL_INDEF;
+    item->v.uint = 0;
+    return true;
+  } else if (ai > AI_8) {
+    CN_CURSOR_FAIL(CN_CBOR_ERR_RESERVED_AI);
+  }
+
+  switch (mt) {
+  case MT_UNSIGNED:
+    item->v.uint = val;
+    break;
+  case MT_NEGATIVE:
+    item->v.sint = ~val;
+    break;
+  case MT_BYTES: case MT_TEXT:
+    if (val > left)
+      CN_CURSOR_FAIL(CN_CBOR_ERR_OUT_OF_DATA);
+    item->v.str = (const char *)cur->pos;
+    item->length = val;
+    cur->pos += val;
+    break;
+  case MT_MAP:
+    /* each pair takes at least two bytes */
+    if (val > left / 2)
+      CN_CURSOR_FAIL(CN_CBOR_ERR_OUT_OF_DATA);
+    item->length = val;
+    item->v.uint = val;
+    break;
+  case MT_ARRAY:
+    if (val > left)
+      CN_CURSOR_FAIL(CN_CBOR_ERR_OUT_OF_DATA);
+    item->length = val;
+    item->v.uint = val;
+    break;
+  case MT_TAG:
+    item->v.uint = val;
+    break;
+  case MT_PRIM:
+    switch (ai) {
+    case VAL_NIL: item->type = CN_CBOR_NULL; item->v.uint = val; break;
+    case VAL_FALSE: item->type = CN_CBOR_FALSE; item->v.uint = val; break;
+    case VAL_TRUE: item->type = CN_CBOR_TRUE; item->v.uint = val; break;
+    case AI_2: item->type = CN_CBOR_DOUBLE; item->v.dbl = decode_half(val); break;
+    case AI_4:
+      item->type = CN_CBOR_DOUBLE;
+      u32.u = val;
+      item->v.dbl = u32.f;
+      break;
+    case AI_8:
+      item->type = CN_CBOR_DOUBLE;
+      u64.u = val;
+      item->v.dbl = u64.d;
+      break;
+    default: item->v.uint = val;
+    }
+  }
+  return true;
+}
+
+/* Items still owed by the item just read, not counting indefinite ones */
+static size_t owed(const cn_cbor_item *item) {
+  switch (item->type) {
+  case CN_CBOR_ARRAY:
+    return item->length;
+  case CN_CBOR_MAP:
+    return item->length * 2;
+  case CN_CBOR_TAG:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/*
+ * Definite containers only add to a running count of items still to
+ * read.  An indefinite one saves that count and starts a new one that
+ * runs until its break, so only indefinite nesting needs any state.
+ */
+bool cn_cbor_cursor_skip_contents(cn_cbor_cursor *cur,
+                                  const cn_cbor_item *item) {
+  size_t saved[CN_CURSOR_MAX_INDEF];
+  size_t pending = 0;
+  int depth = 0;
+  cn_cbor_item it;
+
+  assert(item);
+  if (item->flags & CN_CBOR_FL_INDEF) {
+    saved[depth++] = 0;
+  } else {
+    pending = owed(item);
+  }
+
+  while (pending > 0 || depth > 0) {
+    if (pending == 0 && cn_cbor_cursor_break(cur)) {
+      pending = saved[--depth];
+      continue;
+    }
+    if (!cn_cbor_cursor_next(cur, &it))
+      return false;
+    if (pending > 0)
+      pending--;
+    if (it.flags & CN_CBOR_FL_INDEF) {
+      if (depth == CN_CURSOR_MAX_INDEF)
+        CN_CURSOR_FAIL(CN_CBOR_ERR_TOO_DEEP);
+      saved[depth++] = pending;
+      pending = 0;
+    } else {
+      pending += owed(&it);
+    }
+  }
+  return true;
+}
+
+bool cn_cbor_cursor_skip(cn_cbor_cursor *cur) {
+  cn_cbor_item it;
+
+  if (!cn_cbor_cursor_next(cur, &it))
+    return false;
+  return cn_cbor_cursor_skip_contents(cur, &it);
+}
+
+bool cn_cbor_cursor_mapget_int(cn_cbor_cursor *cur,
+                               const cn_cbor_item *map,
+                               long key,
+                               cn_cbor_item *value) {
+  bool indef;
+  size_t i;
+  cn_cbor_item k;
+
+  assert(map);
+  assert(map->type == CN_CBOR_MAP);
+  assert(value);
+  indef = (map->flags & CN_CBOR_FL_INDEF) != 0;
+
+  for (i = 0; indef || i < map->length; i++) {
+    if (indef && cn_cbor_cursor_break(cur))
+      break;
+    if (!cn_cbor_cursor_next(cur, &k))
+      return false;
+    if ((k.type == CN_CBOR_UINT && key >= 0 &&
+         k.v.uint == (unsigned long)key) ||
+        (k.type == CN_CBOR_INT && k.v.sint == key)) {
+      return cn_cbor_cursor_next(cur, value);
+    }
+    if (!cn_cbor_cursor_skip_contents(cur, &k) ||
+        !cn_cbor_cursor_skip(cur))
+      return false;
+  }
+  cur->err = CN_CBOR_NO_ERROR;
+  return false;
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif  /* CN_CURSOR_C */
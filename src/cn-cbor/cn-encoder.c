@@ -9,11 +9,14 @@ extern "C" {
 #endif
 
 #include <arpa/inet.h>
+#include <assert.h>
+#include <stdint.h>
 #include <string.h>
 #include <strings.h>
 
 #include "cn-cbor/cn-encoder.h"
 #include "cbor.h"
+#include "ls_mem.h"
 
 #define hton8p(p) (*(uint8_t*)(p))
 #define hton16p(p) (htons(*(uint16_t*)(p)))
@@ -138,93 +141,437 @@ ssize_t cbor_encoder_write_negative(uint8_t *buf,
 }
 
 
-#define ADVANCE(st) ret = (st); \
-if (ret < 0) { return -1; } \
-count += ret;
+/*
+ * Writers: encoding without recursion or a tree.  A writer counts only,
+ * fills a fixed or growing buffer, or fills a scratch buffer and a list
+ * of iovecs.
+ */
+#define WRITER_FAIL(w, code) do { (w)->err = (code); return false; } while (0)
 
-static ssize_t _write_children(uint8_t *buf,
-                               size_t buf_offset,
-                               size_t buf_size,
-                               const cn_cbor *cb){
-   ssize_t count = 0;
-   ssize_t ret = 0;
-   cn_cbor *child;
+static void _writer_init(cn_cbor_writer *w) {
+  memset(w, 0, sizeof(*w));
+  w->err = CN_CBOR_NO_ERROR;
+}
 
-   for (child=cb->first_child; child; child = child->next) {
-     ADVANCE(cbor_encoder_write(buf, buf_offset+count, buf_size, child));
-   }
+void cn_cbor_writer_init(cn_cbor_writer *w, uint8_t *buf, size_t size) {
+  assert(w);
+  _writer_init(w);
+  w->buf = buf;
+  w->size = buf ? size : 0;
+}
 
-   return count;
+void cn_cbor_writer_init_growable(cn_cbor_writer *w) {
+  assert(w);
+  _writer_init(w);
+  w->growable = true;
 }
 
-ssize_t cbor_encoder_write(uint8_t *buf,
-                           size_t buf_offset,
-                           size_t buf_size,
-                           const cn_cbor *cb) {
-  ssize_t count = 0;
-  ssize_t ret = 0;
+void cn_cbor_writer_init_iov(cn_cbor_writer *w,
+                             uint8_t *scratch, size_t size,
+                             struct iovec *iov, int iovcnt,
+                             size_t copy_max) {
+  assert(w);
+  _writer_init(w);
+  w->buf = scratch;
+  w->size = scratch ? size : 0;
+  w->iov = iov;
+  w->iovcnt = iov ? iovcnt : 0;
+  w->copy_max = copy_max;
+}
+
+void cn_cbor_writer_free(cn_cbor_writer *w) {
+  assert(w);
+  if (w->growable) {
+    ls_data_free(w->buf);
+    w->buf = NULL;
+    w->size = 0;
+  }
+}
+
+bool cn_cbor_writer_finish(cn_cbor_writer *w) {
+  assert(w);
+  if (w->err != CN_CBOR_NO_ERROR) {
+    return false;
+  }
+  if (w->depth) {
+    WRITER_FAIL(w, CN_CBOR_ERR_OUT_OF_DATA);
+  }
+  return true;
+}
+
+static bool _writer_room(cn_cbor_writer *w, size_t len) {
+  size_t size;
+  uint8_t *buf;
+
+  if (len <= w->size - w->pos) {
+    return true;
+  }
+  if (!w->growable) {
+    return false;
+  }
+  size = w->size ? w->size : 64;
+  while (len > size - w->pos) {
+    if (size > SIZE_MAX / 2) {
+      return false;
+    }
+    size *= 2;
+  }
+  buf = ls_data_realloc_tagged(LS_MEM_TAG_CBOR, w->buf, size);
+  if (!buf) {
+    return false;
+  }
+  w->buf = buf;
+  w->size = size;
+  return true;
+}
+
+static bool _writer_copy(cn_cbor_writer *w, const void *data, size_t len) {
+  if (!w->iov && w->err == CN_CBOR_NO_ERROR && len <= w->size - w->pos) {
+    if (len) {
+      memcpy(w->buf + w->pos, data, len);
+    }
+    w->pos += len;
+    w->length += len;
+    return true;
+  }
+  if (w->err != CN_CBOR_NO_ERROR) {
+    return false;
+  }
+  if (len == 0) {
+    return true;
+  }
+  if (w->buf || w->growable) {
+    if (!_writer_room(w, len)) {
+      WRITER_FAIL(w, CN_CBOR_ERR_OUT_OF_MEMORY);
+    }
+    memcpy(w->buf + w->pos, data, len);
+    if (w->iov) {
+      if (w->in_scratch) {
+        w->iov[w->used - 1].iov_len += len;
+      } else {
+        if (w->used == w->iovcnt) {
+          WRITER_FAIL(w, CN_CBOR_ERR_OUT_OF_MEMORY);
+        }
+        w->iov[w->used].iov_base = w->buf + w->pos;
+        w->iov[w->used].iov_len = len;
+        w->used++;
+        w->in_scratch = true;
+      }
+    }
+    w->pos += len;
+  }
+  w->length += len;
+  return true;
+}
+
+static bool _writer_ref(cn_cbor_writer *w, const void *data, size_t len) {
+  if (!w->iov || len < w->copy_max) {
+    return _writer_copy(w, data, len);
+  }
+  if (w->err != CN_CBOR_NO_ERROR) {
+    return false;
+  }
+  if (w->used == w->iovcnt) {
+    WRITER_FAIL(w, CN_CBOR_ERR_OUT_OF_MEMORY);
+  }
+  w->iov[w->used].iov_base = (void *)data;
+  w->iov[w->used].iov_len = len;
+  w->used++;
+  w->in_scratch = false;
+  w->length += len;
+  return true;
+}
+
+/* ai is AI_1, AI_2, AI_4 or AI_8, or the value itself if below 24 */
+static bool _writer_head_ai(cn_cbor_writer *w, uint8_t ib, uint8_t ai,
+                            uint64_t val) {
+  uint8_t head[9];
+  uint8_t *p = head;
+  size_t len;
+  size_t i;
+  /* straight into a plain buffer with room, the common case */
+  bool direct = !w->iov && w->err == CN_CBOR_NO_ERROR;
+
+  len = ai < AI_1 ? 1 : 1 + (1 << (ai - AI_1));
+  if (direct && len <= w->size - w->pos) {
+    p = w->buf + w->pos;
+  } else {
+    direct = false;
+  }
+  p[0] = ib | ai;
+  for (i = len - 1; i > 0; i--) {
+    p[i] = (uint8_t)val;
+    val >>= 8;
+  }
+  if (direct) {
+    w->pos += len;
+    w->length += len;
+    return true;
+  }
+  return _writer_copy(w, head, len);
+}
+
+static bool _writer_head(cn_cbor_writer *w, uint8_t ib, uint64_t val) {
+  if (val < 24) {
+    return _writer_head_ai(w, ib, (uint8_t)val, val);
+  } else if (val < 256) {
+    return _writer_head_ai(w, ib, AI_1, val);
+  } else if (val < 65536) {
+    return _writer_head_ai(w, ib, AI_2, val);
+  } else if (val < 0x100000000L) {
+    return _writer_head_ai(w, ib, AI_4, val);
+  }
+  return _writer_head_ai(w, ib, AI_8, val);
+}
+
+/* An item is complete: count it in the open container, closing definite
+   containers that are now full */
+static bool _writer_done(cn_cbor_writer *w) {
+  cn_cbor_writer_level *top;
+
+  if (w->err != CN_CBOR_NO_ERROR) {
+    return false;
+  }
+  while (w->depth) {
+    top = &w->open[w->depth - 1];
+    if (top->indef) {
+      top->count++;
+      break;
+    }
+    if (--top->count) {
+      break;
+    }
+    w->depth--;
+  }
+  return true;
+}
+
+static bool _writer_open(cn_cbor_writer *w, bool indef, bool map,
+                         uint64_t count) {
+  if (w->err != CN_CBOR_NO_ERROR) {
+    return false;
+  }
+  if (!indef && count == 0) {
+    return _writer_done(w);
+  }
+  if (w->depth == CN_CBOR_WRITER_MAX_DEPTH) {
+    WRITER_FAIL(w, CN_CBOR_ERR_TOO_DEEP);
+  }
+  w->open[w->depth].indef = indef;
+  w->open[w->depth].map = map;
+  w->open[w->depth].count = count;
+  w->depth++;
+  return true;
+}
+
+bool cn_cbor_write_array(cn_cbor_writer *w, uint64_t count) {
+  return _writer_head(w, IB_ARRAY, count) &&
+    _writer_open(w, false, false, count);
+}
+
+bool cn_cbor_write_map(cn_cbor_writer *w, uint64_t pairs) {
+  if (pairs > UINT64_MAX / 2) {
+    WRITER_FAIL(w, CN_CBOR_ERR_OUT_OF_MEMORY);
+  }
+  return _writer_head(w, IB_MAP, pairs) &&
+    _writer_open(w, false, true, pairs * 2);
+}
+
+bool cn_cbor_write_array_indef(cn_cbor_writer *w) {
+  uint8_t ib = IB_ARRAY | AI_INDEF;
+  return _writer_copy(w, &ib, 1) && _writer_open(w, true, false, 0);
+}
+
+bool cn_cbor_write_map_indef(cn_cbor_writer *w) {
+  uint8_t ib = IB_MAP | AI_INDEF;
+  return _writer_copy(w, &ib, 1) && _writer_open(w, true, true, 0);
+}
+
+bool cn_cbor_write_end(cn_cbor_writer *w) {
+  cn_cbor_writer_level *top;
+  uint8_t brk = IB_BREAK;
+
+  if (w->err != CN_CBOR_NO_ERROR) {
+    return false;
+  }
+  top = w->depth ? &w->open[w->depth - 1] : NULL;
+  if (!top || !top->indef) {
+    WRITER_FAIL(w, CN_CBOR_ERR_BREAK_OUTSIDE_INDEF);
+  }
+  if (top->map && (top->count & 1)) {
+    WRITER_FAIL(w, CN_CBOR_ERR_ODD_SIZE_INDEF_MAP);
+  }
+  if (!_writer_copy(w, &brk, 1)) {
+    return false;
+  }
+  w->depth--;
+  return _writer_done(w);
+}
+
+bool cn_cbor_write_tag(cn_cbor_writer *w, uint64_t tag) {
+  return _writer_head(w, IB_TAG, tag) && _writer_open(w, false, false, 1);
+}
+
+bool cn_cbor_write_uint(cn_cbor_writer *w, uint64_t val) {
+  return _writer_head(w, IB_UNSIGNED, val) && _writer_done(w);
+}
+
+bool cn_cbor_write_int(cn_cbor_writer *w, int64_t val) {
+  if (val >= 0) {
+    return cn_cbor_write_uint(w, (uint64_t)val);
+  }
+  return _writer_head(w, IB_NEGATIVE, (uint64_t)(-1 - val)) &&
+    _writer_done(w);
+}
+
+bool cn_cbor_write_bytes(cn_cbor_writer *w, const void *data, size_t len) {
+  return _writer_head(w, IB_BYTES, len) &&
+    _writer_ref(w, data, len) &&
+    _writer_done(w);
+}
+
+bool cn_cbor_write_text(cn_cbor_writer *w, const char *str, size_t len) {
+  return _writer_head(w, IB_TEXT, len) &&
+    _writer_ref(w, str, len) &&
+    _writer_done(w);
+}
+
+bool cn_cbor_write_encoded(cn_cbor_writer *w, const void *item, size_t len) {
+  return _writer_copy(w, item, len) && _writer_done(w);
+}
+
+bool cn_cbor_write_bool(cn_cbor_writer *w, bool val) {
+  return _writer_head(w, IB_PRIM, val ? VAL_TRUE : VAL_FALSE) &&
+    _writer_done(w);
+}
+
+bool cn_cbor_write_null(cn_cbor_writer *w) {
+  return _writer_head(w, IB_PRIM, VAL_NIL) && _writer_done(w);
+}
+
+bool cn_cbor_write_double(cn_cbor_writer *w, double val) {
+  union {
+    double d;
+    uint64_t u;
+  } u64;
+  u64.d = val;
+  return _writer_head_ai(w, IB_PRIM, AI_8, u64.u) && _writer_done(w);
+}
+
+/* what comes before the children, if any */
+static bool _writer_node(cn_cbor_writer *w, const cn_cbor *cb) {
+  union {
+    double d;
+    uint64_t u;
+  } u64;
+  uint8_t ib = cb->type < sizeof(_xlate) ? _xlate[cb->type] : 0xFF;
 
   switch (cb->type) {
   case CN_CBOR_ARRAY:
-    if (cb->flags & CN_CBOR_FL_INDEF) {
-      write_byte(_xlate[cb->type] | AI_INDEF);
-      ADVANCE(_write_children(buf, buf_offset+count, buf_size, cb));
-      write_byte(0xFF);
-    } else {
-      ADVANCE(cbor_encoder_write_head(buf, buf_offset, buf_size, cb->type, cb->length));
-      ADVANCE(_write_children(buf, buf_offset+count, buf_size, cb));
-    }
-    break;
   case CN_CBOR_MAP:
     if (cb->flags & CN_CBOR_FL_INDEF) {
-      write_byte(_xlate[cb->type] | AI_INDEF);
-      ADVANCE(_write_children(buf, buf_offset+count, buf_size, cb));
-      write_byte(0xFF);
-    } else {
-      ADVANCE(cbor_encoder_write_head(buf, buf_offset, buf_size, cb->type, cb->length/2));
-      ADVANCE(_write_children(buf, buf_offset+count, buf_size, cb));
+      ib |= AI_INDEF;
+      return _writer_copy(w, &ib, 1);
     }
-    break;
+    return _writer_head(w, ib,
+                        cb->type == CN_CBOR_MAP ? cb->length / 2 : cb->length);
   case CN_CBOR_BYTES_CHUNKED:
   case CN_CBOR_TEXT_CHUNKED:
-    write_byte(_xlate[cb->type] | AI_INDEF);
-    ADVANCE(_write_children(buf, buf_offset+count, buf_size, cb));
-    write_byte(0xFF);
-    break;
-
-  case CN_CBOR_TAG:
-    ADVANCE(cbor_encoder_write_head(buf, buf_offset, buf_size, cb->type, cb->v.uint));
-    ADVANCE(_write_children(buf, buf_offset+count, buf_size, cb));
-    break;
-
+    ib |= AI_INDEF;
+    return _writer_copy(w, &ib, 1);
   case CN_CBOR_TEXT:
   case CN_CBOR_BYTES:
-    ADVANCE(cbor_encoder_write_head(buf, buf_offset, buf_size, cb->type, cb->length));
-    ensure_writable(cb->length);
-    memcpy(buf+buf_offset+count, cb->v.str, cb->length);
-    count += cb->length;
-    break;
-
+    return _writer_head(w, ib, cb->length) &&
+      _writer_ref(w, cb->v.str, cb->length);
   case CN_CBOR_NULL:
   case CN_CBOR_FALSE:
   case CN_CBOR_TRUE:
   case CN_CBOR_UINT:
   case CN_CBOR_SIMPLE:
-    ADVANCE(cbor_encoder_write_head(buf, buf_offset, buf_size, cb->type, cb->v.uint));
-    break;
-
+  case CN_CBOR_TAG:
+    return _writer_head(w, ib, cb->v.uint);
   case CN_CBOR_INT:
-    ADVANCE(cbor_encoder_write_negative(buf, buf_offset, buf_size, cb->v.sint));
-    break;
+    return _writer_head(w, ib, -cb->v.sint - 1);
   case CN_CBOR_DOUBLE:
-    ADVANCE(cbor_encoder_write_double(buf, buf_offset, buf_size, cb->v.dbl));
-    break;
+    u64.d = cb->v.dbl;
+    return _writer_head_ai(w, IB_PRIM, AI_8, u64.u);
+  default:
+    WRITER_FAIL(w, CN_CBOR_ERR_INVALID_ITEM);
+  }
+}
 
-  case CN_CBOR_INVALID:
+bool cn_cbor_write_item(cn_cbor_writer *w, const cn_cbor *cb) {
+  const cn_cbor *p = cb;
+  uint8_t brk = IB_BREAK;
+
+  assert(cb);
+  for (;;) {
+    if (!_writer_node(w, p)) {
+      return false;
+    }
+    if (p->first_child) {
+      p = p->first_child;
+      continue;
+    }
+    /* p is done; close it and any parents it was the last child of */
+    for (;;) {
+      if (((p->flags & CN_CBOR_FL_INDEF) ||
+           p->type == CN_CBOR_BYTES_CHUNKED ||
+           p->type == CN_CBOR_TEXT_CHUNKED) &&
+          !_writer_copy(w, &brk, 1)) {
+        return false;
+      }
+      if (p == cb) {
+        return _writer_done(w);
+      }
+      if (p->next) {
+        p = p->next;
+        break;
+      }
+      p = p->parent;
+    }
+  }
+}
+
+ssize_t cbor_encoder_write(uint8_t *buf,
+                           size_t buf_offset,
+                           size_t buf_size,
+                           const cn_cbor *cb) {
+  cn_cbor_writer w;
+  if (!buf || buf_offset > buf_size) {
     return -1;
   }
+  cn_cbor_writer_init(&w, buf + buf_offset, buf_size - buf_offset);
+  if (!cn_cbor_write_item(&w, cb)) {
+    return -1;
+  }
+  return w.length;
+}
 
-  return count;
+ssize_t cbor_encoder_size(const cn_cbor *cb) {
+  cn_cbor_writer w;
+  cn_cbor_writer_init(&w, NULL, 0);
+  if (!cn_cbor_write_item(&w, cb)) {
+    return -1;
+  }
+  return w.length;
+}
+
+int cbor_encoder_writev(const cn_cbor *cb,
+                        uint8_t *scratch,
+                        size_t scratch_size,
+                        struct iovec *iov,
+                        int iovcnt,
+                        size_t copy_max) {
+  cn_cbor_writer w;
+  if (!scratch) {
+    return -1;
+  }
+  cn_cbor_writer_init_iov(&w, scratch, scratch_size, iov, iovcnt, copy_max);
+  if (!cn_cbor_write_item(&w, cb)) {
+    return -1;
+  }
+  return w.used;
 }
 
 #ifdef  __cplusplus
@@ -10,6 +10,7 @@ extern "C" {
 
 #include <stdlib.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "cn-cbor/cn-cbor.h"
 
@@ -35,6 +36,22 @@ ssize_t cbor_encoder_write(uint8_t *buf,
                            size_t buf_size,
                            const cn_cbor *cb);
 
+/* the exact number of bytes cbor_encoder_write() will produce for cb, or
+   -1 if it cannot be encoded */
+ssize_t cbor_encoder_size(const cn_cbor *cb);
+
+/* Encode cb as a list of buffers without copying large strings: heads,
+   scalars and strings shorter than copy_max are written into scratch,
+   and longer strings are pointed to in place, so they must outlive the
+   iovecs.  Returns the number of iov entries used, or -1 if scratch or
+   iov ran out or cb cannot be encoded. */
+int cbor_encoder_writev(const cn_cbor *cb,
+                        uint8_t *scratch,
+                        size_t scratch_size,
+                        struct iovec *iov,
+                        int iovcnt,
+                        size_t copy_max);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -7,5 +7,11 @@ const char *cn_cbor_error_str[] = {
  "CN_CBOR_ERR_MT_UNDEF_FOR_INDEF",
  "CN_CBOR_ERR_RESERVED_AI",
  "CN_CBOR_ERR_WRONG_NESTING_IN_INDEF_STRING",
- "CN_CBOR_ERR_OUT_OF_MEMORY"
+ "CN_CBOR_ERR_OUT_OF_MEMORY",
+ "CN_CBOR_ERR_TOO_DEEP",
+ "CN_CBOR_ERR_TOO_MANY_ITEMS",
+ "CN_CBOR_ERR_COUNT_TOO_LARGE",
+ "CN_CBOR_ERR_INVALID_ITEM",
+ "CN_CBOR_ERR_INVALID_UTF8",
+ "CN_CBOR_ERR_SCHEMA_MISMATCH"
 };
@@ -0,0 +1,176 @@
+#ifndef CN_MAP_C
+#define CN_MAP_C
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+#ifdef EMACS_INDENTATION_HELPER
+} /* Duh. */
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "cn-cbor/cn-cbor.h"
+#include "ls_mem.h"
+
+/* Smaller maps are walked; hashing them costs more than it saves */
+#define CN_MAP_INDEX_MIN_PAIRS 8
+
+/* FNV-1a */
+static uint32_t hash_bytes(const char *p, size_t len) {
+  uint32_t h = 2166136261u;
+  while (len--) {
+    h ^= (unsigned char)*p++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static uint32_t hash_int(long v) {
+  uint64_t x = (uint64_t)v;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return (uint32_t)x;
+}
+
+void cn_cbor_key_int(cn_cbor_key* key, long k) {
+  assert(key);
+  key->type = CN_CBOR_INT;
+  key->v.sint = k;
+  key->length = 0;
+  key->hash = hash_int(k);
+}
+
+void cn_cbor_key_string(cn_cbor_key* key, const char* k) {
+  assert(key);
+  assert(k);
+  key->type = CN_CBOR_TEXT;
+  key->v.str = k;
+  key->length = strlen(k);
+  key->hash = hash_bytes(k, key->length);
+}
+
+/* Fill key from a map key node; false if the node cannot be a key */
+static bool key_from_node(cn_cbor_key* key, const cn_cbor* cp) {
+  switch (cp->type) {
+  case CN_CBOR_UINT: case CN_CBOR_INT:
+    cn_cbor_key_int(key, cp->v.sint);
+    return true;
+  case CN_CBOR_TEXT: case CN_CBOR_BYTES:
+    key->type = CN_CBOR_TEXT;
+    key->v.str = cp->v.str;
+    key->length = cp->length;
+    key->hash = hash_bytes(cp->v.str, cp->length);
+    return true;
+  default:
+    return false;
+  }
+}
+
+/* Same matching as cn_cbor_mapget_int() and cn_cbor_mapget_string() */
+static bool key_matches(const cn_cbor_key* key, const cn_cbor* cp) {
+  switch (cp->type) {
+  case CN_CBOR_UINT: case CN_CBOR_INT:
+    return key->type == CN_CBOR_INT && cp->v.sint == key->v.sint;
+  case CN_CBOR_TEXT: case CN_CBOR_BYTES:
+    return key->type == CN_CBOR_TEXT &&
+      (size_t)cp->length == key->length &&
+      memcmp(cp->v.str, key->v.str, key->length) == 0;
+  default:
+    return false;
+  }
+}
+
+const cn_cbor* cn_cbor_mapget_key(const cn_cbor* cb, const cn_cbor_key* key) {
+  cn_cbor* cp;
+  assert(cb);
+  assert(key);
+  for (cp = cb->first_child; cp && cp->next; cp = cp->next->next) {
+    if (key_matches(key, cp)) {
+      return cp->next;
+    }
+  }
+  return NULL;
+}
+
+static void index_build(cn_cbor_map_index* idx, const cn_cbor* cb) {
+  cn_cbor* cp;
+  cn_cbor_key key;
+  unsigned int size = 2;
+  unsigned int i;
+  unsigned int pairs = cb->length / 2;
+
+  idx->map = cb;
+  idx->generation = cb->generation;
+  idx->length = cb->length;
+  if (pairs < CN_MAP_INDEX_MIN_PAIRS) {
+    return;
+  }
+  /* at most half full */
+  while (size < pairs * 2) {
+    size <<= 1;
+  }
+  idx->slots = ls_data_calloc_tagged(LS_MEM_TAG_CBOR,
+                                     size, sizeof(*idx->slots));
+  if (!idx->slots) {
+    return;                     /* lookups walk the map instead */
+  }
+  idx->mask = size - 1;
+
+  for (cp = cb->first_child; cp && cp->next; cp = cp->next->next) {
+    if (!key_from_node(&key, cp)) {
+      continue;
+    }
+    for (i = key.hash & idx->mask; idx->slots[i]; i = (i + 1) & idx->mask) {
+      if (key_matches(&key, idx->slots[i])) {
+        break;                  /* the first of duplicate keys wins */
+      }
+    }
+    if (!idx->slots[i]) {
+      idx->slots[i] = cp;
+    }
+  }
+}
+
+const cn_cbor* cn_cbor_mapget_indexed(cn_cbor_map_index* idx,
+                                      const cn_cbor* cb,
+                                      const cn_cbor_key* key) {
+  unsigned int i;
+  assert(idx);
+  assert(cb);
+  assert(key);
+
+  if (idx->map != cb || idx->generation != cb->generation ||
+      idx->length != cb->length) {
+    cn_cbor_map_index_free(idx);
+    index_build(idx, cb);
+  }
+  if (!idx->slots) {
+    return cn_cbor_mapget_key(cb, key);
+  }
+  for (i = key->hash & idx->mask; idx->slots[i]; i = (i + 1) & idx->mask) {
+    if (key_matches(key, idx->slots[i])) {
+      return idx->slots[i]->next;
+    }
+  }
+  return NULL;
+}
+
+void cn_cbor_map_index_free(cn_cbor_map_index* idx) {
+  assert(idx);
+  ls_data_free(idx->slots);
+  idx->map = NULL;
+  idx->slots = NULL;
+  idx->mask = 0;
+  idx->generation = 0;
+  idx->length = 0;
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif  /* CN_MAP_C */
@@ -0,0 +1,98 @@
+#ifndef CN_SEQ_C
+#define CN_SEQ_C
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+#ifdef EMACS_INDENTATION_HELPER
+} /* Duh. */
+#endif
+
+#include <string.h>
+#include <assert.h>
+
+#include "cn-cbor/cn-cbor.h"
+
+void cn_cbor_seq_init(cn_cbor_seq* seq, const cn_cbor_limits* limits,
+                      cn_alloc_func calloc_func, void* context) {
+  assert(seq);
+  memset(seq, 0, sizeof(*seq));
+  seq->limits = limits;
+  seq->calloc_func = calloc_func;
+  seq->context = context;
+}
+
+void cn_cbor_seq_input(cn_cbor_seq* seq, const char* buf, size_t len) {
+  assert(seq);
+  assert(buf || !len);
+  seq->buf = buf;
+  seq->len = len;
+  seq->pos = 0;
+}
+
+/* An incomplete item is retried with whatever the buffer holds now */
+static bool seq_ready(cn_cbor_seq* seq) {
+  if (seq->err != CN_CBOR_NO_ERROR && seq->err != CN_CBOR_ERR_OUT_OF_DATA)
+    return false;
+  seq->err = CN_CBOR_NO_ERROR;
+  return seq->pos < seq->len;
+}
+
+static void seq_consume(cn_cbor_seq* seq, size_t used) {
+  seq->pos += used;
+  seq->offset += used;
+}
+
+const cn_cbor* cn_cbor_seq_next(cn_cbor_seq* seq) {
+  const cn_cbor *cb;
+  cn_cbor_errback back;
+  size_t used;
+
+  assert(seq);
+  if (!seq_ready(seq))
+    return NULL;
+  cb = cn_cbor_decode_first(seq->buf + seq->pos, seq->len - seq->pos, &used,
+                            seq->limits, seq->calloc_func, seq->context,
+                            &back);
+  if (!cb) {
+    seq->err = back.err;
+    return NULL;
+  }
+  seq_consume(seq, used);
+  return cb;
+}
+
+bool cn_cbor_seq_next_raw(cn_cbor_seq* seq, const char** item, size_t* len) {
+  cn_cbor_cursor cur;
+
+  assert(seq);
+  assert(item);
+  assert(len);
+  if (!seq_ready(seq))
+    return false;
+  cn_cbor_cursor_init(&cur, seq->buf + seq->pos, seq->len - seq->pos);
+  if (!cn_cbor_cursor_skip(&cur)) {
+    seq->err = cur.err;
+    return false;
+  }
+  *item = seq->buf + seq->pos;
+  *len = (const char *)cur.pos - *item;
+  seq_consume(seq, *len);
+  return true;
+}
+
+size_t cn_cbor_seq_pending(const cn_cbor_seq* seq) {
+  assert(seq);
+  return seq->len - seq->pos;
+}
+
+bool cn_cbor_seq_done(const cn_cbor_seq* seq) {
+  assert(seq);
+  return seq->err == CN_CBOR_NO_ERROR && seq->pos == seq->len;
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif  /* CN_SEQ_C */
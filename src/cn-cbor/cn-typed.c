@@ -0,0 +1,193 @@
+#ifndef CN_TYPED_C
+#define CN_TYPED_C
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+#ifdef EMACS_INDENTATION_HELPER
+} /* Duh. */
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "cn-cbor/cn-cbor.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CN_TYPED_X86 1
+#include <immintrin.h>
+#endif
+
+/* tag = 0b010fsell: float, signed, little-endian, log2 of the size */
+#define TA_TAG_FIRST 64
+#define TA_TAG_LAST 87
+#define TA_FLOAT 0x10
+#define TA_SIGNED 0x08
+#define TA_LITTLE 0x04
+#define TA_SINT8_RESERVED 76
+
+static bool host_little_endian(void) {
+  const uint16_t one = 1;
+  return *(const uint8_t *)&one == 1;
+}
+
+bool cn_cbor_typed_array_init(cn_cbor_typed_array* ta, uint64_t tag,
+                              const void* data, size_t len) {
+  unsigned int ll;
+
+  assert(ta);
+  assert(data || !len);
+  if (tag < TA_TAG_FIRST || tag > TA_TAG_LAST || tag == TA_SINT8_RESERVED)
+    return false;
+  ll = tag & 3;
+  if (tag & TA_FLOAT) {
+    ta->kind = CN_CBOR_TA_FLOAT;
+    ta->size = 2u << ll;
+  } else {
+    ta->kind = (tag & TA_SIGNED) ? CN_CBOR_TA_SINT : CN_CBOR_TA_UINT;
+    ta->size = 1u << ll;        /* 68 is uint8, clamped */
+  }
+  if (len % ta->size)
+    return false;
+  /* single bytes have no order */
+  ta->little_endian = (ta->size == 1) ? host_little_endian() :
+    (tag & TA_LITTLE) != 0;
+  ta->data = data;
+  ta->count = len / ta->size;
+  return true;
+}
+
+bool cn_cbor_typed_array_view(const cn_cbor* cb, cn_cbor_typed_array* ta) {
+  assert(cb);
+  if (cb->type != CN_CBOR_TAG || !cb->first_child ||
+      cb->first_child->type != CN_CBOR_BYTES)
+    return false;
+  return cn_cbor_typed_array_init(ta, cb->v.uint, cb->first_child->v.str,
+                                  cb->first_child->length);
+}
+
+const void* cn_cbor_typed_array_native(const cn_cbor_typed_array* ta) {
+  assert(ta);
+  if (ta->little_endian != host_little_endian() ||
+      (uintptr_t)ta->data % ta->size)
+    return NULL;
+  return ta->data;
+}
+
+static void swap_scalar(uint8_t *out, const uint8_t *in, size_t count,
+                        unsigned int size) {
+  size_t i;
+  unsigned int j;
+  for (i = 0; i < count; i++, in += size, out += size) {
+    for (j = 0; j < size; j++)
+      out[j] = in[size - 1 - j];
+  }
+}
+
+#ifdef CN_TYPED_X86
+
+/* pshufb masks reversing each element of 2, 4, 8 and 16 bytes */
+static const uint8_t swap_masks[4][16] = {
+  {1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14},
+  {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+  {7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8},
+  {15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0}
+};
+
+static const uint8_t *swap_mask(unsigned int size) {
+  switch (size) {
+  case 2: return swap_masks[0];
+  case 4: return swap_masks[1];
+  case 8: return swap_masks[2];
+  default: return swap_masks[3];
+  }
+}
+
+/* whole vectors only; the caller does the rest */
+static __attribute__((target("avx2")))
+size_t swap_avx2(uint8_t *out, const uint8_t *in, size_t len,
+                 unsigned int size) {
+  const __m256i mask = _mm256_broadcastsi128_si256(
+    _mm_loadu_si128((const __m128i *)swap_mask(size)));
+  size_t i;
+  for (i = 0; i + 32 <= len; i += 32) {
+    _mm256_storeu_si256((__m256i *)(out + i),
+      _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(in + i)),
+                          mask));
+  }
+  return i;
+}
+
+static __attribute__((target("ssse3")))
+size_t swap_ssse3(uint8_t *out, const uint8_t *in, size_t len,
+                  unsigned int size) {
+  const __m128i mask = _mm_loadu_si128((const __m128i *)swap_mask(size));
+  size_t i;
+  for (i = 0; i + 16 <= len; i += 16) {
+    _mm_storeu_si128((__m128i *)(out + i),
+      _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i)), mask));
+  }
+  return i;
+}
+
+#endif  /* CN_TYPED_X86 */
+
+void cn_cbor_typed_array_copy(const cn_cbor_typed_array* ta, void* out) {
+  uint8_t *dst = out;
+  const uint8_t *src;
+  size_t len, done = 0;
+
+  assert(ta);
+  assert(out || !ta->count);
+  src = ta->data;
+  len = ta->count * ta->size;
+  if (ta->size == 1 || ta->little_endian == host_little_endian()) {
+    memcpy(dst, src, len);
+    return;
+  }
+#ifdef CN_TYPED_X86
+  /* vectors are a whole number of elements of any size */
+  if (__builtin_cpu_supports("avx2"))
+    done = swap_avx2(dst, src, len, ta->size);
+  else if (__builtin_cpu_supports("ssse3"))
+    done = swap_ssse3(dst, src, len, ta->size);
+#endif
+  swap_scalar(dst + done, src + done, (len - done) / ta->size, ta->size);
+}
+
+bool cn_cbor_write_typed_array(cn_cbor_writer* w, cn_cbor_ta_kind kind,
+                               unsigned int size,
+                               const void* data, size_t count) {
+  uint64_t tag = TA_TAG_FIRST;
+  unsigned int unit = 1;        /* the smallest size of this kind */
+  unsigned int ll = 0;
+
+  assert(w);
+  assert(data || !count);
+  if (w->err != CN_CBOR_NO_ERROR)
+    return false;
+  if (kind == CN_CBOR_TA_FLOAT) {
+    tag |= TA_FLOAT;
+    unit = 2;
+  } else if (kind == CN_CBOR_TA_SINT) {
+    tag |= TA_SIGNED;
+  }
+  while ((unit << ll) < size && ll < 3)
+    ll++;
+  if (size != (unit << ll) || count > SIZE_MAX / size) {
+    w->err = CN_CBOR_ERR_INVALID_ITEM;
+    return false;
+  }
+  tag |= ll;
+  if (size > 1 && host_little_endian())
+    tag |= TA_LITTLE;
+  return cn_cbor_write_tag(w, tag) &&
+    cn_cbor_write_bytes(w, data, count * size);
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif  /* CN_TYPED_C */
@@ -0,0 +1,278 @@
+#ifndef CN_UTF8_C
+#define CN_UTF8_C
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+#ifdef EMACS_INDENTATION_HELPER
+} /* Duh. */
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "cn-cbor/cn-cbor.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CN_UTF8_X86 1
+#include <immintrin.h>
+#endif
+
+/* Below this, setting up vectors costs more than it saves */
+#define CN_UTF8_SIMD_MIN 16
+
+/*
+ * Check the multi-byte character at *pp, whose first byte is not ASCII,
+ * and step over it.  RFC 3629: no overlong forms, no surrogates, nothing
+ * past U+10FFFF.
+ */
+static bool utf8_char(const unsigned char **pp, const unsigned char *end) {
+  const unsigned char *p = *pp;
+  unsigned char c = *p;
+  unsigned char lo = 0x80, hi = 0xbf;
+  size_t n;
+
+  if (c < 0xc2)
+    return false;               /* continuation, or overlong 2-byte */
+  if (c < 0xe0) {
+    n = 1;
+  } else if (c < 0xf0) {
+    n = 2;
+    if (c == 0xe0)
+      lo = 0xa0;                /* overlong */
+    else if (c == 0xed)
+      hi = 0x9f;                /* surrogates */
+  } else if (c < 0xf5) {
+    n = 3;
+    if (c == 0xf0)
+      lo = 0x90;                /* overlong */
+    else if (c == 0xf4)
+      hi = 0x8f;                /* past U+10FFFF */
+  } else {
+    return false;
+  }
+  if ((size_t)(end - p) <= n)
+    return false;
+  if (p[1] < lo || p[1] > hi)
+    return false;
+  if (n > 1 && (p[2] & 0xc0) != 0x80)
+    return false;
+  if (n > 2 && (p[3] & 0xc0) != 0x80)
+    return false;
+  *pp = p + n + 1;
+  return true;
+}
+
+bool cn_cbor_utf8_valid_scalar(const char* buf, size_t len) {
+  const unsigned char *p = (const unsigned char *)buf;
+  const unsigned char *end = p + len;
+  uint64_t v;
+
+  assert(buf || !len);
+  while (p < end) {
+    /* ASCII eight bytes at a time, or all of a short tail at once */
+    if (end - p >= 8) {
+      memcpy(&v, p, 8);
+      if (!(v & 0x8080808080808080ULL)) {
+        p += 8;
+        continue;
+      }
+    } else {
+      const unsigned char *q;
+      unsigned char high = 0;
+      for (q = p; q < end; q++)
+        high |= *q;
+      if (!(high & 0x80))
+        return true;
+    }
+    if (*p < 0x80)
+      p++;
+    else if (!utf8_char(&p, end))
+      return false;
+  }
+  return true;
+}
+
+#ifdef CN_UTF8_X86
+
+/* SSE2 is always there on x86-64: skip ASCII sixteen bytes at a time */
+static bool utf8_valid_sse2(const unsigned char *p, const unsigned char *end) {
+  int mask;
+
+  while (p < end) {
+    if (end - p >= 16) {
+      mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p));
+      if (!mask) {
+        p += 16;
+        continue;
+      }
+      p += __builtin_ctz(mask);
+    } else if (*p < 0x80) {
+      p++;
+      continue;
+    }
+    if (!utf8_char(&p, end))
+      return false;
+  }
+  return true;
+}
+
+/*
+ * AVX2, by table lookup on the high and low nibbles of each byte and the
+ * high nibble of the one before it (Keiser and Lemire, "Validating UTF-8
+ * In Less Than One Instruction Per Byte", 2021).  Each table gives the
+ * errors that nibble allows; a byte pair is bad if all three agree.
+ * Third and fourth bytes are caught by comparing where continuations
+ * must be with where two continuations were found in a row.
+ */
+#define U8_TOO_SHORT    (1 << 0)        /* lead or ASCII after a lead */
+#define U8_TOO_LONG     (1 << 1)        /* continuation after ASCII */
+#define U8_OVERLONG_3   (1 << 2)
+#define U8_TOO_LARGE    (1 << 3)
+#define U8_SURROGATE    (1 << 4)
+#define U8_OVERLONG_2   (1 << 5)
+#define U8_TOO_LARGE_1000 (1 << 6)
+#define U8_OVERLONG_4   (1 << 6)
+#define U8_TWO_CONTS    (1 << 7)
+#define U8_CARRY        (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+#define U8_TARGET __attribute__((target("avx2")))
+
+/* input shifted right by n bytes, with the end of prev shifted in */
+#define U8_PREV(input, prev, n) \
+  _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), \
+                     16 - (n))
+
+static U8_TARGET __m256i utf8_high_nibble(__m256i v) {
+  return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f));
+}
+
+static const uint8_t byte_1_high_table[16] = {
+  U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+  U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+  U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+  U8_TOO_SHORT | U8_OVERLONG_2,
+  U8_TOO_SHORT,
+  U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+  U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4
+};
+
+static const uint8_t byte_1_low_table[16] = {
+  U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,
+  U8_CARRY | U8_OVERLONG_2,
+  U8_CARRY,
+  U8_CARRY,
+  U8_CARRY | U8_TOO_LARGE,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000
+};
+
+static const uint8_t byte_2_high_table[16] = {
+  U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+  U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+  U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 |
+    U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+  U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE,
+  U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+  U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+  U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT
+};
+
+/* the same 16 entries in both lanes, for _mm256_shuffle_epi8() */
+static U8_TARGET __m256i utf8_table(const uint8_t *table) {
+  return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)table));
+}
+
+static U8_TARGET __m256i utf8_block_errors(__m256i input, __m256i prev) {
+  __m256i prev1 = U8_PREV(input, prev, 1);
+  __m256i special, third, fourth, must23;
+
+  special = _mm256_and_si256(
+    _mm256_and_si256(
+      _mm256_shuffle_epi8(utf8_table(byte_1_high_table),
+                          utf8_high_nibble(prev1)),
+      _mm256_shuffle_epi8(utf8_table(byte_1_low_table),
+                          _mm256_and_si256(prev1, _mm256_set1_epi8(0x0f)))),
+    _mm256_shuffle_epi8(utf8_table(byte_2_high_table),
+                        utf8_high_nibble(input)));
+
+  /* only 111xxxxx two back, or 1111xxxx three back, reach 0x80 */
+  third = _mm256_subs_epu8(U8_PREV(input, prev, 2),
+                           _mm256_set1_epi8((char)(0xe0 - 0x80)));
+  fourth = _mm256_subs_epu8(U8_PREV(input, prev, 3),
+                            _mm256_set1_epi8((char)(0xf0 - 0x80)));
+  must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                            _mm256_set1_epi8((char)0x80));
+  return _mm256_xor_si256(must23, special);
+}
+
+static U8_TARGET bool utf8_valid_avx2(const unsigned char *p,
+                                      const unsigned char *end) {
+  /* a lead byte in the last three places wants bytes from the next
+     block */
+  const __m256i max_end = _mm256_setr_epi8(
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+  __m256i prev = _mm256_setzero_si256();
+  __m256i incomplete = _mm256_setzero_si256();
+  __m256i error = _mm256_setzero_si256();
+  __m256i input;
+  unsigned char tail[32];
+
+  for (;;) {
+    if (end - p >= 32) {
+      input = _mm256_loadu_si256((const __m256i *)p);
+      p += 32;
+    } else {
+      /* ASCII padding shows up anything left unfinished */
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, p, end - p);
+      input = _mm256_loadu_si256((const __m256i *)tail);
+      p = end;
+    }
+    if (!_mm256_movemask_epi8(input)) {
+      error = _mm256_or_si256(error, incomplete);
+    } else {
+      error = _mm256_or_si256(error, utf8_block_errors(input, prev));
+      incomplete = _mm256_subs_epu8(input, max_end);
+    }
+    prev = input;
+    if (p == end)
+      break;
+  }
+  error = _mm256_or_si256(error, incomplete);
+  return _mm256_testz_si256(error, error);
+}
+
+#endif  /* CN_UTF8_X86 */
+
+bool cn_cbor_utf8_valid(const char* buf, size_t len) {
+  assert(buf || !len);
+#ifdef CN_UTF8_X86
+  if (len >= CN_UTF8_SIMD_MIN) {
+    if (__builtin_cpu_supports("avx2"))
+      return utf8_valid_avx2((const unsigned char *)buf,
+                             (const unsigned char *)buf + len);
+    return utf8_valid_sse2((const unsigned char *)buf,
+                           (const unsigned char *)buf + len);
+  }
+#endif
+  return cn_cbor_utf8_valid_scalar(buf, len);
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif  /* CN_UTF8_C */
@@ -0,0 +1,67 @@
+/**
+ * \file
+ *
+ * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "ls_clock.h"
+
+/* Monotonic milliseconds as of the last ls_clock_update() */
+static uint64_t _now = 0;
+
+/* The last formatted timestamp of this thread, and the second it is for */
+static __thread time_t _stamp_time = (time_t)-1;
+static __thread char   _stamp[LS_CLOCK_TIMESTAMP_LEN];
+
+LS_API uint64_t ls_clock_update(void)
+{
+    struct timespec ts;
+    uint64_t now;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+    __atomic_store_n(&_now, now, __ATOMIC_RELAXED);
+
+    return now;
+}
+
+LS_API uint64_t ls_clock_now(void)
+{
+    uint64_t now = __atomic_load_n(&_now, __ATOMIC_RELAXED);
+
+    return now ? now : ls_clock_update();
+}
+
+LS_API const char *ls_clock_timestamp(void)
+{
+    time_t t;
+    struct tm local;
+
+    t = time(NULL);
+    if (t == (time_t)-1)
+    {
+        return NULL;
+    }
+
+    if (t != _stamp_time)
+    {
+        if (!localtime_r(&t, &local))
+        {
+            return NULL;
+        }
+        /* bounded, so the compiler can see that it fits */
+        snprintf(_stamp, sizeof(_stamp), "%04u-%02u-%02uT%02u:%02u:%02u",
+                 (unsigned)(local.tm_year+1900) % 10000u,
+                 (unsigned)(local.tm_mon+1) % 100u,
+                 (unsigned)local.tm_mday % 100u,
+                 (unsigned)local.tm_hour % 100u,
+                 (unsigned)local.tm_min % 100u,
+                 (unsigned)local.tm_sec % 100u);
+        _stamp_time = t;
+    }
+
+    return _stamp;
+}
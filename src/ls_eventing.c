@@ -2,6 +2,8 @@
  * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
  */
 
+#define LS_LOG_FILE_MODULE LS_LOG_MODULE_EVENTING
+
 #include <assert.h>
 #include <string.h>
 
@@ -13,6 +15,7 @@
 
 /* Internal Constants */
 static const int DISPATCH_BUCKETS = 7;
+static const size_t EVENT_ID_INITIAL = 8;
 static const size_t MOMENT_POOLSIZE = 0;
 
 /**
@@ -157,7 +160,7 @@ static void _handle_trigger_int(ls_event_dispatcher *dispatch)
     assert(moment);
     evt = &moment->evt;
 
-    ls_log(LS_LOG_DEBUG, "processing event '%s'", evt->name);
+    LS_LOG(LS_LOG_DEBUG, "processing event '%s'", evt->name);
 
     assert(NULL == dispatch->running);
     dispatch->running = evt->notifier;
@@ -219,7 +222,7 @@ static inline void _dispatch_trigger(ls_event_dispatcher *dispatcher,
 
     if (dispatcher->running != NULL)
     {
-        ls_log(LS_LOG_DEBUG, "already processing events; deferring event '%s'",
+        LS_LOG(LS_LOG_DEBUG, "already processing events; deferring event '%s'",
                moment->evt.name);
         return;
     }
@@ -264,6 +267,35 @@ static void _clean_event(bool replace, bool delete_key, void *key, void *data)
     ls_data_free(event);
 }
 
+/**
+ * Ensures there is room in the id table for one more event.
+ */
+static bool _reserve_event_id(ls_event_dispatcher *dispatch, ls_err *err)
+{
+    ls_event **by_id;
+    size_t     capacity;
+
+    if (dispatch->event_count < dispatch->event_capacity)
+    {
+        return true;
+    }
+
+    capacity = dispatch->event_capacity ?
+               dispatch->event_capacity * 2 : EVENT_ID_INITIAL;
+    by_id = ls_data_realloc_tagged(LS_MEM_TAG_EVENTING,
+                                   dispatch->events_by_id,
+                                   capacity * sizeof(ls_event *));
+    if (by_id == NULL)
+    {
+        LS_ERROR(err, LS_ERR_NO_MEMORY);
+        return false;
+    }
+
+    dispatch->events_by_id = by_id;
+    dispatch->event_capacity = capacity;
+    return true;
+}
+
 static bool _prepare_trigger(ls_event_dispatcher *dispatch,
         ls_event_trigger_data **trigger_data, ls_err *err)
 {
@@ -288,7 +320,7 @@ static bool _prepare_trigger(ls_event_dispatcher *dispatch,
 
     if (!ls_pool_create(MOMENT_POOLSIZE, &pool, err))
     {
-        ls_log(LS_LOG_WARN, "unable to allocate pool with block size %zd",
+        LS_LOG(LS_LOG_WARN, "unable to allocate pool with block size %zd",
                MOMENT_POOLSIZE);
         return false;
     }
@@ -298,7 +330,7 @@ static bool _prepare_trigger(ls_event_dispatcher *dispatch,
                         &momentUnion.momentPtr,
                         err))
     {
-        ls_log(LS_LOG_WARN, "unable to allocate moment");
+        LS_LOG(LS_LOG_WARN, "unable to allocate moment");
         ls_pool_destroy(pool);
         return false;
     }
@@ -308,7 +340,7 @@ static bool _prepare_trigger(ls_event_dispatcher *dispatch,
     if (!ls_pool_malloc(pool,
                         sizeof(ls_event_trigger_t), &tdataUnion.tdataPtr, err))
     {
-        ls_log(LS_LOG_WARN, "unable to allocate event trigger data");
+        LS_LOG(LS_LOG_WARN, "unable to allocate event trigger data");
         ls_pool_destroy(pool);
         return false;
     }
@@ -338,7 +370,7 @@ static void _trigger_prepared(
     assert(trigger_data->pool);
     assert(trigger_data->moment);
 
-    ls_log(LS_LOG_DEBUG, "triggering event '%s'", event->name);
+    LS_LOG(LS_LOG_DEBUG, "triggering event '%s'", event->name);
 
     moment = trigger_data->moment;
 
@@ -386,7 +418,8 @@ LS_API bool ls_event_dispatcher_create(void *source,
         return false;
     }
 
-    dispatch = ls_data_malloc(sizeof(ls_event_dispatch_t));
+    dispatch = ls_data_malloc_tagged(LS_MEM_TAG_EVENTING,
+                                     sizeof(ls_event_dispatch_t));
     if (dispatch == NULL)
     {
         LS_ERROR(err, LS_ERR_NO_MEMORY);
@@ -394,16 +427,24 @@ LS_API bool ls_event_dispatcher_create(void *source,
         return false;
     }
 
+    memset(dispatch, 0, sizeof(ls_event_dispatch_t));
+    if (!_reserve_event_id(dispatch, err))
+    {
+        ls_htable_destroy(events);
+        ls_data_free(dispatch);
+        return false;
+    }
+
     PUSH_EVENTING_NDC;
     if (_ndcDepth == 0) {
       LS_ERROR(err, LS_ERR_NO_MEMORY);
       ls_htable_destroy(events);
+      ls_data_free(dispatch->events_by_id);
       ls_data_free(dispatch);
       return false;
     }
-    ls_log(LS_LOG_TRACE, "creating new event dispatcher");
+    LS_LOG(LS_LOG_TRACE, "creating new event dispatcher");
 
-    memset(dispatch, 0, sizeof(ls_event_dispatch_t));
     dispatch->source = source;
     dispatch->events = events;
     *outdispatch = dispatch;
@@ -424,14 +465,14 @@ LS_API void ls_event_dispatcher_destroy(ls_event_dispatcher *dispatch)
 
     if (NULL != dispatch->running)
     {
-        ls_log(LS_LOG_DEBUG,
+        LS_LOG(LS_LOG_DEBUG,
                "currently processing events; deferring dispatcher destruction");
         dispatch->destroy_pending = true;
         POP_EVENTING_NDC;
         return;
     }
 
-    ls_log(LS_LOG_DEBUG, "destroying dispatcher");
+    LS_LOG(LS_LOG_DEBUG, "destroying dispatcher");
 
     moment = dispatch->next_moment;
     while (moment)
@@ -442,6 +483,7 @@ LS_API void ls_event_dispatcher_destroy(ls_event_dispatcher *dispatch)
     }
 
     ls_htable_destroy(dispatch->events);
+    ls_data_free(dispatch->events_by_id);
     ls_data_free(dispatch);
 
     POP_EVENTING_NDC;
@@ -465,6 +507,20 @@ LS_API ls_event *ls_event_dispatcher_get_event(
     return evt;
 }
 
+LS_API ls_event *ls_event_dispatcher_get_event_by_id(
+                        ls_event_dispatcher *dispatch,
+                        ls_event_id id)
+{
+    assert(dispatch);
+
+    if (id >= dispatch->event_count)
+    {
+        return NULL;
+    }
+
+    return dispatch->events_by_id[id];
+}
+
 LS_API bool ls_event_dispatcher_create_event(
                     ls_event_dispatcher *dispatch,
                     const char *name,
@@ -496,8 +552,14 @@ LS_API bool ls_event_dispatcher_create_event(
         goto ls_event_dispatcher_create_event_done_label;
     }
 
+    if (!_reserve_event_id(dispatch, err))
+    {
+        retval = false;
+        goto ls_event_dispatcher_create_event_done_label;
+    }
+
     nameLen = ls_strlen(name);
-    evt_name = (char *)ls_data_malloc(nameLen + 1);
+    evt_name = (char *)ls_data_malloc_tagged(LS_MEM_TAG_EVENTING, nameLen + 1);
     if (evt_name == NULL)
     {
         LS_ERROR(err, LS_ERR_NO_MEMORY);
@@ -506,7 +568,8 @@ LS_API bool ls_event_dispatcher_create_event(
     }
     memcpy(evt_name, name, nameLen + 1);
 
-    notifier = ls_data_malloc(sizeof(ls_event_notifier_t));
+    notifier = ls_data_malloc_tagged(LS_MEM_TAG_EVENTING,
+                                     sizeof(ls_event_notifier_t));
     if (notifier == NULL)
     {
         LS_ERROR(err, LS_ERR_NO_MEMORY);
@@ -518,6 +581,7 @@ LS_API bool ls_event_dispatcher_create_event(
     notifier->dispatcher = dispatch;
     notifier->source = dispatch->source;
     notifier->name = evt_name;
+    notifier->id = (ls_event_id)dispatch->event_count;
 
     if (!ls_htable_put(dispatch->events,
                        evt_name,
@@ -529,6 +593,7 @@ LS_API bool ls_event_dispatcher_create_event(
         goto ls_event_dispatcher_create_event_done_label;
     }
     evt_name = NULL;
+    dispatch->events_by_id[dispatch->event_count++] = notifier;
 
     if (event)
     {
@@ -562,6 +627,13 @@ LS_API const char *ls_event_get_name(ls_event *event)
     return event->name;
 }
 
+LS_API ls_event_id ls_event_get_id(ls_event *event)
+{
+    assert(event);
+
+    return event->id;
+}
+
 LS_API const void *ls_event_get_source(ls_event *event)
 {
     LS_LOG_TRACE_FUNCTION_NO_ARGS;
@@ -592,7 +664,8 @@ LS_API bool ls_event_bind(ls_event                 *event,
     if (!_remove_binding(event, cb, &binding, &prev))
     {
         /* no match found; allocate a new one */
-        binding = ls_data_malloc(sizeof(ls_event_binding_t));
+        binding = ls_data_malloc_tagged(LS_MEM_TAG_EVENTING,
+                                        sizeof(ls_event_binding_t));
         if (binding == NULL)
         {
             LS_ERROR(err, LS_ERR_NO_MEMORY);
@@ -644,6 +717,13 @@ LS_API bool ls_event_bind(ls_event                 *event,
     return true;
 }
 
+LS_API bool ls_event_is_bound(ls_event *event)
+{
+    assert(event);
+
+    return event->bindings != NULL;
+}
+
 LS_API void ls_event_unbind(ls_event *event,
                                     ls_event_notify_callback cb)
 {
@@ -751,6 +831,38 @@ LS_API void ls_event_trigger_prepared(
     POP_EVENTING_NDC;
 }
 
+LS_API bool ls_event_trigger_direct(ls_event *event, void *data)
+{
+    struct _ls_event_data_t evt;
+
+    assert(event);
+
+    evt.source = event->dispatcher->source;
+    evt.name = event->name;
+    evt.notifier = event;
+    evt.data = data;
+    evt.selected = NULL;
+    evt.pool = NULL;
+    evt.handled = false;
+
+    for (ls_event_binding_t *binding = event->bindings;
+         NULL != binding;
+         binding = binding->next)
+    {
+        if (!binding->unbound)
+        {
+            bool handled = evt.handled;
+
+            binding->cb(&evt, binding->arg);
+
+            // prevent callbacks from "unhandling"
+            evt.handled = handled || evt.handled;
+        }
+    }
+
+    return evt.handled;
+}
+
 LS_API bool ls_event_trigger(ls_event *event,
                              void *data,
                              ls_event_result_callback result_cb,
@@ -11,6 +11,10 @@
  *
  * The name should match lexically in an ASCII case-insensitive manner.
  *
+ * Name lookup hashes the name on every call.  Sources that trigger or bind
+ * frequently should resolve the event once, or address it by the
+ * ls_event_id assigned when it was created, which is a plain array index.
+ *
  * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
  */
 
@@ -84,10 +88,26 @@ LS_API ls_event *ls_event_dispatcher_get_event(
         ls_event_dispatcher *dispatch,
         const char          *name);
 
+/**
+ * Retrieves the event notifier from the dispatcher for the given identifier.
+ * This is an array lookup, and is preferred over
+ * ls_event_dispatcher_get_event() on hot paths.
+ *
+ * \invariant dispatch != NULL
+ * \param[in] dispatch The event dispatcher
+ * \param[in] id The event identifier, as returned by ls_event_get_id()
+ * \retval ls_event_notifier The event notifier, or NULL if not found
+ */
+LS_API ls_event *ls_event_dispatcher_get_event_by_id(
+        ls_event_dispatcher *dispatch,
+        ls_event_id          id);
+
 /**
  * Create a new event for the given dispatcher and event name. When
  * created, this event is registered with the given dispatcher and can be
- * accessed via ls_event_dispatcher_get_event().
+ * accessed via ls_event_dispatcher_get_event(), or via
+ * ls_event_dispatcher_get_event_by_id() with the next unused identifier
+ * (the number of events previously created in {dispatch}).
  *
  * \b NOTE: The event name is case-insensitive; while the original value may
  * be retained, most uses use a "lower-case" variant.
@@ -124,6 +144,15 @@ LS_API bool ls_event_dispatcher_create_event(
  */
 LS_API const char *ls_event_get_name(ls_event *event);
 
+/**
+ * Retrieves the identifier of this event within its dispatcher.
+ *
+ * \invariant event != NULL
+ * \param[in] event The event
+ * \retval ls_event_id The identifier of the event
+ */
+LS_API ls_event_id ls_event_get_id(ls_event *event);
+
 /**
  * Retrieves the source for the given event.
  *
@@ -156,6 +185,17 @@ LS_API bool ls_event_bind(ls_event                *event,
                           void                    *arg,
                           ls_err                  *err);
 
+/**
+ * Determines whether any callbacks are bound to the given event.  Sources
+ * can use this to skip ls_event_trigger(), and the allocation it implies,
+ * for events nobody is listening to.
+ *
+ * \invariant event != NULL
+ * \param[in] event The event
+ * \retval bool True if at least one callback is bound.
+ */
+LS_API bool ls_event_is_bound(ls_event *event);
+
 /**
  * Unbinds the given event callback. If {cb} is not currently bound to the
  * event, this function does nothing.
@@ -191,6 +231,23 @@ LS_API bool ls_event_trigger(ls_event                *event,
                              void                    *result_arg,
                              ls_err                  *err);
 
+/**
+ * Runs the callbacks bound to an event immediately on the calling thread,
+ * without queueing a moment on the dispatcher.  No allocation takes place
+ * and no dispatcher state is modified, so this may be called for the same
+ * event from several threads at once, provided the event's bindings are not
+ * changed meanwhile.  Callbacks that unbind themselves are not supported.
+ *
+ * The ls_event_data passed to the callbacks lives on the caller's stack, and
+ * its pool is NULL.
+ *
+ * \invariant event != NULL
+ * \param[in] event The event
+ * \param[in] data The data for this event triggering
+ * \retval bool True if any callback marked the event handled.
+ */
+LS_API bool ls_event_trigger_direct(ls_event *event, void *data);
+
 /**
  * Same as ls_event_trigger except that no internal allocation takes place,
  * ensuring the trigger succeeds, even in low memory conditions.
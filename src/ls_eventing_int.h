@@ -53,6 +53,10 @@ typedef struct _ls_event_dispatch_t
 {
     void                    *source;
     ls_htable               *events;
+    /** events indexed by ls_event_id */
+    ls_event                **events_by_id;
+    size_t                  event_count;
+    size_t                  event_capacity;
     ls_event                *running;
     ls_event_moment_t       *moment_queue_tail;
     ls_event_moment_t       *next_moment;
@@ -67,5 +71,6 @@ typedef struct _ls_event_t
     ls_event_dispatch_t *dispatcher;
     const void          *source;
     const char          *name;
+    ls_event_id         id;
     ls_event_binding_t  *bindings;
 } ls_event_notifier_t;
@@ -88,7 +88,8 @@ static bool _resize_hashtable(ls_htable *tab,
     ls_hnode *node, *next_node;
     unsigned int c;
 
-    new_buckets = ls_data_malloc(buckets * sizeof(ls_hnode*));
+    new_buckets = ls_data_malloc_tagged(LS_MEM_TAG_HTABLE,
+                                        buckets * sizeof(ls_hnode*));
     if (!new_buckets)
     {
         LS_ERROR(err, LS_ERR_NO_MEMORY);
@@ -197,7 +198,8 @@ LS_API bool ls_htable_create(int buckets,
         buckets = HASH_NUM_BUCKETS;
     }
 
-    ret_table = ls_data_malloc(sizeof(struct _ls_htable));
+    ret_table = ls_data_malloc_tagged(LS_MEM_TAG_HTABLE,
+                                      sizeof(struct _ls_htable));
     if (!ret_table)
     {
         LS_ERROR(err, LS_ERR_NO_MEMORY);
@@ -205,7 +207,8 @@ LS_API bool ls_htable_create(int buckets,
     }
     memset(ret_table, 0, sizeof(struct _ls_htable));
 
-    ret_table->buckets = ls_data_malloc(buckets * sizeof(ls_hnode*));
+    ret_table->buckets = ls_data_malloc_tagged(LS_MEM_TAG_HTABLE,
+                                               buckets * sizeof(ls_hnode*));
     if (!ret_table->buckets)
     {
         ls_data_free(ret_table);
@@ -324,7 +327,7 @@ LS_API bool ls_htable_put(ls_htable *tbl,
     }
 
     // create new node
-    node = ls_data_malloc(sizeof(struct _ls_hnode));
+    node = ls_data_malloc_tagged(LS_MEM_TAG_HTABLE, sizeof(struct _ls_hnode));
     if (!node)
     {
         LS_ERROR(err, LS_ERR_NO_MEMORY);
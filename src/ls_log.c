@@ -8,10 +8,13 @@
 #include "./ls_log_int.h"
 #include "ls_log.h"
 #include "ls_mem.h"
+#include "ls_clock.h"
 
+#include <stdlib.h>
 #include <time.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 /*****************************************************************************
  * Internal type definitions
@@ -39,22 +42,81 @@ static const int level_colors[] = {
     36, // MEMTRACE: cyan
 };
 
-static ls_loglevel _ls_loglevel = LS_LOG_INFO;
+LS_API ls_loglevel _ls_log_levels[LS_LOG_MODULE_MAX] = {
+    LS_LOG_INFO,
+    LS_LOG_INFO,
+    LS_LOG_INFO,
+    LS_LOG_INFO
+};
 static ls_log_vararg_function _ls_log_vararg_function = vfprintf;
 
-typedef struct _ndc_node_int_t
+/* Deepest NDC stack that is printed; deeper pushes are only counted */
+#define NDC_MAX_DEPTH 16
+/* Longest NDC message, including the NULL; longer ones are truncated */
+#define NDC_MAX_MESSAGE 128
+
+typedef struct _ndc_entry
+{
+    uint32_t id;
+    char     message[NDC_MAX_MESSAGE];
+} ndc_entry;
+
+/* Each thread's NDC stack; entries[0] is the bottom */
+typedef struct _ndc_stack
+{
+    int       depth;
+    uint32_t  count;
+    ndc_entry entries[NDC_MAX_DEPTH];
+} ndc_stack;
+
+static bool                _ndc_enabled = true;
+static __thread ndc_stack  _ndc;
+
+/* Size of one queued log line, including the newline */
+#define LOG_RECORD_SIZE 512
+/* Ring size used when ls_log_async_start() is passed 0 */
+#define LOG_ASYNC_DEFAULT_CAPACITY 1024
+/* How long the writer sleeps when it may have missed a wakeup */
+#define LOG_ASYNC_POLL_MS 10
+
+/* One formatted line in the async ring.  {seq} is the slot's position in
+ * the ring protocol (see _async_reserve) */
+typedef struct _log_record
+{
+    size_t seq;
+    size_t len;
+    char   text[LOG_RECORD_SIZE];
+} log_record;
+
+/* State for the async logging mode: a bounded multi-producer,
+ * single-consumer ring of preformatted lines and the thread that writes
+ * them */
+typedef struct _log_async
+{
+    log_record            *records;
+    size_t                 mask;
+    ls_log_overflow_policy policy;
+    size_t                 enqueue_pos;
+    size_t                 dequeue_pos;
+    uint64_t               dropped;
+    uint64_t               reported;
+    bool                   idle;
+    bool                   stopping;
+    pthread_t              thread;
+    pthread_mutex_t        lock;
+    pthread_cond_t         wake;
+    pthread_cond_t         drained;
+} log_async;
+
+/* The line being logged; {rec} is NULL when writing synchronously */
+typedef struct _log_line
 {
-    uint32_t               id;
-    char                   *message;
-    struct _ndc_node_int_t *next;
-} *_ndc_node_t;
+    log_record *rec;
+    size_t      pos;
+} log_line;
 
-static bool        _ndc_enabled = true;
-// TODO: once we support threading, these will have to be thread-local instead
-// TODO:   of static
-static int         _ndc_depth = 0;
-static _ndc_node_t _ndc_head  = NULL;
-static uint32_t    _ndc_count = 0;
+static log_async *_async = NULL;
+static bool       _async_atexit = false;
 
 
 static int _ls_log_fixed_function(FILE *stream, const char *fmt, ...)
@@ -93,10 +155,32 @@ LS_API void ls_log_set_function(ls_log_vararg_function fn)
 
 LS_API void ls_log_set_level(ls_loglevel level)
 {
+    int i;
+
+    assert(LS_LOG_NONE <= (int)level);
+    assert(LS_LOG_MEMTRACE >= level);
+
+    for (i = 0; i < LS_LOG_MODULE_MAX; i++)
+    {
+        _ls_log_levels[i] = level;
+    }
+}
+
+LS_API void ls_log_set_module_level(ls_log_module_id module,
+                                    ls_loglevel level)
+{
+    assert(LS_LOG_MODULE_MAX > module);
     assert(LS_LOG_NONE <= (int)level);
     assert(LS_LOG_MEMTRACE >= level);
 
-    _ls_loglevel = level;
+    _ls_log_levels[module] = level;
+}
+
+LS_API ls_loglevel ls_log_get_module_level(ls_log_module_id module)
+{
+    assert(LS_LOG_MODULE_MAX > module);
+
+    return _ls_log_levels[module];
 }
 
 LS_API void ls_log_set_ndc_enabled(bool enabled)
@@ -106,41 +190,70 @@ LS_API void ls_log_set_ndc_enabled(bool enabled)
 
 LS_API ls_loglevel ls_log_get_level()
 {
-    return _ls_loglevel;
+    return _ls_log_levels[LS_LOG_MODULE_DEFAULT];
 }
 
-static void _log_ndc_stack(_ndc_node_t ndcNode)
+static void _log_vemit(log_line *line, const char *fmt, va_list ap)
 {
-    if (!ndcNode)
+    log_record *rec = line->rec;
+    int written;
+
+    if (!rec)
     {
+        _ls_log_vararg_function(stderr, fmt, ap);
         return;
     }
 
-    if (ndcNode->next)
+    // always leave room for the newline; longer lines are truncated
+    if (rec->len >= LOG_RECORD_SIZE - 2)
     {
-        _log_ndc_stack(ndcNode->next);
+        return;
     }
 
-    _ls_log_fixed_function(stderr, "{ndcid=%u; %s} ",
-                           ndcNode->id, ndcNode->message);
+    written = vsnprintf(rec->text + rec->len,
+                        LOG_RECORD_SIZE - 1 - rec->len, fmt, ap);
+    if (written > 0)
+    {
+        rec->len += (size_t)written;
+        if (rec->len > LOG_RECORD_SIZE - 2)
+        {
+            rec->len = LOG_RECORD_SIZE - 2;
+        }
+    }
 }
 
-static bool _log_prefix(ls_loglevel level)
+static void _log_emit(log_line *line, const char *fmt, ...)
+        __attribute__ ((__format__ (__printf__, 2, 3)));
+static void _log_emit(log_line *line, const char *fmt, ...)
 {
-    time_t t;
-    struct tm local;
+    va_list ap;
 
-    assert(LS_LOG_ERROR <= level);
-    assert(LS_LOG_MEMTRACE >= level);
+    va_start(ap, fmt);
+    _log_vemit(line, fmt, ap);
+    va_end(ap);
+}
 
-    if (level > _ls_loglevel)
+static void _log_ndc_stack(log_line *line)
+{
+    int depth = _ndc.depth;
+    int i;
+
+    for (i = 0; i < depth && i < NDC_MAX_DEPTH; i++)
     {
-       return false;
+        _log_emit(line, "{ndcid=%u; %s} ",
+                  _ndc.entries[i].id, _ndc.entries[i].message);
     }
+    if (depth > NDC_MAX_DEPTH)
+    {
+        _log_emit(line, "{+%d} ", depth - NDC_MAX_DEPTH);
+    }
+}
 
-    // TODO: cache time and update it asyncronously with a timer?
-    t = time(NULL);
-    if ((t == (time_t)-1) || !localtime_r(&t, &local))
+static bool _log_header(log_line *line, ls_loglevel level)
+{
+    const char *stamp = ls_clock_timestamp();
+
+    if (!stamp)
     {
         // Note: both time() and localtime_r() only fail for
         // reasons that are difficult if impossible to create,
@@ -148,66 +261,144 @@ static bool _log_prefix(ls_loglevel level)
         return false;
     }
 
-    _ls_log_fixed_function(stderr,
-            "\x1b[1m%d-%2.2d-%2.2dT%2.2d:%2.2d:%2.2d\x1b[0m [\x1b[%dm%-8s\x1b[0m]: ",
-            local.tm_year+1900,
-            local.tm_mon+1,
-            local.tm_mday,
-            local.tm_hour,
-            local.tm_min,
-            local.tm_sec,
+    _log_emit(line,
+            "\x1b[1m%s\x1b[0m [\x1b[%dm%-8s\x1b[0m]: ",
+            stamp,
             level_colors[level],
             ls_log_level_name(level));
 
+    return true;
+}
+
+/*
+ * Claim the next slot of the ring for {line}.  Lock-free: producers race on
+ * enqueue_pos, and a slot is free once its seq equals the position being
+ * claimed.  Returns false (and counts a drop) when the ring is full.
+ */
+static bool _async_reserve(log_async *async, log_line *line)
+{
+    size_t pos = __atomic_load_n(&async->enqueue_pos, __ATOMIC_RELAXED);
+
+    while (true)
+    {
+        log_record *rec = &async->records[pos & async->mask];
+        size_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&async->enqueue_pos, &pos, pos + 1,
+                                            true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+            {
+                rec->len = 0;
+                line->rec = rec;
+                line->pos = pos;
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            __atomic_add_fetch(&async->dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+        else
+        {
+            pos = __atomic_load_n(&async->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*
+ * Filter on level, then start a line: claim a ring slot in async mode and
+ * write the date/level/NDC prefix.
+ */
+static bool _log_begin(log_line *line,
+                       ls_log_module_id module,
+                       ls_loglevel level)
+{
+    log_async *async = _async;
+
+    assert(LS_LOG_ERROR <= level);
+    assert(LS_LOG_MEMTRACE >= level);
+
+    if (level > _ls_log_levels[module])
+    {
+       return false;
+    }
+
+    line->rec = NULL;
+    line->pos = 0;
+    if (async && !_async_reserve(async, line))
+    {
+        return false;
+    }
+
+    if (!_log_header(line, level))
+    {
+        if (line->rec)
+        {
+            // the slot is already ours; publish it empty
+            line->rec->len = 0;
+            __atomic_store_n(&line->rec->seq, line->pos + 1, __ATOMIC_RELEASE);
+        }
+        return false;
+    }
+
     if (_ndc_enabled)
     {
-        _log_ndc_stack(_ndc_head);
+        _log_ndc_stack(line);
     }
 
     return true;
 }
 
+static void _log_end(log_line *line)
+{
+    log_record *rec = line->rec;
+    log_async *async = _async;
+
+    if (!rec)
+    {
+        _ls_log_fixed_function(stderr, "\n");
+        return;
+    }
+
+    rec->text[rec->len++] = '\n';
+    rec->text[rec->len] = '\0';
+    __atomic_store_n(&rec->seq, line->pos + 1, __ATOMIC_RELEASE);
+
+    // never wait on the writer; if this races with it going idle it will
+    // still wake up within LOG_ASYNC_POLL_MS
+    if (async && __atomic_load_n(&async->idle, __ATOMIC_ACQUIRE))
+    {
+        pthread_cond_signal(&async->wake);
+    }
+}
+
 LS_API int ls_log_push_ndc(const char *fmt, ...)
 {
     va_list ap;
-    int messageLen;
-    _ndc_node_t newNode;
+    int messageLen = 0;
     assert(fmt);
 
-    va_start(ap, fmt);
-    if (0 > (messageLen = vsnprintf(NULL, 0, fmt, ap)))
+    if (_ndc.depth < NDC_MAX_DEPTH)
     {
-        ls_log(LS_LOG_WARN,"invalid NDC format string: '%s'", fmt);
-        return 0;
-    }
-    va_end(ap);
+        ndc_entry *entry = &_ndc.entries[_ndc.depth];
 
-    newNode = ls_data_malloc(sizeof(struct _ndc_node_int_t));
-    if (!newNode)
-    {
-        ls_log(LS_LOG_WARN, "could not push NDC: '%s' (out of memory)", fmt);
-        return 0;
+        va_start(ap, fmt);
+        messageLen = vsnprintf(entry->message, NDC_MAX_MESSAGE, fmt, ap);
+        va_end(ap);
+        entry->id = _ndc.count++;
     }
 
-    memset(newNode, 0, sizeof(struct _ndc_node_int_t));
-    newNode->message = ls_data_malloc(messageLen+1);
-    if (!newNode->message)
+    if (0 > messageLen)
     {
-        ls_data_free(newNode);
-        ls_log(LS_LOG_WARN, "could not push NDC: '%s' (out of memory)", fmt);
+        ls_log(LS_LOG_WARN,"invalid NDC format string: '%s'", fmt);
         return 0;
     }
 
-    va_start(ap, fmt);
-    messageLen = vsprintf(newNode->message, fmt, ap);
-    assert(0 <= messageLen);
-    va_end(ap);
-
-    newNode->id   = _ndc_count++;
-    newNode->next = _ndc_head;
-    _ndc_head     = newNode;
-
-    return ++_ndc_depth;
+    return ++_ndc.depth;
 }
 
 LS_API void ls_log_pop_ndc(int ndc_depth)
@@ -219,49 +410,72 @@ LS_API void ls_log_pop_ndc(int ndc_depth)
         return;
     }
 
-    if (ndc_depth != _ndc_depth)
+    if (ndc_depth != _ndc.depth)
     {
         ls_log(LS_LOG_WARN, "ndc depth mismatch on pop (expected %d, got %d)",
-               _ndc_depth, ndc_depth);
+               _ndc.depth, ndc_depth);
     }
 
-    while (_ndc_head && _ndc_depth >= ndc_depth)
+    if (_ndc.depth >= ndc_depth)
     {
-        _ndc_node_t prevHead;
-        --_ndc_depth;
-        prevHead = _ndc_head;
-        _ndc_head = prevHead->next;
-
-        ls_data_free(prevHead->message);
-        ls_data_free(prevHead);
+        _ndc.depth = ndc_depth - 1;
     }
 }
 
 LS_API void ls_log(ls_loglevel level, const char *fmt, ...)
 {
     va_list ap;
+    log_line line;
 
     assert(fmt);
 
-    if (!_log_prefix(level))
+    if (!_log_begin(&line, LS_LOG_MODULE_DEFAULT, level))
     {
         return;
     }
 
     va_start(ap, fmt);
-    _ls_log_vararg_function(stderr, fmt, ap);
+    _log_vemit(&line, fmt, ap);
+    va_end(ap);
+    _log_end(&line);
+}
+
+void _ls_log_vmodule(ls_log_module_id module, ls_loglevel level,
+                     const char *fmt, va_list ap)
+{
+    log_line line;
+
+    assert(LS_LOG_MODULE_MAX > module);
+    assert(fmt);
+
+    if (!_log_begin(&line, module, level))
+    {
+        return;
+    }
+
+    _log_vemit(&line, fmt, ap);
+    _log_end(&line);
+}
+
+LS_API void ls_log_module(ls_log_module_id module, ls_loglevel level,
+                          const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    _ls_log_vmodule(module, level, fmt, ap);
     va_end(ap);
-    _ls_log_fixed_function(stderr, "\n");
 }
 
 LS_API void ls_log_err(
         ls_loglevel level, ls_err *err, const char *fmt, ...)
 {
     va_list ap;
+    log_line line;
 
     assert(fmt);
 
-    if (!_log_prefix(level))
+    if (!_log_begin(&line, LS_LOG_MODULE_DEFAULT, level))
     {
         return;
     }
@@ -271,13 +485,13 @@ LS_API void ls_log_err(
         // err->code is almost always useless, since err->message is usually
         // already set with ls_err_message() in the LS_ERROR
         // macro.
-        _ls_log_fixed_function(stderr, "reason(%s): ", err->message);
+        _log_emit(&line, "reason(%s): ", err->message);
     }
 
     va_start(ap, fmt);
-    _ls_log_vararg_function(stderr, fmt, ap);
+    _log_vemit(&line, fmt, ap);
     va_end(ap);
-    _ls_log_fixed_function(stderr, "\n");
+    _log_end(&line);
 }
 
 LS_API void ls_log_chunked(ls_loglevel level,
@@ -285,17 +499,18 @@ LS_API void ls_log_chunked(ls_loglevel level,
                                    const char *fmt, ...)
 {
     va_list ap;
+    log_line line;
 
     assert(generator_fn);
     assert(fmt);
 
-    if (!_log_prefix(level))
+    if (!_log_begin(&line, LS_LOG_MODULE_DEFAULT, level))
     {
         return;
     }
 
     va_start(ap, fmt);
-    _ls_log_vararg_function(stderr, fmt, ap);
+    _log_vemit(&line, fmt, ap);
     va_end(ap);
 
     while (true)
@@ -313,11 +528,11 @@ LS_API void ls_log_chunked(ls_loglevel level,
 
         if (0 == len)
         {
-            _ls_log_fixed_function(stderr, "%s", chunk);
+            _log_emit(&line, "%s", chunk);
         }
         else
         {
-            _ls_log_fixed_function(stderr, "%.*s", (int)len, chunk);
+            _log_emit(&line, "%.*s", (int)len, chunk);
         }
 
         if (free_fn)
@@ -326,5 +541,207 @@ LS_API void ls_log_chunked(ls_loglevel level,
         }
     }
 
-    _ls_log_fixed_function(stderr, "\n");
+    _log_end(&line);
+}
+
+static void _async_timed_wait(pthread_cond_t *cond, pthread_mutex_t *lock)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += LOG_ASYNC_POLL_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(cond, lock, &deadline);
+}
+
+static void _async_report_dropped(log_async *async)
+{
+    uint64_t dropped;
+    log_line line = { NULL, 0 };
+
+    if (async->policy != LS_LOG_OVERFLOW_COUNT)
+    {
+        return;
+    }
+
+    dropped = __atomic_load_n(&async->dropped, __ATOMIC_RELAXED);
+    if (dropped == async->reported)
+    {
+        return;
+    }
+
+    // written straight from the writer thread; no NDC, it isn't ours
+    if (_log_header(&line, LS_LOG_WARN))
+    {
+        _ls_log_fixed_function(stderr, "dropped %llu log messages\n",
+                               (unsigned long long)(dropped - async->reported));
+    }
+    async->reported = dropped;
+}
+
+static void *_async_run(void *arg)
+{
+    log_async *async = arg;
+
+    while (true)
+    {
+        size_t pos = __atomic_load_n(&async->dequeue_pos, __ATOMIC_RELAXED);
+        log_record *rec = &async->records[pos & async->mask];
+
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) == pos + 1)
+        {
+            _async_report_dropped(async);
+            if (rec->len)
+            {
+                _ls_log_fixed_function(stderr, "%.*s",
+                                       (int)rec->len, rec->text);
+            }
+            __atomic_store_n(&rec->seq, pos + async->mask + 1,
+                             __ATOMIC_RELEASE);
+            __atomic_store_n(&async->dequeue_pos, pos + 1, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        pthread_mutex_lock(&async->lock);
+        _async_report_dropped(async);
+        pthread_cond_broadcast(&async->drained);
+        if (async->stopping &&
+            pos == __atomic_load_n(&async->enqueue_pos, __ATOMIC_ACQUIRE))
+        {
+            pthread_mutex_unlock(&async->lock);
+            break;
+        }
+        __atomic_store_n(&async->idle, true, __ATOMIC_RELEASE);
+        _async_timed_wait(&async->wake, &async->lock);
+        __atomic_store_n(&async->idle, false, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&async->lock);
+    }
+
+    return NULL;
+}
+
+LS_API bool ls_log_async_start(size_t capacity,
+                               ls_log_overflow_policy policy,
+                               ls_err *err)
+{
+    log_async *async;
+    size_t size = 2;
+    size_t i;
+    int rc;
+
+    if (_async)
+    {
+        LS_ERROR(err, LS_ERR_INVALID_STATE);
+        return false;
+    }
+
+    if (0 == capacity)
+    {
+        capacity = LOG_ASYNC_DEFAULT_CAPACITY;
+    }
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    async = ls_data_calloc_tagged(LS_MEM_TAG_LOG, 1, sizeof(log_async));
+    if (!async)
+    {
+        LS_ERROR(err, LS_ERR_NO_MEMORY);
+        return false;
+    }
+    async->records = ls_data_calloc_tagged(LS_MEM_TAG_LOG,
+                                           size, sizeof(log_record));
+    if (!async->records)
+    {
+        ls_data_free(async);
+        LS_ERROR(err, LS_ERR_NO_MEMORY);
+        return false;
+    }
+    for (i = 0; i < size; i++)
+    {
+        async->records[i].seq = i;
+    }
+    async->mask = size - 1;
+    async->policy = policy;
+    pthread_mutex_init(&async->lock, NULL);
+    pthread_cond_init(&async->wake, NULL);
+    pthread_cond_init(&async->drained, NULL);
+
+    /* pthread_create() returns its error rather than setting errno */
+    rc = pthread_create(&async->thread, NULL, _async_run, async);
+    if (rc != 0)
+    {
+        LS_ERROR(err, -rc);
+        pthread_cond_destroy(&async->drained);
+        pthread_cond_destroy(&async->wake);
+        pthread_mutex_destroy(&async->lock);
+        ls_data_free(async->records);
+        ls_data_free(async);
+        return false;
+    }
+
+    if (!_async_atexit)
+    {
+        // flush whatever is queued if the program exits without stopping
+        atexit(ls_log_async_stop);
+        _async_atexit = true;
+    }
+
+    _async = async;
+    return true;
+}
+
+LS_API void ls_log_async_flush(void)
+{
+    log_async *async = _async;
+    size_t target;
+
+    if (!async)
+    {
+        return;
+    }
+
+    target = __atomic_load_n(&async->enqueue_pos, __ATOMIC_ACQUIRE);
+    pthread_mutex_lock(&async->lock);
+    while (__atomic_load_n(&async->dequeue_pos, __ATOMIC_ACQUIRE) < target)
+    {
+        pthread_cond_signal(&async->wake);
+        _async_timed_wait(&async->drained, &async->lock);
+    }
+    pthread_mutex_unlock(&async->lock);
+}
+
+LS_API void ls_log_async_stop(void)
+{
+    log_async *async = _async;
+
+    if (!async)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&async->lock);
+    async->stopping = true;
+    pthread_cond_signal(&async->wake);
+    pthread_mutex_unlock(&async->lock);
+    pthread_join(async->thread, NULL);
+
+    _async = NULL;
+    pthread_cond_destroy(&async->drained);
+    pthread_cond_destroy(&async->wake);
+    pthread_mutex_destroy(&async->lock);
+    ls_data_free(async->records);
+    ls_data_free(async);
+}
+
+LS_API uint64_t ls_log_async_dropped(void)
+{
+    log_async *async = _async;
+
+    return async ? __atomic_load_n(&async->dropped, __ATOMIC_RELAXED) : 0;
 }
@@ -0,0 +1,589 @@
+/**
+ * \file
+ *
+ * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
+ */
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "./ls_log_int.h"
+#include "ls_log.h"
+#include "ls_log_binary.h"
+
+/* Longest string argument copied into a message */
+#define MAX_STRING_ARG 255
+
+/* An open binary log */
+typedef struct _log_binary
+{
+    int       fd;
+    uint8_t  *base;
+    size_t    size;
+    size_t    used;
+    uint32_t  epoch;
+    uint64_t  dropped;
+} log_binary;
+
+static log_binary     *_binary = NULL;
+static uint32_t        _binary_epoch = 0;
+static uint32_t        _site_count = 0;
+static pthread_mutex_t _site_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Marks a site whose format can't be stored; it is always logged as text */
+static const char _SIG_TEXT_ONLY[] = "!";
+
+/*
+ * Work out the type of each argument {fmt} takes.  Returns false for
+ * conversions that cannot be copied as plain values, or too many arguments.
+ */
+static bool _parse_signature(const char *fmt, char *sig, size_t max)
+{
+    size_t n = 0;
+    const char *p = fmt;
+
+    while (*p)
+    {
+        char length = 0;
+        char type;
+
+        if (*p++ != '%')
+        {
+            continue;
+        }
+        if (*p == '%')
+        {
+            p++;
+            continue;
+        }
+
+        while (*p && strchr("-+ #0'", *p))
+        {
+            p++;
+        }
+        if (*p == '*')
+        {
+            if (n >= max)
+            {
+                return false;
+            }
+            sig[n++] = LS_LOG_ARG_INT;
+            p++;
+        }
+        while (isdigit((unsigned char)*p))
+        {
+            p++;
+        }
+        if (*p == '.')
+        {
+            p++;
+            if (*p == '*')
+            {
+                if (n >= max)
+                {
+                    return false;
+                }
+                sig[n++] = LS_LOG_ARG_INT;
+                p++;
+            }
+            while (isdigit((unsigned char)*p))
+            {
+                p++;
+            }
+        }
+
+        switch (*p)
+        {
+        case 'h':
+            p += (p[1] == 'h') ? 2 : 1;
+            break;
+        case 'l':
+            if (p[1] == 'l')
+            {
+                length = LS_LOG_ARG_LLONG;
+                p += 2;
+            }
+            else
+            {
+                length = LS_LOG_ARG_LONG;
+                p++;
+            }
+            break;
+        case 'q':
+            length = LS_LOG_ARG_LLONG;
+            p++;
+            break;
+        case 'L':
+        case 'z':
+        case 'j':
+        case 't':
+            length = *p++;
+            break;
+        default:
+            break;
+        }
+
+        switch (*p)
+        {
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            type = (length && length != 'L') ? length :
+                   (length == 'L') ? LS_LOG_ARG_LLONG : LS_LOG_ARG_INT;
+            break;
+        case 'c':
+            if (length)
+            {
+                return false;
+            }
+            type = LS_LOG_ARG_INT;
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            type = (length == 'L') ? LS_LOG_ARG_LDOUBLE : LS_LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            if (length)
+            {
+                return false;
+            }
+            type = LS_LOG_ARG_STRING;
+            break;
+        case 'p':
+            type = LS_LOG_ARG_POINTER;
+            break;
+        default:
+            // %n, %m, wide characters, or a malformed conversion
+            return false;
+        }
+        p++;
+
+        if (n >= max)
+        {
+            return false;
+        }
+        sig[n++] = type;
+    }
+
+    sig[n] = '\0';
+    return true;
+}
+
+static inline size_t _align8(size_t len)
+{
+    return (len + 7) & ~(size_t)7;
+}
+
+/*
+ * Reserve {len} bytes of the file, or count a drop.  The size is stored
+ * straight away, so that readers can step over a record that is never
+ * committed.
+ */
+static uint8_t *_reserve(log_binary *binary, size_t len)
+{
+    size_t off = __atomic_fetch_add(&binary->used, len, __ATOMIC_RELAXED);
+    ls_log_record_header *hdr;
+
+    if (off + len > binary->size)
+    {
+        __atomic_add_fetch(&binary->dropped, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    hdr = (ls_log_record_header *)(binary->base + off);
+    __atomic_store_n(&hdr->size, (uint32_t)len, __ATOMIC_RELAXED);
+    return binary->base + off;
+}
+
+/* Fill in the rest of the header; the kind goes last, which makes the
+   record visible */
+static void _commit(uint8_t *rec, ls_log_record_kind kind,
+                    ls_log_site *site, ls_log_module_id module,
+                    ls_loglevel level)
+{
+    ls_log_record_header *hdr = (ls_log_record_header *)rec;
+
+    hdr->level = (uint8_t)level;
+    hdr->module = (uint8_t)module;
+    hdr->nargs = (uint8_t)strlen(site->sig);
+    hdr->site = site->id;
+    __atomic_store_n(&hdr->kind, (uint8_t)kind, __ATOMIC_RELEASE);
+}
+
+/*
+ * Give {site} an ID and write its description to {binary}, once per site
+ * and log.  Returns false if the site has to be logged as text.  If the
+ * description doesn't fit, {site} is left undescribed.
+ */
+static bool _describe_site(log_binary *binary, ls_log_site *site,
+                           ls_log_module_id module, ls_loglevel level,
+                           const char *fmt)
+{
+    size_t fmt_len, file_len, sig_len, len;
+    uint32_t line;
+    uint8_t *rec;
+    bool ret = true;
+
+    pthread_mutex_lock(&_site_lock);
+    if (site->epoch == binary->epoch)
+    {
+        goto done;
+    }
+
+    if (0 == site->id)
+    {
+        if (!_parse_signature(fmt, site->sig, LS_LOG_SITE_MAX_ARGS))
+        {
+            strcpy(site->sig, _SIG_TEXT_ONLY);
+        }
+        site->id = ++_site_count;
+    }
+    if (0 == strcmp(site->sig, _SIG_TEXT_ONLY))
+    {
+        ret = false;
+        goto done;
+    }
+
+    fmt_len = strlen(fmt) + 1;
+    file_len = strlen(site->file) + 1;
+    sig_len = strlen(site->sig) + 1;
+    len = _align8(sizeof(ls_log_record_header) + sizeof(line) +
+                  fmt_len + file_len + sig_len);
+    rec = _reserve(binary, len);
+    if (!rec)
+    {
+        // the site stays undescribed, so its messages are dropped too
+        goto done;
+    }
+
+    line = (uint32_t)site->line;
+    memcpy(rec + sizeof(ls_log_record_header), &line, sizeof(line));
+    len = sizeof(ls_log_record_header) + sizeof(line);
+    memcpy(rec + len, fmt, fmt_len);
+    memcpy(rec + len + fmt_len, site->file, file_len);
+    memcpy(rec + len + fmt_len + file_len, site->sig, sig_len);
+    _commit(rec, LS_LOG_RECORD_SITE, site, module, level);
+
+    __atomic_store_n(&site->epoch, binary->epoch, __ATOMIC_RELEASE);
+
+done:
+    pthread_mutex_unlock(&_site_lock);
+    return ret;
+}
+
+/* The size of a message from {site} with arguments {ap} */
+static size_t _message_size(const ls_log_site *site, va_list ap)
+{
+    size_t len = sizeof(ls_log_record_header) + sizeof(uint64_t);
+    const char *c;
+
+    for (c = site->sig; *c; c++)
+    {
+        switch (*c)
+        {
+        case LS_LOG_ARG_INT:
+            (void)va_arg(ap, int);
+            len += sizeof(int64_t);
+            break;
+        case LS_LOG_ARG_LONG:
+            (void)va_arg(ap, long);
+            len += sizeof(int64_t);
+            break;
+        case LS_LOG_ARG_LLONG:
+            (void)va_arg(ap, long long);
+            len += sizeof(int64_t);
+            break;
+        case LS_LOG_ARG_SIZE:
+            (void)va_arg(ap, size_t);
+            len += sizeof(int64_t);
+            break;
+        case LS_LOG_ARG_INTMAX:
+            (void)va_arg(ap, intmax_t);
+            len += sizeof(int64_t);
+            break;
+        case LS_LOG_ARG_PTRDIFF:
+            (void)va_arg(ap, ptrdiff_t);
+            len += sizeof(int64_t);
+            break;
+        case LS_LOG_ARG_DOUBLE:
+            (void)va_arg(ap, double);
+            len += sizeof(double);
+            break;
+        case LS_LOG_ARG_LDOUBLE:
+            (void)va_arg(ap, long double);
+            len += sizeof(double);
+            break;
+        case LS_LOG_ARG_POINTER:
+            (void)va_arg(ap, void *);
+            len += sizeof(uint64_t);
+            break;
+        case LS_LOG_ARG_STRING:
+        {
+            const char *str = va_arg(ap, const char *);
+            len += sizeof(uint32_t);
+            if (str)
+            {
+                len += strnlen(str, MAX_STRING_ARG);
+            }
+            break;
+        }
+        default:
+            assert(false);
+        }
+    }
+
+    return _align8(len);
+}
+
+/* Copy the arguments {ap} to {out} */
+static void _write_args(const ls_log_site *site, uint8_t *out, va_list ap)
+{
+    const char *c;
+
+    for (c = site->sig; *c; c++)
+    {
+        int64_t ival;
+        double dval;
+        uint64_t pval;
+
+        switch (*c)
+        {
+        case LS_LOG_ARG_INT:
+            ival = va_arg(ap, int);
+            goto write_int;
+        case LS_LOG_ARG_LONG:
+            ival = va_arg(ap, long);
+            goto write_int;
+        case LS_LOG_ARG_LLONG:
+            ival = va_arg(ap, long long);
+            goto write_int;
+        case LS_LOG_ARG_SIZE:
+            ival = (int64_t)va_arg(ap, size_t);
+            goto write_int;
+        case LS_LOG_ARG_INTMAX:
+            ival = va_arg(ap, intmax_t);
+            goto write_int;
+        case LS_LOG_ARG_PTRDIFF:
+            ival = va_arg(ap, ptrdiff_t);
+write_int:
+            memcpy(out, &ival, sizeof(ival));
+            out += sizeof(ival);
+            break;
+        case LS_LOG_ARG_DOUBLE:
+            dval = va_arg(ap, double);
+            goto write_double;
+        case LS_LOG_ARG_LDOUBLE:
+            dval = (double)va_arg(ap, long double);
+write_double:
+            memcpy(out, &dval, sizeof(dval));
+            out += sizeof(dval);
+            break;
+        case LS_LOG_ARG_POINTER:
+            pval = (uintptr_t)va_arg(ap, void *);
+            memcpy(out, &pval, sizeof(pval));
+            out += sizeof(pval);
+            break;
+        case LS_LOG_ARG_STRING:
+        {
+            const char *str = va_arg(ap, const char *);
+            uint32_t len = LS_LOG_BINARY_NULL_STRING;
+
+            if (str)
+            {
+                len = (uint32_t)strnlen(str, MAX_STRING_ARG);
+            }
+            memcpy(out, &len, sizeof(len));
+            out += sizeof(len);
+            if (str)
+            {
+                memcpy(out, str, len);
+                out += len;
+            }
+            break;
+        }
+        default:
+            assert(false);
+        }
+    }
+}
+
+/* Write a message to {binary}; false if it has to be logged as text */
+static bool _binary_vlog(log_binary *binary, ls_log_site *site,
+                         ls_log_module_id module, ls_loglevel level,
+                         const char *fmt, va_list ap)
+{
+    struct timespec now;
+    uint64_t usec;
+    size_t len;
+    uint8_t *rec;
+    va_list sizing;
+
+    if (__atomic_load_n(&site->epoch, __ATOMIC_ACQUIRE) != binary->epoch)
+    {
+        if (!_describe_site(binary, site, module, level, fmt))
+        {
+            return false;
+        }
+        if (__atomic_load_n(&site->epoch, __ATOMIC_ACQUIRE) != binary->epoch)
+        {
+            // the log is full
+            return true;
+        }
+    }
+
+    va_copy(sizing, ap);
+    len = _message_size(site, sizing);
+    va_end(sizing);
+
+    rec = _reserve(binary, len);
+    if (!rec)
+    {
+        // dropped, and counted
+        return true;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    usec = (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+    memcpy(rec + sizeof(ls_log_record_header), &usec, sizeof(usec));
+    _write_args(site, rec + sizeof(ls_log_record_header) + sizeof(usec), ap);
+    _commit(rec, LS_LOG_RECORD_MESSAGE, site, module, level);
+
+    return true;
+}
+
+LS_API void ls_log_site_log(ls_log_site *site,
+                            ls_log_module_id module,
+                            ls_loglevel level,
+                            const char *fmt, ...)
+{
+    log_binary *binary = _binary;
+    va_list ap;
+    bool logged = false;
+
+    assert(site);
+    assert(fmt);
+
+    va_start(ap, fmt);
+    if (binary && level <= _ls_log_levels[module])
+    {
+        logged = _binary_vlog(binary, site, module, level, fmt, ap);
+    }
+    va_end(ap);
+
+    if (!logged)
+    {
+        va_start(ap, fmt);
+        _ls_log_vmodule(module, level, fmt, ap);
+        va_end(ap);
+    }
+}
+
+LS_API bool ls_log_binary_open(const char *path, size_t size, ls_err *err)
+{
+    log_binary *binary;
+    ls_log_binary_header hdr;
+
+    assert(path);
+
+    if (_binary)
+    {
+        LS_ERROR(err, LS_ERR_INVALID_STATE);
+        return false;
+    }
+    if (size < sizeof(hdr))
+    {
+        LS_ERROR(err, LS_ERR_INVALID_ARG);
+        return false;
+    }
+
+    binary = ls_data_calloc_tagged(LS_MEM_TAG_LOG, 1, sizeof(log_binary));
+    if (!binary)
+    {
+        LS_ERROR(err, LS_ERR_NO_MEMORY);
+        return false;
+    }
+
+    binary->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (binary->fd < 0)
+    {
+        LS_ERROR(err, -errno);
+        goto error;
+    }
+    if (ftruncate(binary->fd, (off_t)size) != 0)
+    {
+        LS_ERROR(err, -errno);
+        goto error;
+    }
+    binary->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        binary->fd, 0);
+    if (binary->base == MAP_FAILED)
+    {
+        binary->base = NULL;
+        LS_ERROR(err, -errno);
+        goto error;
+    }
+    binary->size = size;
+
+    memcpy(hdr.magic, LS_LOG_BINARY_MAGIC, sizeof(hdr.magic));
+    hdr.version = LS_LOG_BINARY_VERSION;
+    hdr.byte_order = LS_LOG_BINARY_BYTE_ORDER;
+    memcpy(binary->base, &hdr, sizeof(hdr));
+    binary->used = _align8(sizeof(hdr));
+
+    // sites describe themselves again in each new log
+    binary->epoch = ++_binary_epoch;
+    _binary = binary;
+    return true;
+
+error:
+    if (binary->fd >= 0)
+    {
+        close(binary->fd);
+    }
+    ls_data_free(binary);
+    return false;
+}
+
+LS_API void ls_log_binary_close(void)
+{
+    log_binary *binary = _binary;
+    size_t used;
+
+    if (!binary)
+    {
+        return;
+    }
+    _binary = NULL;
+
+    used = binary->used < binary->size ? binary->used : binary->size;
+    munmap(binary->base, binary->size);
+    if (ftruncate(binary->fd, (off_t)used) != 0)
+    {
+        LS_LOG(LS_LOG_WARN, "could not trim binary log: %s", strerror(errno));
+    }
+    close(binary->fd);
+    ls_data_free(binary);
+}
+
+LS_API uint64_t ls_log_binary_dropped(void)
+{
+    log_binary *binary = _binary;
+
+    return binary ? __atomic_load_n(&binary->dropped, __ATOMIC_RELAXED) : 0;
+}
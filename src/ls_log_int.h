@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include "ls_log.h"
 #include "ls_mem.h"
 
 /**
@@ -23,3 +24,10 @@
  */
 void _ls_log_set_memory_funcs(ls_data_malloc_func allocator,
                               ls_data_free_func   deallocator);
+
+/**
+ * ls_log_module() with a va_list.  Used for the text fallback of binary
+ * logging.
+ */
+void _ls_log_vmodule(ls_log_module_id module, ls_loglevel level,
+                     const char *fmt, va_list ap);
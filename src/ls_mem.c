@@ -4,11 +4,14 @@
  * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
  */
 
+#define LS_LOG_FILE_MODULE LS_LOG_MODULE_MEM
+
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "ls_basics.h"
 #include "ls_str.h"
@@ -21,26 +24,14 @@ ls_data_malloc_func  _malloc_func  = malloc;
 ls_data_realloc_func _realloc_func = realloc;
 ls_data_free_func    _free_func    = free;
 
-/*
- * malloc and free wrappers, _malloc_fnc checks errors and add cleaners as needed.
- */
-static bool _malloc_fnc(ls_pool *pool, size_t size, void **ptr,
-                        ls_pool_cleaner cleaner, ls_err *err)
-{
-    void *ret = ls_data_malloc(size);
-    if (!ret)
-    {
-        LS_ERROR(err, LS_ERR_NO_MEMORY);
-        return false;
-    }
-    if (pool && cleaner && !ls_pool_add_cleaner(pool, cleaner, ret, err))
-    {
-        ls_data_free(ret);
-        return false;
-    }
+/* Alignment of pool allocations, enough for any basic type */
+#define POOL_ALIGNMENT (2 * sizeof(void *))
+/* New pages double in size, up to this multiple of the pool's page size */
+#define POOL_PAGE_GROWTH_LIMIT 64
 
-    *ptr = ret;
-    return true;
+static inline size_t _pool_align(size_t size)
+{
+    return (size + POOL_ALIGNMENT - 1) & ~(POOL_ALIGNMENT - 1);
 }
 
 /*
@@ -48,13 +39,17 @@ static bool _malloc_fnc(ls_pool *pool, size_t size, void **ptr,
  */
 static bool _page_malloc(_pool_page page, size_t size, void **ptr)
 {
-    size_t will_use = page->used;
+    size_t will_use;
 
-    /* may need word-boundary alignment here... */
-    /* ... but keeping it simple until we do */
+    if (!page)
+    {
+        return false;
+    }
+
+    will_use = _pool_align(page->used);
 
     /* if request will not fit in page, failure */
-    if (size > (page->size - will_use))
+    if (will_use > page->size || size > (page->size - will_use))
     {
         return false;
     }
@@ -64,125 +59,603 @@ static bool _page_malloc(_pool_page page, size_t size, void **ptr)
     return true;
 }
 
-// page cleaner
-static void _free_page(void *arg)
+static void _free_pages(_pool_page page)
 {
-    _pool_page page = (struct pool_page*)arg;
-
-    ls_data_free(page->block);
-    ls_data_free(page);
+    while (page)
+    {
+        _pool_page next = page->next;
+        ls_data_free(page);
+        page = next;
+    }
 }
 
-/* Allocate and add a new page to the given pool
-   may result in a LS_ERR_NO_MEMORY err,
-   increments pool->size as side-effect */
+/* Make a new current page for the given pool, reusing a spare page if
+   there is one.  May result in a LS_ERR_NO_MEMORY err, increments
+   pool->size as side-effect of allocating */
 static bool _add_page(ls_pool *pool, ls_err* err)
 {
-    _pool_page page;
+    _pool_page page = pool->spare;
 
-    if (!_malloc_fnc(pool, sizeof(struct pool_page), (void *) &page, NULL, err))
+    if (page)
     {
-        return false;
+        pool->spare = page->next;
     }
-    if (!_malloc_fnc(pool, pool->page_size, &(page->block), NULL, err))
+    else
+    {
+        size_t header = _pool_align(sizeof(struct pool_page));
+        size_t size = pool->next_page_size;
+
+        /* the page header and its block share one allocation */
+        page = ls_data_malloc(header + size);
+        if (!page)
+        {
+            LS_ERROR(err, LS_ERR_NO_MEMORY);
+            return false;
+        }
+        page->block = (uint8_t *)page + header;
+        page->size  = size;
+        pool->size += size;
+
+        if (pool->next_page_size < pool->page_size * POOL_PAGE_GROWTH_LIMIT)
+        {
+            pool->next_page_size *= 2;
+        }
+    }
+
+    page->used  = 0;
+    page->next  = pool->pages;
+    pool->pages = page;
+
+    return true;
+}
+
+/* Allocate from the pool's pages; size must be <= pool->page_size */
+static bool _pool_page_alloc(ls_pool *pool, size_t size, void **ptr,
+                             ls_err *err)
+{
+    if (_page_malloc(pool->pages, size, ptr))
+    {
+        return true;
+    }
+    if (!_add_page(pool, err))
     {
-        ls_data_free(page);
         return false;
     }
-    if (!ls_pool_add_cleaner(pool, _free_page, page, err))
+    /* size will fit on an empty page */
+    return _page_malloc(pool->pages, size, ptr);
+}
+
+/* Add a cleaner, stored in the pool's pages when they are big enough.
+   {size} is the size of a direct allocation the cleaner frees, or 0 */
+static bool _add_cleaner(ls_pool *pool,
+                         ls_pool_cleaner callback,
+                         void *arg,
+                         size_t size,
+                         ls_err *err)
+{
+    _pool_cleaner_ctx ctx;
+    bool heap = pool->page_size < sizeof(struct pool_cleaner_ctx);
+
+    if (heap)
+    {
+        ctx = ls_data_malloc(sizeof(struct pool_cleaner_ctx));
+        if (!ctx)
+        {
+            LS_ERROR(err, LS_ERR_NO_MEMORY);
+            return false;
+        }
+    }
+    else if (!_pool_page_alloc(pool, sizeof(struct pool_cleaner_ctx),
+                               (void *) &ctx, err))
     {
-        ls_data_free(page->block);
-        ls_data_free(page);
         return false;
     }
 
-    page->size  = pool->page_size;
-    page->used  = 0;
-    page->next  = pool->pages;
-    pool->pages = page;
-    pool->size += pool->page_size;
+    ctx->cleaner = callback;
+    ctx->arg = arg;
+    ctx->size = size;
+    ctx->heap = heap;
 
+    if (!pool->cleaners)
+    {
+        pool->tail = ctx;
+    }
+    ctx->next = pool->cleaners;
+    pool->cleaners = ctx;
     return true;
 }
 
+/* Run the cleaners added since {stop} was the newest, newest first */
+static void _run_cleaners(ls_pool *pool, _pool_cleaner_ctx stop)
+{
+    while (pool->cleaners != stop)
+    {
+        _pool_cleaner_ctx ctx = pool->cleaners;
+
+        pool->cleaners = ctx->next;
+        (*ctx->cleaner)(ctx->arg);
+        pool->size -= ctx->size;
+        if (ctx->heap)
+        {
+            ls_data_free(ctx);
+        }
+    }
+    if (!pool->cleaners)
+    {
+        pool->tail = NULL;
+    }
+}
+
 static bool _paging_enabled = true;
 void ls_pool_enable_paging(bool enable)
 {
     _paging_enabled = enable;
 }
 
-/* exported functions */
-LS_API void ls_data_set_memory_funcs(ls_data_malloc_func malloc_func,
-                                     ls_data_realloc_func realloc_func,
-                                     ls_data_free_func free_func)
+/*
+ * Every block handed out by ls_data_malloc is preceded by a mem_block
+ * header recording its requested size, accounting tag and cache size
+ * class, so ls_data_free can account for it and find the right cache
+ * without being told the size.
+ *
+ * Per-thread small block caches: when enabled, small blocks still come
+ * from _malloc_func one at a time, but freed ones are kept around for
+ * reuse instead of going back to _free_func.
+ */
+#define MEM_CLASS_COUNT 8
+#define MEM_CLASS_NONE  0xffff
+#define MEM_CLASS_MAX   256
+/* Blocks of one class a thread keeps before returning a batch */
+#define MEM_CACHE_MAX   64
+/* Blocks moved between a thread and the central pool at once */
+#define MEM_CACHE_BATCH 32
+
+typedef union _mem_block
 {
-    _malloc_func = (malloc_func) ? malloc_func : malloc;
-    _realloc_func = (realloc_func) ? realloc_func : realloc;
-    _free_func = (free_func) ? free_func : free;
+    struct
+    {
+        union
+        {
+            /* requested size while in use */
+            size_t            size;
+            /* next free block while cached */
+            union _mem_block *next;
+        } u;
+        /* size class, or MEM_CLASS_NONE for uncached blocks */
+        uint16_t              cls;
+        /* ls_mem_tag the block is accounted to */
+        uint16_t              tag;
+    } h;
+    /* keep the user area aligned like the pool */
+    uint8_t                   pad[POOL_ALIGNMENT];
+} mem_block;
+
+/* A batch parked in the central pool; overlays the user area of its
+   first block, which is at least 16 bytes */
+typedef struct _mem_batch
+{
+    union _mem_block *next_batch;
+    size_t            count;
+} mem_batch;
+
+typedef struct _mem_thread_cache
+{
+    mem_block *free[MEM_CLASS_COUNT];
+    size_t     count[MEM_CLASS_COUNT];
+    bool       registered;
+} mem_thread_cache;
+
+static const size_t _class_sizes[MEM_CLASS_COUNT] =
+    { 16, 32, 48, 64, 96, 128, 192, 256 };
+/* size class for each 16 byte step up to MEM_CLASS_MAX */
+static const uint8_t _class_for[MEM_CLASS_MAX / 16] =
+    { 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7 };
+
+static bool _caches_enabled = false;
+static __thread mem_thread_cache _tcache;
+static pthread_mutex_t _central_lock = PTHREAD_MUTEX_INITIALIZER;
+static mem_block *_central[MEM_CLASS_COUNT];
+static pthread_key_t _tcache_key;
+static pthread_once_t _tcache_once = PTHREAD_ONCE_INIT;
+
+/* Accounting; all updates are relaxed atomics */
+static ls_mem_tag_stats _tag_stats[LS_MEM_TAG_MAX];
+static ls_mem_tag_stats _total_stats;
+static uint64_t _histogram[LS_MEM_HISTOGRAM_BUCKETS];
+
+static const char *_tag_names[LS_MEM_TAG_MAX] =
+    { "other", "tube", "htable", "eventing", "cbor", "log" };
+
+static inline mem_block *_block_of(void *ptr)
+{
+    return (mem_block *)ptr - 1;
 }
 
-LS_API void ls_data_free(void *ptr)
+static inline mem_batch *_batch_of(mem_block *b)
 {
-    if (ptr)
+    return (mem_batch *)(b + 1);
+}
+
+static void _stats_add(ls_mem_tag_stats *s, size_t size)
+{
+    size_t live = __atomic_add_fetch(&s->live_bytes, size, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&s->peak_bytes, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&s->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->bytes_allocated, size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->live_objects, 1, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&s->peak_bytes, &peak, live, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
     {
-        ls_log(LS_LOG_MEMTRACE, "mem.c:free %p", ptr);
+    }
+}
 
-        _free_func(ptr);
+static void _stats_remove(ls_mem_tag_stats *s, size_t size)
+{
+    __atomic_fetch_add(&s->frees, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&s->live_bytes, size, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&s->live_objects, 1, __ATOMIC_RELAXED);
+}
+
+static void _account_alloc(uint16_t tag, size_t size)
+{
+    size_t limit = 16;
+    unsigned bucket = 0;
+
+    while (size > limit && bucket < LS_MEM_HISTOGRAM_BUCKETS - 1)
+    {
+        limit <<= 1;
+        bucket++;
     }
+    __atomic_fetch_add(&_histogram[bucket], 1, __ATOMIC_RELAXED);
+    _stats_add(&_tag_stats[tag], size);
+    _stats_add(&_total_stats, size);
 }
 
-LS_API void *ls_data_malloc(size_t size)
+static void _account_free(uint16_t tag, size_t size)
 {
-    void *ret = _malloc_func(size);
+    _stats_remove(&_tag_stats[tag], size);
+    _stats_remove(&_total_stats, size);
+}
 
-    if (ret)
+static void _stats_snapshot(ls_mem_tag_stats *s, ls_mem_tag_stats *out)
+{
+    out->allocs          = __atomic_load_n(&s->allocs, __ATOMIC_RELAXED);
+    out->frees           = __atomic_load_n(&s->frees, __ATOMIC_RELAXED);
+    out->bytes_allocated = __atomic_load_n(&s->bytes_allocated,
+                                           __ATOMIC_RELAXED);
+    out->live_bytes      = __atomic_load_n(&s->live_bytes, __ATOMIC_RELAXED);
+    out->live_objects    = __atomic_load_n(&s->live_objects, __ATOMIC_RELAXED);
+    out->peak_bytes      = __atomic_load_n(&s->peak_bytes, __ATOMIC_RELAXED);
+}
+
+/* Move count blocks from the front of the thread's list to the central
+   pool as one batch */
+static void _cache_flush(mem_thread_cache *tc, size_t cls, size_t count)
+{
+    mem_block *head = tc->free[cls];
+    mem_block *tail = head;
+    size_t i;
+
+    for (i = 1; i < count; i++)
+    {
+        tail = tail->h.u.next;
+    }
+    tc->free[cls] = tail->h.u.next;
+    tc->count[cls] -= count;
+    tail->h.u.next = NULL;
+
+    _batch_of(head)->count = count;
+    pthread_mutex_lock(&_central_lock);
+    _batch_of(head)->next_batch = _central[cls];
+    _central[cls] = head;
+    pthread_mutex_unlock(&_central_lock);
+}
+
+static void _cache_flush_all(mem_thread_cache *tc)
+{
+    size_t cls;
+
+    for (cls = 0; cls < MEM_CLASS_COUNT; cls++)
+    {
+        if (tc->count[cls] > 0)
+        {
+            _cache_flush(tc, cls, tc->count[cls]);
+        }
+    }
+}
+
+/* thread exit: hand everything cached to the central pool */
+static void _cache_thread_exit(void *arg)
+{
+    _cache_flush_all((mem_thread_cache *)arg);
+}
+
+static void _cache_key_init(void)
+{
+    pthread_key_create(&_tcache_key, _cache_thread_exit);
+}
+
+/* Arrange for the thread's cache to be flushed when it exits; called
+   whenever the cache is about to hold blocks */
+static void _cache_register(mem_thread_cache *tc)
+{
+    if (!tc->registered)
+    {
+        pthread_once(&_tcache_once, _cache_key_init);
+        pthread_setspecific(_tcache_key, tc);
+        tc->registered = true;
+    }
+}
+
+/* Take one batch of the given class from the central pool */
+static void _cache_refill(mem_thread_cache *tc, size_t cls)
+{
+    mem_block *head;
+
+    pthread_mutex_lock(&_central_lock);
+    head = _central[cls];
+    if (head)
+    {
+        _central[cls] = _batch_of(head)->next_batch;
+    }
+    pthread_mutex_unlock(&_central_lock);
+
+    if (head)
+    {
+        _cache_register(tc);
+        tc->free[cls]  = head;
+        tc->count[cls] = _batch_of(head)->count;
+    }
+}
+
+static mem_block *_cache_get(size_t size)
+{
+    mem_thread_cache *tc = &_tcache;
+    size_t cls = _class_for[(size - 1) >> 4];
+    mem_block *b;
+
+    if (!tc->free[cls])
+    {
+        _cache_refill(tc, cls);
+    }
+
+    b = tc->free[cls];
+    if (b)
+    {
+        tc->free[cls] = b->h.u.next;
+        tc->count[cls]--;
+        return b;
+    }
+
+    b = _malloc_func(sizeof(mem_block) + _class_sizes[cls]);
+    if (b)
+    {
+        b->h.cls = (uint16_t)cls;
+    }
+    return b;
+}
+
+static void _cache_put(mem_block *b)
+{
+    mem_thread_cache *tc = &_tcache;
+    size_t cls = b->h.cls;
+
+    _cache_register(tc);
+    b->h.u.next = tc->free[cls];
+    tc->free[cls] = b;
+    if (++tc->count[cls] > MEM_CACHE_MAX)
     {
-        ls_log(LS_LOG_MEMTRACE, "mem.c:malloc %p %zd", ret, size);
+        _cache_flush(tc, cls, MEM_CACHE_BATCH);
+    }
+}
+
+static mem_block *_block_get(size_t size)
+{
+    mem_block *b;
+
+    if (_caches_enabled && size > 0 && size <= MEM_CLASS_MAX)
+    {
+        return _cache_get(size);
+    }
+
+    b = _malloc_func(sizeof(mem_block) + size);
+    if (b)
+    {
+        b->h.cls = MEM_CLASS_NONE;
+    }
+    return b;
+}
+
+/* Cached blocks go back to a cache even if caching has since been
+   turned off; ls_data_release_caches() frees them */
+static void _block_put(mem_block *b)
+{
+    if (b->h.cls == MEM_CLASS_NONE)
+    {
+        _free_func(b);
     }
     else
     {
-        ls_log(LS_LOG_WARN,
-               "mem.c:malloc unable to allocate block of size %zd", size);
+        _cache_put(b);
     }
+}
 
+static mem_block *_block_resize(mem_block *b, size_t size)
+{
+    mem_block *ret;
+
+    if (!b)
+    {
+        if (_caches_enabled && size > 0 && size <= MEM_CLASS_MAX)
+        {
+            return _cache_get(size);
+        }
+    }
+    else if (b->h.cls != MEM_CLASS_NONE)
+    {
+        if (size > 0 && size <= _class_sizes[b->h.cls])
+        {
+            return b;
+        }
+
+        ret = _block_get(size);
+        if (ret)
+        {
+            memcpy(ret + 1, b + 1, (size < b->h.u.size) ? size : b->h.u.size);
+            _block_put(b);
+        }
+        return ret;
+    }
+
+    ret = _realloc_func(b, sizeof(mem_block) + size);
+    if (ret)
+    {
+        ret->h.cls = MEM_CLASS_NONE;
+    }
     return ret;
 }
 
-LS_API void *ls_data_realloc(void *ptr, size_t size)
+/* exported functions */
+LS_API void ls_data_set_memory_funcs(ls_data_malloc_func malloc_func,
+                                     ls_data_realloc_func realloc_func,
+                                     ls_data_free_func free_func)
+{
+    _malloc_func = (malloc_func) ? malloc_func : malloc;
+    _realloc_func = (realloc_func) ? realloc_func : realloc;
+    _free_func = (free_func) ? free_func : free;
+}
+
+LS_API void ls_data_set_thread_caches(bool enabled)
 {
-    void *ret = _realloc_func(ptr, size);
+    _caches_enabled = enabled;
+}
 
-    if (ret)
+LS_API void ls_data_release_caches(void)
+{
+    mem_block *batch;
+    mem_block *b;
+    size_t cls;
+
+    _cache_flush_all(&_tcache);
+
+    for (cls = 0; cls < MEM_CLASS_COUNT; cls++)
     {
-        if (ret != ptr)
+        pthread_mutex_lock(&_central_lock);
+        batch = _central[cls];
+        _central[cls] = NULL;
+        pthread_mutex_unlock(&_central_lock);
+
+        while (batch)
         {
-            // log the steps separately so mem leaks can be easily identified
-            // by running log output through
-            // fgrep mem.c: | sed -r 's/.*mem.c:[^ ]* ([^ ]*).*/\1/' | sort |
-            //   uniq -c | sort -n | while read count addr; do
-            //     if [[ 1 -eq $((count % 2)) ]]; then echo "$addr $count"
-            //     fi; done
-            if (ptr)
+            mem_block *next_batch = _batch_of(batch)->next_batch;
+            while (batch)
             {
-                ls_log(LS_LOG_MEMTRACE, "mem.c:realloc(free) %p", ptr);
+                b = batch;
+                batch = b->h.u.next;
+                _free_func(b);
             }
-            ls_log(LS_LOG_MEMTRACE, "mem.c:realloc(malloc) %p %zd", ret, size);
+            batch = next_batch;
         }
     }
-    else
+}
+
+LS_API void ls_data_free(void *ptr)
+{
+    mem_block *b;
+
+    if (ptr)
     {
-        ls_log(LS_LOG_WARN,
+        LS_LOG(LS_LOG_MEMTRACE, "mem.c:free %p", ptr);
+
+        b = _block_of(ptr);
+        _account_free(b->h.tag, b->h.u.size);
+        _block_put(b);
+    }
+}
+
+LS_API void *ls_data_malloc_tagged(ls_mem_tag tag, size_t size)
+{
+    mem_block *b;
+
+    assert(tag < LS_MEM_TAG_MAX);
+    b = _block_get(size);
+    if (!b)
+    {
+        LS_LOG(LS_LOG_WARN,
+               "mem.c:malloc unable to allocate block of size %zd", size);
+        return NULL;
+    }
+
+    b->h.u.size = size;
+    b->h.tag = (uint16_t)tag;
+    _account_alloc(b->h.tag, size);
+    LS_LOG(LS_LOG_MEMTRACE, "mem.c:malloc %p %zd", (void *)(b + 1), size);
+
+    return b + 1;
+}
+
+LS_API void *ls_data_malloc(size_t size)
+{
+    return ls_data_malloc_tagged(LS_MEM_TAG_OTHER, size);
+}
+
+LS_API void *ls_data_realloc_tagged(ls_mem_tag tag, void *ptr, size_t size)
+{
+    mem_block *b = ptr ? _block_of(ptr) : NULL;
+    size_t old_size = b ? b->h.u.size : 0;
+    uint16_t old_tag = b ? b->h.tag : LS_MEM_TAG_OTHER;
+    mem_block *ret;
+
+    assert(tag < LS_MEM_TAG_MAX);
+    ret = _block_resize(b, size);
+    if (!ret)
+    {
+        LS_LOG(LS_LOG_WARN,
                "mem.c:realloc unable to realloc %p to block of size %zd",
                ptr, size);
+        return NULL;
     }
 
-    return ret;
+    if (b)
+    {
+        _account_free(old_tag, old_size);
+    }
+    ret->h.u.size = size;
+    ret->h.tag = (uint16_t)tag;
+    _account_alloc(ret->h.tag, size);
+
+    if (ret != b)
+    {
+        // log the steps separately so mem leaks can be easily identified
+        // by running log output through
+        // fgrep mem.c: | sed -r 's/.*mem.c:[^ ]* ([^ ]*).*/\1/' | sort |
+        //   uniq -c | sort -n | while read count addr; do
+        //     if [[ 1 -eq $((count % 2)) ]]; then echo "$addr $count"
+        //     fi; done
+        if (ptr)
+        {
+            LS_LOG(LS_LOG_MEMTRACE, "mem.c:realloc(free) %p", ptr);
+        }
+        LS_LOG(LS_LOG_MEMTRACE, "mem.c:realloc(malloc) %p %zd",
+               (void *)(ret + 1), size);
+    }
+
+    return ret + 1;
 }
 
-LS_API void *ls_data_calloc(size_t nmemb, size_t size)
+LS_API void *ls_data_realloc(void *ptr, size_t size)
+{
+    return ls_data_realloc_tagged(ptr ? (ls_mem_tag)_block_of(ptr)->h.tag :
+                                        LS_MEM_TAG_OTHER,
+                                  ptr, size);
+}
+
+LS_API void *ls_data_calloc_tagged(ls_mem_tag tag, size_t nmemb, size_t size)
 {
     size_t block_size = nmemb * size;
-    void *ret = ls_data_malloc(block_size);
+    void *ret = ls_data_malloc_tagged(tag, block_size);
 
     if (ret)
     {
@@ -192,6 +665,54 @@ LS_API void *ls_data_calloc(size_t nmemb, size_t size)
     return ret;
 }
 
+LS_API void *ls_data_calloc(size_t nmemb, size_t size)
+{
+    return ls_data_calloc_tagged(LS_MEM_TAG_OTHER, nmemb, size);
+}
+
+LS_API void ls_mem_get_stats(ls_mem_stats *stats)
+{
+    size_t i;
+
+    assert(stats);
+    for (i = 0; i < LS_MEM_TAG_MAX; i++)
+    {
+        _stats_snapshot(&_tag_stats[i], &stats->tags[i]);
+    }
+    _stats_snapshot(&_total_stats, &stats->total);
+    for (i = 0; i < LS_MEM_HISTOGRAM_BUCKETS; i++)
+    {
+        stats->histogram[i] = __atomic_load_n(&_histogram[i],
+                                              __ATOMIC_RELAXED);
+    }
+}
+
+LS_API void ls_mem_reset_peaks(void)
+{
+    size_t i;
+
+    for (i = 0; i < LS_MEM_TAG_MAX; i++)
+    {
+        __atomic_store_n(&_tag_stats[i].peak_bytes,
+                         __atomic_load_n(&_tag_stats[i].live_bytes,
+                                         __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&_total_stats.peak_bytes,
+                     __atomic_load_n(&_total_stats.live_bytes,
+                                     __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+}
+
+LS_API const char *ls_mem_tag_name(ls_mem_tag tag)
+{
+    if (tag >= LS_MEM_TAG_MAX)
+    {
+        return NULL;
+    }
+    return _tag_names[tag];
+}
+
 LS_API char *ls_data_strdup(const char  *src)
 {
     char *ret = NULL;
@@ -233,14 +754,17 @@ LS_API bool ls_pool_create(size_t size, ls_pool **pool, ls_err *err)
 
     assert(pool);
 
-    if (!_malloc_fnc(NULL,
-                     sizeof(struct _ls_pool_int), (void *) &ret, NULL, err))
+    ret = ls_data_malloc(sizeof(struct _ls_pool_int));
+    if (!ret)
     {
+        LS_ERROR(err, LS_ERR_NO_MEMORY);
         return false;
     }
 
     ret->cleaners = NULL;
+    ret->tail = NULL;
     ret->pages = NULL;
+    ret->spare = NULL;
     ret->size = 0;
 
 //see ../include/pool_types.h for information on DISABLE_POOL_PAGES
@@ -252,6 +776,7 @@ LS_API bool ls_pool_create(size_t size, ls_pool **pool, ls_err *err)
         size = 0;
     }
     ret->page_size = size;
+    ret->next_page_size = size;
 
     if (size && !_add_page(ret, err))
     {
@@ -264,20 +789,54 @@ LS_API bool ls_pool_create(size_t size, ls_pool **pool, ls_err *err)
 
 LS_API void ls_pool_destroy(ls_pool *pool)
 {
-    struct pool_cleaner_ctx *cur, *next;
+    assert(pool);
 
+    _run_cleaners(pool, NULL);
+    _free_pages(pool->pages);
+    _free_pages(pool->spare);
+
+    ls_data_free(pool);
+}
+
+LS_API void ls_pool_reset(ls_pool *pool)
+{
+    ls_pool_marker empty = { NULL, 0, NULL };
+
+    assert(pool);
+
+    ls_pool_rewind(pool, &empty);
+}
+
+LS_API void ls_pool_mark(ls_pool *pool, ls_pool_marker *marker)
+{
+    assert(pool);
+    assert(marker);
+
+    marker->page = pool->pages;
+    marker->used = pool->pages ? pool->pages->used : 0;
+    marker->cleaners = pool->cleaners;
+}
+
+LS_API void ls_pool_rewind(ls_pool *pool, const ls_pool_marker *marker)
+{
     assert(pool);
+    assert(marker);
+
+    _run_cleaners(pool, marker->cleaners);
 
-    cur = pool->cleaners;
-    while (cur != NULL)
+    /* pages started since the mark are kept for reuse */
+    while (pool->pages && pool->pages != marker->page)
     {
-        (*cur->cleaner)(cur->arg);
-        next = cur->next;
-        ls_data_free(cur);
-        cur = next;
-    }
+        _pool_page page = pool->pages;
 
-    ls_data_free(pool);
+        pool->pages = page->next;
+        page->next = pool->spare;
+        pool->spare = page;
+    }
+    if (pool->pages)
+    {
+        pool->pages->used = marker->used;
+    }
 }
 
 LS_API bool ls_pool_add_cleaner(ls_pool *pool,
@@ -285,26 +844,10 @@ LS_API bool ls_pool_add_cleaner(ls_pool *pool,
                                 void   *arg,
                                 ls_err *err)
 {
-    _pool_cleaner_ctx ctx;
-
     assert(pool);
     assert(callback);
 
-    if (!_malloc_fnc(pool, sizeof(struct pool_cleaner_ctx), (void *) &ctx, NULL, err))
-    {
-        return false;
-    }
-
-    ctx->cleaner = callback;
-    ctx->arg = arg;
-
-    if (!pool->cleaners)
-    {
-        pool->tail = ctx;
-    }
-    ctx->next = pool->cleaners;
-    pool->cleaners = ctx;
-    return true;
+    return _add_cleaner(pool, callback, arg, 0, err);
 }
 
 LS_API bool ls_pool_malloc(ls_pool *pool,
@@ -323,22 +866,24 @@ LS_API bool ls_pool_malloc(ls_pool *pool,
         /* if request is too big for page, just malloc*/
         if (size > pool->page_size)
         {
-            if (!_malloc_fnc(pool, size, &ret, ls_data_free, err))
+            ret = ls_data_malloc(size);
+            if (!ret)
+            {
+                LS_ERROR(err, LS_ERR_NO_MEMORY);
+                return false;
+            }
+            if (!_add_cleaner(pool, ls_data_free, ret, size, err))
             {
+                ls_data_free(ret);
                 return false;
             }
             /* "manually" inc pool's size */
             pool->size += size;
         }
         /* try to allocate from current page */
-        else if (!_page_malloc(pool->pages, size, &ret))
+        else if (!_pool_page_alloc(pool, size, &ret, err))
         {
-            if (!_add_page(pool, err))
-            {
-                return false;
-            }
-            /* size will fit on an empty page */
-            _page_malloc(pool->pages, size, &ret);
+            return false;
         }
     }
     *ptr = ret;
@@ -40,21 +40,21 @@ void ls_pool_enable_paging(bool enable);
 /**
  * Pools use "page"s, blocks of allocated mem, for allocation
  * and release efficiency. When possible pools "malloc" by just
- * return pointers into a page. When releasing pools free entire
- * pages, not pointer by pointer, very desirable behavior when
- * managing recursive data structures like DOMs.
+ * return pointers into a page, aligned to twice the size of a pointer.
+ * When releasing pools free entire pages, not pointer by pointer, very
+ * desirable behavior when managing recursive data structures like DOMs.
  *
  * If a allocation request could not fit in any page, memory is
  * allocated directly. The resultant pointer is freed when the
  * pool is destroyed. If a request would fit in a page but the
  * current page doesn't have enough free spoace a new page is
- * allocated and used for the request.
+ * allocated and used for the request. Each new page is twice the size
+ * of the previous one, up to 64 times the pool's page size.
  *
- * A page is a node in a LL. Not really necessary for
- * alloc/free logic but a list makes testing page much easier.
- * Without this list pages are still accessable through the
- * cleaner list (where the page is the arg passed to
- * a _pool_page_free cleaner) but it's confusing.
+ * A page is a node in a LL, newest first; the header and the block
+ * share one allocation. Pages given back by ls_pool_reset() or
+ * ls_pool_rewind() move to the pool's spare list and are used again
+ * before any new page is allocated.
  */
 typedef struct pool_page
 {
@@ -65,31 +65,38 @@ typedef struct pool_page
 } *_pool_page;
 
 /**
- * pool_cleaners are callbacks fired when a pool is being destroyed.
- * A pool_cleaner_ctx is a node in a LL of cleaners. Each "context"
- * contains a cleaner ref and an argument to pass to the cleaner.
- * Typically the argument is the pointer that should be freed.
- * It is up to the cleaner to free arg if it is a pointer. pages
- * are freed using a page cleaner etc.
+ * pool_cleaners are callbacks fired when a pool is being destroyed,
+ * reset or rewound. A pool_cleaner_ctx is a node in a LL of cleaners,
+ * newest first. Each "context" contains a cleaner ref and an argument to
+ * pass to the cleaner. Typically the argument is the pointer that should
+ * be freed. It is up to the cleaner to free arg if it is a pointer.
+ *
+ * Contexts are allocated from the pool's own pages, and only come from
+ * ls_data_malloc when the pages are too small to hold one.
  */
 typedef struct pool_cleaner_ctx
 {
     ls_pool_cleaner cleaner;
     void*           arg;
+    size_t          size;  /* direct allocation freed by cleaner, or 0 */
+    bool            heap;  /* context was allocated with ls_data_malloc */
     struct pool_cleaner_ctx *next;
 } *_pool_cleaner_ctx;
 
 /**
  * A pool is a head pointer to the page linked list, a head
  * pointer to the cleaners LL, the total number of bytes
- * allocated by this pool (pages*page size)+off page allocations
- * and the page size given to the pool at creation.
+ * held by this pool (all pages, including spares, plus off page
+ * allocations), the page size given to the pool at creation and the
+ * size of the next page to allocate.
  */
 typedef struct _ls_pool_int
 {
     size_t size;
     size_t page_size;
+    size_t next_page_size;
     struct pool_cleaner_ctx *cleaners;
     struct pool_cleaner_ctx *tail;
     struct pool_page        *pages;
+    struct pool_page        *spare;
 } _ls_pool;
@@ -74,39 +74,192 @@ bool spud_create_id(spud_tube_id *id, ls_err *err)
     return true;
 }
 
-bool spud_parse(const uint8_t *payload, size_t length, spud_message *msg, ls_err *err)
+/* Hands out nodes from a block sized for the whole datagram */
+typedef struct _spud_node_slab {
+    cn_cbor *next;
+    cn_cbor *end;
+} spud_node_slab;
+
+static void *_slab_calloc(size_t count, size_t size, void *context)
+{
+    spud_node_slab *slab = context;
+    cn_cbor *ret = slab->next;
+
+    if ((count * size != sizeof(cn_cbor)) || (ret == slab->end)) {
+        return NULL;
+    }
+    slab->next++;
+    memset(ret, 0, sizeof(*ret));
+    return ret;
+}
+
+/* cn-cbor errors are reported past LS_ERR_USER */
+#define SPUD_CBOR_ERROR(err, cbor_code) do {                 \
+        if ((err) != NULL) {                                 \
+            (err)->code = LS_ERR_USER + (cbor_code);         \
+            (err)->message = cn_cbor_error_str[(cbor_code)]; \
+            (err)->function = __func__;                      \
+            (err)->file = __FILE__;                          \
+            (err)->line = __LINE__;                          \
+        }                                                    \
+    } while (0)
+
+static bool _parse_header(const uint8_t *payload, size_t length,
+                          ls_pool *pool, spud_message *msg, ls_err *err)
 {
-    cn_cbor_errback cbor_err;
     if ((payload == NULL) || (msg == NULL) || !spud_is_spud(payload, length)) {
         LS_ERROR(err, LS_ERR_INVALID_ARG);
         return false;
     }
     msg->header = (spud_header *)payload;
-    if (length > sizeof(spud_header)) {
-        msg->cbor = cn_cbor_decode((const char*)payload+sizeof(spud_header),
-                                   length - sizeof(spud_header),
-                                   NULL, NULL,
-                                   &cbor_err);
-        if (!msg->cbor) {
-            if (err != NULL) {
-                err->code = LS_ERR_USER + cbor_err.err;
-                err->message = cn_cbor_error_str[cbor_err.err];
-                err->function = __func__;
-                err->file = __FILE__;
-                err->line = __LINE__;
+    msg->cbor = NULL;
+    msg->pool = pool;
+    msg->length = length;
+    if (pool) {
+        ls_pool_mark(pool, &msg->mark);
+    }
+    return true;
+}
+
+bool spud_parse(const uint8_t *payload, size_t length, spud_message *msg, ls_err *err)
+{
+    return _parse_header(payload, length, NULL, msg, err);
+}
+
+bool spud_parse_pool(const uint8_t *payload, size_t length, ls_pool *pool,
+                     spud_message *msg, ls_err *err)
+{
+    if (pool == NULL) {
+        LS_ERROR(err, LS_ERR_INVALID_ARG);
+        return false;
+    }
+    return _parse_header(payload, length, pool, msg, err);
+}
+
+bool spud_message_cbor(spud_message *msg, const cn_cbor **cbor, ls_err *err)
+{
+    static const cn_cbor_limits limits = {
+        SPUD_MAX_CBOR_DEPTH, SPUD_MAX_CBOR_ITEMS, SPUD_MAX_CBOR_COUNT, false
+    };
+    spud_node_slab slab = {NULL, NULL};
+    cn_cbor_errback cbor_err;
+    size_t cbor_len;
+    size_t max_nodes;
+    void *nodes;
+
+    assert(msg);
+    assert(cbor);
+    if (!msg->cbor && (msg->length > sizeof(spud_header))) {
+        /* every CBOR item takes at least one byte */
+        cbor_len = msg->length - sizeof(spud_header);
+        max_nodes = cbor_len < SPUD_MAX_CBOR_ITEMS ?
+            cbor_len : SPUD_MAX_CBOR_ITEMS;
+        if (msg->pool) {
+            if (!ls_pool_malloc(msg->pool, max_nodes * sizeof(cn_cbor),
+                                &nodes, err)) {
+                return false;
             }
+            slab.next = nodes;
+            slab.end  = slab.next + max_nodes;
+        }
+        msg->cbor = cn_cbor_decode_limited((const char *)(msg->header + 1),
+                                           cbor_len, &limits,
+                                           msg->pool ? _slab_calloc : NULL,
+                                           msg->pool ? &slab : NULL,
+                                           &cbor_err);
+        if (!msg->cbor) {
+            SPUD_CBOR_ERROR(err, cbor_err.err);
+            return false;
+        }
+    }
+    *cbor = msg->cbor;
+    return true;
+}
+
+bool spud_message_data(spud_message *msg, const uint8_t **data, size_t *len,
+                       ls_err *err)
+{
+    cn_cbor_cursor cur;
+    cn_cbor_item map, key, value;
+    const uint8_t *found = NULL;
+    size_t found_len = 0;
+    bool seen = false;
+    bool indef;
+    size_t i;
+    const cn_cbor *cp;
+
+    assert(msg);
+    assert(data);
+    assert(len);
+    *data = NULL;
+    *len = 0;
+
+    if (msg->cbor) {
+        cp = (msg->cbor->type == CN_CBOR_MAP) ?
+            cn_cbor_mapget_int(msg->cbor, 0) : NULL;
+        if (cp && (cp->type == CN_CBOR_BYTES || cp->type == CN_CBOR_TEXT)) {
+            *data = (const uint8_t *)cp->v.str;
+            *len = cp->length;
+        }
+        return true;
+    }
+    if (msg->length <= sizeof(spud_header)) {
+        return true;
+    }
+
+    /* walk the whole datagram, so that anything spud_message_cbor() would
+       refuse is refused here too */
+    cn_cbor_cursor_init(&cur, (const char *)(msg->header + 1),
+                        msg->length - sizeof(spud_header));
+    if (!cn_cbor_cursor_next(&cur, &map)) {
+        SPUD_CBOR_ERROR(err, cur.err);
+        return false;
+    }
+    if (map.type != CN_CBOR_MAP) {
+        if (!cn_cbor_cursor_skip_contents(&cur, &map)) {
+            SPUD_CBOR_ERROR(err, cur.err);
             return false;
         }
     } else {
-        msg->cbor = NULL;
+        indef = (map.flags & CN_CBOR_FL_INDEF) != 0;
+        for (i = 0; indef || i < map.length; i++) {
+            if (indef && cn_cbor_cursor_break(&cur)) {
+                break;
+            }
+            if (!cn_cbor_cursor_next(&cur, &key) ||
+                !cn_cbor_cursor_skip_contents(&cur, &key) ||
+                !cn_cbor_cursor_next(&cur, &value) ||
+                !cn_cbor_cursor_skip_contents(&cur, &value)) {
+                SPUD_CBOR_ERROR(err, cur.err);
+                return false;
+            }
+            /* the first key 0 wins, as with cn_cbor_mapget_int() */
+            if (!seen && key.type == CN_CBOR_UINT && key.v.uint == 0) {
+                seen = true;
+                if ((value.type == CN_CBOR_BYTES ||
+                     value.type == CN_CBOR_TEXT) &&
+                    !(value.flags & CN_CBOR_FL_INDEF)) {
+                    found = (const uint8_t *)value.v.str;
+                    found_len = value.length;
+                }
+            }
+        }
     }
+    if (!cn_cbor_cursor_done(&cur)) {
+        SPUD_CBOR_ERROR(err, CN_CBOR_ERR_NOT_ALL_DATA_CONSUMED);
+        return false;
+    }
+    *data = found;
+    *len = found_len;
     return true;
 }
 
 void spud_unparse(spud_message *msg)
 {
     msg->header = NULL;
-    if (msg->cbor) {
+    if (msg->pool) {
+        ls_pool_rewind(msg->pool, &msg->mark);
+    } else if (msg->cbor) {
         cn_cbor_free(msg->cbor);
     }
     msg->cbor = NULL;
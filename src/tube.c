@@ -2,6 +2,8 @@
  * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
  */
 
+#define LS_LOG_FILE_MODULE LS_LOG_MODULE_TUBE
+
 #ifdef __APPLE__
 #define __APPLE_USE_RFC_3542
 #endif
@@ -18,9 +20,11 @@
 #include <string.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 
 #include "config.h"
 #include "tube.h"
+#include "ls_clock.h"
 #include "ls_eventing.h"
 #include "ls_htable.h"
 #include "ls_log.h"
@@ -29,22 +33,65 @@
 
 #define DEFAULT_HASH_SIZE 65521
 #define MAXBUFLEN 1500
+/* Room for the CBOR nodes of the largest datagram, so parse pools never
+   grow past their first page */
+#define PARSE_POOL_SIZE (SPUD_MAX_CBOR_ITEMS * sizeof(cn_cbor))
+#define DEFAULT_WORKER_QUEUE_DEPTH 64
+
+static const char *_event_names[EV_MAX] = {
+  EV_RUNNING_NAME,
+  EV_DATA_NAME,
+  EV_CLOSE_NAME,
+  EV_ADD_NAME,
+  EV_REMOVE_NAME
+};
 
 static tube_sendmsg_func _sendmsg_func = sendmsg;
 static tube_recvmsg_func _recvmsg_func = recvmsg;
 
+/* One set of the tube events, with its own bindings */
+typedef struct _tube_subscribers
+{
+  ls_event_dispatcher *dispatcher;
+  ls_event *events[EV_MAX];
+} tube_subscribers;
+
+/* A data packet waiting for a worker */
+typedef struct _tube_work_item
+{
+  tube *t;
+  struct sockaddr_storage peer;
+  size_t len;
+  uint8_t buf[MAXBUFLEN];
+} tube_work_item;
+
+/* A worker thread with a bounded queue.  Every tube hashes to exactly one
+   worker, so a tube's data events are handled in arrival order. */
+typedef struct _tube_worker
+{
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  tube_work_item *items;
+  size_t depth;
+  size_t head;
+  size_t count;
+  bool stopping;
+  tube_manager *mgr;
+  ls_pool *parse_pool;
+} tube_worker;
+
 struct _tube_manager
 {
   int sock;
   ls_htable *tubes;
-  ls_event_dispatcher *dispatcher;
-  ls_event *e_running;
-  ls_event *e_data;
-  ls_event *e_close;
-  ls_event *e_add;
-  ls_event *e_remove;
+  tube_subscribers subs;
   tube_policies policy;
   bool keep_going;
+  tube_worker *workers;
+  unsigned int num_workers;
+  ls_pool *parse_pool;
 };
 
 struct _tube
@@ -55,15 +102,102 @@ struct _tube
   spud_tube_id id;
   void *data;
   tube_manager *mgr;
+  tube_group *group;
+  tube_subscribers *subs;    /* allocated on first tube_bind_event */
 };
 
+struct _tube_group
+{
+  tube_subscribers subs;
+};
+
+static bool _subscribers_init(tube_subscribers *subs,
+                              void *source,
+                              ls_err *err)
+{
+    int i;
+    assert(subs);
+
+    memset(subs, 0, sizeof(tube_subscribers));
+    if (!ls_event_dispatcher_create(source, &subs->dispatcher, err)) {
+        return false;
+    }
+
+    for (i = 0; i < EV_MAX; i++) {
+        if (!ls_event_dispatcher_create_event(subs->dispatcher,
+                                              _event_names[i],
+                                              &subs->events[i],
+                                              err)) {
+            return false;
+        }
+        assert(ls_event_get_id(subs->events[i]) == (ls_event_id)i);
+    }
+    return true;
+}
+
+static void _subscribers_fini(tube_subscribers *subs)
+{
+    assert(subs);
+    if (subs->dispatcher) {
+        ls_event_dispatcher_destroy(subs->dispatcher);
+        subs->dispatcher = NULL;
+    }
+}
+
+static bool _subscribers_bind(tube_subscribers *subs,
+                              tube_event_type type,
+                              ls_event_notify_callback cb,
+                              void *arg,
+                              ls_err *err)
+{
+    assert(subs);
+    assert(cb);
+
+    if ((int)type < 0 || type >= EV_MAX) {
+        LS_ERROR(err, LS_ERR_INVALID_ARG);
+        return false;
+    }
+    return ls_event_bind(subs->events[type], cb, arg, err);
+}
+
+static bool _subscribers_trigger(tube_subscribers *subs,
+                                 tube_event_type type,
+                                 void *data,
+                                 ls_err *err)
+{
+    /* Nobody listening: skip the trigger and its allocation */
+    if (!subs || !subs->dispatcher || !ls_event_is_bound(subs->events[type])) {
+        return true;
+    }
+    return ls_event_trigger(subs->events[type], data, NULL, NULL, err);
+}
+
+/* Fire an event for a tube: first to the tube's own subscribers, then to
+   its group, then to the whole manager. */
+static bool _tube_trigger(tube *t,
+                          tube_event_type type,
+                          void *data,
+                          ls_err *err)
+{
+    tube_manager *mgr = t->mgr;
+    tube_group *group = t->group;
+
+    if (!_subscribers_trigger(t->subs, type, data, err)) {
+        return false;
+    }
+    if (group && !_subscribers_trigger(&group->subs, type, data, err)) {
+        return false;
+    }
+    return _subscribers_trigger(&mgr->subs, type, data, err);
+}
+
 LS_API bool tube_create(tube_manager *mgr, tube **t, ls_err *err)
 {
     tube *ret = NULL;
     assert(t != NULL);
     assert(mgr != NULL);
 
-    ret = ls_data_malloc(sizeof(tube));
+    ret = ls_data_malloc_tagged(LS_MEM_TAG_TUBE, sizeof(tube));
     if (ret == NULL) {
         LS_ERROR(err, LS_ERR_NO_MEMORY);
         *t = NULL;
@@ -78,9 +212,89 @@ LS_API bool tube_create(tube_manager *mgr, tube **t, ls_err *err)
 
 LS_API void tube_destroy(tube *t)
 {
+    if (t->subs) {
+        _subscribers_fini(t->subs);
+        ls_data_free(t->subs);
+    }
     ls_data_free(t);
 }
 
+LS_API bool tube_bind_event(tube *t,
+                            tube_event_type type,
+                            ls_event_notify_callback cb,
+                            void *arg,
+                            ls_err *err)
+{
+    assert(t);
+    assert(cb);
+
+    if (!t->subs) {
+        t->subs = ls_data_malloc_tagged(LS_MEM_TAG_TUBE,
+                                        sizeof(tube_subscribers));
+        if (t->subs == NULL) {
+            LS_ERROR(err, LS_ERR_NO_MEMORY);
+            return false;
+        }
+        if (!_subscribers_init(t->subs, t, err)) {
+            _subscribers_fini(t->subs);
+            ls_data_free(t->subs);
+            t->subs = NULL;
+            return false;
+        }
+    }
+    return _subscribers_bind(t->subs, type, cb, arg, err);
+}
+
+LS_API void tube_set_group(tube *t, tube_group *group)
+{
+    assert(t);
+    t->group = group;
+}
+
+LS_API tube_group *tube_get_group(tube *t)
+{
+    assert(t);
+    return t->group;
+}
+
+LS_API bool tube_group_create(tube_group **g, ls_err *err)
+{
+    tube_group *ret;
+    assert(g != NULL);
+
+    ret = ls_data_malloc_tagged(LS_MEM_TAG_TUBE, sizeof(tube_group));
+    if (ret == NULL) {
+        LS_ERROR(err, LS_ERR_NO_MEMORY);
+        *g = NULL;
+        return false;
+    }
+    if (!_subscribers_init(&ret->subs, ret, err)) {
+        _subscribers_fini(&ret->subs);
+        ls_data_free(ret);
+        *g = NULL;
+        return false;
+    }
+    *g = ret;
+    return true;
+}
+
+LS_API void tube_group_destroy(tube_group *g)
+{
+    assert(g);
+    _subscribers_fini(&g->subs);
+    ls_data_free(g);
+}
+
+LS_API bool tube_group_bind_event(tube_group *g,
+                                  tube_event_type type,
+                                  ls_event_notify_callback cb,
+                                  void *arg,
+                                  ls_err *err)
+{
+    assert(g);
+    return _subscribers_bind(&g->subs, type, cb, arg, err);
+}
+
 LS_API bool tube_print(const tube *t, ls_err *err)
 {
   // TODO: output peer and ID as well.
@@ -256,6 +470,86 @@ LS_API bool tube_data(tube *t, uint8_t *data, size_t len, ls_err *err)
     return tube_send(t, SPUD_DATA, false, false, d, l, 2, err);
 }
 
+/* send what a writer in iovec mode wrote */
+static bool _send_writer(tube *t,
+                         spud_command cmd,
+                         cn_cbor_writer *w,
+                         ls_err *err)
+{
+    uint8_t *d[TUBE_MAP_IOVECS];
+    size_t l[TUBE_MAP_IOVECS];
+    int i;
+
+    assert(w->used <= TUBE_MAP_IOVECS);
+    if (!cn_cbor_writer_finish(w)) {
+        LS_ERROR(err, (w->err == CN_CBOR_ERR_OUT_OF_MEMORY) ?
+                 LS_ERR_OVERFLOW : LS_ERR_INVALID_ARG);
+        return false;
+    }
+    if (w->length > MAXBUFLEN - sizeof(spud_header)) {
+        LS_ERROR(err, LS_ERR_OVERFLOW);
+        return false;
+    }
+    for (i = 0; i < w->used; i++) {
+        d[i] = w->iov[i].iov_base;
+        l[i] = w->iov[i].iov_len;
+    }
+    return tube_send(t, cmd, false, false, d, l, w->used, err);
+}
+
+LS_API bool tube_send_cbor(tube *t,
+                           spud_command cmd,
+                           const cn_cbor *cbor,
+                           ls_err *err)
+{
+    tube_map m;
+    uint8_t flat[MAXBUFLEN + 1];
+    uint8_t *d[1];
+    size_t l[1];
+    ssize_t sz;
+
+    assert(t);
+    assert(cbor);
+    sz = cbor_encoder_size(cbor);
+    if ((sz < 0) || ((size_t)sz > MAXBUFLEN - sizeof(spud_header))) {
+        LS_ERROR(err, LS_ERR_OVERFLOW);
+        return false;
+    }
+
+    cn_cbor_writer_init_iov(&m.w, m.scratch, sizeof(m.scratch),
+                            m.iov, TUBE_MAP_IOVECS, TUBE_MAP_COPY_MAX);
+    if (cn_cbor_write_item(&m.w, cbor)) {
+        return _send_writer(t, cmd, &m.w, err);
+    }
+
+    /* too many pieces; copy it all instead */
+    if (cbor_encoder_write(flat, 0, sizeof(flat), cbor) != sz) {
+        LS_ERROR(err, LS_ERR_OVERFLOW);
+        return false;
+    }
+    d[0] = flat;
+    l[0] = sz;
+    return tube_send(t, cmd, false, false, d, l, 1, err);
+}
+
+LS_API void tube_map_init(tube_map *m, size_t pairs)
+{
+    assert(m);
+    cn_cbor_writer_init_iov(&m->w, m->scratch, sizeof(m->scratch),
+                            m->iov, TUBE_MAP_IOVECS, TUBE_MAP_COPY_MAX);
+    cn_cbor_write_map(&m->w, pairs);
+}
+
+LS_API bool tube_send_map(tube *t,
+                          spud_command cmd,
+                          tube_map *m,
+                          ls_err *err)
+{
+    assert(t);
+    assert(m);
+    return _send_writer(t, cmd, &m->w, err);
+}
+
 LS_API bool tube_close(tube *t, ls_err *err)
 {
     assert(t);
@@ -278,6 +572,41 @@ LS_API void *tube_get_data(tube *t)
     return t->data;
 }
 
+LS_API const cn_cbor *tube_event_cbor(tube_event_data *d)
+{
+    const cn_cbor *cbor = NULL;
+    ls_err err;
+
+    assert(d);
+    if (!d->msg) {
+        return NULL;
+    }
+    if (!spud_message_cbor(d->msg, &cbor, &err)) {
+        LS_LOG_ERR(err, "spud_message_cbor");
+        return NULL;
+    }
+    return cbor;
+}
+
+LS_API bool tube_event_data_bytes(tube_event_data *d,
+                                  const uint8_t **data,
+                                  size_t *len)
+{
+    ls_err err;
+
+    assert(d);
+    assert(data);
+    assert(len);
+    if (!d->msg) {
+        return false;
+    }
+    if (!spud_message_data(d->msg, data, len, &err)) {
+        LS_LOG_ERR(err, "spud_message_data");
+        return false;
+    }
+    return *data != NULL;
+}
+
 LS_API char *tube_id_to_string(tube *t, char* buf, size_t len)
 {
     assert(t);
@@ -322,13 +651,223 @@ static int compare_id(const void *key1, const void *key2) {
     return ret;
 }
 
+static void _subscribers_trigger_direct(tube_subscribers *subs,
+                                        tube_event_type type,
+                                        void *data)
+{
+    if (!subs || !subs->dispatcher || !ls_event_is_bound(subs->events[type])) {
+        return;
+    }
+    ls_event_trigger_direct(subs->events[type], data);
+}
+
+static void _worker_process(tube_worker *w, tube_work_item *item)
+{
+    spud_message msg = {NULL, NULL, NULL, 0, {NULL, 0, NULL}};
+    tube_event_data d;
+    ls_err err;
+
+    if (!spud_parse_pool(item->buf, item->len, w->parse_pool, &msg, &err)) {
+        /* the loop has checked the header already */
+        LS_LOG_ERR(err, "spud_parse");
+        return;
+    }
+    d.t = item->t;
+    d.msg = &msg;
+    d.peer = (const struct sockaddr *)&item->peer;
+
+    _subscribers_trigger_direct(d.t->subs, EV_DATA, &d);
+    if (d.t->group) {
+        _subscribers_trigger_direct(&d.t->group->subs, EV_DATA, &d);
+    }
+    _subscribers_trigger_direct(&w->mgr->subs, EV_DATA, &d);
+
+    spud_unparse(&msg);
+}
+
+static void *_worker_run(void *arg)
+{
+    tube_worker *w = arg;
+    tube_work_item *item;
+
+    pthread_mutex_lock(&w->lock);
+    while (true) {
+        while ((w->count == 0) && !w->stopping) {
+            pthread_cond_wait(&w->not_empty, &w->lock);
+        }
+        if (w->count == 0) {
+            break;
+        }
+        /* the slot is not reused until count drops, so work on it in place */
+        item = &w->items[w->head];
+        pthread_mutex_unlock(&w->lock);
+
+        _worker_process(w, item);
+
+        pthread_mutex_lock(&w->lock);
+        w->head = (w->head + 1) % w->depth;
+        w->count--;
+        pthread_cond_broadcast(&w->not_full);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static tube_worker *_worker_for(tube_manager *mgr, tube *t)
+{
+    if (mgr->num_workers == 0) {
+        return NULL;
+    }
+    return &mgr->workers[hash_id(&t->id) % mgr->num_workers];
+}
+
+/* Queue a packet for the tube's worker, blocking while the queue is full so
+   that a slow worker holds up the receive loop instead of growing memory. */
+static void _worker_enqueue(tube_worker *w,
+                            tube *t,
+                            const uint8_t *buf,
+                            size_t len,
+                            const struct sockaddr *peer,
+                            socklen_t peer_len)
+{
+    tube_work_item *item;
+
+    pthread_mutex_lock(&w->lock);
+    while (w->count == w->depth) {
+        pthread_cond_wait(&w->not_full, &w->lock);
+    }
+    item = &w->items[(w->head + w->count) % w->depth];
+    pthread_mutex_unlock(&w->lock);
+
+    /* only this thread fills the tail slot */
+    item->t = t;
+    item->len = len;
+    memcpy(item->buf, buf, len);
+    if (peer_len > sizeof(item->peer)) {
+        peer_len = sizeof(item->peer);
+    }
+    memcpy(&item->peer, peer, peer_len);
+
+    pthread_mutex_lock(&w->lock);
+    w->count++;
+    pthread_cond_signal(&w->not_empty);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Wait until the worker has handled everything queued so far.  Called
+   before a tube's other events, or its removal, so they follow its data. */
+static void _worker_drain(tube_worker *w)
+{
+    if (!w || pthread_equal(pthread_self(), w->thread)) {
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    while (w->count > 0) {
+        pthread_cond_wait(&w->not_full, &w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void _workers_stop(tube_manager *mgr)
+{
+    unsigned int i;
+    tube_worker *w;
+
+    for (i = 0; i < mgr->num_workers; i++) {
+        w = &mgr->workers[i];
+        pthread_mutex_lock(&w->lock);
+        w->stopping = true;
+        pthread_cond_signal(&w->not_empty);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+
+        pthread_cond_destroy(&w->not_full);
+        pthread_cond_destroy(&w->not_empty);
+        pthread_mutex_destroy(&w->lock);
+        ls_data_free(w->items);
+        ls_pool_destroy(w->parse_pool);
+    }
+    ls_data_free(mgr->workers);
+    mgr->workers = NULL;
+    mgr->num_workers = 0;
+}
+
+LS_API bool tube_manager_set_workers(tube_manager *mgr,
+                                     unsigned int num_workers,
+                                     size_t queue_depth,
+                                     ls_err *err)
+{
+    unsigned int i;
+    tube_worker *w;
+    int rc;
+
+    assert(mgr);
+
+    _workers_stop(mgr);
+    if (num_workers == 0) {
+        return true;
+    }
+    if (queue_depth == 0) {
+        queue_depth = DEFAULT_WORKER_QUEUE_DEPTH;
+    }
+
+    mgr->workers = ls_data_calloc_tagged(LS_MEM_TAG_TUBE,
+                                         num_workers, sizeof(tube_worker));
+    if (!mgr->workers) {
+        LS_ERROR(err, LS_ERR_NO_MEMORY);
+        return false;
+    }
+
+    for (i = 0; i < num_workers; i++) {
+        w = &mgr->workers[i];
+        w->mgr = mgr;
+        w->depth = queue_depth;
+        w->items = ls_data_malloc_tagged(LS_MEM_TAG_TUBE,
+                                         queue_depth *
+                                         sizeof(tube_work_item));
+        if (!w->items) {
+            LS_ERROR(err, LS_ERR_NO_MEMORY);
+            goto cleanup;
+        }
+        if (!ls_pool_create(PARSE_POOL_SIZE, &w->parse_pool, err)) {
+            ls_data_free(w->items);
+            goto cleanup;
+        }
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->not_empty, NULL);
+        pthread_cond_init(&w->not_full, NULL);
+        /* pthread_create() returns its error rather than setting errno */
+        rc = pthread_create(&w->thread, NULL, _worker_run, w);
+        if (rc != 0) {
+            LS_ERROR(err, -rc);
+            pthread_cond_destroy(&w->not_full);
+            pthread_cond_destroy(&w->not_empty);
+            pthread_mutex_destroy(&w->lock);
+            ls_data_free(w->items);
+            ls_pool_destroy(w->parse_pool);
+            goto cleanup;
+        }
+        mgr->num_workers++;
+    }
+    return true;
+cleanup:
+    _workers_stop(mgr);
+    return false;
+}
+
+LS_API unsigned int tube_manager_get_workers(tube_manager *mgr)
+{
+    assert(mgr);
+    return mgr->num_workers;
+}
+
 LS_API bool tube_manager_create(int buckets,
                                 tube_manager **m,
                                 ls_err *err)
 {
     tube_manager *ret = NULL;
     assert(m != NULL);
-    ret = ls_data_malloc(sizeof(tube_manager));
+    ret = ls_data_malloc_tagged(LS_MEM_TAG_TUBE, sizeof(tube_manager));
     if (ret == NULL) {
         LS_ERROR(err, LS_ERR_NO_MEMORY);
         return false;
@@ -344,30 +883,7 @@ LS_API bool tube_manager_create(int buckets,
         goto cleanup;
     }
 
-    if (!ls_event_dispatcher_create(ret, &ret->dispatcher, err)) {
-        goto cleanup;
-    }
-
-    if (!ls_event_dispatcher_create_event(ret->dispatcher,
-                                          EV_RUNNING_NAME,
-                                          &ret->e_running,
-                                          err) ||
-        !ls_event_dispatcher_create_event(ret->dispatcher,
-                                          EV_DATA_NAME,
-                                          &ret->e_data,
-                                          err) ||
-        !ls_event_dispatcher_create_event(ret->dispatcher,
-                                          EV_CLOSE_NAME,
-                                          &ret->e_close,
-                                          err) ||
-        !ls_event_dispatcher_create_event(ret->dispatcher,
-                                          EV_ADD_NAME,
-                                          &ret->e_add,
-                                          err) ||
-        !ls_event_dispatcher_create_event(ret->dispatcher,
-                                          EV_REMOVE_NAME,
-                                          &ret->e_remove,
-                                          err)) {
+    if (!_subscribers_init(&ret->subs, ret, err)) {
         goto cleanup;
     }
 
@@ -383,13 +899,14 @@ LS_API void tube_manager_destroy(tube_manager *mgr) {
     assert(mgr);
 
     mgr->keep_going = false;
+    _workers_stop(mgr);
     if (mgr->tubes) {
         ls_htable_destroy(mgr->tubes); // will clean
         mgr->tubes = NULL;
     }
-    if (mgr->dispatcher) {
-        ls_event_dispatcher_destroy(mgr->dispatcher);
-        mgr->dispatcher = NULL;
+    _subscribers_fini(&mgr->subs);
+    if (mgr->parse_pool) {
+        ls_pool_destroy(mgr->parse_pool);
     }
     ls_data_free(mgr);
 }
@@ -449,11 +966,11 @@ LS_API bool tube_manager_bind_event(tube_manager *mgr,
 {
     ls_event *ev;
     assert(mgr);
-    assert(mgr->dispatcher);
+    assert(mgr->subs.dispatcher);
     assert(name);
     assert(cb);
 
-    ev = ls_event_dispatcher_get_event(mgr->dispatcher, name);
+    ev = ls_event_dispatcher_get_event(mgr->subs.dispatcher, name);
     if (!ev) {
         LS_ERROR(err, LS_ERR_BAD_FORMAT);
         return false;
@@ -462,6 +979,15 @@ LS_API bool tube_manager_bind_event(tube_manager *mgr,
     return ls_event_bind(ev, cb, mgr, err);
 }
 
+LS_API bool tube_manager_bind_event_type(tube_manager *mgr,
+                                         tube_event_type type,
+                                         ls_event_notify_callback cb,
+                                         ls_err *err)
+{
+    assert(mgr);
+    return _subscribers_bind(&mgr->subs, type, cb, mgr, err);
+}
+
 static void clean_tube(bool replace, bool destroy_key, void *key, void *data)
 {
     tube *t = data;
@@ -470,14 +996,16 @@ static void clean_tube(bool replace, bool destroy_key, void *key, void *data)
     UNUSED_PARAM(destroy_key);
     UNUSED_PARAM(key);
 
+    /* let queued data for this tube finish before it goes away */
+    _worker_drain(_worker_for(t->mgr, t));
     if (t->state == TS_RUNNING) {
         if (!tube_close(t, &err)) {
             LS_LOG_ERR(err, "tube_close");
             // keep going!
         }
     }
-    if (!ls_event_trigger(t->mgr->e_remove, t, NULL, NULL, &err)) {
-        LS_LOG_ERR(err, "ls_event_trigger");
+    if (!_tube_trigger(t, EV_REMOVE, t, &err)) {
+        LS_LOG_ERR(err, "_tube_trigger");
         // keep going!
     }
     tube_destroy(t);
@@ -492,7 +1020,7 @@ LS_API bool tube_manager_add(tube_manager *mgr,
     if (!ls_htable_put(mgr->tubes, &t->id, t, clean_tube, err)) {
       return false;
     }
-    return ls_event_trigger(mgr->e_add, t, NULL, NULL, err);
+    return _tube_trigger(t, EV_ADD, t, err);
 }
 
 LS_API void tube_manager_remove(tube_manager *mgr,
@@ -512,7 +1040,7 @@ LS_API bool tube_manager_loop(tube_manager *mgr, ls_err *err)
     ssize_t numbytes;
     uint8_t buf[MAXBUFLEN];
     char id_str[SPUD_ID_STRING_SIZE+1];
-    spud_message msg = {NULL, NULL};
+    spud_message msg = {NULL, NULL, NULL, 0, {NULL, 0, NULL}};
     spud_tube_id uid;
     spud_command cmd;
     tube_event_data d;
@@ -531,6 +1059,13 @@ LS_API bool tube_manager_loop(tube_manager *mgr, ls_err *err)
     iov[0].iov_len = sizeof(buf);
     d.peer = (const struct sockaddr *)&their_addr;
 
+    /* datagrams decode into the same pool when asked to; it is reset after
+       every packet */
+    if (!mgr->parse_pool &&
+        !ls_pool_create(PARSE_POOL_SIZE, &mgr->parse_pool, err)) {
+        goto error;
+    }
+
     while (mgr->keep_going) {
         hdr.msg_namelen = sizeof(their_addr);
         hdr.msg_controllen = sizeof(mctl);
@@ -543,24 +1078,25 @@ LS_API bool tube_manager_loop(tube_manager *mgr, ls_err *err)
             LS_ERROR(err, -errno);
             goto error;
         }
+        ls_clock_update();
 
-        if (!spud_parse(buf, numbytes, &msg, err)) {
+        if (!spud_parse_pool(buf, numbytes, mgr->parse_pool, &msg, err)) {
             // it's an attack.  Move along.
             LS_LOG_ERR(*err, "spud_parse");
-            goto cleanup;
+            continue;
         }
 
         spud_copy_id(&msg.header->tube_id, &uid);
 
         cmd    = msg.header->flags & SPUD_COMMAND;
         d.t    = ls_htable_get(mgr->tubes, &uid);
-        d.cbor = msg.cbor;
+        d.msg  = &msg;
         if (!d.t) {
             if (!tube_manager_is_responder(mgr) || (cmd != SPUD_OPEN)) {
               // Not for one of our tubes, and we're not a responder, so punt.
               // Even if we're a responder, if we get anything but an open
               // for an unknown tube, ignore it.
-              ls_log(LS_LOG_WARN, "Invalid tube ID: %s",
+              LS_LOG(LS_LOG_WARN, "Invalid tube ID: %s",
                      spud_id_to_string(id_str, sizeof(id_str), &uid));
               goto cleanup;
             }
@@ -569,7 +1105,7 @@ LS_API bool tube_manager_loop(tube_manager *mgr, ls_err *err)
             if (!tube_create(mgr, &d.t, err)) {
                 // probably out of memory
                 // TODO: replace with an unused queue
-                goto error;
+                goto unparse_error;
             }
 
             for (cmsg=CMSG_FIRSTHDR(&hdr); cmsg; cmsg=CMSG_NXTHDR(&hdr, cmsg)) {
@@ -587,17 +1123,21 @@ LS_API bool tube_manager_loop(tube_manager *mgr, ls_err *err)
         switch(cmd) {
         case SPUD_DATA:
             if (d.t->state == TS_RUNNING) {
-                if (!ls_event_trigger(mgr->e_data, &d, NULL, NULL, err)) {
-                    goto error;
+                if (mgr->num_workers > 0) {
+                    _worker_enqueue(_worker_for(mgr, d.t), d.t,
+                                    buf, numbytes, d.peer, hdr.msg_namelen);
+                } else if (!_tube_trigger(d.t, EV_DATA, &d, err)) {
+                    goto unparse_error;
                 }
             }
             break;
         case SPUD_CLOSE:
             if (d.t->state != TS_UNKNOWN) {
                 /* double-close is a no-op */
+                _worker_drain(_worker_for(mgr, d.t));
                 d.t->state = TS_UNKNOWN;
-                if (!ls_event_trigger(mgr->e_close, &d, NULL, NULL, err)) {
-                    goto error;
+                if (!_tube_trigger(d.t, EV_CLOSE, &d, err)) {
+                    goto unparse_error;
                 }
                 tube_manager_remove(mgr, d.t);
             }
@@ -608,8 +1148,8 @@ LS_API bool tube_manager_loop(tube_manager *mgr, ls_err *err)
         case SPUD_ACK:
             if (d.t->state == TS_OPENING) {
                 d.t->state = TS_RUNNING;
-                if (!ls_event_trigger(mgr->e_running, &d, NULL, NULL, err)) {
-                    goto error;
+                if (!_tube_trigger(d.t, EV_RUNNING, &d, err)) {
+                    goto unparse_error;
                 }
             }
             break;
@@ -618,6 +1158,9 @@ cleanup:
         spud_unparse(&msg);
     }
     return true;
+unparse_error:
+    /* hand back whatever was decoded into the parse pool */
+    spud_unparse(&msg);
 error:
     return false;
 }
@@ -0,0 +1,262 @@
+/* Generated by cborgen from test/cbor_schema.txt.  Do not edit. */
+
+#include <string.h>
+
+#include "cbor_schema.h"
+
+static bool cborgen_fail(cn_cbor_errback *errp, cn_cbor_error err,
+                         const char *buf, const cn_cbor_cursor *cur)
+{
+    if (errp) {
+        errp->err = err;
+        errp->pos = (int)((const char *)cur->pos - buf);
+    }
+    return false;
+}
+
+bool test_decl_decode(test_decl *m, const char *buf, size_t len,
+    cn_cbor_errback *errp)
+{
+    cn_cbor_cursor cur;
+    cn_cbor_item map, key, val;
+    uint32_t seen = 0;
+    bool indef;
+    size_t i;
+    int field;
+
+    memset(m, 0, sizeof(*m));
+    cn_cbor_cursor_init(&cur, buf, len);
+    if (!cn_cbor_cursor_next(&cur, &map)) {
+        return cborgen_fail(errp, cur.err, buf, &cur);
+    }
+    if (map.type != CN_CBOR_MAP) {
+        return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);
+    }
+    indef = (map.flags & CN_CBOR_FL_INDEF) != 0;
+    for (i = 0; indef || i < map.length; i++) {
+        if (indef && cn_cbor_cursor_break(&cur)) {
+            break;
+        }
+        if (!cn_cbor_cursor_next(&cur, &key)) {
+            return cborgen_fail(errp, cur.err, buf, &cur);
+        }
+        field = -1;
+        if ((key.type == CN_CBOR_UINT && key.v.sint >= 0) ||
+            (key.type == CN_CBOR_INT && key.v.sint < 0)) {
+            switch (key.v.sint) {
+            case 0:
+                field = 0;
+                break;
+            case 1:
+                field = 1;
+                break;
+            case -1:
+                field = 2;
+                break;
+            }
+        } else if (key.type == CN_CBOR_TEXT &&
+                   !(key.flags & CN_CBOR_FL_INDEF)) {
+            if (key.length == 2 &&
+                memcmp(key.v.str, "ip", 2) == 0) {
+                field = 3;
+            } else if (key.length == 2 &&
+                       memcmp(key.v.str, "up", 2) == 0) {
+                field = 4;
+            } else if (key.length == 3 &&
+                       memcmp(key.v.str, "rtt", 3) == 0) {
+                field = 5;
+            }
+        } else if (!cn_cbor_cursor_skip_contents(&cur, &key)) {
+            return cborgen_fail(errp, cur.err, buf, &cur);
+        }
+        if (field < 0) {
+            /* not in the schema */
+            if (!cn_cbor_cursor_skip(&cur)) {
+                return cborgen_fail(errp, cur.err, buf, &cur);
+            }
+            continue;
+        }
+        if (seen & ((uint32_t)1 << field)) {
+            return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);
+        }
+        seen |= (uint32_t)1 << field;
+        if (!cn_cbor_cursor_next(&cur, &val)) {
+            return cborgen_fail(errp, cur.err, buf, &cur);
+        }
+        switch (field) {
+        case 0:
+            if (val.type != CN_CBOR_BYTES ||
+                (val.flags & CN_CBOR_FL_INDEF)) {
+                return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);
+            }
+            m->data = (const uint8_t *)val.v.str;
+            m->data_len = val.length;
+            break;
+        case 1:
+            if (val.type != CN_CBOR_UINT) {
+                return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);
+            }
+            m->has_seq = true;
+            m->seq = val.v.uint;
+            break;
+        case 2:
+            if (!(val.type == CN_CBOR_UINT && val.v.sint >= 0) &&
+                !(val.type == CN_CBOR_INT && val.v.sint < 0)) {
+                return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);
+            }
+            m->has_offset = true;
+            m->offset = val.v.sint;
+            break;
+        case 3:
+            if (val.type != CN_CBOR_TEXT ||
+                (val.flags & CN_CBOR_FL_INDEF)) {
+                return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);
+            }
+            m->has_addr = true;
+            m->addr = val.v.str;
+            m->addr_len = val.length;
+            break;
+        case 4:
+            if (val.type != CN_CBOR_TRUE &&
+                val.type != CN_CBOR_FALSE) {
+                return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);
+            }
+            m->has_up = true;
+            m->up = (val.type == CN_CBOR_TRUE);
+            break;
+        case 5:
+            if (val.type != CN_CBOR_DOUBLE) {
+                return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);
+            }
+            m->has_rtt = true;
+            m->rtt = val.v.dbl;
+            break;
+        }
+    }
+    if ((seen & 0x1UL) != 0x1UL) {
+        return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);
+    }
+    if (!cn_cbor_cursor_done(&cur)) {
+        return cborgen_fail(errp, CN_CBOR_ERR_NOT_ALL_DATA_CONSUMED, buf, &cur);
+    }
+    return true;
+}
+
+bool test_decl_write(const test_decl *m, cn_cbor_writer *w)
+{
+    static const uint8_t key_data[] = { 0x00 };
+    static const uint8_t key_seq[] = { 0x01 };
+    static const uint8_t key_offset[] = { 0x20 };
+    static const uint8_t key_addr[] = { 0x62, 0x69, 0x70 };
+    static const uint8_t key_up[] = { 0x62, 0x75, 0x70 };
+    static const uint8_t key_rtt[] = { 0x63, 0x72, 0x74, 0x74 };
+
+    cn_cbor_write_map(w, 1 +
+        (m->has_seq ? 1 : 0) +
+        (m->has_offset ? 1 : 0) +
+        (m->has_addr ? 1 : 0) +
+        (m->has_up ? 1 : 0) +
+        (m->has_rtt ? 1 : 0));
+    cn_cbor_write_encoded(w, key_data, sizeof(key_data));
+    cn_cbor_write_bytes(w, m->data, m->data_len);
+    if (m->has_seq) {
+        cn_cbor_write_encoded(w, key_seq, sizeof(key_seq));
+        cn_cbor_write_uint(w, m->seq);
+    }
+    if (m->has_offset) {
+        cn_cbor_write_encoded(w, key_offset, sizeof(key_offset));
+        cn_cbor_write_int(w, m->offset);
+    }
+    if (m->has_addr) {
+        cn_cbor_write_encoded(w, key_addr, sizeof(key_addr));
+        cn_cbor_write_text(w, m->addr, m->addr_len);
+    }
+    if (m->has_up) {
+        cn_cbor_write_encoded(w, key_up, sizeof(key_up));
+        cn_cbor_write_bool(w, m->up);
+    }
+    if (m->has_rtt) {
+        cn_cbor_write_encoded(w, key_rtt, sizeof(key_rtt));
+        cn_cbor_write_double(w, m->rtt);
+    }
+    return w->err == CN_CBOR_NO_ERROR;
+}
+
+bool test_ack_decode(test_ack *m, const char *buf, size_t len,
+    cn_cbor_errback *errp)
+{
+    cn_cbor_cursor cur;
+    cn_cbor_item map, key, val;
+    uint32_t seen = 0;
+    bool indef;
+    size_t i;
+    int field;
+
+    memset(m, 0, sizeof(*m));
+    cn_cbor_cursor_init(&cur, buf, len);
+    if (!cn_cbor_cursor_next(&cur, &map)) {
+        return cborgen_fail(errp, cur.err, buf, &cur);
+    }
+    if (map.type != CN_CBOR_MAP) {
+        return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);
+    }
+    indef = (map.flags & CN_CBOR_FL_INDEF) != 0;
+    for (i = 0; indef || i < map.length; i++) {
+        if (indef && cn_cbor_cursor_break(&cur)) {
+            break;
+        }
+        if (!cn_cbor_cursor_next(&cur, &key)) {
+            return cborgen_fail(errp, cur.err, buf, &cur);
+        }
+        field = -1;
+        if ((key.type == CN_CBOR_UINT && key.v.sint >= 0) ||
+            (key.type == CN_CBOR_INT && key.v.sint < 0)) {
+            switch (key.v.sint) {
+            case 0:
+                field = 0;
+                break;
+            }
+        } else if (!cn_cbor_cursor_skip_contents(&cur, &key)) {
+            return cborgen_fail(errp, cur.err, buf, &cur);
+        }
+        if (field < 0) {
+            /* not in the schema */
+            if (!cn_cbor_cursor_skip(&cur)) {
+                return cborgen_fail(errp, cur.err, buf, &cur);
+            }
+            continue;
+        }
+        if (seen & ((uint32_t)1 << field)) {
+            return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);
+        }
+        seen |= (uint32_t)1 << field;
+        if (!cn_cbor_cursor_next(&cur, &val)) {
+            return cborgen_fail(errp, cur.err, buf, &cur);
+        }
+        switch (field) {
+        case 0:
+            if (val.type != CN_CBOR_UINT) {
+                return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);
+            }
+            m->seq = val.v.uint;
+            break;
+        }
+    }
+    if ((seen & 0x1UL) != 0x1UL) {
+        return cborgen_fail(errp, CN_CBOR_ERR_SCHEMA_MISMATCH, buf, &cur);
+    }
+    if (!cn_cbor_cursor_done(&cur)) {
+        return cborgen_fail(errp, CN_CBOR_ERR_NOT_ALL_DATA_CONSUMED, buf, &cur);
+    }
+    return true;
+}
+
+bool test_ack_write(const test_ack *m, cn_cbor_writer *w)
+{
+    static const uint8_t key_seq[] = { 0x00 };
+
+    cn_cbor_write_map(w, 1);
+    cn_cbor_write_encoded(w, key_seq, sizeof(key_seq));
+    cn_cbor_write_uint(w, m->seq);
+    return w->err == CN_CBOR_NO_ERROR;
+}
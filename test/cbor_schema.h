@@ -0,0 +1,48 @@
+/* Generated by cborgen from test/cbor_schema.txt.  Do not edit. */
+
+#ifndef CBOR_SCHEMA_H
+#define CBOR_SCHEMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cn-cbor/cn-cbor.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+typedef struct test_decl {
+    const uint8_t *data;
+    size_t data_len;
+    bool has_seq;
+    uint64_t seq;
+    bool has_offset;
+    int64_t offset;
+    bool has_addr;
+    const char *addr;
+    size_t addr_len;
+    bool has_up;
+    bool up;
+    bool has_rtt;
+    double rtt;
+} test_decl;
+
+bool test_decl_decode(test_decl *m, const char *buf, size_t len,
+    cn_cbor_errback *errp);
+bool test_decl_write(const test_decl *m, cn_cbor_writer *w);
+
+typedef struct test_ack {
+    uint64_t seq;
+} test_ack;
+
+bool test_ack_decode(test_ack *m, const char *buf, size_t len,
+    cn_cbor_errback *errp);
+bool test_ack_write(const test_ack *m, cn_cbor_writer *w);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* CBOR_SCHEMA_H */
@@ -10,6 +10,7 @@
 #include "cn-cbor/cn-cbor.h"
 #include "../src/cn-cbor/cn-encoder.h"
 #include "ls_mem.h"
+#include "cbor_schema.h"
 
 Suite * cbor_suite (void);
 
@@ -46,6 +47,12 @@ START_TEST (cbor_error_test)
     ck_assert_str_eq(cn_cbor_error_str[CN_CBOR_ERR_RESERVED_AI], "CN_CBOR_ERR_RESERVED_AI");
     ck_assert_str_eq(cn_cbor_error_str[CN_CBOR_ERR_WRONG_NESTING_IN_INDEF_STRING], "CN_CBOR_ERR_WRONG_NESTING_IN_INDEF_STRING");
     ck_assert_str_eq(cn_cbor_error_str[CN_CBOR_ERR_OUT_OF_MEMORY], "CN_CBOR_ERR_OUT_OF_MEMORY");
+    ck_assert_str_eq(cn_cbor_error_str[CN_CBOR_ERR_TOO_DEEP], "CN_CBOR_ERR_TOO_DEEP");
+    ck_assert_str_eq(cn_cbor_error_str[CN_CBOR_ERR_TOO_MANY_ITEMS], "CN_CBOR_ERR_TOO_MANY_ITEMS");
+    ck_assert_str_eq(cn_cbor_error_str[CN_CBOR_ERR_COUNT_TOO_LARGE], "CN_CBOR_ERR_COUNT_TOO_LARGE");
+    ck_assert_str_eq(cn_cbor_error_str[CN_CBOR_ERR_INVALID_ITEM], "CN_CBOR_ERR_INVALID_ITEM");
+    ck_assert_str_eq(cn_cbor_error_str[CN_CBOR_ERR_INVALID_UTF8], "CN_CBOR_ERR_INVALID_UTF8");
+    ck_assert_str_eq(cn_cbor_error_str[CN_CBOR_ERR_SCHEMA_MISMATCH], "CN_CBOR_ERR_SCHEMA_MISMATCH");
 }
 END_TEST
 
@@ -98,6 +105,7 @@ START_TEST (cbor_parse_test)
         enc_sz = cbor_encoder_write(encoded, 0, sizeof(encoded), cb);
         ck_assert_int_eq(enc_sz, b.sz);
         ck_assert_int_eq(memcmp(b.ptr, encoded, enc_sz), 0);
+        ck_assert_int_eq(cbor_encoder_size(cb), b.sz);
         free(b.ptr);
         cn_cbor_free(cb);
     }
@@ -121,6 +129,9 @@ START_TEST (cbor_fail_test)
         {"1f", CN_CBOR_ERR_MT_UNDEF_FOR_INDEF},
         {"1c", CN_CBOR_ERR_RESERVED_AI},
         {"7f4100", CN_CBOR_ERR_WRONG_NESTING_IN_INDEF_STRING},
+        {"9bffffffffffffffff00", CN_CBOR_ERR_OUT_OF_DATA},
+        {"ba8000000000", CN_CBOR_ERR_OUT_OF_DATA},
+        {"df00", CN_CBOR_ERR_MT_UNDEF_FOR_INDEF},
     };
     const cn_cbor *cb;
     buffer b;
@@ -138,6 +149,1086 @@ START_TEST (cbor_fail_test)
 }
 END_TEST
 
+static void assert_same_tree(const cn_cbor *cb, const cn_cbor_compact *cc)
+{
+    const cn_cbor *cp;
+    const cn_cbor_compact *ccp;
+
+    ck_assert_int_eq(cc->type, cb->type);
+    ck_assert_int_eq(cc->flags & CN_CBOR_FL_INDEF, cb->flags & CN_CBOR_FL_INDEF);
+    ck_assert_int_eq(cc->length, cb->length);
+    switch (cb->type) {
+    case CN_CBOR_BYTES: case CN_CBOR_TEXT:
+        ck_assert(cc->v.str == cb->v.str);
+        break;
+    case CN_CBOR_DOUBLE:
+        ck_assert(memcmp(&cc->v.dbl, &cb->v.dbl, sizeof(double)) == 0);
+        break;
+    case CN_CBOR_ARRAY: case CN_CBOR_MAP:
+    case CN_CBOR_BYTES_CHUNKED: case CN_CBOR_TEXT_CHUNKED:
+        break;
+    default:
+        ck_assert_int_eq(cc->v.uint, cb->v.uint);
+    }
+    for (cp = cb->first_child, ccp = cn_cbor_compact_first_child(cc);
+         cp;
+         cp = cp->next, ccp = cn_cbor_compact_next(ccp)) {
+        ck_assert(ccp != NULL);
+        assert_same_tree(cp, ccp);
+    }
+    ck_assert(ccp == NULL);
+}
+
+START_TEST (cbor_compact_test)
+{
+    cn_cbor_errback err;
+    char *tests[] = {
+        "00",
+        "3b0000000100000000",
+        "6161",
+        "818100",
+        "a1616100",
+        "d8184100",
+        "f8ff",
+        "fb3ff199999999999a",
+        "5f42010243030405ff",
+        "7f61616161ff",
+        "9fff",
+        "bf61610161629f0203ffff",
+        "83a0808101",
+        "a2006161820102d81880",
+    };
+    cn_cbor_compact nodes[32];
+    const cn_cbor *cb;
+    const cn_cbor_compact *cc;
+    buffer b;
+    size_t i, used;
+
+    ck_assert_int_le(sizeof(cn_cbor_compact), 24);
+    for (i=0; i<sizeof(tests)/sizeof(char*); i++) {
+        ck_assert(parse_hex(tests[i], &b));
+        cb = cn_cbor_decode(b.ptr, b.sz, NULL, NULL, &err);
+        ck_assert_msg(cb != NULL, tests[i]);
+        cc = cn_cbor_compact_decode(b.ptr, b.sz, nodes, 32, &used, &err);
+        ck_assert_msg(cc == nodes, tests[i]);
+        ck_assert_int_le(used, b.sz);
+        assert_same_tree(cb, cc);
+
+        /* exactly enough nodes, then one short */
+        ck_assert(cn_cbor_compact_decode(b.ptr, b.sz, nodes, used,
+                                         NULL, &err) != NULL);
+        ck_assert(cn_cbor_compact_decode(b.ptr, b.sz, nodes, used - 1,
+                                         NULL, &err) == NULL);
+        ck_assert_int_eq(err.err, CN_CBOR_ERR_TOO_MANY_ITEMS);
+        free(b.ptr);
+        cn_cbor_free(cb);
+    }
+}
+END_TEST
+
+START_TEST (cbor_compact_fail_test)
+{
+    cn_cbor_errback err;
+    cbor_failure tests[] = {
+        {"81", CN_CBOR_ERR_OUT_OF_DATA},
+        {"0000", CN_CBOR_ERR_NOT_ALL_DATA_CONSUMED},
+        {"bf00ff", CN_CBOR_ERR_ODD_SIZE_INDEF_MAP},
+        {"ff", CN_CBOR_ERR_BREAK_OUTSIDE_INDEF},
+        {"1f", CN_CBOR_ERR_MT_UNDEF_FOR_INDEF},
+        {"1c", CN_CBOR_ERR_RESERVED_AI},
+        {"7f4100", CN_CBOR_ERR_WRONG_NESTING_IN_INDEF_STRING},
+        {"5f5fffff", CN_CBOR_ERR_WRONG_NESTING_IN_INDEF_STRING},
+    };
+    cn_cbor_compact nodes[CN_CBOR_COMPACT_MAX_DEPTH + 2];
+    char deep[CN_CBOR_COMPACT_MAX_DEPTH + 2];
+    buffer b;
+    size_t i;
+
+    for (i=0; i<sizeof(tests)/sizeof(cbor_failure); i++) {
+        ck_assert(parse_hex(tests[i].hex, &b));
+        ck_assert_msg(cn_cbor_compact_decode(b.ptr, b.sz, nodes, 8,
+                                             NULL, &err) == NULL,
+                      tests[i].hex);
+        ck_assert_int_eq(err.err, tests[i].err);
+        free(b.ptr);
+    }
+
+    /* one array more than may be open at once */
+    memset(deep, 0x81, sizeof(deep) - 1);
+    deep[sizeof(deep) - 1] = 0x00;
+    ck_assert(cn_cbor_compact_decode(deep, sizeof(deep), nodes, 8,
+                                     NULL, &err) == NULL);
+    ck_assert_int_eq(err.err, CN_CBOR_ERR_TOO_MANY_ITEMS);
+    ck_assert(cn_cbor_compact_decode(deep, sizeof(deep), nodes,
+                                     sizeof(nodes) / sizeof(nodes[0]),
+                                     NULL, &err) == NULL);
+    ck_assert_int_eq(err.err, CN_CBOR_ERR_TOO_DEEP);
+}
+END_TEST
+
+START_TEST (cbor_compact_get_test)
+{
+    cn_cbor_errback err;
+    cn_cbor_compact nodes[16];
+    const cn_cbor_compact *cc, *val;
+    buffer b;
+
+    // {1: [10, 11, 12], "a": 2, -1: h'cc', "b": {}}
+    ck_assert(parse_hex("a4"
+                        "01830a0b0c"
+                        "616102"
+                        "2041cc"
+                        "6162a0", &b));
+    cc = cn_cbor_compact_decode(b.ptr, b.sz, nodes, 16, NULL, &err);
+    ck_assert(cc != NULL);
+
+    val = cn_cbor_compact_mapget_int(cc, 1);
+    ck_assert(val != NULL);
+    ck_assert_int_eq(val->type, CN_CBOR_ARRAY);
+    ck_assert_int_eq(cn_cbor_compact_index(val, 2)->v.uint, 12);
+    ck_assert(cn_cbor_compact_index(val, 3) == NULL);
+
+    val = cn_cbor_compact_mapget_string(cc, "a");
+    ck_assert(val != NULL);
+    ck_assert_int_eq(val->v.uint, 2);
+
+    val = cn_cbor_compact_mapget_int(cc, -1);
+    ck_assert(val != NULL);
+    ck_assert_int_eq(val->type, CN_CBOR_BYTES);
+    ck_assert_int_eq(val->length, 1);
+
+    val = cn_cbor_compact_mapget_string(cc, "b");
+    ck_assert(val != NULL);
+    ck_assert_int_eq(val->type, CN_CBOR_MAP);
+    ck_assert(cn_cbor_compact_first_child(val) == NULL);
+
+    ck_assert(cn_cbor_compact_mapget_int(cc, 2) == NULL);
+    ck_assert(cn_cbor_compact_mapget_string(cc, "c") == NULL);
+    free(b.ptr);
+}
+END_TEST
+
+typedef struct _cbor_limit_case
+{
+    char *hex;
+    cn_cbor_limits limits;
+    cn_cbor_error err;
+} cbor_limit_case;
+
+START_TEST (cbor_limits_test)
+{
+    cn_cbor_errback err;
+    cbor_limit_case tests[] = {
+        {"8180",       {.max_depth = 1}, CN_CBOR_ERR_TOO_DEEP},       // [[]]
+        {"8180",       {.max_depth = 2}, CN_CBOR_NO_ERROR},
+        {"81d81800",   {.max_depth = 1}, CN_CBOR_ERR_TOO_DEEP},       // [24(0)]
+        {"9f9fffff",   {.max_depth = 1}, CN_CBOR_ERR_TOO_DEEP},       // [_ [_ ]]
+        {"7f6161ff",   {.max_depth = 1}, CN_CBOR_NO_ERROR},           // (_ "a")
+        {"83010203",   {.max_items = 3}, CN_CBOR_ERR_TOO_MANY_ITEMS}, // [1, 2, 3]
+        {"83010203",   {.max_items = 4}, CN_CBOR_NO_ERROR},
+        {"83010203",   {.max_count = 2}, CN_CBOR_ERR_COUNT_TOO_LARGE},
+        {"83010203",   {.max_count = 3}, CN_CBOR_NO_ERROR},
+        {"9f010203ff", {.max_count = 2}, CN_CBOR_ERR_COUNT_TOO_LARGE}, // [_ 1, 2, 3]
+        {"9f0102ff",   {.max_count = 2}, CN_CBOR_NO_ERROR},
+        {"a201020304", {.max_count = 1}, CN_CBOR_ERR_COUNT_TOO_LARGE}, // {1: 2, 3: 4}
+        {"bf01020304ff", {.max_count = 1}, CN_CBOR_ERR_COUNT_TOO_LARGE},
+        {"bf0102ff",   {.max_count = 1}, CN_CBOR_NO_ERROR},
+        /* the count is refused before any of its data is looked for */
+        {"9a00010000", {.max_count = 1000}, CN_CBOR_ERR_COUNT_TOO_LARGE},
+        {"62c3a9",     {.check_utf8 = true}, CN_CBOR_NO_ERROR},      // "\u00e9"
+        {"62c3a9",     {.check_utf8 = false}, CN_CBOR_NO_ERROR},
+        {"61ff",       {.check_utf8 = true}, CN_CBOR_ERR_INVALID_UTF8},
+        {"61ff",       {.check_utf8 = false}, CN_CBOR_NO_ERROR},
+        {"41ff",       {.check_utf8 = true}, CN_CBOR_NO_ERROR},      // h'ff'
+        /* chunks may not split a character */
+        {"7f61c36161a9ff", {.check_utf8 = true}, CN_CBOR_ERR_INVALID_UTF8},
+        {"63eda080",   {.check_utf8 = true}, CN_CBOR_ERR_INVALID_UTF8}, // U+D800
+    };
+    const cn_cbor *cb;
+    buffer b;
+    size_t i;
+
+    for (i=0; i<sizeof(tests)/sizeof(tests[0]); i++) {
+        ck_assert(parse_hex(tests[i].hex, &b));
+        err.err = CN_CBOR_NO_ERROR;
+        cb = cn_cbor_decode_limited(b.ptr, b.sz, &tests[i].limits,
+                                    NULL, NULL, &err);
+        ck_assert_msg((cb == NULL) == (tests[i].err != CN_CBOR_NO_ERROR),
+                      tests[i].hex);
+        ck_assert_int_eq(err.err, tests[i].err);
+
+        free(b.ptr);
+        cn_cbor_free(cb);
+    }
+
+    /* no limits at all */
+    ck_assert(parse_hex("818180", &b));
+    cb = cn_cbor_decode_limited(b.ptr, b.sz, NULL, NULL, NULL, &err);
+    ck_assert(cb != NULL);
+    free(b.ptr);
+    cn_cbor_free(cb);
+}
+END_TEST
+
+START_TEST (cbor_mapget_key_test)
+{
+    cn_cbor_errback err;
+    cn_cbor_key key;
+    const cn_cbor *cb, *val;
+    buffer b;
+
+    // {1: 2, -1: 3, "a": 4, h'6262': 5, [0]: 6}
+    ck_assert(parse_hex("a50102200361610442626205810006", &b));
+    cb = cn_cbor_decode(b.ptr, b.sz, NULL, NULL, &err);
+    ck_assert(cb != NULL);
+
+    cn_cbor_key_int(&key, 1);
+    val = cn_cbor_mapget_key(cb, &key);
+    ck_assert(val != NULL);
+    ck_assert_int_eq(val->v.uint, 2);
+    ck_assert(val == cn_cbor_mapget_int(cb, 1));
+
+    cn_cbor_key_int(&key, -1);
+    val = cn_cbor_mapget_key(cb, &key);
+    ck_assert(val != NULL);
+    ck_assert_int_eq(val->v.uint, 3);
+
+    cn_cbor_key_string(&key, "a");
+    val = cn_cbor_mapget_key(cb, &key);
+    ck_assert(val != NULL);
+    ck_assert_int_eq(val->v.uint, 4);
+
+    cn_cbor_key_string(&key, "bb");
+    val = cn_cbor_mapget_key(cb, &key);
+    ck_assert(val != NULL);
+    ck_assert_int_eq(val->v.uint, 5);
+    ck_assert(val == cn_cbor_mapget_string(cb, "bb"));
+
+    cn_cbor_key_string(&key, "b");
+    ck_assert(cn_cbor_mapget_key(cb, &key) == NULL);
+    cn_cbor_key_int(&key, 0);
+    ck_assert(cn_cbor_mapget_key(cb, &key) == NULL);
+
+    free(b.ptr);
+    cn_cbor_free(cb);
+}
+END_TEST
+
+START_TEST (cbor_map_index_test)
+{
+    cn_cbor_errback err;
+    cn_cbor_map_index idx = CN_CBOR_MAP_INDEX_INIT;
+    cn_cbor_key key;
+    const cn_cbor *cb, *small, *val;
+    unsigned char buf[256];
+    char name[4];
+    size_t len = 0;
+    int i;
+
+    // {0: 0, "k0": 100, 1: 1, "k1": 101, ..., 19: 19, "k19": 119, 0: 999}
+    buf[len++] = 0xb8;
+    buf[len++] = 41;
+    for (i = 0; i < 20; i++) {
+        buf[len++] = i;             /* key */
+        buf[len++] = i;             /* value */
+        snprintf(name, sizeof(name), "k%d", i);
+        buf[len++] = 0x60 + strlen(name);
+        memcpy(buf + len, name, strlen(name));
+        len += strlen(name);
+        buf[len++] = 0x18;
+        buf[len++] = 100 + i;
+    }
+    buf[len++] = 0x00;
+    buf[len++] = 0x19;
+    buf[len++] = 0x03;
+    buf[len++] = 0xe7;
+
+    cb = cn_cbor_decode((const char *)buf, len, NULL, NULL, &err);
+    ck_assert(cb != NULL);
+
+    for (i = 0; i < 20; i++) {
+        cn_cbor_key_int(&key, i);
+        val = cn_cbor_mapget_indexed(&idx, cb, &key);
+        ck_assert(val != NULL);
+        ck_assert_int_eq(val->v.uint, i);
+        ck_assert(val == cn_cbor_mapget_int(cb, i));
+
+        snprintf(name, sizeof(name), "k%d", i);
+        cn_cbor_key_string(&key, name);
+        val = cn_cbor_mapget_indexed(&idx, cb, &key);
+        ck_assert(val != NULL);
+        ck_assert_int_eq(val->v.uint, 100 + i);
+    }
+    ck_assert(idx.map == cb);
+    ck_assert(idx.slots != NULL);
+
+    cn_cbor_key_int(&key, 20);
+    ck_assert(cn_cbor_mapget_indexed(&idx, cb, &key) == NULL);
+    cn_cbor_key_string(&key, "k20");
+    ck_assert(cn_cbor_mapget_indexed(&idx, cb, &key) == NULL);
+
+    /* a different map replaces the index; small ones are walked */
+    small = cn_cbor_decode("\xa1\x61\x61\x01", 4, NULL, NULL, &err);
+    ck_assert(small != NULL);
+    cn_cbor_key_string(&key, "a");
+    val = cn_cbor_mapget_indexed(&idx, small, &key);
+    ck_assert(val != NULL);
+    ck_assert_int_eq(val->v.uint, 1);
+    ck_assert(idx.map == small);
+    ck_assert(idx.slots == NULL);
+
+    cn_cbor_map_index_free(&idx);
+    ck_assert(idx.map == NULL);
+    cn_cbor_free(small);
+    cn_cbor_free(cb);
+}
+END_TEST
+
+static size_t gather(const struct iovec *iov, int n, unsigned char *out)
+{
+    size_t len = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+        memcpy(out + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+    return len;
+}
+
+START_TEST (cbor_writev_test)
+{
+    cn_cbor_errback err;
+    const cn_cbor *cb;
+    buffer b;
+    unsigned char scratch[64];
+    unsigned char out[256];
+    struct iovec iov[8];
+    int n;
+
+    // {0: h'aabb...' (100 bytes), "k": "v", 1: [_ 1.5, h'cc']}
+    ck_assert(parse_hex("a3"
+                        "005864"
+                        "aabbaabbaabbaabbaabbaabbaabbaabbaabbaabbaabbaabbaabb"
+                        "aabbaabbaabbaabbaabbaabbaabbaabbaabbaabbaabbaabbaabb"
+                        "aabbaabbaabbaabbaabbaabbaabbaabbaabbaabbaabbaabbaabb"
+                        "aabbaabbaabbaabbaabbaabbaabbaabbaabbaabbaabb"
+                        "61"
+                        "6b6176"
+                        "019ffb3ff800000000000041ccff", &b));
+    ck_assert_int_eq(b.sz, 1 + 3 + 100 + 4 + 14);
+    cb = cn_cbor_decode(b.ptr, b.sz, NULL, NULL, &err);
+    ck_assert(cb != NULL);
+    ck_assert_int_eq(cbor_encoder_size(cb), b.sz);
+
+    /* the long string is sent in place, between two runs of scratch */
+    n = cbor_encoder_writev(cb, scratch, sizeof(scratch), iov, 8, 32);
+    ck_assert_int_eq(n, 3);
+    ck_assert(iov[1].iov_base == cb->first_child->next->v.str);
+    ck_assert_int_eq(iov[1].iov_len, 100);
+    ck_assert_int_eq(gather(iov, n, out), b.sz);
+    ck_assert_int_eq(memcmp(out, b.ptr, b.sz), 0);
+
+    /* short enough to copy */
+    n = cbor_encoder_writev(cb, out, sizeof(out), iov, 8, 101);
+    ck_assert_int_eq(n, 1);
+    ck_assert_int_eq(iov[0].iov_len, b.sz);
+    ck_assert_int_eq(memcmp(out, b.ptr, b.sz), 0);
+
+    /* out of room */
+    ck_assert_int_eq(cbor_encoder_writev(cb, scratch, 8, iov, 8, 32), -1);
+    ck_assert_int_eq(cbor_encoder_writev(cb, scratch, sizeof(scratch),
+                                         iov, 2, 32), -1);
+
+    free(b.ptr);
+    cn_cbor_free(cb);
+}
+END_TEST
+
+static void assert_written(const cn_cbor_writer *w, const char *hex)
+{
+    buffer b;
+    ck_assert(parse_hex((char *)hex, &b));
+    ck_assert_int_eq(w->length, b.sz);
+    ck_assert_int_eq(w->pos, b.sz);
+    ck_assert_int_eq(memcmp(w->buf, b.ptr, b.sz), 0);
+    free(b.ptr);
+}
+
+START_TEST (cbor_writer_test)
+{
+    cn_cbor_writer w;
+    uint8_t buf[64];
+
+    // {0: h'0102', "a": [1, -2, 1.5], 1: [_ true, null], 2: 24(false)}
+    cn_cbor_writer_init(&w, buf, sizeof(buf));
+    ck_assert(cn_cbor_write_map(&w, 4));
+    ck_assert(cn_cbor_write_uint(&w, 0));
+    ck_assert(cn_cbor_write_bytes(&w, "\x01\x02", 2));
+    ck_assert(cn_cbor_write_text(&w, "a", 1));
+    ck_assert(cn_cbor_write_array(&w, 3));
+    ck_assert(cn_cbor_write_int(&w, 1));
+    ck_assert(cn_cbor_write_int(&w, -2));
+    ck_assert(cn_cbor_write_double(&w, 1.5));
+    ck_assert_int_eq(w.depth, 1);
+    ck_assert(cn_cbor_write_uint(&w, 1));
+    ck_assert(cn_cbor_write_array_indef(&w));
+    ck_assert(cn_cbor_write_bool(&w, true));
+    ck_assert(cn_cbor_write_null(&w));
+    ck_assert(cn_cbor_write_end(&w));
+    ck_assert(cn_cbor_write_uint(&w, 2));
+    ck_assert(cn_cbor_write_tag(&w, 24));
+    ck_assert(cn_cbor_write_bool(&w, false));
+    ck_assert_int_eq(w.depth, 0);
+    ck_assert(cn_cbor_writer_finish(&w));
+    assert_written(&w, "a4"
+                   "00420102"
+                   "616183012"
+                   "1fb3ff8000000000000"
+                   "019ff5f6ff"
+                   "02d818f4");
+
+    /* empty containers close at once */
+    cn_cbor_writer_init(&w, buf, sizeof(buf));
+    ck_assert(cn_cbor_write_array(&w, 2));
+    ck_assert(cn_cbor_write_map(&w, 0));
+    ck_assert(cn_cbor_write_map_indef(&w));
+    ck_assert(cn_cbor_write_end(&w));
+    ck_assert(cn_cbor_writer_finish(&w));
+    assert_written(&w, "82a0bfff");
+}
+END_TEST
+
+START_TEST (cbor_writer_fail_test)
+{
+    cn_cbor_writer w;
+    uint8_t buf[4];
+    int i;
+
+    /* out of room, and the error sticks */
+    cn_cbor_writer_init(&w, buf, sizeof(buf));
+    ck_assert(cn_cbor_write_uint(&w, 0xffff));
+    ck_assert(!cn_cbor_write_uint(&w, 1000));
+    ck_assert_int_eq(w.err, CN_CBOR_ERR_OUT_OF_MEMORY);
+    ck_assert(!cn_cbor_write_uint(&w, 1));
+    ck_assert(!cn_cbor_writer_finish(&w));
+
+    /* only count */
+    cn_cbor_writer_init(&w, NULL, 0);
+    ck_assert(cn_cbor_write_text(&w, "hello", 5));
+    ck_assert_int_eq(w.length, 6);
+
+    cn_cbor_writer_init(&w, NULL, 0);
+    ck_assert(!cn_cbor_write_end(&w));
+    ck_assert_int_eq(w.err, CN_CBOR_ERR_BREAK_OUTSIDE_INDEF);
+
+    cn_cbor_writer_init(&w, NULL, 0);
+    ck_assert(cn_cbor_write_array(&w, 1));
+    ck_assert(!cn_cbor_write_end(&w));
+    ck_assert_int_eq(w.err, CN_CBOR_ERR_BREAK_OUTSIDE_INDEF);
+
+    cn_cbor_writer_init(&w, NULL, 0);
+    ck_assert(cn_cbor_write_map_indef(&w));
+    ck_assert(cn_cbor_write_uint(&w, 1));
+    ck_assert(!cn_cbor_write_end(&w));
+    ck_assert_int_eq(w.err, CN_CBOR_ERR_ODD_SIZE_INDEF_MAP);
+
+    cn_cbor_writer_init(&w, NULL, 0);
+    ck_assert(cn_cbor_write_map(&w, 1));
+    ck_assert(cn_cbor_write_uint(&w, 1));
+    ck_assert(!cn_cbor_writer_finish(&w));
+    ck_assert_int_eq(w.err, CN_CBOR_ERR_OUT_OF_DATA);
+
+    cn_cbor_writer_init(&w, NULL, 0);
+    for (i = 0; i < CN_CBOR_WRITER_MAX_DEPTH; i++) {
+        ck_assert(cn_cbor_write_array(&w, 1));
+    }
+    ck_assert(!cn_cbor_write_array(&w, 1));
+    ck_assert_int_eq(w.err, CN_CBOR_ERR_TOO_DEEP);
+}
+END_TEST
+
+START_TEST (cbor_writer_growable_test)
+{
+    cn_cbor_writer w;
+    cn_cbor_errback err;
+    const cn_cbor *cb;
+    char text[300];
+    char *copy;
+    int i;
+
+    memset(text, 't', sizeof(text));
+    cn_cbor_writer_init_growable(&w);
+    ck_assert(cn_cbor_write_array(&w, 10));
+    for (i = 0; i < 10; i++) {
+        ck_assert(cn_cbor_write_text(&w, text, sizeof(text)));
+    }
+    ck_assert(cn_cbor_writer_finish(&w));
+    ck_assert_int_eq(w.pos, 1 + 10 * (3 + sizeof(text)));
+
+    /* the tree must not point into w.buf, which may move */
+    copy = malloc(w.pos);
+    memcpy(copy, w.buf, w.pos);
+    cb = cn_cbor_decode(copy, w.pos, NULL, NULL, &err);
+    ck_assert(cb != NULL);
+    ck_assert_int_eq(cb->length, 10);
+    ck_assert_int_eq(cb->last_child->length, sizeof(text));
+
+    /* and a tree through the same writer */
+    ck_assert(cn_cbor_write_item(&w, cb));
+    ck_assert_int_eq(w.pos, 2 * (1 + 10 * (3 + sizeof(text))));
+    cn_cbor_free(cb);
+    free(copy);
+    cn_cbor_writer_free(&w);
+    ck_assert(w.buf == NULL);
+}
+END_TEST
+
+START_TEST (cbor_encode_deep_test)
+{
+    cn_cbor_errback err;
+    const cn_cbor *cb;
+    const size_t depth = 100000;
+    char *in = malloc(depth + 1);
+    uint8_t *out = malloc(depth + 1);
+
+    /* deep enough to overflow the stack if the encoder recursed */
+    memset(in, 0x81, depth);
+    in[depth] = 0x00;
+    cb = cn_cbor_decode(in, depth + 1, NULL, NULL, &err);
+    ck_assert(cb != NULL);
+    ck_assert_int_eq(cbor_encoder_size(cb), depth + 1);
+    ck_assert_int_eq(cbor_encoder_write(out, 0, depth + 1, cb), depth + 1);
+    ck_assert_int_eq(memcmp(in, out, depth + 1), 0);
+    ck_assert_int_eq(cbor_encoder_write(out, 0, depth, cb), -1);
+
+    cn_cbor_free(cb);
+    free(in);
+    free(out);
+}
+END_TEST
+
+static unsigned utf8_rand(unsigned *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7fff;
+}
+
+/* Valid text of about len bytes: ASCII runs and 2, 3 and 4 byte forms */
+static size_t utf8_fill(char *buf, size_t len, unsigned *seed)
+{
+    static const char *chars[] = {
+        "a", "~", "\xc2\x80", "\xdf\xbf", "\xe0\xa0\x80", "\xed\x9f\xbf",
+        "\xee\x80\x80", "\xef\xbf\xbf", "\xf0\x90\x80\x80",
+        "\xf4\x8f\xbf\xbf"
+    };
+    size_t n = 0;
+    while (n + 4 <= len) {
+        const char *c = (utf8_rand(seed) & 3) ?
+            chars[utf8_rand(seed) % 2] :
+            chars[utf8_rand(seed) % (sizeof(chars) / sizeof(chars[0]))];
+        memcpy(buf + n, c, strlen(c));
+        n += strlen(c);
+    }
+    return n;
+}
+
+START_TEST (cbor_utf8_test)
+{
+    static const struct {
+        const char *s;
+        bool valid;
+    } cases[] = {
+        {"", true},
+        {"plain ascii", true},
+        {"\xc3\xa9", true},
+        {"\xc3", false},                // cut short
+        {"\xa9", false},                // lone continuation
+        {"\xc0\xaf", false},            // overlong
+        {"\xe0\x9f\xbf", false},        // overlong
+        {"\xf0\x8f\xbf\xbf", false},    // overlong
+        {"\xed\xa0\x80", false},        // surrogate
+        {"\xf4\x90\x80\x80", false},    // past U+10FFFF
+        {"\xf5\x80\x80\x80", false},
+        {"\xff", false},
+        {"\xe2\x82\xac", true},
+        {"\xf0\x9f\x98\x80", true},
+    };
+    char buf[512], pad[512];
+    unsigned seed = 1;
+    size_t i, len, pos;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        len = strlen(cases[i].s);
+        ck_assert(cn_cbor_utf8_valid_scalar(cases[i].s, len) ==
+                  cases[i].valid);
+        ck_assert(cn_cbor_utf8_valid(cases[i].s, len) == cases[i].valid);
+        /* the same again at every offset of a long string, so the
+           vector code sees it in every lane and across blocks */
+        for (pos = 0; pos + len <= 100; pos++) {
+            memset(pad, 'x', 100);
+            memcpy(pad + pos, cases[i].s, len);
+            ck_assert(cn_cbor_utf8_valid(pad, 100) == cases[i].valid);
+        }
+    }
+
+    /* random text, then the same with one byte changed */
+    for (i = 0; i < 4000; i++) {
+        len = utf8_fill(buf, 64 + utf8_rand(&seed) % 440, &seed);
+        ck_assert(cn_cbor_utf8_valid_scalar(buf, len));
+        ck_assert(cn_cbor_utf8_valid(buf, len));
+        buf[utf8_rand(&seed) % len] = (char)utf8_rand(&seed);
+        ck_assert_int_eq(cn_cbor_utf8_valid(buf, len),
+                         cn_cbor_utf8_valid_scalar(buf, len));
+        /* and cut short */
+        pos = utf8_rand(&seed) % len;
+        ck_assert_int_eq(cn_cbor_utf8_valid(buf, pos),
+                         cn_cbor_utf8_valid_scalar(buf, pos));
+    }
+}
+END_TEST
+
+/* 1, "a", [2, 3], {1: 2}, (_ h'01', h'02'), null */
+static char *seq_hex = "01" "6161" "820203" "a10102" "5f41014102ff" "f6";
+static const cn_cbor_type seq_types[] = {
+    CN_CBOR_UINT, CN_CBOR_TEXT, CN_CBOR_ARRAY, CN_CBOR_MAP,
+    CN_CBOR_BYTES_CHUNKED, CN_CBOR_NULL
+};
+static const size_t seq_ends[] = { 1, 3, 6, 9, 15, 16 };
+
+START_TEST (cbor_seq_test)
+{
+    cn_cbor_seq seq;
+    const cn_cbor *cb;
+    const char *item;
+    size_t len;
+    int i;
+    buffer b;
+
+    ck_assert(parse_hex(seq_hex, &b));
+    cn_cbor_seq_init(&seq, NULL, NULL, NULL);
+    cn_cbor_seq_input(&seq, b.ptr, b.sz);
+    for (i = 0; i < 6; i++) {
+        cb = cn_cbor_seq_next(&seq);
+        ck_assert(cb != NULL);
+        ck_assert_int_eq(cb->type, seq_types[i]);
+        ck_assert_int_eq(seq.offset, seq_ends[i]);
+        cn_cbor_free(cb);
+    }
+    ck_assert(cn_cbor_seq_next(&seq) == NULL);
+    ck_assert_int_eq(seq.err, CN_CBOR_NO_ERROR);
+    ck_assert(cn_cbor_seq_done(&seq));
+
+    cn_cbor_seq_init(&seq, NULL, NULL, NULL);
+    cn_cbor_seq_input(&seq, b.ptr, b.sz);
+    for (i = 0; i < 6; i++) {
+        ck_assert(cn_cbor_seq_next_raw(&seq, &item, &len));
+        ck_assert(item == b.ptr + (i ? seq_ends[i - 1] : 0));
+        ck_assert_int_eq(seq.offset, seq_ends[i]);
+    }
+    ck_assert(!cn_cbor_seq_next_raw(&seq, &item, &len));
+    ck_assert(cn_cbor_seq_done(&seq));
+
+    // an empty sequence is fine
+    cn_cbor_seq_init(&seq, NULL, NULL, NULL);
+    cn_cbor_seq_input(&seq, NULL, 0);
+    ck_assert(cn_cbor_seq_next(&seq) == NULL);
+    ck_assert(cn_cbor_seq_done(&seq));
+    free(b.ptr);
+}
+END_TEST
+
+/* Read the sequence a few bytes at a time, as from a socket or file */
+static void seq_chunked(const buffer *b, size_t chunk, bool raw)
+{
+    char win[16];
+    size_t have = 0, fed = 0;
+    int items = 0;
+    cn_cbor_seq seq;
+    const cn_cbor *cb;
+    const char *item;
+    size_t len;
+
+    cn_cbor_seq_init(&seq, NULL, NULL, NULL);
+    while (fed < b->sz) {
+        size_t n = b->sz - fed < chunk ? b->sz - fed : chunk;
+        memcpy(win + have, b->ptr + fed, n);
+        fed += n;
+        cn_cbor_seq_input(&seq, win, have + n);
+        for (;;) {
+            if (raw) {
+                if (!cn_cbor_seq_next_raw(&seq, &item, &len))
+                    break;
+            } else {
+                if (!(cb = cn_cbor_seq_next(&seq)))
+                    break;
+                ck_assert_int_eq(cb->type, seq_types[items]);
+                cn_cbor_free(cb);
+            }
+            ck_assert_int_eq(seq.offset, seq_ends[items]);
+            items++;
+        }
+        ck_assert(seq.err == CN_CBOR_NO_ERROR ||
+                  seq.err == CN_CBOR_ERR_OUT_OF_DATA);
+        have = cn_cbor_seq_pending(&seq);
+        memmove(win, seq.buf + seq.pos, have);
+    }
+    ck_assert_int_eq(items, 6);
+    ck_assert(cn_cbor_seq_done(&seq));
+}
+
+START_TEST (cbor_seq_chunked_test)
+{
+    cn_cbor_seq seq;
+    buffer b;
+    size_t chunk;
+
+    ck_assert(parse_hex(seq_hex, &b));
+    for (chunk = 1; chunk <= b.sz; chunk++) {
+        seq_chunked(&b, chunk, false);
+        seq_chunked(&b, chunk, true);
+    }
+
+    // a stream that stops inside an item is not done
+    cn_cbor_seq_init(&seq, NULL, NULL, NULL);
+    cn_cbor_seq_input(&seq, b.ptr, 5);
+    cn_cbor_free(cn_cbor_seq_next(&seq));
+    cn_cbor_free(cn_cbor_seq_next(&seq));
+    ck_assert(cn_cbor_seq_next(&seq) == NULL);
+    ck_assert_int_eq(seq.err, CN_CBOR_ERR_OUT_OF_DATA);
+    ck_assert_int_eq(seq.offset, 3);
+    ck_assert_int_eq(cn_cbor_seq_pending(&seq), 2);
+    ck_assert(!cn_cbor_seq_done(&seq));
+    free(b.ptr);
+}
+END_TEST
+
+START_TEST (cbor_seq_fail_test)
+{
+    cn_cbor_limits limits = { .max_items = 2 };
+    cn_cbor_seq seq;
+    const cn_cbor *cb;
+    const char *item;
+    size_t len;
+    buffer b;
+
+    // 1, then a stray break, then 2
+    ck_assert(parse_hex("01ff02", &b));
+    cn_cbor_seq_init(&seq, NULL, NULL, NULL);
+    cn_cbor_seq_input(&seq, b.ptr, b.sz);
+    cn_cbor_free(cn_cbor_seq_next(&seq));
+    ck_assert(cn_cbor_seq_next(&seq) == NULL);
+    ck_assert_int_eq(seq.err, CN_CBOR_ERR_BREAK_OUTSIDE_INDEF);
+    ck_assert_int_eq(seq.offset, 1);
+    // errors other than running out of data stick
+    cn_cbor_seq_input(&seq, b.ptr + 2, 1);
+    ck_assert(cn_cbor_seq_next(&seq) == NULL);
+    ck_assert(!cn_cbor_seq_next_raw(&seq, &item, &len));
+    ck_assert(!cn_cbor_seq_done(&seq));
+    free(b.ptr);
+
+    // limits apply to each item, not to the whole sequence
+    ck_assert(parse_hex("8101" "8102" "820304", &b));
+    cn_cbor_seq_init(&seq, &limits, NULL, NULL);
+    cn_cbor_seq_input(&seq, b.ptr, b.sz);
+    cb = cn_cbor_seq_next(&seq);
+    ck_assert(cb != NULL);
+    cn_cbor_free(cb);
+    cb = cn_cbor_seq_next(&seq);
+    ck_assert(cb != NULL);
+    cn_cbor_free(cb);
+    ck_assert(cn_cbor_seq_next(&seq) == NULL);
+    ck_assert_int_eq(seq.err, CN_CBOR_ERR_TOO_MANY_ITEMS);
+    ck_assert_int_eq(seq.offset, 4);
+    free(b.ptr);
+}
+END_TEST
+
+START_TEST (cbor_typed_array_test)
+{
+    cn_cbor_errback err;
+    cn_cbor_typed_array ta;
+    const cn_cbor *cb;
+    uint16_t out[2];
+    buffer b;
+
+    // 69([1, 2]) little-endian, then 65([1, 2]) big-endian
+    ck_assert(parse_hex("d8454401000200", &b));
+    cb = cn_cbor_decode(b.ptr, b.sz, NULL, NULL, &err);
+    ck_assert(cb != NULL);
+    ck_assert(cn_cbor_typed_array_view(cb, &ta));
+    ck_assert_int_eq(ta.kind, CN_CBOR_TA_UINT);
+    ck_assert_int_eq(ta.size, 2);
+    ck_assert(ta.little_endian);
+    ck_assert_int_eq(ta.count, 2);
+    cn_cbor_typed_array_copy(&ta, out);
+    ck_assert_int_eq(out[0], 1);
+    ck_assert_int_eq(out[1], 2);
+    cn_cbor_free(cb);
+    free(b.ptr);
+
+    ck_assert(parse_hex("d8414400010002", &b));
+    cb = cn_cbor_decode(b.ptr, b.sz, NULL, NULL, &err);
+    ck_assert(cb != NULL);
+    ck_assert(cn_cbor_typed_array_view(cb, &ta));
+    ck_assert(!ta.little_endian);
+    cn_cbor_typed_array_copy(&ta, out);
+    ck_assert_int_eq(out[0], 1);
+    ck_assert_int_eq(out[1], 2);
+    cn_cbor_free(cb);
+    free(b.ptr);
+
+    // 82(h'') is an empty array of big-endian doubles
+    ck_assert(cn_cbor_typed_array_init(&ta, 82, "", 0));
+    ck_assert_int_eq(ta.kind, CN_CBOR_TA_FLOAT);
+    ck_assert_int_eq(ta.size, 8);
+    ck_assert_int_eq(ta.count, 0);
+    // sint8 has no byte order; 76 is reserved
+    ck_assert(cn_cbor_typed_array_init(&ta, 72, "\x80", 1));
+    ck_assert_int_eq(ta.kind, CN_CBOR_TA_SINT);
+    ck_assert(!cn_cbor_typed_array_init(&ta, 76, "\x80", 1));
+    ck_assert(!cn_cbor_typed_array_init(&ta, 63, "", 0));
+    ck_assert(!cn_cbor_typed_array_init(&ta, 88, "", 0));
+    // not a whole number of elements
+    ck_assert(!cn_cbor_typed_array_init(&ta, 65, "\x00\x01\x00", 3));
+
+    // not a typed array: 1(h'00'), 65("ab"), and 65 alone
+    ck_assert(parse_hex("c14100", &b));
+    cb = cn_cbor_decode(b.ptr, b.sz, NULL, NULL, &err);
+    ck_assert(!cn_cbor_typed_array_view(cb, &ta));
+    cn_cbor_free(cb);
+    free(b.ptr);
+    ck_assert(parse_hex("d841626162", &b));
+    cb = cn_cbor_decode(b.ptr, b.sz, NULL, NULL, &err);
+    ck_assert(!cn_cbor_typed_array_view(cb, &ta));
+    ck_assert(!cn_cbor_typed_array_view(cb->first_child, &ta));
+    cn_cbor_free(cb);
+    free(b.ptr);
+}
+END_TEST
+
+START_TEST (cbor_typed_array_native_test)
+{
+    static const uint32_t vals[3] = { 1, 2, 0x01020304 };
+    const uint16_t one = 1;
+    bool little = *(const uint8_t *)&one == 1;
+    uint64_t host = little ? 70 : 66;   /* uint32 in host order */
+    cn_cbor_typed_array ta;
+
+    ck_assert(cn_cbor_typed_array_init(&ta, host, vals, sizeof(vals)));
+    ck_assert(cn_cbor_typed_array_native(&ta) == vals);
+    // misaligned
+    ck_assert(cn_cbor_typed_array_init(&ta, host,
+                                       (const uint8_t *)vals + 2, 8));
+    ck_assert(cn_cbor_typed_array_native(&ta) == NULL);
+    // other order
+    ck_assert(cn_cbor_typed_array_init(&ta, host ^ 4, vals, sizeof(vals)));
+    ck_assert(cn_cbor_typed_array_native(&ta) == NULL);
+    // single bytes are always in order
+    ck_assert(cn_cbor_typed_array_init(&ta, 64, vals, sizeof(vals)));
+    ck_assert(cn_cbor_typed_array_native(&ta) == vals);
+}
+END_TEST
+
+/* Each size, in host order through the writer and swapped by hand, at
+   lengths that leave every kind of tail after the vectors */
+START_TEST (cbor_typed_array_roundtrip_test)
+{
+    static const struct {
+        cn_cbor_ta_kind kind;
+        unsigned int size;
+    } types[] = {
+        {CN_CBOR_TA_UINT, 1}, {CN_CBOR_TA_UINT, 2}, {CN_CBOR_TA_UINT, 4},
+        {CN_CBOR_TA_UINT, 8}, {CN_CBOR_TA_SINT, 1}, {CN_CBOR_TA_SINT, 2},
+        {CN_CBOR_TA_SINT, 4}, {CN_CBOR_TA_SINT, 8}, {CN_CBOR_TA_FLOAT, 2},
+        {CN_CBOR_TA_FLOAT, 4}, {CN_CBOR_TA_FLOAT, 8}, {CN_CBOR_TA_FLOAT, 16},
+    };
+    uint8_t data[16 * 70], swapped[16 * 70], out[16 * 70], enc[2048];
+    cn_cbor_typed_array ta;
+    cn_cbor_writer w;
+    cn_cbor_errback err;
+    const cn_cbor *cb;
+    size_t t, count, i, j, size;
+    uint64_t tag;
+
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 37 + 11);
+    }
+    for (t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        size = types[t].size;
+        for (count = 0; count <= 70; count++) {
+            cn_cbor_writer_init(&w, enc, sizeof(enc));
+            ck_assert(cn_cbor_write_typed_array(&w, types[t].kind, size,
+                                                data, count));
+            ck_assert(cn_cbor_writer_finish(&w));
+            cb = cn_cbor_decode((const char *)enc, w.length,
+                                NULL, NULL, &err);
+            ck_assert(cb != NULL);
+            ck_assert(cn_cbor_typed_array_view(cb, &ta));
+            ck_assert_int_eq(ta.kind, types[t].kind);
+            ck_assert_int_eq(ta.size, size);
+            ck_assert_int_eq(ta.count, count);
+            memset(out, 0, sizeof(out));
+            cn_cbor_typed_array_copy(&ta, out);
+            ck_assert(memcmp(out, data, count * size) == 0);
+            tag = cb->v.uint;
+            cn_cbor_free(cb);
+
+            if (size == 1) {
+                continue;
+            }
+            for (i = 0; i < count; i++) {
+                for (j = 0; j < size; j++) {
+                    swapped[i * size + j] = data[i * size + size - 1 - j];
+                }
+            }
+            ck_assert(cn_cbor_typed_array_init(&ta, tag ^ 4, swapped,
+                                               count * size));
+            memset(out, 0, sizeof(out));
+            cn_cbor_typed_array_copy(&ta, out);
+            ck_assert(memcmp(out, data, count * size) == 0);
+        }
+    }
+
+    // sizes that have no tag
+    cn_cbor_writer_init(&w, enc, sizeof(enc));
+    ck_assert(!cn_cbor_write_typed_array(&w, CN_CBOR_TA_UINT, 3, data, 1));
+    ck_assert_int_eq(w.err, CN_CBOR_ERR_INVALID_ITEM);
+    cn_cbor_writer_init(&w, enc, sizeof(enc));
+    ck_assert(!cn_cbor_write_typed_array(&w, CN_CBOR_TA_SINT, 16, data, 1));
+    cn_cbor_writer_init(&w, enc, sizeof(enc));
+    ck_assert(!cn_cbor_write_typed_array(&w, CN_CBOR_TA_FLOAT, 1, data, 1));
+}
+END_TEST
+
+START_TEST (cbor_write_encoded_test)
+{
+    static const uint8_t key[] = { 0x63, 0x72, 0x74, 0x74 };   // "rtt"
+    uint8_t buf[32];
+    cn_cbor_writer w;
+    cn_cbor_errback err;
+    const cn_cbor *cb;
+
+    cn_cbor_writer_init(&w, buf, sizeof(buf));
+    ck_assert(cn_cbor_write_map(&w, 1));
+    ck_assert(cn_cbor_write_encoded(&w, key, sizeof(key)));
+    ck_assert(cn_cbor_write_uint(&w, 7));
+    ck_assert(cn_cbor_writer_finish(&w));
+    ck_assert_int_eq(w.length, 6);
+    cb = cn_cbor_decode((const char *)buf, w.length, NULL, NULL, &err);
+    ck_assert(cb != NULL);
+    ck_assert_int_eq(cn_cbor_mapget_string(cb, "rtt")->v.uint, 7);
+    cn_cbor_free(cb);
+
+    // no room
+    cn_cbor_writer_init(&w, buf, 2);
+    ck_assert(!cn_cbor_write_encoded(&w, key, sizeof(key)));
+    ck_assert(w.err != CN_CBOR_NO_ERROR);
+}
+END_TEST
+
+START_TEST (cbor_schema_test)
+{
+    static const uint8_t data[] = { 1, 2, 3 };
+    uint8_t enc[128];
+    cn_cbor_writer w;
+    cn_cbor_errback err;
+    test_decl in, out;
+    test_ack ack;
+    buffer b;
+    size_t i;
+    struct {
+        char *hex;
+        cn_cbor_error err;
+    } fails[] = {
+        {"a0", CN_CBOR_ERR_SCHEMA_MISMATCH},            // no data
+        {"80", CN_CBOR_ERR_SCHEMA_MISMATCH},            // not a map
+        {"a100f6", CN_CBOR_ERR_SCHEMA_MISMATCH},        // data: null
+        {"a2004000f5", CN_CBOR_ERR_SCHEMA_MISMATCH},    // data twice
+        {"a2004001fb3ff0000000000000", CN_CBOR_ERR_SCHEMA_MISMATCH},
+        {"a2004062757001", CN_CBOR_ERR_SCHEMA_MISMATCH}, // up: 1
+        {"a10040ff", CN_CBOR_ERR_NOT_ALL_DATA_CONSUMED},
+        {"a20040", CN_CBOR_ERR_OUT_OF_DATA},
+        {"a2004020", CN_CBOR_ERR_OUT_OF_DATA},
+    };
+
+    memset(&in, 0, sizeof(in));
+    in.data = data;
+    in.data_len = sizeof(data);
+    cn_cbor_writer_init(&w, enc, sizeof(enc));
+    ck_assert(test_decl_write(&in, &w));
+    ck_assert(cn_cbor_writer_finish(&w));
+    ck_assert(test_decl_decode(&out, (const char *)enc, w.length, &err));
+    ck_assert_int_eq(out.data_len, 3);
+    ck_assert(memcmp(out.data, data, 3) == 0);
+    ck_assert(!out.has_seq && !out.has_offset && !out.has_addr);
+    ck_assert(!out.has_up && !out.has_rtt);
+
+    in.has_seq = true;
+    in.seq = 0xffffffffffffffffULL;
+    in.has_offset = true;
+    in.offset = -1000000;
+    in.has_addr = true;
+    in.addr = "192.0.2.1";
+    in.addr_len = 9;
+    in.has_up = true;
+    in.up = true;
+    in.has_rtt = true;
+    in.rtt = 0.125;
+    cn_cbor_writer_init(&w, enc, sizeof(enc));
+    ck_assert(test_decl_write(&in, &w));
+    ck_assert(cn_cbor_writer_finish(&w));
+    ck_assert(test_decl_decode(&out, (const char *)enc, w.length, &err));
+    ck_assert(out.has_seq && out.seq == in.seq);
+    ck_assert(out.has_offset && out.offset == -1000000);
+    ck_assert(out.has_addr && out.addr_len == 9);
+    ck_assert(memcmp(out.addr, "192.0.2.1", 9) == 0);
+    ck_assert(out.has_up && out.up);
+    ck_assert(out.has_rtt && out.rtt == 0.125);
+
+    // unknown keys of every kind are skipped, in an indefinite map
+    ck_assert(parse_hex("bf"
+                        "05a1018203f6"          // 5: {1: [3, null]}
+                        "63666f6f5f4101ff"      // "foo": (_ h'01')
+                        "7f6169ff00"            // (_ "i"): 0
+                        "004102"                // 0: h'02'
+                        "62757020"              // "up": -1, not a bool
+                        "ff", &b));
+    ck_assert(!test_decl_decode(&out, b.ptr, b.sz, &err));
+    ck_assert_int_eq(err.err, CN_CBOR_ERR_SCHEMA_MISMATCH);
+    free(b.ptr);
+    ck_assert(parse_hex("bf"
+                        "05a1018203f6"
+                        "63666f6f5f4101ff"
+                        "7f6169ff00"
+                        "004102"
+                        "627570f4"              // "up": false
+                        "ff", &b));
+    ck_assert(test_decl_decode(&out, b.ptr, b.sz, &err));
+    ck_assert_int_eq(out.data_len, 1);
+    ck_assert_int_eq(out.data[0], 2);
+    ck_assert(out.has_up && !out.up);
+    free(b.ptr);
+
+    for (i = 0; i < sizeof(fails) / sizeof(fails[0]); i++) {
+        ck_assert(parse_hex(fails[i].hex, &b));
+        err.err = CN_CBOR_NO_ERROR;
+        ck_assert(!test_decl_decode(&out, b.ptr, b.sz, &err));
+        ck_assert_int_eq(err.err, fails[i].err);
+        free(b.ptr);
+    }
+
+    ack.seq = 300;
+    cn_cbor_writer_init(&w, enc, sizeof(enc));
+    ck_assert(test_ack_write(&ack, &w));
+    ck_assert(cn_cbor_writer_finish(&w));
+    ck_assert_int_eq(w.length, 5);
+    ck_assert(test_ack_decode(&ack, (const char *)enc, w.length, &err));
+    ck_assert_int_eq(ack.seq, 300);
+    ck_assert(!test_ack_decode(&ack, (const char *)enc, w.length - 1, &err));
+    ck_assert_int_eq(err.err, CN_CBOR_ERR_OUT_OF_DATA);
+}
+END_TEST
+
 // Decoder loses float size information
 START_TEST (cbor_float_test)
 {
@@ -248,6 +1339,244 @@ START_TEST (cbor_alloc_test)
 }
 END_TEST
 
+START_TEST (cbor_map_index_pool_test)
+{
+    cn_cbor_errback err;
+    cn_cbor_map_index idx = CN_CBOR_MAP_INDEX_INIT;
+    cn_cbor_key key;
+    const cn_cbor *first, *cb, *val;
+    unsigned char buf[64];
+    ls_pool *pool;
+    ls_err lerr;
+    size_t len;
+    int round, i;
+
+    fail_unless(ls_pool_create(4096, &pool, &lerr));
+
+    /* two maps of the same shape, one after the other in the same pool,
+       as per-packet decoding does: {0: 0, 1: 1, ...} then {0: 50, ...} */
+    first = NULL;
+    for (round = 0; round < 2; round++) {
+        len = 0;
+        buf[len++] = 0xa0 + 10;
+        for (i = 0; i < 10; i++) {
+            buf[len++] = round ? 10 + i : i;
+            buf[len++] = 0x18;
+            buf[len++] = round * 50 + i;
+        }
+        ls_pool_reset(pool);
+        cb = cn_cbor_decode((const char *)buf, len, cn_test_alloc, pool,
+                            &err);
+        ck_assert(cb != NULL);
+        if (round) {
+            ck_assert(cb == first);
+        }
+        first = cb;
+
+        for (i = 0; i < 10; i++) {
+            cn_cbor_key_int(&key, round ? 10 + i : i);
+            val = cn_cbor_mapget_indexed(&idx, cb, &key);
+            ck_assert(val != NULL);
+            ck_assert_int_eq(val->v.uint, round * 50 + i);
+
+            cn_cbor_key_int(&key, round ? i : 10 + i);
+            ck_assert(cn_cbor_mapget_indexed(&idx, cb, &key) == NULL);
+        }
+    }
+    cn_cbor_map_index_free(&idx);
+    ls_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST (cbor_mem_tag_test)
+{
+    cn_cbor_errback err;
+    cn_cbor_writer w;
+    ls_mem_stats before, after;
+    const cn_cbor *cb;
+
+    /* the default allocator is counted as cbor */
+    ls_mem_get_stats(&before);
+    cb = cn_cbor_decode("\x82\x01\x02", 3, NULL, NULL, &err);
+    ck_assert(cb != NULL);
+    ls_mem_get_stats(&after);
+    ck_assert_int_eq(after.tags[LS_MEM_TAG_CBOR].live_objects,
+                     before.tags[LS_MEM_TAG_CBOR].live_objects + 3);
+    cn_cbor_free(cb);
+    ls_mem_get_stats(&after);
+    ck_assert_int_eq(after.tags[LS_MEM_TAG_CBOR].live_objects,
+                     before.tags[LS_MEM_TAG_CBOR].live_objects);
+
+    cn_cbor_writer_init_growable(&w);
+    ck_assert(cn_cbor_write_uint(&w, 1));
+    ls_mem_get_stats(&after);
+    ck_assert_int_eq(after.tags[LS_MEM_TAG_CBOR].live_objects,
+                     before.tags[LS_MEM_TAG_CBOR].live_objects + 1);
+    cn_cbor_writer_free(&w);
+    ls_mem_get_stats(&after);
+    ck_assert_int_eq(after.tags[LS_MEM_TAG_CBOR].live_objects,
+                     before.tags[LS_MEM_TAG_CBOR].live_objects);
+}
+END_TEST
+
+START_TEST (cbor_cursor_test)
+{
+    cn_cbor_cursor cur;
+    cn_cbor_item item;
+    buffer b;
+
+    // [1, -2, h'0102', "abc", [null, true], {1: 2.5}]
+    ck_assert(parse_hex("8601214201026361626382f6f5a101f94100", &b));
+    cn_cbor_cursor_init(&cur, b.ptr, b.sz);
+    ck_assert(cn_cbor_cursor_next(&cur, &item));
+    ck_assert_int_eq(item.type, CN_CBOR_ARRAY);
+    ck_assert_int_eq(item.length, 6);
+    ck_assert(cn_cbor_cursor_next(&cur, &item));
+    ck_assert_int_eq(item.type, CN_CBOR_UINT);
+    ck_assert_int_eq(item.v.uint, 1);
+    ck_assert(cn_cbor_cursor_next(&cur, &item));
+    ck_assert_int_eq(item.type, CN_CBOR_INT);
+    ck_assert_int_eq(item.v.sint, -2);
+    ck_assert(cn_cbor_cursor_next(&cur, &item));
+    ck_assert_int_eq(item.type, CN_CBOR_BYTES);
+    ck_assert_int_eq(item.length, 2);
+    ck_assert(item.v.str == b.ptr + 4);
+    ck_assert(cn_cbor_cursor_next(&cur, &item));
+    ck_assert_int_eq(item.type, CN_CBOR_TEXT);
+    ck_assert(strncmp(item.v.str, "abc", item.length) == 0);
+    ck_assert(cn_cbor_cursor_skip(&cur));  // [null, true]
+    ck_assert(cn_cbor_cursor_next(&cur, &item));
+    ck_assert_int_eq(item.type, CN_CBOR_MAP);
+    ck_assert(cn_cbor_cursor_skip(&cur));  // the key
+    ck_assert(cn_cbor_cursor_next(&cur, &item));
+    ck_assert_int_eq(item.type, CN_CBOR_DOUBLE);
+    ck_assert(item.v.dbl == 2.5);
+    ck_assert(cn_cbor_cursor_done(&cur));
+
+    // out of data
+    ck_assert(!cn_cbor_cursor_next(&cur, &item));
+    ck_assert_int_eq(cur.err, CN_CBOR_ERR_OUT_OF_DATA);
+    free(b.ptr);
+
+    // the whole thing in one skip
+    ck_assert(parse_hex("8601214201026361626382f6f5a101f94100", &b));
+    cn_cbor_cursor_init(&cur, b.ptr, b.sz);
+    ck_assert(cn_cbor_cursor_skip(&cur));
+    ck_assert(cn_cbor_cursor_done(&cur));
+    free(b.ptr);
+}
+END_TEST
+
+START_TEST (cbor_cursor_indef_test)
+{
+    cn_cbor_cursor cur;
+    cn_cbor_item item;
+    buffer b;
+    int chunks = 0;
+
+    // [_ [_ 1, [2, 3]], {_ "a": (_ h'01', h'0203')}, 4]
+    ck_assert(parse_hex("9f9f01820203ffbf61615f4101420203ffff04ff", &b));
+    cn_cbor_cursor_init(&cur, b.ptr, b.sz);
+    ck_assert(cn_cbor_cursor_next(&cur, &item));
+    ck_assert_int_eq(item.type, CN_CBOR_ARRAY);
+    ck_assert(item.flags & CN_CBOR_FL_INDEF);
+    ck_assert(cn_cbor_cursor_skip(&cur));
+    ck_assert(cn_cbor_cursor_next(&cur, &item));
+    ck_assert_int_eq(item.type, CN_CBOR_MAP);
+    ck_assert(cn_cbor_cursor_next(&cur, &item));
+    ck_assert_int_eq(item.type, CN_CBOR_TEXT);
+    ck_assert(cn_cbor_cursor_next(&cur, &item));
+    ck_assert_int_eq(item.type, CN_CBOR_BYTES);
+    ck_assert(item.flags & CN_CBOR_FL_INDEF);
+    while (!cn_cbor_cursor_break(&cur)) {
+        ck_assert(cn_cbor_cursor_next(&cur, &item));
+        ck_assert_int_eq(item.type, CN_CBOR_BYTES);
+        chunks++;
+    }
+    ck_assert_int_eq(chunks, 2);
+    ck_assert(cn_cbor_cursor_break(&cur));
+    ck_assert(cn_cbor_cursor_next(&cur, &item));
+    ck_assert_int_eq(item.v.uint, 4);
+    ck_assert(cn_cbor_cursor_break(&cur));
+    ck_assert(cn_cbor_cursor_done(&cur));
+
+    cn_cbor_cursor_init(&cur, b.ptr, b.sz);
+    ck_assert(cn_cbor_cursor_skip(&cur));
+    ck_assert(cn_cbor_cursor_done(&cur));
+    free(b.ptr);
+
+    // break with nothing open, and truncated indefinite items
+    ck_assert(parse_hex("ff", &b));
+    cn_cbor_cursor_init(&cur, b.ptr, b.sz);
+    ck_assert(!cn_cbor_cursor_skip(&cur));
+    ck_assert_int_eq(cur.err, CN_CBOR_ERR_BREAK_OUTSIDE_INDEF);
+    free(b.ptr);
+    ck_assert(parse_hex("9f9f01ff", &b));
+    cn_cbor_cursor_init(&cur, b.ptr, b.sz);
+    ck_assert(!cn_cbor_cursor_skip(&cur));
+    ck_assert_int_eq(cur.err, CN_CBOR_ERR_OUT_OF_DATA);
+    free(b.ptr);
+
+    // too many open indefinite items
+    ck_assert(parse_hex("9f9f9f9f9f9f9f9f9f9f9f9f9f9f9f9f9f", &b));
+    cn_cbor_cursor_init(&cur, b.ptr, b.sz);
+    ck_assert(!cn_cbor_cursor_skip(&cur));
+    ck_assert_int_eq(cur.err, CN_CBOR_ERR_TOO_DEEP);
+    free(b.ptr);
+
+    // a count larger than the input fails before any work
+    ck_assert(parse_hex("9bffffffffffffffff00", &b));
+    cn_cbor_cursor_init(&cur, b.ptr, b.sz);
+    ck_assert(!cn_cbor_cursor_skip(&cur));
+    ck_assert_int_eq(cur.err, CN_CBOR_ERR_OUT_OF_DATA);
+    free(b.ptr);
+}
+END_TEST
+
+START_TEST (cbor_cursor_mapget_test)
+{
+    cn_cbor_cursor cur;
+    cn_cbor_item map, item;
+    buffer b;
+
+    // {"x": [1, {2: 3}], -1: 7, 0: h'6869'}
+    ck_assert(parse_hex("a361788201a10203200700426869", &b));
+    cn_cbor_cursor_init(&cur, b.ptr, b.sz);
+    ck_assert(cn_cbor_cursor_next(&cur, &map));
+    ck_assert(cn_cbor_cursor_mapget_int(&cur, &map, 0, &item));
+    ck_assert_int_eq(item.type, CN_CBOR_BYTES);
+    ck_assert_int_eq(item.length, 2);
+    ck_assert(memcmp(item.v.str, "hi", 2) == 0);
+    ck_assert(cn_cbor_cursor_done(&cur));
+
+    cn_cbor_cursor_init(&cur, b.ptr, b.sz);
+    ck_assert(cn_cbor_cursor_next(&cur, &map));
+    ck_assert(cn_cbor_cursor_mapget_int(&cur, &map, -1, &item));
+    ck_assert_int_eq(item.v.uint, 7);
+
+    cn_cbor_cursor_init(&cur, b.ptr, b.sz);
+    ck_assert(cn_cbor_cursor_next(&cur, &map));
+    ck_assert(!cn_cbor_cursor_mapget_int(&cur, &map, 2, &item));
+    ck_assert_int_eq(cur.err, CN_CBOR_NO_ERROR);
+    ck_assert(cn_cbor_cursor_done(&cur));
+
+    // truncated value
+    cn_cbor_cursor_init(&cur, b.ptr, b.sz - 1);
+    ck_assert(cn_cbor_cursor_next(&cur, &map));
+    ck_assert(!cn_cbor_cursor_mapget_int(&cur, &map, 0, &item));
+    ck_assert_int_eq(cur.err, CN_CBOR_ERR_OUT_OF_DATA);
+    free(b.ptr);
+
+    // indefinite map
+    ck_assert(parse_hex("bf0102ff", &b));
+    cn_cbor_cursor_init(&cur, b.ptr, b.sz);
+    ck_assert(cn_cbor_cursor_next(&cur, &map));
+    ck_assert(!cn_cbor_cursor_mapget_int(&cur, &map, 5, &item));
+    ck_assert(cn_cbor_cursor_done(&cur));
+    free(b.ptr);
+}
+END_TEST
+
 Suite * cbor_suite (void)
 {
     Suite *s = suite_create ("cbor");
@@ -256,9 +1585,34 @@ Suite * cbor_suite (void)
         tcase_add_test (tc_cbor_parse, cbor_error_test);
         tcase_add_test (tc_cbor_parse, cbor_parse_test);
         tcase_add_test (tc_cbor_parse, cbor_fail_test);
+        tcase_add_test (tc_cbor_parse, cbor_limits_test);
+        tcase_add_test (tc_cbor_parse, cbor_compact_test);
+        tcase_add_test (tc_cbor_parse, cbor_compact_fail_test);
+        tcase_add_test (tc_cbor_parse, cbor_compact_get_test);
+        tcase_add_test (tc_cbor_parse, cbor_utf8_test);
+        tcase_add_test (tc_cbor_parse, cbor_seq_test);
+        tcase_add_test (tc_cbor_parse, cbor_seq_chunked_test);
+        tcase_add_test (tc_cbor_parse, cbor_seq_fail_test);
+        tcase_add_test (tc_cbor_parse, cbor_typed_array_test);
+        tcase_add_test (tc_cbor_parse, cbor_typed_array_native_test);
+        tcase_add_test (tc_cbor_parse, cbor_typed_array_roundtrip_test);
+        tcase_add_test (tc_cbor_parse, cbor_write_encoded_test);
+        tcase_add_test (tc_cbor_parse, cbor_schema_test);
         tcase_add_test (tc_cbor_parse, cbor_float_test);
+        tcase_add_test (tc_cbor_parse, cbor_writev_test);
+        tcase_add_test (tc_cbor_parse, cbor_writer_test);
+        tcase_add_test (tc_cbor_parse, cbor_writer_fail_test);
+        tcase_add_test (tc_cbor_parse, cbor_writer_growable_test);
+        tcase_add_test (tc_cbor_parse, cbor_encode_deep_test);
+        tcase_add_test (tc_cbor_parse, cbor_mapget_key_test);
+        tcase_add_test (tc_cbor_parse, cbor_map_index_test);
         tcase_add_test (tc_cbor_parse, cbor_getset_test);
         tcase_add_test (tc_cbor_parse, cbor_alloc_test);
+        tcase_add_test (tc_cbor_parse, cbor_map_index_pool_test);
+        tcase_add_test (tc_cbor_parse, cbor_mem_tag_test);
+        tcase_add_test (tc_cbor_parse, cbor_cursor_test);
+        tcase_add_test (tc_cbor_parse, cbor_cursor_indef_test);
+        tcase_add_test (tc_cbor_parse, cbor_cursor_mapget_test);
 
         suite_add_tcase (s, tc_cbor_parse);
     }
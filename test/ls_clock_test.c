@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2015 SPUDlib authors.  See LICENSE file.
+ */
+
+#include <check.h>
+
+#include <string.h>
+#include <time.h>
+#include "ls_clock.h"
+
+Suite * ls_clock_suite (void);
+
+START_TEST (ls_clock_now_test)
+{
+    struct timespec timer = { 0, 5000000 };
+    uint64_t before, after;
+
+    before = ls_clock_update();
+    ck_assert(before > 0);
+    ck_assert(ls_clock_now() == before);
+
+    // the cached value only moves on update
+    nanosleep(&timer, NULL);
+    ck_assert(ls_clock_now() == before);
+    after = ls_clock_update();
+    ck_assert(after >= before + 5);
+    ck_assert(ls_clock_now() == after);
+}
+END_TEST
+
+START_TEST (ls_clock_timestamp_test)
+{
+    const char *stamp;
+
+    stamp = ls_clock_timestamp();
+    ck_assert(stamp != NULL);
+    ck_assert_int_eq(strlen(stamp), LS_CLOCK_TIMESTAMP_LEN - 1);
+    ck_assert_int_eq(stamp[4], '-');
+    ck_assert_int_eq(stamp[10], 'T');
+    ck_assert_int_eq(stamp[16], ':');
+
+    // same buffer, reused
+    ck_assert(ls_clock_timestamp() == stamp);
+}
+END_TEST
+
+Suite * ls_clock_suite (void)
+{
+  Suite *s = suite_create ("ls_clock");
+  {/* Clock test case */
+      TCase *tc_ls_clock = tcase_create ("clock");
+
+      tcase_add_test (tc_ls_clock, ls_clock_now_test);
+      tcase_add_test (tc_ls_clock, ls_clock_timestamp_test);
+
+      suite_add_tcase (s, tc_ls_clock);
+  }
+
+  return s;
+}
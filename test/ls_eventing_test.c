@@ -582,6 +582,46 @@ START_TEST (ls_event_create_test)
 }
 END_TEST
 
+START_TEST (ls_event_id_test)
+{
+    ls_event        *evt1, *evt2, *evts[20];
+    ls_err          err;
+    char            name[16];
+    int             i;
+
+    // the fixture creates two events
+    evt1 = ls_event_dispatcher_get_event(g_dispatcher, "mockEvent1");
+    evt2 = ls_event_dispatcher_get_event(g_dispatcher, "mockEvent2");
+    ck_assert_int_eq(ls_event_get_id(evt1), 0);
+    ck_assert_int_eq(ls_event_get_id(evt2), 1);
+    ck_assert(ls_event_dispatcher_get_event_by_id(g_dispatcher, 0) == evt1);
+    ck_assert(ls_event_dispatcher_get_event_by_id(g_dispatcher, 1) == evt2);
+    ck_assert(ls_event_dispatcher_get_event_by_id(g_dispatcher, 2) == NULL);
+    ck_assert(ls_event_dispatcher_get_event_by_id(
+                      g_dispatcher, LS_EVENT_ID_INVALID) == NULL);
+
+    // enough to grow the id table a couple of times
+    for (i = 0; i < 20; i++)
+    {
+        sprintf(name, "idEvent%d", i);
+        ck_assert(ls_event_dispatcher_create_event(g_dispatcher, name,
+                                                   &evts[i], &err));
+        ck_assert_int_eq(ls_event_get_id(evts[i]), i + 2);
+    }
+    for (i = 0; i < 20; i++)
+    {
+        ck_assert(ls_event_dispatcher_get_event_by_id(
+                          g_dispatcher, i + 2) == evts[i]);
+    }
+    ck_assert(ls_event_dispatcher_get_event_by_id(g_dispatcher, 0) == evt1);
+
+    // a failed create does not consume an id
+    ck_assert(!ls_event_dispatcher_create_event(g_dispatcher, "mockEvent1",
+                                                NULL, &err));
+    ck_assert(ls_event_dispatcher_get_event_by_id(g_dispatcher, 22) == NULL);
+}
+END_TEST
+
 START_TEST (ls_event_bindings_test)
 {
     ls_event            *evt1;
@@ -1595,6 +1635,7 @@ Suite * ls_eventing_suite (void)
 
       tcase_add_test (tc_ls_eventing, ls_event_dispatcher_create_destroy_test);
       tcase_add_test (tc_ls_eventing, ls_event_create_test);
+      tcase_add_test (tc_ls_eventing, ls_event_id_test);
       tcase_add_test (tc_ls_eventing, ls_event_bindings_test);
       tcase_add_test (tc_ls_eventing, ls_event_trigger_simple_test);
       tcase_add_test (tc_ls_eventing, ls_event_trigger_simple_results_test);
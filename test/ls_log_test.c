@@ -5,7 +5,11 @@
 #include <check.h>
 
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include "ls_log.h"
+#include "ls_log_binary.h"
 #include "test_utils.h"
 
 Suite * ls_log_suite (void);
@@ -217,6 +221,64 @@ START_TEST (ls_log_ndc_test)
 }
 END_TEST
 
+static void *_ndc_thread(void *arg)
+{
+    int depth;
+
+    UNUSED_PARAM(arg);
+    depth = ls_log_push_ndc("other");
+    ls_log_pop_ndc(depth);
+    return (void *)(intptr_t)depth;
+}
+
+START_TEST (ls_log_ndc_limits_test)
+{
+    char longmsg[300];
+    pthread_t thread;
+    void *ret;
+    int depth, i;
+
+    ls_log_set_level(LS_LOG_DEBUG);
+
+    // truncated messages
+    memset(longmsg, 'x', sizeof(longmsg) - 1);
+    longmsg[sizeof(longmsg) - 1] = '\0';
+    depth = ls_log_push_ndc("%s", longmsg);
+    ck_assert_int_eq(depth, 1);
+    _log_offset = 0;
+    ls_log(LS_LOG_DEBUG, "test");
+    _normalizeLogOutput();
+    ck_assert_int_eq(strlen(_log_output),
+                     strlen("[\x1b[34mDEBUG   \x1b[0m]: {} test") + 127);
+    ls_log_pop_ndc(depth);
+
+    // each thread has its own stack
+    depth = ls_log_push_ndc("main");
+    ck_assert_int_eq(pthread_create(&thread, NULL, _ndc_thread, NULL), 0);
+    ck_assert_int_eq(pthread_join(thread, &ret), 0);
+    ck_assert_int_eq((intptr_t)ret, 1);
+    ls_log_pop_ndc(depth);
+
+    // deep stacks are counted, not printed
+    for (i = 0; i < 20; i++)
+    {
+        depth = ls_log_push_ndc("%d", i % 10);
+    }
+    ck_assert_int_eq(depth, 20);
+    _log_offset = 0;
+    ls_log(LS_LOG_DEBUG, "test");
+    _normalizeLogOutput();
+    ck_assert_str_eq(_log_output, "[\x1b[34mDEBUG   \x1b[0m]: "
+                     "{0} {1} {2} {3} {4} {5} {6} {7} {8} {9} "
+                     "{0} {1} {2} {3} {4} {5} {+4} test");
+    ls_log_pop_ndc(1);
+    _log_offset = 0;
+    ls_log(LS_LOG_DEBUG, "test");
+    _normalizeLogOutput();
+    ck_assert_str_eq(_log_output, "[\x1b[34mDEBUG   \x1b[0m]: test");
+}
+END_TEST
+
 START_TEST (ls_log_err_test)
 {
     ls_err err;
@@ -338,6 +400,226 @@ START_TEST (ls_log_set_level_test)
 END_TEST
 
 
+static int _count_evaluations(int *count)
+{
+    return ++(*count);
+}
+
+START_TEST (ls_log_module_level_test)
+{
+    void *ptr;
+    int evaluated = 0;
+
+    ls_log_set_level(LS_LOG_ERROR);
+    ls_log_set_module_level(LS_LOG_MODULE_MEM, LS_LOG_MEMTRACE);
+    ck_assert_int_eq(ls_log_get_module_level(LS_LOG_MODULE_MEM),
+                     LS_LOG_MEMTRACE);
+    ck_assert_int_eq(ls_log_get_module_level(LS_LOG_MODULE_EVENTING),
+                     LS_LOG_ERROR);
+    ck_assert_int_eq(ls_log_get_level(), LS_LOG_ERROR);
+    ck_assert(LS_LOG_ENABLED(LS_LOG_MODULE_MEM, LS_LOG_MEMTRACE));
+    ck_assert(!LS_LOG_ENABLED(LS_LOG_MODULE_TUBE, LS_LOG_WARN));
+
+    _log_offset = 0;
+    ptr = ls_data_malloc(8);
+    ck_assert_int_ne(_log_offset, 0);
+    ck_assert(strstr(_log_output, "mem.c:malloc") != NULL);
+    _log_offset = 0;
+    ls_data_free(ptr);
+    ck_assert_int_ne(_log_offset, 0);
+
+    _log_offset = 0;
+    LS_LOG(LS_LOG_DEBUG, "Debug %d", _count_evaluations(&evaluated));
+    ck_assert_int_eq(_log_offset, 0);
+    ck_assert_int_eq(evaluated, 0);
+    LS_LOG(LS_LOG_ERROR, "Error %d", _count_evaluations(&evaluated));
+    ck_assert_int_ne(_log_offset, 0);
+    ck_assert_int_eq(evaluated, 1);
+
+    _log_offset = 0;
+    ls_log_module(LS_LOG_MODULE_TUBE, LS_LOG_WARN, "Warn");
+    ck_assert_int_eq(_log_offset, 0);
+    ls_log_module(LS_LOG_MODULE_MEM, LS_LOG_WARN, "Warn");
+    ck_assert_int_ne(_log_offset, 0);
+
+    ls_log_set_level(LS_LOG_ERROR);
+    ck_assert_int_eq(ls_log_get_module_level(LS_LOG_MODULE_MEM), LS_LOG_ERROR);
+    _log_offset = 0;
+    ptr = ls_data_malloc(8);
+    ls_data_free(ptr);
+    ck_assert_int_eq(_log_offset, 0);
+}
+END_TEST
+
+
+static int _gate_closed = 0;
+
+static int _gated_vfprintf(FILE *stream, const char *format, va_list ap)
+{
+    struct timespec timer = { 0, 1000000 };
+
+    while (__atomic_load_n(&_gate_closed, __ATOMIC_ACQUIRE))
+    {
+        nanosleep(&timer, NULL);
+    }
+    return _myvfprintf(stream, format, ap);
+}
+
+START_TEST (ls_log_async_test)
+{
+    ls_err err;
+    int i;
+
+    ls_log_set_level(LS_LOG_INFO);
+    ls_log_set_ndc_enabled(false);
+
+    // flush/stop/dropped are harmless without async logging
+    ls_log_async_flush();
+    ls_log_async_stop();
+    ck_assert_int_eq(ls_log_async_dropped(), 0);
+
+    ck_assert(ls_log_async_start(0, LS_LOG_OVERFLOW_DROP, &err));
+    ck_assert(!ls_log_async_start(0, LS_LOG_OVERFLOW_DROP, &err));
+    ck_assert_int_eq(err.code, LS_ERR_INVALID_STATE);
+
+    _log_offset = 0;
+    ls_log(LS_LOG_ERROR, "This is a test error");
+    ls_log_async_flush();
+    _normalizeLogOutput();
+    ck_assert_str_eq(_log_output,
+                     "[\x1b[31mERROR   \x1b[0m]: This is a test error");
+
+    // filtered messages never reach the queue
+    _log_offset = 0;
+    ls_log(LS_LOG_DEBUG, "Debug");
+    ls_log_async_flush();
+    ck_assert_int_eq(_log_offset, 0);
+    ls_log_async_stop();
+
+    // hold the writer up so the queue overflows
+    ls_log_set_function(_gated_vfprintf);
+    __atomic_store_n(&_gate_closed, 1, __ATOMIC_RELEASE);
+    ck_assert(ls_log_async_start(2, LS_LOG_OVERFLOW_COUNT, &err));
+    _log_offset = 0;
+    for (i = 0; i < 11; i++)
+    {
+        ls_log(LS_LOG_ERROR, "%d", i);
+    }
+    ck_assert(ls_log_async_dropped() >= 9);
+    __atomic_store_n(&_gate_closed, 0, __ATOMIC_RELEASE);
+    ls_log_async_flush();
+    ls_log_async_stop();
+    ck_assert(strstr(_log_output, "log messages") != NULL);
+    ck_assert_int_eq(ls_log_async_dropped(), 0);
+
+    ls_log_set_ndc_enabled(true);
+}
+END_TEST
+
+
+static const char * volatile _null_str = NULL;
+
+START_TEST (ls_log_binary_test)
+{
+    char path[] = "/tmp/ls_log_binary_XXXXXX";
+    const char *fmt = "binary %d %s %zu %.1f %s";
+    ls_err err;
+    FILE *f;
+    uint8_t buf[4096];
+    size_t size, off;
+    ls_log_binary_header fh;
+    int sites = 0, messages = 0;
+    int fd, i;
+
+    fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+    close(fd);
+
+    ls_log_set_level(LS_LOG_INFO);
+    ck_assert_int_eq(ls_log_binary_dropped(), 0);
+    ck_assert(ls_log_binary_open(path, sizeof(buf), &err));
+    ck_assert(!ls_log_binary_open(path, sizeof(buf), &err));
+    ck_assert_int_eq(err.code, LS_ERR_INVALID_STATE);
+
+    _log_offset = 0;
+    for (i = 0; i < 3; i++)
+    {
+        LS_LOG(LS_LOG_ERROR, fmt, i, "str", (size_t)7, 1.5, _null_str);
+    }
+    LS_LOG(LS_LOG_DEBUG, "filtered %d", i);
+    ck_assert_int_eq(_log_offset, 0);
+
+    // wide strings can't be stored; logged as text instead
+    LS_LOG(LS_LOG_ERROR, "text %ls", L"only");
+    ck_assert_int_ne(_log_offset, 0);
+    ls_log_binary_close();
+
+    f = fopen(path, "rb");
+    ck_assert(f != NULL);
+    size = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    unlink(path);
+
+    ck_assert_int_ge(size, sizeof(fh));
+    memcpy(&fh, buf, sizeof(fh));
+    ck_assert(memcmp(fh.magic, LS_LOG_BINARY_MAGIC, 8) == 0);
+    ck_assert_int_eq(fh.version, LS_LOG_BINARY_VERSION);
+
+    for (off = sizeof(fh); off + sizeof(ls_log_record_header) <= size; )
+    {
+        ls_log_record_header hdr;
+        const uint8_t *body;
+        int64_t ival;
+        uint32_t slen;
+        double dval;
+
+        memcpy(&hdr, buf + off, sizeof(hdr));
+        ck_assert_int_ne(hdr.size, 0);
+        body = buf + off + sizeof(hdr);
+        if (hdr.kind == LS_LOG_RECORD_SITE)
+        {
+            sites++;
+            ck_assert_str_eq((const char *)body + 4, fmt);
+        }
+        else
+        {
+            ck_assert_int_eq(hdr.kind, LS_LOG_RECORD_MESSAGE);
+            ck_assert_int_eq(hdr.level, LS_LOG_ERROR);
+            ck_assert_int_eq(hdr.nargs, 5);
+            body += sizeof(uint64_t);
+            memcpy(&ival, body, sizeof(ival));
+            ck_assert_int_eq(ival, messages);
+            memcpy(&slen, body + 8, sizeof(slen));
+            ck_assert_int_eq(slen, 3);
+            ck_assert(memcmp(body + 12, "str", 3) == 0);
+            memcpy(&ival, body + 15, sizeof(ival));
+            ck_assert_int_eq(ival, 7);
+            memcpy(&dval, body + 23, sizeof(dval));
+            ck_assert(dval == 1.5);
+            memcpy(&slen, body + 31, sizeof(slen));
+            ck_assert_int_eq(slen, LS_LOG_BINARY_NULL_STRING);
+            messages++;
+        }
+        off += hdr.size;
+    }
+    ck_assert_int_eq(off, size);
+    ck_assert_int_eq(sites, 1);
+    ck_assert_int_eq(messages, 3);
+
+    // too small for anything but the header: messages are dropped
+    ck_assert(!ls_log_binary_open(path, 4, &err));
+    ck_assert_int_eq(err.code, LS_ERR_INVALID_ARG);
+    ck_assert(ls_log_binary_open(path, 32, &err));
+    _log_offset = 0;
+    LS_LOG(LS_LOG_ERROR, fmt, i, "str", (size_t)7, 1.5, _null_str);
+    ck_assert_int_eq(_log_offset, 0);
+    ck_assert_int_eq(ls_log_binary_dropped(), 1);
+    ls_log_binary_close();
+    unlink(path);
+}
+END_TEST
+
+
 Suite * ls_log_suite (void)
 {
   Suite *s = suite_create ("ls_log");
@@ -348,9 +630,13 @@ Suite * ls_log_suite (void)
       tcase_add_test (tc_ls_log, ls_log_message_test);
       tcase_add_test (tc_ls_log, ls_log_test);
       tcase_add_test (tc_ls_log, ls_log_ndc_test);
+      tcase_add_test (tc_ls_log, ls_log_ndc_limits_test);
       tcase_add_test (tc_ls_log, ls_log_err_test);
       tcase_add_test (tc_ls_log, ls_log_chunked_test);
       tcase_add_test (tc_ls_log, ls_log_set_level_test);
+      tcase_add_test (tc_ls_log, ls_log_module_level_test);
+      tcase_add_test (tc_ls_log, ls_log_async_test);
+      tcase_add_test (tc_ls_log, ls_log_binary_test);
 
       suite_add_tcase (s, tc_ls_log);
   }
@@ -3,6 +3,7 @@
  */
 
 #include <check.h>
+#include <pthread.h>
 
 #include "../src/ls_eventing.h"
 #include "ls_mem.h"
@@ -244,7 +245,6 @@ START_TEST (ls_pool_create_destroy_test)
     ls_err err;
     ls_pool *pool;
     _pool_page page;
-    _pool_cleaner_ctx cleaner;
     /* create with pages */
     ck_assert(ls_pool_create(1024, &pool, &err));
     ck_assert(pool != NULL);
@@ -257,11 +257,8 @@ START_TEST (ls_pool_create_destroy_test)
     ck_assert(page->size == 1024);
     ck_assert(page->used == 0);
 
-    /* should be one cleaner (for the page) */
-    ck_assert_int_eq(1, cleaner_count(pool));
-    /* cleaner should be for page */
-    cleaner = get_cleaner(pool, 0);
-    ck_assert(cleaner->arg == page);
+    /* pages are freed directly, without cleaners */
+    ck_assert_int_eq(0, cleaner_count(pool));
     ls_pool_destroy(pool);
 
     /* without pages */
@@ -286,7 +283,6 @@ START_TEST (ls_pool_malloc_test)
     size_t i;
 
     _pool_page page;
-    _pool_cleaner_ctx cleaner;
 
     ck_assert(ls_pool_create(1024, &pool, &err));
     ck_assert(ls_pool_malloc(pool, 512, &ptr, &err));
@@ -295,29 +291,22 @@ START_TEST (ls_pool_malloc_test)
     ck_assert(ls_pool_malloc(pool, 615, &ptr, &err));
     ck_assert(ptr != NULL);
 
-    ck_assert(pool->size == 2048);
+    /* the second page is twice the size of the first */
+    ck_assert(pool->size == 3072);
     ck_assert(pool->page_size == 1024);
 
     ck_assert_int_eq(2, page_count(pool));
 
     page = get_page(pool, 0);
     ck_assert(page != NULL);
-    ck_assert(page->size == 1024);
+    ck_assert(page->size == 2048);
     ck_assert_int_eq(page->used, 615);
 
     page = get_page(pool, 1);
     ck_assert(page->size == 1024);
     ck_assert_int_eq(page->used, 512);
 
-    ck_assert_int_eq(2, cleaner_count(pool));
-
-    cleaner = get_cleaner(pool, 0);
-    page = get_page(pool, 0);
-    ck_assert(cleaner->arg == page);
-
-    cleaner = get_cleaner(pool, 1);
-    page = get_page(pool, 1);
-    ck_assert(cleaner->arg == page);
+    ck_assert_int_eq(0, cleaner_count(pool));
 
     ls_pool_destroy(pool);
 
@@ -328,6 +317,7 @@ START_TEST (ls_pool_malloc_test)
     {
         size_t  sz = (i % (sizeof(uintptr_t) * 2)) + 1;
         ck_assert(ls_pool_malloc(pool, sz, &ptr, &err));
+        ck_assert_int_eq((uintptr_t)ptr % (sizeof(uintptr_t) * 2), 0);
     }
     ls_pool_destroy(pool);
 }
@@ -356,16 +346,15 @@ START_TEST (ls_pool_malloc_overallocate_test)
     page1 = get_page(pool, 0);
     ck_assert(page1 != NULL);
     ck_assert(page1->size == 1024);
-    ck_assert_int_eq(page1->used, 512);
+    /* the cleaner for the direct allocation is kept in the page */
+    ck_assert_int_eq(page1->used, 512 + sizeof(struct pool_cleaner_ctx));
 
-    ck_assert_int_eq(2, cleaner_count(pool));
+    ck_assert_int_eq(1, cleaner_count(pool));
 
     cleaner = get_cleaner(pool, 0);
-    page1 = get_page(pool, 0);
     ck_assert(cleaner->arg == ptr);
-
-    cleaner = get_cleaner(pool, 1);
-    ck_assert(cleaner->arg == page1);
+    ck_assert((uint8_t *)cleaner >= (uint8_t *)page1->block);
+    ck_assert((uint8_t *)cleaner < (uint8_t *)page1->block + page1->size);
 
     ls_pool_destroy(pool);
 
@@ -397,6 +386,102 @@ START_TEST (ls_pool_strdup_shorterpool_test)
 }
 END_TEST
 
+static int _cleaner_runs = 0;
+static void _count_cleaner(void *arg)
+{
+    UNUSED_PARAM(arg);
+    ++_cleaner_runs;
+}
+
+START_TEST (ls_pool_reset_test)
+{
+    ls_pool *pool;
+    ls_err err;
+    void *ptr;
+    void *first;
+    int i, round;
+    oom_test_data *tdata = oom_get_data();
+
+    ck_assert(ls_pool_create(256, &pool, &err));
+    ck_assert(ls_pool_malloc(pool, 100, &first, &err));
+
+    _cleaner_runs = 0;
+    for (round = 0; round < 3; ++round)
+    {
+        if (round == 1)
+        {
+            /* pages have grown to fit; no more mallocs */
+            oom_set_enabled(true);
+        }
+        ls_pool_reset(pool);
+        for (i = 0; i < 20; ++i)
+        {
+            ck_assert(ls_pool_malloc(pool, 100, &ptr, &err));
+            if (i == 0)
+            {
+                ck_assert(ptr == first);
+            }
+        }
+        ck_assert(ls_pool_add_cleaner(pool, _count_cleaner, NULL, &err));
+    }
+    ck_assert_int_eq(tdata->numMallocCalls, 0);
+    ck_assert_int_eq(tdata->numFreeCalls, 0);
+    oom_set_enabled(false);
+    ck_assert_int_eq(_cleaner_runs, 2);
+
+    /* direct allocations are freed on reset */
+    ck_assert(ls_pool_malloc(pool, 1000, &ptr, &err));
+    ck_assert_int_eq(cleaner_count(pool), 2);
+    ls_pool_reset(pool);
+    ck_assert_int_eq(_cleaner_runs, 3);
+    ck_assert_int_eq(cleaner_count(pool), 0);
+    /* all pages are spare until the next allocation */
+    ck_assert_int_eq(page_count(pool), 0);
+    ck_assert(pool->spare != NULL);
+
+    ls_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST (ls_pool_mark_rewind_test)
+{
+    ls_pool *pool;
+    ls_err err;
+    ls_pool_marker outer, inner;
+    void *ptr, *kept, *after;
+    size_t size;
+    int i;
+
+    ck_assert(ls_pool_create(128, &pool, &err));
+    ck_assert(ls_pool_malloc(pool, 10, &kept, &err));
+    ls_pool_mark(pool, &outer);
+    ck_assert(ls_pool_malloc(pool, 10, &after, &err));
+    ls_pool_mark(pool, &inner);
+
+    _cleaner_runs = 0;
+    for (i = 0; i < 10; ++i)
+    {
+        ck_assert(ls_pool_malloc(pool, 100, &ptr, &err));
+    }
+    ck_assert(ls_pool_add_cleaner(pool, _count_cleaner, NULL, &err));
+    ck_assert(page_count(pool) > 1);
+    size = pool->size;
+
+    ls_pool_rewind(pool, &inner);
+    ck_assert_int_eq(_cleaner_runs, 1);
+    ck_assert_int_eq(page_count(pool), 1);
+    /* the pages are kept */
+    ck_assert_int_eq(pool->size, size);
+
+    ls_pool_rewind(pool, &outer);
+    ck_assert(ls_pool_malloc(pool, 10, &ptr, &err));
+    ck_assert(ptr == after);
+    ck_assert(kept != NULL);
+
+    ls_pool_destroy(pool);
+}
+END_TEST
+
 #endif
 START_TEST (ls_pool_calloc_test)
 {
@@ -526,6 +611,196 @@ START_TEST (ls_data_memory_test)
 }
 END_TEST
 
+static void *_thread_cache_worker(void *arg)
+{
+    void *blocks[10];
+    int i;
+
+    UNUSED_PARAM(arg);
+    for (i = 0; i < 10; i++)
+    {
+        blocks[i] = ls_data_malloc(200);
+    }
+    for (i = 0; i < 10; i++)
+    {
+        ls_data_free(blocks[i]);
+    }
+    return NULL;
+}
+
+START_TEST (ls_data_thread_cache_test)
+{
+    void *blocks[100];
+    void *big;
+    pthread_t thread;
+    int i;
+    oom_test_data *tdata = oom_get_data();
+    oom_set_enabled(true);
+    ls_data_set_thread_caches(true);
+
+    for (i = 0; i < 100; i++)
+    {
+        blocks[i] = ls_data_malloc(24);
+        fail_if(blocks[i] == NULL);
+        fail_unless(((uintptr_t)blocks[i] % (2 * sizeof(void *))) == 0);
+        memset(blocks[i], i, 24);
+    }
+    ck_assert_int_eq(tdata->numMallocCalls, 100);
+    for (i = 0; i < 100; i++)
+    {
+        ls_data_free(blocks[i]);
+    }
+    ck_assert_int_eq(tdata->numFreeCalls, 0);
+
+    // served from this thread's cache and the central pool
+    for (i = 0; i < 100; i++)
+    {
+        blocks[i] = ls_data_malloc(32);
+    }
+    ck_assert_int_eq(tdata->numMallocCalls, 100);
+
+    // growing within the size class keeps the block
+    big = blocks[0];
+    blocks[0] = ls_data_realloc(blocks[0], 30);
+    ck_assert_ptr_eq(blocks[0], big);
+    blocks[0] = ls_data_realloc(blocks[0], 40);
+    ck_assert_int_eq(tdata->numMallocCalls, 101);
+
+    for (i = 0; i < 100; i++)
+    {
+        ls_data_free(blocks[i]);
+    }
+
+    // blocks cached by an exiting thread go to the central pool
+    ck_assert_int_eq(pthread_create(&thread, NULL, _thread_cache_worker, NULL),
+                     0);
+    pthread_join(thread, NULL);
+    ck_assert_int_eq(tdata->numMallocCalls, 111);
+    for (i = 0; i < 10; i++)
+    {
+        blocks[i] = ls_data_malloc(200);
+    }
+    ck_assert_int_eq(tdata->numMallocCalls, 111);
+    for (i = 0; i < 10; i++)
+    {
+        ls_data_free(blocks[i]);
+    }
+
+    // large blocks are not cached
+    big = ls_data_malloc(1000);
+    ck_assert_int_eq(tdata->numMallocCalls, 112);
+    memset(big, 7, 1000);
+    big = ls_data_realloc(big, 2000);
+    ck_assert_int_eq(((uint8_t *)big)[999], 7);
+    ls_data_free(big);
+    ck_assert_int_eq(tdata->numFreeCalls, 1);
+
+    ls_data_release_caches();
+    ck_assert_int_eq(tdata->numFreeCalls, tdata->numMallocCalls);
+
+    ls_data_set_thread_caches(false);
+    oom_set_enabled(false);
+}
+END_TEST
+
+static void *_thread_cache_alloc_worker(void *arg)
+{
+    UNUSED_PARAM(arg);
+    return ls_data_malloc(24);
+}
+
+START_TEST (ls_data_thread_cache_alloc_only_test)
+{
+    void *blocks[100];
+    void *ptr;
+    pthread_t thread;
+    int i;
+    oom_test_data *tdata = oom_get_data();
+    oom_set_enabled(true);
+    ls_data_set_thread_caches(true);
+
+    // overflowing this thread's cache puts a batch in the central pool
+    for (i = 0; i < 100; i++)
+    {
+        blocks[i] = ls_data_malloc(24);
+    }
+    for (i = 0; i < 100; i++)
+    {
+        ls_data_free(blocks[i]);
+    }
+
+    // a thread that only allocates still hands back the rest of its batch
+    ck_assert_int_eq(pthread_create(&thread, NULL,
+                                    _thread_cache_alloc_worker, NULL),
+                     0);
+    pthread_join(thread, &ptr);
+    fail_if(ptr == NULL);
+    ls_data_free(ptr);
+    ck_assert_int_eq(tdata->numMallocCalls, 100);
+
+    ls_data_release_caches();
+    ck_assert_int_eq(tdata->numFreeCalls, tdata->numMallocCalls);
+
+    ls_data_set_thread_caches(false);
+    oom_set_enabled(false);
+}
+END_TEST
+
+START_TEST (ls_mem_stats_test)
+{
+    ls_mem_stats before, after;
+    ls_htable *table;
+    void *ptr;
+    ls_err err;
+
+    ls_mem_get_stats(&before);
+    ck_assert(ls_htable_create(7, ls_int_hashcode, ls_int_compare,
+                               &table, &err));
+    ls_mem_get_stats(&after);
+    ck_assert_int_eq(after.tags[LS_MEM_TAG_HTABLE].live_objects,
+                     before.tags[LS_MEM_TAG_HTABLE].live_objects + 2);
+    ck_assert(after.tags[LS_MEM_TAG_HTABLE].live_bytes >
+              before.tags[LS_MEM_TAG_HTABLE].live_bytes);
+    ck_assert_int_eq(after.tags[LS_MEM_TAG_TUBE].allocs,
+                     before.tags[LS_MEM_TAG_TUBE].allocs);
+    ls_htable_destroy(table);
+    ls_mem_get_stats(&after);
+    ck_assert_int_eq(after.tags[LS_MEM_TAG_HTABLE].live_bytes,
+                     before.tags[LS_MEM_TAG_HTABLE].live_bytes);
+    ck_assert_int_eq(after.tags[LS_MEM_TAG_HTABLE].frees,
+                     before.tags[LS_MEM_TAG_HTABLE].frees + 2);
+
+    // realloc keeps the tag, and the peak tracks the largest size
+    ls_mem_reset_peaks();
+    ls_mem_get_stats(&before);
+    ptr = ls_data_malloc_tagged(LS_MEM_TAG_CBOR, 100);
+    ptr = ls_data_realloc(ptr, 5000);
+    ptr = ls_data_realloc(ptr, 10);
+    ls_mem_get_stats(&after);
+    ck_assert_int_eq(after.tags[LS_MEM_TAG_CBOR].live_bytes,
+                     before.tags[LS_MEM_TAG_CBOR].live_bytes + 10);
+    ck_assert_int_eq(after.tags[LS_MEM_TAG_CBOR].peak_bytes,
+                     before.tags[LS_MEM_TAG_CBOR].live_bytes + 5000);
+    ck_assert_int_eq(after.tags[LS_MEM_TAG_CBOR].allocs,
+                     before.tags[LS_MEM_TAG_CBOR].allocs + 3);
+    ck_assert_int_eq(after.tags[LS_MEM_TAG_CBOR].bytes_allocated,
+                     before.tags[LS_MEM_TAG_CBOR].bytes_allocated + 5110);
+    ck_assert(after.total.peak_bytes >= before.total.live_bytes + 5000);
+
+    // 10 <= 16, 100 <= 128, 5000 <= 8192
+    ck_assert_int_eq(after.histogram[0], before.histogram[0] + 1);
+    ck_assert_int_eq(after.histogram[3], before.histogram[3] + 1);
+    ck_assert_int_eq(after.histogram[9], before.histogram[9] + 1);
+    ls_data_free(ptr);
+    ls_mem_get_stats(&after);
+    ck_assert_int_eq(after.tags[LS_MEM_TAG_CBOR].live_objects,
+                     before.tags[LS_MEM_TAG_CBOR].live_objects);
+
+    ck_assert_str_eq(ls_mem_tag_name(LS_MEM_TAG_EVENTING), "eventing");
+    ck_assert(ls_mem_tag_name(LS_MEM_TAG_MAX) == NULL);
+}
+END_TEST
+
 /* htable_tests */
 START_TEST (ls_htable_no_mem_test)
 {
@@ -645,12 +920,17 @@ Suite * ls_mem_suite (void)
         tcase_add_test (tc_ls_mem, ls_pool_malloc_test);
         tcase_add_test (tc_ls_mem, ls_pool_malloc_overallocate_test);
         tcase_add_test (tc_ls_mem, ls_pool_strdup_shorterpool_test);
+        tcase_add_test (tc_ls_mem, ls_pool_reset_test);
+        tcase_add_test (tc_ls_mem, ls_pool_mark_rewind_test);
         tcase_add_test (tc_ls_mem, ls_pool_calloc_test);
         tcase_add_test (tc_ls_mem, ls_pool_calloc_nobytes_test);
         tcase_add_test (tc_ls_mem, ls_pool_strdup_test);
         tcase_add_test (tc_ls_mem, ls_pool_add_cleaner_test);
         tcase_add_test (tc_ls_mem, ls_pool_add_cleaner_nonpool_test);
         tcase_add_test (tc_ls_mem, ls_data_memory_test);
+        tcase_add_test (tc_ls_mem, ls_data_thread_cache_test);
+        tcase_add_test (tc_ls_mem, ls_data_thread_cache_alloc_only_test);
+        tcase_add_test (tc_ls_mem, ls_mem_stats_test);
         tcase_add_test (tc_ls_mem, ls_htable_no_mem_test);
         tcase_add_test (tc_ls_mem, ls_htable_put_no_mem_test);
         tcase_add_test (tc_ls_mem, ls_event_dispatcher_create_no_mem_test);
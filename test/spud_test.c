@@ -4,6 +4,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <check.h>
 
@@ -100,14 +101,153 @@ START_TEST (spud_parse_test)
                       0x00,
                       0xa1, 0x00,
                       0x41, 0x61 };
+    uint8_t trailing[] = { 0xd8, 0x00, 0x00, 0xd8,
+                           0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+                           0x00,
+                           0xa1, 0x00, 0x41, 0x61,
+                           0xff, 0x1c };
+    uint8_t truncated[] = { 0xd8, 0x00, 0x00, 0xd8,
+                            0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+                            0x00,
+                            0xa2, 0x00, 0x41, 0x61, 0x01 };
+
+    const cn_cbor *cbor;
+    const uint8_t *data;
+    size_t len;
 
     fail_if(spud_parse(NULL, 0, NULL, &err));
     fail_if(spud_parse(buf, 0, NULL, &err));
     fail_if(spud_parse(buf, 0, &msg, &err));
     fail_unless(spud_parse(buf, 13, &msg, &err));
-    fail_if(spud_parse(buf, 14, &msg, &err));
-    fail_if(spud_parse(buf, 15, &msg, &err));
+    fail_unless(spud_message_cbor(&msg, &cbor, &err));
+    ck_assert(cbor == NULL);
+    fail_unless(spud_message_data(&msg, &data, &len, &err));
+    ck_assert(data == NULL);
+
+    /* only the header is checked up front */
+    fail_unless(spud_parse(buf, 14, &msg, &err));
+    fail_if(spud_message_cbor(&msg, &cbor, &err));
+    ck_assert_int_eq(err.code, LS_ERR_USER + CN_CBOR_ERR_OUT_OF_DATA);
+    fail_if(spud_message_data(&msg, &data, &len, &err));
+    fail_unless(spud_parse(buf, 15, &msg, &err));
+    fail_if(spud_message_cbor(&msg, &cbor, &err));
+    fail_if(spud_message_data(&msg, &data, &len, &err));
+
     fail_unless(spud_parse(buf, sizeof(buf), &msg, &err));
+    fail_unless(spud_message_data(&msg, &data, &len, &err));
+    ck_assert(data == buf + 16);
+    ck_assert_int_eq(len, 1);
+    ck_assert(msg.cbor == NULL);
+    fail_unless(spud_message_cbor(&msg, &cbor, &err));
+    ck_assert_int_eq(cbor->type, CN_CBOR_MAP);
+    fail_unless(spud_message_data(&msg, &data, &len, &err));
+    ck_assert(data == buf + 16);
+    spud_unparse(&msg);
+
+    /* the data accessor refuses what the tree decoder refuses */
+    fail_unless(spud_parse(trailing, sizeof(trailing), &msg, &err));
+    fail_if(spud_message_data(&msg, &data, &len, &err));
+    ck_assert_int_eq(err.code,
+                     LS_ERR_USER + CN_CBOR_ERR_NOT_ALL_DATA_CONSUMED);
+    ck_assert(data == NULL);
+    fail_if(spud_message_cbor(&msg, &cbor, &err));
+    spud_unparse(&msg);
+
+    fail_unless(spud_parse(truncated, sizeof(truncated), &msg, &err));
+    fail_if(spud_message_data(&msg, &data, &len, &err));
+    ck_assert_int_eq(err.code, LS_ERR_USER + CN_CBOR_ERR_OUT_OF_DATA);
+    ck_assert(data == NULL);
+    fail_if(spud_message_cbor(&msg, &cbor, &err));
+    spud_unparse(&msg);
+}
+END_TEST
+
+START_TEST (spud_parse_pool_test)
+{
+    spud_message msg;
+    ls_pool *pool;
+    ls_pool_marker start, end;
+    const cn_cbor *cbor;
+    ls_err err;
+    char *keep;
+    uint8_t buf[] = { 0xd8, 0x00, 0x00, 0xd8,
+                      0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+                      0x00,
+                      0xa1, 0x00,
+                      0x41, 0x61 };
+
+    fail_unless(ls_pool_create(1024, &pool, &err));
+    ls_pool_mark(pool, &start);
+
+    fail_if(spud_parse_pool(buf, sizeof(buf), NULL, &msg, &err));
+    fail_unless(spud_parse_pool(buf, 15, pool, &msg, &err));
+    fail_if(spud_message_cbor(&msg, &cbor, &err));
+    spud_unparse(&msg);
+
+    fail_unless(spud_parse_pool(buf, sizeof(buf), pool, &msg, &err));
+    fail_unless(spud_message_cbor(&msg, &cbor, &err));
+    ck_assert(cbor == msg.cbor);
+    ck_assert_int_eq(cbor->type, CN_CBOR_MAP);
+    ck_assert_int_eq(cbor->first_child->next->type, CN_CBOR_BYTES);
+    ck_assert_int_eq(cbor->first_child->next->v.str[0], 'a');
+    spud_unparse(&msg);
+    ck_assert(msg.cbor == NULL);
+
+    /* the pool is rewound and its page kept */
+    ls_pool_mark(pool, &end);
+    ck_assert_int_eq(end.used, start.used);
+
+    /* what was in the pool before the message stays there */
+    fail_unless(ls_pool_malloc(pool, 8, (void **)&keep, &err));
+    strcpy(keep, "keep");
+    ls_pool_mark(pool, &start);
+    fail_unless(spud_parse_pool(buf, sizeof(buf), pool, &msg, &err));
+    fail_unless(spud_message_cbor(&msg, &cbor, &err));
+    ls_pool_mark(pool, &end);
+    ck_assert_int_gt(end.used, start.used);
+    spud_unparse(&msg);
+    ls_pool_mark(pool, &end);
+    ck_assert_int_eq(end.used, start.used);
+    ck_assert_str_eq(keep, "keep");
+    ls_pool_destroy(pool);
+}
+END_TEST
+
+/* {0: [[...[]...]]} with the given number of arrays */
+static size_t nested_message(uint8_t *buf, size_t arrays)
+{
+    static const uint8_t hdr[] = { 0xd8, 0x00, 0x00, 0xd8,
+                                   0x01, 0x02, 0x03, 0x04,
+                                   0x05, 0x06, 0x07, 0x08,
+                                   0x00,
+                                   0xa1, 0x00 };
+    size_t i;
+
+    memcpy(buf, hdr, sizeof(hdr));
+    for (i = 0; i < arrays; i++) {
+        buf[sizeof(hdr) + i] = (i == arrays - 1) ? 0x80 : 0x81;
+    }
+    return sizeof(hdr) + arrays;
+}
+
+START_TEST (spud_cbor_limits_test)
+{
+    spud_message msg;
+    const cn_cbor *cbor;
+    ls_err err;
+    uint8_t buf[64];
+    size_t len;
+
+    /* the map and its arrays just fit */
+    len = nested_message(buf, SPUD_MAX_CBOR_DEPTH - 1);
+    fail_unless(spud_parse(buf, len, &msg, &err));
+    fail_unless(spud_message_cbor(&msg, &cbor, &err));
+    spud_unparse(&msg);
+
+    len = nested_message(buf, SPUD_MAX_CBOR_DEPTH);
+    fail_unless(spud_parse(buf, len, &msg, &err));
+    fail_if(spud_message_cbor(&msg, &cbor, &err));
+    ck_assert_int_eq(err.code, LS_ERR_USER + CN_CBOR_ERR_TOO_DEEP);
     spud_unparse(&msg);
 }
 END_TEST
@@ -123,6 +263,8 @@ Suite * spud_suite (void)
       tcase_add_test (tc_core, createId);
       tcase_add_test (tc_core, isIdEqual);
       tcase_add_test (tc_core, spud_parse_test);
+      tcase_add_test (tc_core, spud_parse_pool_test);
+      tcase_add_test (tc_core, spud_cbor_limits_test);
 
       suite_add_tcase (s, tc_core);
   }
@@ -17,6 +17,7 @@ Suite * ls_log_suite (void);
 Suite * ls_htable_suite (void);
 Suite * ls_eventing_suite (void);
 Suite * cbor_suite (void);
+Suite * ls_clock_suite (void);
 
 int main(void){
 
@@ -34,6 +35,7 @@ int main(void){
     srunner_add_suite (sr,  ls_htable_suite () );
     srunner_add_suite (sr,  ls_eventing_suite () );
     srunner_add_suite (sr,  cbor_suite () );
+    srunner_add_suite (sr,  ls_clock_suite () );
     srunner_run_all (sr, CK_NORMAL);
     number_failed = srunner_ntests_failed (sr);
     srunner_free (sr);
@@ -18,6 +18,7 @@ uint8_t spud[] = { 0xd8, 0x00, 0x00, 0xd8,
                    0xa1, 0x00,
                    0x41, 0x61 };
 bool first = true;
+static size_t _sent_len = 0;
 
 static ssize_t _mock_sendmsg(int socket,
                              const struct msghdr *hdr,
@@ -31,6 +32,7 @@ static ssize_t _mock_sendmsg(int socket,
         count += hdr->msg_iov[i].iov_len;
     }
     // I totally sent it.  Really.
+    _sent_len = count;
     return count;
 }
 
@@ -110,6 +112,84 @@ START_TEST (tube_manager_bind_event_test)
 }
 END_TEST
 
+START_TEST (tube_manager_bind_event_type_test)
+{
+    ls_err err;
+
+    fail_unless( tube_manager_bind_event_type(_mgr, EV_RUNNING, test_cb, &err),
+                 ls_err_message( err.code ));
+    fail_unless( tube_manager_bind_event_type(_mgr, EV_DATA, test_cb, &err),
+                 ls_err_message( err.code ));
+    fail_unless( tube_manager_bind_event_type(_mgr, EV_CLOSE, test_cb, &err),
+                 ls_err_message( err.code ));
+    fail_unless( tube_manager_bind_event_type(_mgr, EV_ADD, test_cb, &err),
+                 ls_err_message( err.code ));
+    fail_unless( tube_manager_bind_event_type(_mgr, EV_REMOVE, test_cb, &err),
+                 ls_err_message( err.code ));
+    fail_if( tube_manager_bind_event_type(_mgr, EV_MAX, test_cb, &err) );
+    ck_assert_int_eq(err.code, LS_ERR_INVALID_ARG);
+}
+END_TEST
+
+static char _order[16];
+
+static void order_cb(ls_event_data evt, void *arg){
+    UNUSED_PARAM(evt);
+    strncat(_order, arg, sizeof(_order) - strlen(_order) - 1);
+}
+
+static void mgr_order_cb(ls_event_data evt, void *arg){
+    UNUSED_PARAM(evt);
+    UNUSED_PARAM(arg);
+    strncat(_order, "m", sizeof(_order) - strlen(_order) - 1);
+}
+
+START_TEST (tube_bind_event_test)
+{
+    tube *t1, *t2;
+    tube_group *g;
+    ls_err err;
+    struct sockaddr_in6 remoteAddr;
+
+    fail_unless( ls_sockaddr_get_remote_ip_addr(&remoteAddr,
+                                                "::1",
+                                                "1402",
+                                                &err),
+                 ls_err_message( err.code ) );
+    fail_unless( tube_group_create(&g, &err), ls_err_message( err.code ) );
+    fail_unless( tube_create(_mgr, &t1, &err) );
+    fail_unless( tube_create(_mgr, &t2, &err) );
+    ck_assert(tube_get_group(t1) == NULL);
+    tube_set_group(t1, g);
+    tube_set_group(t2, g);
+    ck_assert(tube_get_group(t1) == g);
+
+    fail_unless( tube_bind_event(t1, EV_ADD, order_cb, "t", &err),
+                 ls_err_message( err.code ) );
+    fail_unless( tube_group_bind_event(g, EV_ADD, order_cb, "g", &err),
+                 ls_err_message( err.code ) );
+    fail_unless( tube_manager_bind_event_type(_mgr, EV_ADD, mgr_order_cb, &err),
+                 ls_err_message( err.code ) );
+    fail_if( tube_bind_event(t1, EV_MAX, order_cb, "x", &err) );
+    ck_assert_int_eq(err.code, LS_ERR_INVALID_ARG);
+
+    _order[0] = '\0';
+    fail_unless( tube_open(t1, (const struct sockaddr*)&remoteAddr, &err),
+                 ls_err_message( err.code ) );
+    ck_assert_str_eq(_order, "tgm");
+
+    /* t2 has no subscriptions of its own */
+    _order[0] = '\0';
+    fail_unless( tube_open(t2, (const struct sockaddr*)&remoteAddr, &err),
+                 ls_err_message( err.code ) );
+    ck_assert_str_eq(_order, "gm");
+
+    tube_manager_remove(_mgr, t1);
+    tube_manager_remove(_mgr, t2);
+    tube_group_destroy(g);
+}
+END_TEST
+
 START_TEST (tube_utilities_test)
 {
     tube *t;
@@ -226,6 +306,103 @@ START_TEST (tube_data_test)
 }
 END_TEST
 
+START_TEST (tube_send_cbor_test)
+{
+    tube *t;
+    ls_err err;
+    uint8_t buf[2100];
+    const cn_cbor *cb;
+    cn_cbor_errback cbor_err;
+    struct sockaddr_in6 remoteAddr;
+    fail_unless( ls_sockaddr_get_remote_ip_addr(&remoteAddr,
+                                                "127.0.0.1",
+                                                "1402",
+                                                &err),
+                 ls_err_message( err.code ) );
+
+    fail_unless( tube_create(_mgr, &t, &err) );
+    fail_unless( tube_open(t, (const struct sockaddr*)&remoteAddr, &err),
+                 ls_err_message( err.code ) );
+
+    // {0: h'...' (200 bytes), "a": 1}
+    memset(buf, 'x', sizeof(buf));
+    buf[0] = 0xa2;
+    buf[1] = 0x00;
+    buf[2] = 0x58;
+    buf[3] = 200;
+    buf[204] = 0x61;
+    buf[205] = 'a';
+    buf[206] = 0x01;
+    cb = cn_cbor_decode((const char *)buf, 207, NULL, NULL, &cbor_err);
+    fail_unless(cb != NULL);
+    fail_unless( tube_send_cbor(t, SPUD_DATA, cb, &err),
+                 ls_err_message( err.code ) );
+    ck_assert_int_eq(_sent_len, sizeof(spud_header) + 207);
+    cn_cbor_free(cb);
+
+    // too big for one datagram
+    buf[2] = 0x59;
+    buf[3] = 0x07;
+    buf[4] = 0xd0;
+    buf[2005] = 0x61;
+    buf[2006] = 'a';
+    buf[2007] = 0x01;
+    cb = cn_cbor_decode((const char *)buf, 2008, NULL, NULL, &cbor_err);
+    fail_unless(cb != NULL);
+    fail_if( tube_send_cbor(t, SPUD_DATA, cb, &err) );
+    ck_assert_int_eq(err.code, LS_ERR_OVERFLOW);
+    cn_cbor_free(cb);
+
+    tube_manager_remove(_mgr, t);
+}
+END_TEST
+
+START_TEST (tube_send_map_test)
+{
+    tube *t;
+    tube_map m;
+    ls_err err;
+    uint8_t payload[200];
+    struct sockaddr_in6 remoteAddr;
+    fail_unless( ls_sockaddr_get_remote_ip_addr(&remoteAddr,
+                                                "127.0.0.1",
+                                                "1402",
+                                                &err),
+                 ls_err_message( err.code ) );
+
+    fail_unless( tube_create(_mgr, &t, &err) );
+    fail_unless( tube_open(t, (const struct sockaddr*)&remoteAddr, &err),
+                 ls_err_message( err.code ) );
+
+    // {0: h'...', 1: "hi", 2: 1000}
+    memset(payload, 'p', sizeof(payload));
+    tube_map_init(&m, 3);
+    cn_cbor_write_uint(&m.w, 0);
+    cn_cbor_write_bytes(&m.w, payload, sizeof(payload));
+    cn_cbor_write_uint(&m.w, 1);
+    cn_cbor_write_text(&m.w, "hi", 2);
+    cn_cbor_write_uint(&m.w, 2);
+    cn_cbor_write_uint(&m.w, 1000);
+    fail_unless( tube_send_map(t, SPUD_DATA, &m, &err),
+                 ls_err_message( err.code ) );
+    ck_assert_int_eq(_sent_len, sizeof(spud_header) + 1 + 1 + 2 + 200 +
+                     1 + 3 + 1 + 3);
+    /* the payload went out in place */
+    ck_assert_int_eq(m.w.used, 3);
+    ck_assert(m.iov[1].iov_base == payload);
+
+    /* a pair short */
+    tube_map_init(&m, 2);
+    cn_cbor_write_uint(&m.w, 0);
+    cn_cbor_write_uint(&m.w, 0);
+    cn_cbor_write_uint(&m.w, 1);
+    fail_if( tube_send_map(t, SPUD_DATA, &m, &err) );
+    ck_assert_int_eq(err.code, LS_ERR_INVALID_ARG);
+
+    tube_manager_remove(_mgr, t);
+}
+END_TEST
+
 START_TEST (tube_close_test)
 {
     tube *t;
@@ -276,6 +453,73 @@ START_TEST (tube_manager_loop_test)
 }
 END_TEST
 
+static pthread_mutex_t _worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static int _worker_data_count;
+static bool _worker_off_loop;
+static pthread_t _loop_thread;
+
+static void worker_data_cb(ls_event_data evt, void *arg)
+{
+    tube_event_data *td = evt->data;
+    const uint8_t *data;
+    size_t len;
+    UNUSED_PARAM(arg);
+
+    pthread_mutex_lock(&_worker_lock);
+    if (tube_event_data_bytes(td, &data, &len) &&
+        (tube_event_cbor(td) != NULL)) {
+        _worker_data_count++;
+    }
+    if (!pthread_equal(pthread_self(), _loop_thread)) {
+        _worker_off_loop = true;
+    }
+    pthread_mutex_unlock(&_worker_lock);
+}
+
+START_TEST (tube_manager_workers_test)
+{
+    tube *t;
+    ls_err err;
+    ls_err listen_err;
+    spud_tube_id id;
+    struct sockaddr_in6 remoteAddr;
+    struct timespec timer = {0, 20000000}; // 20ms
+    void *ret;
+
+    fail_unless( ls_sockaddr_get_remote_ip_addr(&remoteAddr,
+                                                "::1",
+                                                "1402",
+                                                &err),
+                 ls_err_message( err.code ) );
+    /* a running tube with the ID the mock receives */
+    memcpy(&id, spud + 4, sizeof(id));
+    fail_unless( tube_create(_mgr, &t, &err) );
+    fail_unless( tube_ack(t, &id, (const struct sockaddr*)&remoteAddr, &err),
+                 ls_err_message( err.code ) );
+
+    ck_assert_int_eq(tube_manager_get_workers(_mgr), 0);
+    fail_unless( tube_manager_set_workers(_mgr, 2, 4, &err),
+                 ls_err_message( err.code ) );
+    ck_assert_int_eq(tube_manager_get_workers(_mgr), 2);
+    fail_unless( tube_manager_bind_event_type(_mgr, EV_DATA, worker_data_cb, &err),
+                 ls_err_message( err.code ) );
+
+    _worker_data_count = 0;
+    _worker_off_loop = false;
+    ck_assert_int_eq(pthread_create(&_loop_thread, NULL, listen_run, &listen_err), 0);
+    nanosleep(&timer, NULL);
+    tube_manager_stop(_mgr);
+    ck_assert_int_eq(pthread_join(_loop_thread, &ret), 0);
+    ck_assert(*((bool*)ret));
+
+    /* everything queued is handled before the workers go away */
+    fail_unless( tube_manager_set_workers(_mgr, 0, 0, &err) );
+    ck_assert_int_eq(tube_manager_get_workers(_mgr), 0);
+    ck_assert(_worker_data_count > 0);
+    ck_assert(_worker_off_loop);
+}
+END_TEST
+
 START_TEST (tube_manager_policy_test)
 {
     fail_if(tube_manager_is_responder(_mgr));
@@ -303,13 +547,18 @@ Suite * tube_suite (void)
       tcase_add_checked_fixture(tc_tube, _setup, _teardown);
       tcase_add_test (tc_tube, tube_create_test);
       tcase_add_test (tc_tube, tube_manager_bind_event_test);
+      tcase_add_test (tc_tube, tube_manager_bind_event_type_test);
+      tcase_add_test (tc_tube, tube_bind_event_test);
       tcase_add_test (tc_tube, tube_utilities_test);
       tcase_add_test (tc_tube, tube_print_test);
       tcase_add_test (tc_tube, tube_open_test);
       tcase_add_test (tc_tube, tube_ack_test);
       tcase_add_test (tc_tube, tube_data_test);
+      tcase_add_test (tc_tube, tube_send_cbor_test);
+      tcase_add_test (tc_tube, tube_send_map_test);
       tcase_add_test (tc_tube, tube_close_test);
       tcase_add_test (tc_tube, tube_manager_loop_test);
+      tcase_add_test (tc_tube, tube_manager_workers_test);
       tcase_add_test (tc_tube, tube_manager_policy_test);
       tcase_add_test (tc_tube, tube_manager_set_socket_test);
 